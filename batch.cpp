@@ -0,0 +1,381 @@
+#include "batch.h"
+#include "loader.h"
+#include <thread>
+#include <algorithm>
+
+
+// count of vectors processed by the worker at once
+static const std::size_t BlockSize = 1024;
+// count of blocks in flight per worker
+static const std::size_t BlocksPerThread = 4;
+
+BatchRunner::BatchRunner(const DecodedProgram &program, const std::map<RegNumber, RegValue> &initial):
+    mProgram(program),
+    mInitial(initial),
+    mOutputRegisters(1, 0),
+    mFormat(BF_Csv),
+    mThreads(0),
+    mJit(0),
+    mLockstep(false),
+    mLine(0),
+    mErrorLine(0),
+    mRead(0),
+    mTaken(0),
+    mWritten(0),
+    mFinished(false)
+{
+}
+
+void BatchRunner::setInputRegisters(const std::vector<RegNumber> &registers)
+{
+    mInputRegisters = registers;
+}
+
+void BatchRunner::setOutputRegisters(const std::vector<RegNumber> &registers)
+{
+    mOutputRegisters = registers;
+}
+
+void BatchRunner::setFormat(BatchRunner::Format format)
+{
+    mFormat = format;
+}
+
+void BatchRunner::setThreads(unsigned threads)
+{
+    mThreads = threads;
+}
+
+void BatchRunner::setJit(const JitProgram *jit)
+{
+    mJit = jit;
+}
+
+void BatchRunner::setLockstep(bool enabled)
+{
+    mLockstep = enabled;
+}
+
+BatchRunner::Stats BatchRunner::run(std::istream &input, std::ostream &output)
+{
+    if (mFormat == BF_Binary && mInputRegisters.empty())
+        throw BatchException("Input registers must be specified for binary input.", 0);
+
+    unsigned threads = mThreads;
+    if (threads == 0)
+        threads = std::thread::hardware_concurrency();
+    if (threads == 0)
+        threads = 1;
+
+    mBlocks.assign(threads * BlocksPerThread, Block());
+    mRead = mTaken = mWritten = 0;
+    mFinished = false;
+    mStats = Stats();
+    mLine = 0;
+    mError.clear();
+    mErrorLine = 0;
+
+    // the first block defines count of the input values
+    bool hasInput = readBlock(input, mBlocks[0]);
+    prepare();
+    if (mBlocks[0].count > 0){
+        mBlocks[0].state = Block::BS_Filled;
+        mRead = 1;
+    }
+
+    std::vector<std::thread> workers;
+    for (unsigned i=0; i<threads; ++i)
+        workers.push_back(std::thread(&BatchRunner::work, this));
+    std::thread writer(&BatchRunner::write, this, &output);
+
+    // on error the vectors read before it are still processed and written
+    while (hasInput){
+        Block &block = mBlocks[mRead % mBlocks.size()];
+        {
+            std::unique_lock<std::mutex> lock(mMutex);
+            while (block.state != Block::BS_Free)
+                mChanged.wait(lock);
+        }
+
+        hasInput = readBlock(input, block);
+        if (block.count == 0)
+            break;
+
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            block.state = Block::BS_Filled;
+            ++mRead;
+        }
+        mChanged.notify_all();
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mFinished = true;
+    }
+    mChanged.notify_all();
+
+    for (std::size_t i=0; i<workers.size(); ++i)
+        workers[i].join();
+    writer.join();
+
+    if (! mError.empty())
+        throw BatchException(mError, mErrorLine);
+    return mStats;
+}
+
+
+static inline void appendDecimal(std::string &text, RegValue value)
+{
+    char digits[20];
+    int count = 0;
+    do {
+        digits[count++] = char('0' + value % 10);
+        value /= 10;
+    } while (value);
+
+    while (count)
+        text.push_back(digits[--count]);
+}
+
+bool BatchRunner::readBlock(std::istream &input, BatchRunner::Block &block)
+{
+    block.count = 0;
+
+    if (mFormat == BF_Binary){
+        std::size_t vectorSize = mInputRegisters.size() * sizeof(RegValue);
+        block.inputs.resize(BlockSize * mInputRegisters.size());
+        input.read(reinterpret_cast<char *>(&block.inputs[0]), BlockSize * vectorSize);
+
+        std::size_t size = (std::size_t)input.gcount();
+        block.count = size / vectorSize;
+        mLine += block.count;
+        if (size % vectorSize != 0)
+            return fail("Incomplete input vector.", mLine + 1);
+        return block.count == BlockSize;
+    }
+
+    block.inputs.clear();
+    std::string line;
+    while (block.count < BlockSize){
+        if (! std::getline(input, line))
+            return false;
+
+        ++mLine;
+        const char *pos = line.data();
+        const char *end = pos + line.size();
+        if (pos < end && *(end - 1) == '\r')
+            --end;
+
+        ProgramLoader::skipSpaces(pos, end, true);
+        if (pos == end)
+            continue;
+
+        std::size_t first = block.inputs.size();
+        for (;;){
+            RegValue value;
+            if (! ProgramLoader::lexNumber(pos, end, value, true)){
+                block.inputs.resize(first);
+                return fail("Invalid value, decimal number up to 64 bits is expected.", mLine);
+            }
+            block.inputs.push_back(value);
+
+            ProgramLoader::skipSpaces(pos, end, true);
+            if (pos == end)
+                break;
+            if (*pos != ','){
+                block.inputs.resize(first);
+                return fail("Invalid symbol, comma is expected.", mLine);
+            }
+            ++pos;
+        }
+
+        // R0, R1, ... by the first vector
+        std::size_t count = block.inputs.size() - first;
+        if (mInputRegisters.empty())
+            for (std::size_t i=0; i<count; ++i)
+                mInputRegisters.push_back(i);
+
+        if (count != mInputRegisters.size()){
+            block.inputs.resize(first);
+            return fail("Invalid count of values.", mLine);
+        }
+        ++block.count;
+    }
+    return true;
+}
+
+bool BatchRunner::fail(const std::string &message, unsigned long long line)
+{
+    mError = message;
+    mErrorLine = line;
+    return false;
+}
+
+void BatchRunner::prepare()
+{
+    mRegisterFile = mProgram.loadRegisters(mInitial);
+    if (mRegisterFile.empty())
+        mRegisterFile.push_back(0);
+
+    const std::vector<RegNumber> &numbers = mProgram.registerNumbers();
+    std::map<RegNumber, std::size_t> indexes;
+    for (std::size_t i=0; i<numbers.size(); ++i)
+        indexes[numbers[i]] = i;
+
+    // registers that the program doesn't use are never changed
+    mInputIndexes.assign(mInputRegisters.size(), std::size_t(-1));
+    for (std::size_t i=0; i<mInputRegisters.size(); ++i){
+        std::map<RegNumber, std::size_t>::const_iterator it = indexes.find(mInputRegisters[i]);
+        if (it != indexes.end())
+            mInputIndexes[i] = (*it).second;
+    }
+
+    mOutputs.clear();
+    for (std::size_t i=0; i<mOutputRegisters.size(); ++i){
+        RegNumber number = mOutputRegisters[i];
+        OutputSource source;
+        source.kind = OutputSource::OK_Constant;
+        source.index = 0;
+        source.value = 0;
+
+        std::map<RegNumber, std::size_t>::const_iterator it = indexes.find(number);
+        std::vector<RegNumber>::const_reverse_iterator input = std::find(mInputRegisters.rbegin(), mInputRegisters.rend(), number);
+        if (it != indexes.end()){
+            source.kind = OutputSource::OK_Register;
+            source.index = (*it).second;
+        } else if (input != mInputRegisters.rend()){
+            source.kind = OutputSource::OK_Input;
+            source.index = mInputRegisters.rend() - input - 1;
+        } else if (mInitial.find(number) != mInitial.end())
+            source.value = mInitial.at(number);
+
+        mOutputs.push_back(source);
+    }
+}
+
+void BatchRunner::execute(BatchRunner::Block &block, std::vector<RegValue> &registers) const
+{
+    std::size_t width = mInputRegisters.size();
+    block.output.clear();
+    block.steps = 0;
+
+    if (mLockstep){
+        executeLockstep(block, registers);
+        return;
+    }
+
+    for (std::size_t i=0; i<block.count; ++i){
+        const RegValue *values = &block.inputs[i * width];
+        std::copy(mRegisterFile.begin(), mRegisterFile.end(), registers.begin());
+        for (std::size_t j=0; j<width; ++j)
+            if (mInputIndexes[j] != std::size_t(-1))
+                registers[mInputIndexes[j]] = values[j];
+
+        ExecutionResult result = mJit ? mJit->run(&registers[0]) : ThreadedEngine().run(mProgram, &registers[0]);
+        block.steps += result.steps;
+        appendResult(block, &registers[0], 1, values);
+    }
+}
+
+void BatchRunner::executeLockstep(BatchRunner::Block &block, std::vector<RegValue> &registers) const
+{
+    const std::size_t Lanes = LockstepEngine::Lanes;
+    std::size_t width = mInputRegisters.size();
+    ExecutionResult results[Lanes];
+
+    for (std::size_t first=0; first<block.count; first+=Lanes){
+        std::size_t lanes = std::min(Lanes, block.count - first);
+        for (std::size_t i=0; i<mRegisterFile.size(); ++i)
+            for (std::size_t lane=0; lane<Lanes; ++lane)
+                registers[i * Lanes + lane] = mRegisterFile[i];
+
+        for (std::size_t lane=0; lane<lanes; ++lane){
+            const RegValue *values = &block.inputs[(first + lane) * width];
+            for (std::size_t j=0; j<width; ++j)
+                if (mInputIndexes[j] != std::size_t(-1))
+                    registers[mInputIndexes[j] * Lanes + lane] = values[j];
+        }
+
+        LockstepEngine().run(mProgram, &registers[0], lanes, results);
+
+        for (std::size_t lane=0; lane<lanes; ++lane){
+            block.steps += results[lane].steps;
+            appendResult(block, &registers[lane], Lanes, &block.inputs[(first + lane) * width]);
+        }
+    }
+}
+
+void BatchRunner::appendResult(BatchRunner::Block &block, const RegValue *registers, std::size_t stride,
+                               const RegValue *values) const
+{
+    for (std::size_t j=0; j<mOutputs.size(); ++j){
+        RegValue value = mOutputs[j].value;
+        if (mOutputs[j].kind == OutputSource::OK_Register)
+            value = registers[mOutputs[j].index * stride];
+        else if (mOutputs[j].kind == OutputSource::OK_Input)
+            value = values[mOutputs[j].index];
+
+        if (mFormat == BF_Binary)
+            block.output.append(reinterpret_cast<const char *>(&value), sizeof(value));
+        else {
+            if (j > 0)
+                block.output.push_back(',');
+            appendDecimal(block.output, value);
+        }
+    }
+    if (mFormat == BF_Csv)
+        block.output.push_back('\n');
+}
+
+void BatchRunner::work()
+{
+    std::vector<RegValue> registers(mRegisterFile.size() * (mLockstep ? LockstepEngine::Lanes : 1));
+
+    for (;;){
+        Block *block;
+        {
+            std::unique_lock<std::mutex> lock(mMutex);
+            while (mTaken == mRead && ! mFinished)
+                mChanged.wait(lock);
+            if (mTaken == mRead)
+                return;
+            block = &mBlocks[mTaken++ % mBlocks.size()];
+        }
+
+        execute(*block, registers);
+
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            block->state = Block::BS_Done;
+        }
+        mChanged.notify_all();
+    }
+}
+
+void BatchRunner::write(std::ostream *output)
+{
+    for (;;){
+        Block *block;
+        {
+            std::unique_lock<std::mutex> lock(mMutex);
+            while (! (mWritten < mRead && mBlocks[mWritten % mBlocks.size()].state == Block::BS_Done)
+                   && ! (mFinished && mWritten == mRead))
+                mChanged.wait(lock);
+            if (mWritten == mRead)
+                return;
+            block = &mBlocks[mWritten % mBlocks.size()];
+        }
+
+        output->write(block->output.data(), block->output.size());
+
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            mStats.vectors += block->count;
+            mStats.steps += block->steps;
+            block->state = Block::BS_Free;
+            ++mWritten;
+        }
+        mChanged.notify_all();
+    }
+}
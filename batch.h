@@ -0,0 +1,150 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <map>
+#include <stdexcept>
+#include <mutex>
+#include <condition_variable>
+
+#include "engine.h"
+#include "jit.h"
+#include "lockstep.h"
+
+
+//-- batch runner
+// Runs one decoded program over the stream of input vectors.
+// The reader (calling thread) splits the input into blocks of vectors, worker threads execute
+// blocks with their own register files and the writer thread outputs results in input order.
+// Only fixed count of blocks is in flight, so memory does not depend on the size of the input.
+//
+// Formats:
+//      csv    - one vector per line, values are separated by commas; results are written the same way.
+//      binary - vector is the sequence of 64-bit values in native byte order, results are written the same way.
+class BatchRunner
+{
+public:
+    enum Format {
+        BF_Csv = 0, BF_Binary
+    };
+
+    struct Stats
+    {
+        Stats():
+            vectors(0), steps(0){}
+
+        unsigned long long vectors;
+        unsigned long long steps;
+    };
+
+    // program - decoded (and possibly optimised) program,
+    // initial - initial values of the registers that are not read from the input.
+    BatchRunner(const DecodedProgram &program, const std::map<RegNumber, RegValue> &initial);
+
+    // registers that receive values of the input vector,
+    // if empty - R0, R1, ... by the count of values in the first csv line (binary input requires them).
+    void setInputRegisters(const std::vector<RegNumber> &registers);
+    // registers written for each vector, R0 by default.
+    void setOutputRegisters(const std::vector<RegNumber> &registers);
+    void setFormat(Format format);
+    // threads = 0 - use all available cores.
+    void setThreads(unsigned threads);
+    // compiled program is used instead of the threaded engine.
+    void setJit(const JitProgram *jit);
+    // vectors are executed by groups of LockstepEngine::Lanes,
+    // the program must be decoded without optimisation passes.
+    void setLockstep(bool enabled);
+
+    Stats run(std::istream &input, std::ostream &output);
+
+private:
+    struct Block
+    {
+        enum State {
+            BS_Free, BS_Filled, BS_Done
+        };
+
+        Block():
+            state(BS_Free), count(0), steps(0){}
+
+        State state;
+        std::size_t count;
+        std::vector<RegValue> inputs;
+        std::string output;
+        unsigned long long steps;
+    };
+
+    // source of the output register value
+    struct OutputSource
+    {
+        enum Kind {
+            OK_Register, OK_Input, OK_Constant
+        };
+
+        Kind        kind;
+        std::size_t index;
+        RegValue    value;
+    };
+
+    // reads next block of vectors, returns false if there is no more input (end or error).
+    // On error the block keeps vectors read before it.
+    bool readBlock(std::istream &input, Block &block);
+    bool fail(const std::string &message, unsigned long long line);
+    void prepare();
+    void execute(Block &block, std::vector<RegValue> &registers) const;
+    void executeLockstep(Block &block, std::vector<RegValue> &registers) const;
+    // registers - register file of the vector, value of index i is registers[i * stride],
+    // values - input vector.
+    void appendResult(Block &block, const RegValue *registers, std::size_t stride, const RegValue *values) const;
+
+    void work();
+    void write(std::ostream *output);
+
+private:
+    const DecodedProgram &mProgram;
+    std::map<RegNumber, RegValue> mInitial;
+    std::vector<RegNumber> mInputRegisters;
+    std::vector<RegNumber> mOutputRegisters;
+    Format mFormat;
+    unsigned mThreads;
+    const JitProgram *mJit;
+    bool mLockstep;
+
+    // filled by prepare()
+    std::vector<RegValue> mRegisterFile;
+    std::vector<std::size_t> mInputIndexes;
+    std::vector<OutputSource> mOutputs;
+    unsigned long long mLine;
+    std::string mError;
+    unsigned long long mErrorLine;
+
+    // pipeline state, guarded by mMutex
+    std::vector<Block> mBlocks;
+    std::size_t mRead;
+    std::size_t mTaken;
+    std::size_t mWritten;
+    bool mFinished;
+    Stats mStats;
+    std::mutex mMutex;
+    std::condition_variable mChanged;
+};
+
+class BatchException: public std::runtime_error
+{
+public:
+    // line - number of the input line (csv) or vector (binary), from 1
+    BatchException(std::string message, unsigned long long line):
+        runtime_error(message), mLine(line){}
+
+    unsigned long long line() const {
+        return mLine;
+    }
+
+private:
+    unsigned long long mLine;
+};
+
+
+#endif // BATCH_H
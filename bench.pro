@@ -0,0 +1,66 @@
+TEMPLATE = app
+CONFIG += console
+CONFIG += c++11
+CONFIG -= qt
+TARGET = bench
+
+LIBS += -pthread
+
+SOURCES += bench/main.cpp \
+    bench/workloads.cpp \
+    interpreter.cpp \
+    instruction.cpp \
+    engine.cpp \
+    peephole.cpp \
+    loops.cpp \
+    jit.cpp \
+    transpiler.cpp \
+    bigregister.cpp \
+    loader.cpp \
+    bytecode.cpp \
+    batch.cpp \
+    lockstep.cpp \
+    cfg.cpp \
+    passes.cpp \
+    profiler.cpp \
+    checkpoint.cpp \
+    resultcache.cpp \
+    jobrunner.cpp \
+    program.cpp \
+    output.cpp \
+    cycle.cpp \
+    linker.cpp \
+    trace.cpp \
+    debugger.cpp \
+    conformance.cpp
+
+HEADERS += \
+    bench/workloads.h \
+    interpreter.h \
+    instruction.h \
+    engine.h \
+    peephole.h \
+    loops.h \
+    jit.h \
+    transpiler.h \
+    bigregister.h \
+    loader.h \
+    bytecode.h \
+    batch.h \
+    lockstep.h \
+    cfg.h \
+    passes.h \
+    profiler.h \
+    checkpoint.h \
+    resultcache.h \
+    jobrunner.h \
+    program.h \
+    output.h \
+    cycle.h \
+    linker.h \
+    trace.h \
+    debugger.h \
+    conformance.h
+
+
+DEFINES += LINUX
@@ -0,0 +1,484 @@
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <string>
+#include <sstream>
+#include <iomanip>
+#include <chrono>
+#include <algorithm>
+#include <thread>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "../engine.h"
+#include "../interpreter.h"
+#include "../batch.h"
+#include "../lockstep.h"
+#include "../peephole.h"
+#include "../jit.h"
+#include "../program.h"
+#include "workloads.h"
+
+
+// addition loop: R0 += R1
+//      J(1, 2, 5); S(0); S(2); J(0, 0, 1)
+static std::vector<Instruction> additionProgram()
+{
+    std::vector<Instruction> program;
+    program.push_back(Instruction(Instruction::CT_J, 1, 2, 5));
+    program.push_back(Instruction(Instruction::CT_S, 0));
+    program.push_back(Instruction(Instruction::CT_S, 2));
+    program.push_back(Instruction(Instruction::CT_J, 0, 0, 1));
+    return program;
+}
+
+static double secondsSince(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// compares plain 64-bit registers with checked registers on the same program,
+// best of the repetitions is taken.
+static void benchCheckedRegisters(RegValue iterations, int repetitions)
+{
+    DecodedProgram program(additionProgram());
+    std::map<RegNumber, RegValue> initial;
+    initial[0] = 0;
+    initial[1] = iterations;
+
+    double plainSeconds = 0, checkedSeconds = 0;
+    unsigned long long steps = 0;
+
+    for (int i=0; i<repetitions; ++i){
+        std::vector<RegValue> registers = program.loadRegisters(initial);
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        steps = ThreadedEngine().run(program, &registers[0]).steps;
+        double seconds = secondsSince(start);
+        if (i == 0 || seconds < plainSeconds)
+            plainSeconds = seconds;
+    }
+
+    for (int i=0; i<repetitions; ++i){
+        std::vector<RegValue> values = program.loadRegisters(initial);
+        std::vector<BigRegister> registers(values.size());
+        for (std::size_t j=0; j<values.size(); ++j)
+            registers[j].setValue(values[j]);
+
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        CheckedEngine().run(program, &registers[0]);
+        double seconds = secondsSince(start);
+        if (i == 0 || seconds < checkedSeconds)
+            checkedSeconds = seconds;
+    }
+
+    std::cout << "checked-registers steps=" << steps
+              << " plain_s=" << plainSeconds
+              << " checked_s=" << checkedSeconds
+              << " overhead=" << (plainSeconds > 0 ? checkedSeconds / plainSeconds : 0) << std::endl;
+}
+
+// generates straight-line program of the given count of lines
+static void generateProgram(const std::string &fileName, std::size_t lines)
+{
+    std::ofstream file(fileName.c_str());
+    file << "R0 = 1" << "\n" << "R1 = 2" << "\n";
+    for (std::size_t i=0; i<lines; ++i){
+        switch (i % 4) {
+        case 0: file << "S(" << i % 1000 << ")\n"; break;
+        case 1: file << "T(" << i % 1000 << ", " << (i + 7) % 1000 << ")\n"; break;
+        case 2: file << "Z(" << i % 1000 << ")\n"; break;
+        case 3: file << "J(" << i % 1000 << ", " << i % 999 << ", " << lines + 3 << ")\n"; break;
+        }
+    }
+}
+
+static double loadSeconds(const std::string &fileName, bool mapped, unsigned threads)
+{
+    Interpreter interpreter;
+    interpreter.setMappedLoading(mapped);
+    interpreter.setLoaderThreads(threads);
+    interpreter.setBytecodeCache(false);
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    interpreter.loadFile(fileName);
+    return secondsSince(start);
+}
+
+// compares line by line loading with memory-mapped loading by one and by all threads.
+static void benchLoader(std::size_t lines)
+{
+    std::string fileName = "bench-loader.rml";
+    generateProgram(fileName, lines);
+
+    unsigned cores = std::thread::hardware_concurrency();
+    double stream = loadSeconds(fileName, false, 1);
+    double mapped = loadSeconds(fileName, true, 1);
+    double parallel = loadSeconds(fileName, true, 0);
+    remove(fileName.c_str());
+
+    std::cout << "loader lines=" << lines
+              << " stream_s=" << stream
+              << " mapped_s=" << mapped
+              << " parallel_s=" << parallel
+              << " threads=" << cores << std::endl;
+}
+
+// compares parsing of the text with loading of the cached compiled program.
+static void benchBytecode(std::size_t lines)
+{
+    std::string fileName = "bench-bytecode.rml";
+    std::string cacheName = fileName + "c";
+    generateProgram(fileName, lines);
+    remove(cacheName.c_str());
+
+    double parseAndWrite, cached;
+    {
+        Interpreter interpreter;
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        interpreter.loadFile(fileName);
+        parseAndWrite = secondsSince(start);
+    }
+    {
+        Interpreter interpreter;
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        interpreter.loadFile(fileName);
+        cached = secondsSince(start);
+    }
+    double parse = loadSeconds(fileName, true, 0);
+    remove(fileName.c_str());
+    remove(cacheName.c_str());
+
+    std::cout << "bytecode lines=" << lines
+              << " parse_s=" << parse
+              << " parse_write_s=" << parseAndWrite
+              << " cached_s=" << cached << std::endl;
+}
+
+// runs the addition program over the csv vectors by 1, 2, 4, ... threads up to all cores.
+static void benchBatch(std::size_t vectors)
+{
+    DecodedProgram program(additionProgram());
+    std::ostringstream text;
+    for (std::size_t i=0; i<vectors; ++i)
+        text << i % 1000 << "," << i % 997 << "\n";
+    std::string input = text.str();
+
+    unsigned cores = std::thread::hardware_concurrency();
+    if (cores == 0)
+        cores = 1;
+
+    for (unsigned threads=1; ; threads = std::min(threads * 2, cores)){
+        BatchRunner runner(program, std::map<RegNumber, RegValue>());
+        runner.setThreads(threads);
+
+        std::istringstream in(input);
+        std::ostringstream out;
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        BatchRunner::Stats stats = runner.run(in, out);
+        double seconds = secondsSince(start);
+
+        std::cout << "batch vectors=" << stats.vectors
+                  << " threads=" << threads
+                  << " s=" << seconds
+                  << " vectors_per_s=" << (seconds > 0 ? stats.vectors / seconds : 0) << std::endl;
+        if (threads == cores)
+            break;
+    }
+}
+
+// compares scalar threaded engine with lockstep engine on the addition program (without optimisations).
+// Inputs of the "same" set follow one control path, inputs of the "spread" set diverge.
+static void benchLockstep(std::size_t inputs)
+{
+    const std::size_t Lanes = LockstepEngine::Lanes;
+    DecodedProgram program(additionProgram());
+    std::size_t count = program.registerNumbers().size();
+    const char *sets[] = {"same", "spread"};
+
+    for (int set=0; set<2; ++set){
+        std::vector<RegValue> firsts(inputs), seconds(inputs);
+        for (std::size_t i=0; i<inputs; ++i){
+            firsts[i] = i;
+            seconds[i] = set == 0 ? 1000 : 500 + i * 7919 % 1000;
+        }
+
+        // indexes of R0 and R1 in the register file
+        std::map<RegNumber, RegValue> numbers;
+        numbers[0] = 1;
+        numbers[1] = 2;
+        std::vector<RegValue> indexes = program.loadRegisters(numbers);
+        std::size_t first = std::find(indexes.begin(), indexes.end(), 1) - indexes.begin();
+        std::size_t second = std::find(indexes.begin(), indexes.end(), 2) - indexes.begin();
+
+        RegValue scalarSum = 0;
+        std::vector<RegValue> registers(count);
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        for (std::size_t i=0; i<inputs; ++i){
+            std::fill(registers.begin(), registers.end(), 0);
+            registers[first] = firsts[i];
+            registers[second] = seconds[i];
+            ThreadedEngine().run(program, &registers[0]);
+            scalarSum += registers[first];
+        }
+        double scalarSeconds = secondsSince(start);
+
+        RegValue lockstepSum = 0;
+        LockstepEngine::Stats stats;
+        ExecutionResult results[Lanes];
+        std::vector<RegValue> lanes(count * Lanes);
+        start = std::chrono::steady_clock::now();
+        for (std::size_t i=0; i<inputs; i+=Lanes){
+            std::size_t used = std::min(Lanes, inputs - i);
+            std::fill(lanes.begin(), lanes.end(), 0);
+            for (std::size_t lane=0; lane<used; ++lane){
+                lanes[first * Lanes + lane] = firsts[i + lane];
+                lanes[second * Lanes + lane] = seconds[i + lane];
+            }
+            LockstepEngine().run(program, &lanes[0], used, results, &stats);
+            for (std::size_t lane=0; lane<used; ++lane)
+                lockstepSum += lanes[first * Lanes + lane];
+        }
+        double lockstepSeconds = secondsSince(start);
+
+        std::cout << "lockstep inputs=" << inputs
+                  << " set=" << sets[set]
+                  << " scalar_inputs_per_s=" << (scalarSeconds > 0 ? inputs / scalarSeconds : 0)
+                  << " lockstep_inputs_per_s=" << (lockstepSeconds > 0 ? inputs / lockstepSeconds : 0)
+                  << " divergent_dispatches=" << stats.divergentDispatches
+                  << " scalar_lanes=" << stats.scalarLanes
+                  << " match=" << (scalarSum == lockstepSum ? "yes" : "no") << std::endl;
+    }
+}
+
+// best time of the threaded engine over registers of the Value type,
+// the register file is converted back to RegValue to compare the results.
+template<typename Value>
+static double runWidth(const DecodedProgram &program, const std::vector<RegValue> &initial, int repetitions,
+                       ExecutionResult &result, std::vector<RegValue> &values)
+{
+    double best = 0;
+    std::vector<Value> registers(initial.size());
+    for (int i=0; i<repetitions; ++i){
+        std::copy(initial.begin(), initial.end(), registers.begin());
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        result = ThreadedEngine().run(program, &registers[0]);
+        double seconds = secondsSince(start);
+        if (i == 0 || seconds < best)
+            best = seconds;
+    }
+    values.assign(registers.begin(), registers.end());
+    return best;
+}
+
+// runs the program of the given count of instructions by the threaded engine over 32-, 64- and 128-bit registers
+// and by the machine, that chooses the width itself. Ops of the long body don't fit the caches,
+// so the run time shows the bytes of the op stream read per step.
+static void benchFootprint(unsigned long long instructions, int repetitions)
+{
+    const RegValue Passes = 5;
+    Workload workload = longBodyWorkload(instructions, Passes);
+    Program program(workload.instructions, workload.registers, 0);
+    const DecodedProgram &decoded = program.decoded();
+
+    const char *widths[] = {"32", "64", "128", "machine"};
+    std::vector<RegValue> expected;
+    for (std::size_t w=0; w<sizeof(widths) / sizeof(widths[0]); ++w){
+        ExecutionResult result;
+        std::vector<RegValue> values;
+        double seconds = 0;
+        if (w == 0)
+            seconds = runWidth<uint32_t>(decoded, program.registerFile(), repetitions, result, values);
+        else if (w == 1)
+            seconds = runWidth<RegValue>(decoded, program.registerFile(), repetitions, result, values);
+        else if (w == 2){
+#ifdef REGM_INT128
+            seconds = runWidth<WideRegValue>(decoded, program.registerFile(), repetitions, result, values);
+#else
+            continue;
+#endif
+        } else {
+            Machine machine(program);
+            for (int i=0; i<repetitions; ++i){
+                machine.reset();
+                std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+                result = machine.run();
+                double runSeconds = secondsSince(start);
+                if (i == 0 || runSeconds < seconds)
+                    seconds = runSeconds;
+            }
+            values = machine.registerFile();
+        }
+        if (w == 0)
+            expected = values;
+
+        std::cout << "footprint instructions=" << workload.instructions.size()
+                  << " op_bytes=" << sizeof(DecodedProgram::Op)
+                  << " ops_mb=" << decoded.ops().size() * sizeof(DecodedProgram::Op) / 1000000.0
+                  << " registers=" << widths[w]
+                  << " steps=" << result.steps
+                  << " s=" << seconds
+                  << " steps_per_s=" << std::setprecision(0) << std::fixed << (seconds > 0 ? result.steps / seconds : 0)
+                  << std::defaultfloat << std::setprecision(6)
+                  << " match=" << (values == expected ? "yes" : "no") << std::endl;
+    }
+}
+
+// one load and run of the workload by the engine
+struct Measurement
+{
+    Measurement():
+        loadSeconds(0), runSeconds(0){}
+
+    double loadSeconds;
+    double runSeconds;
+    ExecutionResult result;
+    std::vector<RegValue> registers;
+};
+
+// load - decoding, optimisation or compilation and loading of the register file.
+// returns false if the engine is not available.
+static bool measure(const std::string &engine, const Workload &workload, Measurement &measurement)
+{
+    const std::size_t Lanes = LockstepEngine::Lanes;
+    if (engine == "jit" && ! JitProgram::isSupported())
+        return false;
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    DecodedProgram program(workload.instructions);
+    if (engine == "threaded-O4"){
+        LoopSummariser().summarise(program);
+        PeepholeOptimizer(PeepholeOptimizer::MaxLevel).optimise(program);
+    }
+    JitProgram jit;
+    if (engine == "jit")
+        jit.compile(program);
+
+    std::vector<RegValue> values = program.loadRegisters(workload.registers);
+    if (values.empty())
+        values.push_back(0);
+    std::vector<BigRegister> bigRegisters;
+    std::vector<RegValue> lanes;
+    if (engine == "checked"){
+        bigRegisters.resize(values.size());
+        for (std::size_t i=0; i<values.size(); ++i)
+            bigRegisters[i].setValue(values[i]);
+    } else if (engine == "simd"){
+        lanes.assign(values.size() * Lanes, 0);
+        for (std::size_t i=0; i<values.size(); ++i)
+            lanes[i * Lanes] = values[i];
+    }
+    measurement.loadSeconds = secondsSince(start);
+
+    start = std::chrono::steady_clock::now();
+    if (engine == "jit")
+        measurement.result = jit.run(&values[0]);
+    else if (engine == "checked")
+        measurement.result = CheckedEngine().run(program, &bigRegisters[0]);
+    else if (engine == "simd")
+        LockstepEngine().run(program, &lanes[0], 1, &measurement.result);
+    else
+        measurement.result = ThreadedEngine().run(program, &values[0]);
+    measurement.runSeconds = secondsSince(start);
+
+    // results are compared in the original register order
+    for (std::size_t i=0; i<values.size(); ++i){
+        if (engine == "checked")
+            values[i] = bigRegisters[i].isSmall() ? bigRegisters[i].value() : 0;
+        else if (engine == "simd")
+            values[i] = lanes[i * Lanes];
+    }
+    std::map<RegNumber, RegValue> registers;
+    program.storeRegisters(values, registers);
+    measurement.registers.clear();
+    for (std::map<RegNumber, RegValue>::const_iterator it = registers.begin(); it != registers.end(); ++it)
+        measurement.registers.push_back((*it).second);
+    return true;
+}
+
+static double median(std::vector<double> values)
+{
+    std::sort(values.begin(), values.end());
+    return values[values.size() / 2];
+}
+
+// runs all workloads by all engines. Every phase is repeated after one warm-up run,
+// the best time of the load and the best and median time of the run are printed.
+// One line per workload and engine in the stable order, so the output of two commits can be diffed.
+// Results of every engine are compared with the threaded engine without optimisations.
+static void benchSuite(unsigned long long scale, int repetitions)
+{
+    const char *engines[] = {"threaded-O0", "threaded-O4", "jit", "checked", "simd"};
+    std::vector<Workload> workloads = allWorkloads(scale);
+
+    std::cout << std::fixed << std::setprecision(6);
+    for (std::size_t w=0; w<workloads.size(); ++w){
+        const Workload &workload = workloads[w];
+
+        std::string fileName = "bench-suite.rml";
+        workload.write(fileName);
+        loadSeconds(fileName, true, 0);
+        double parse = 0;
+        for (int i=0; i<repetitions; ++i){
+            double seconds = loadSeconds(fileName, true, 0);
+            if (i == 0 || seconds < parse)
+                parse = seconds;
+        }
+        remove(fileName.c_str());
+
+        std::vector<RegValue> expected;
+        for (std::size_t e=0; e<sizeof(engines) / sizeof(engines[0]); ++e){
+            Measurement measurement;
+            if (! measure(engines[e], workload, measurement))
+                continue;
+
+            double load = 0;
+            std::vector<double> runs;
+            for (int i=0; i<repetitions; ++i){
+                measure(engines[e], workload, measurement);
+                if (i == 0 || measurement.loadSeconds < load)
+                    load = measurement.loadSeconds;
+                runs.push_back(measurement.runSeconds);
+            }
+            if (e == 0)
+                expected = measurement.registers;
+            double best = *std::min_element(runs.begin(), runs.end());
+
+            std::cout << "suite workload=" << workload.name
+                      << " engine=" << engines[e]
+                      << " instructions=" << workload.instructions.size()
+                      << " steps=" << measurement.result.steps
+                      << " parse_s=" << parse
+                      << " load_s=" << load
+                      << " run_min_s=" << best
+                      << " run_median_s=" << median(runs)
+                      << " steps_per_s=" << std::setprecision(0) << (best > 0 ? measurement.result.steps / best : 0)
+                      << std::setprecision(6)
+                      << " match=" << (measurement.registers == expected ? "yes" : "no") << std::endl;
+        }
+    }
+    std::cout << std::defaultfloat;
+}
+
+
+int main(int argc, char* argv[])
+{
+    std::string name = argc > 1 ? argv[1] : "all";
+    unsigned long long parameter = argc > 2 ? strtoull(argv[2], 0, 10) : 0;
+    int repetitions = argc > 3 ? atoi(argv[3]) : 0;
+
+    if (name == "checked" || name == "all")
+        benchCheckedRegisters(parameter ? parameter : 20000000, 3);
+    if (name == "loader" || name == "all")
+        benchLoader(parameter ? parameter : 10000000);
+    if (name == "bytecode" || name == "all")
+        benchBytecode(parameter ? parameter : 10000000);
+    if (name == "batch" || name == "all")
+        benchBatch(parameter ? parameter : 1000000);
+    if (name == "lockstep" || name == "all")
+        benchLockstep(parameter ? parameter : 200000);
+    if (name == "footprint" || name == "all")
+        benchFootprint(parameter ? parameter : 10000000, repetitions > 0 ? repetitions : 3);
+    if (name == "suite" || name == "all")
+        benchSuite(parameter ? parameter : 10000000, repetitions > 0 ? repetitions : 5);
+    return 0;
+}
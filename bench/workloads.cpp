@@ -0,0 +1,206 @@
+#include "workloads.h"
+#include <fstream>
+#include <cmath>
+#include <algorithm>
+
+
+bool Workload::write(const std::string &fileName) const
+{
+    std::ofstream file(fileName.c_str());
+    std::map<RegNumber, RegValue>::const_iterator it = registers.begin();
+    for (; it != registers.end(); ++it)
+        file << "R" << (*it).first << " = " << (*it).second << "\n";
+
+    for (std::size_t i=0; i<instructions.size(); ++i){
+        const Instruction &instruction = instructions[i];
+        switch (instruction.type()) {
+        case Instruction::CT_Z: file << "Z(" << instruction.arg1 << ")\n"; break;
+        case Instruction::CT_S: file << "S(" << instruction.arg1 << ")\n"; break;
+        case Instruction::CT_T: file << "T(" << instruction.arg1 << ", " << instruction.arg2 << ")\n"; break;
+        case Instruction::CT_J:
+            file << "J(" << instruction.arg1 << ", " << instruction.arg2 << ", " << instruction.instr << ")\n";
+            break;
+        }
+    }
+    return bool(file);
+}
+
+static void add(Workload &workload, Instruction::Type type, RegNumber arg1, RegNumber arg2 = 0, InstructionPos instr = 0)
+{
+    workload.instructions.push_back(Instruction(type, arg1, arg2, instr));
+}
+
+Workload additionWorkload(unsigned long long scale)
+{
+    // 4 steps per unit of R1
+    Workload workload;
+    workload.name = "addition";
+    workload.registers[0] = 1000;
+    workload.registers[1] = scale / 4;
+    add(workload, Instruction::CT_J, 1, 2, 5);
+    add(workload, Instruction::CT_S, 0);
+    add(workload, Instruction::CT_S, 2);
+    add(workload, Instruction::CT_J, 0, 0, 1);
+    return workload;
+}
+
+Workload multiplicationWorkload(unsigned long long scale)
+{
+    // inner loop adds R0 to R4 by 4 steps per unit, outer loop runs R1 times
+    Workload workload;
+    workload.name = "multiplication";
+    workload.registers[0] = scale / 400 + 1;
+    workload.registers[1] = 100;
+    add(workload, Instruction::CT_J, 3, 1, 9);
+    add(workload, Instruction::CT_J, 0, 2, 6);
+    add(workload, Instruction::CT_S, 2);
+    add(workload, Instruction::CT_S, 4);
+    add(workload, Instruction::CT_J, 0, 0, 2);
+    add(workload, Instruction::CT_Z, 2);
+    add(workload, Instruction::CT_S, 3);
+    add(workload, Instruction::CT_J, 0, 0, 1);
+    add(workload, Instruction::CT_T, 4, 0);
+    return workload;
+}
+
+Workload subtractionWorkload(unsigned long long scale)
+{
+    // counts from R1 up to R0 by 4 steps per unit
+    Workload workload;
+    workload.name = "subtraction";
+    workload.registers[0] = 1000 + scale / 4;
+    workload.registers[1] = 1000;
+    add(workload, Instruction::CT_T, 1, 2);
+    add(workload, Instruction::CT_J, 0, 2, 6);
+    add(workload, Instruction::CT_S, 2);
+    add(workload, Instruction::CT_S, 3);
+    add(workload, Instruction::CT_J, 0, 0, 2);
+    add(workload, Instruction::CT_T, 3, 0);
+    return workload;
+}
+
+Workload exponentiationWorkload(unsigned long long scale)
+{
+    // R3 - done multiplications, R4 - product, R5 and R6 - counters of the multiplication loops.
+    // Base 2: about 9 * 2^R1 steps.
+    Workload workload;
+    workload.name = "exponentiation";
+    unsigned long long exponent = 1;
+    while (exponent < 60 && (9ULL << (exponent + 1)) <= scale)
+        ++exponent;
+    workload.registers[0] = 2;
+    workload.registers[1] = exponent;
+
+    add(workload, Instruction::CT_Z, 2);
+    add(workload, Instruction::CT_S, 2);
+    add(workload, Instruction::CT_Z, 3);
+    add(workload, Instruction::CT_J, 3, 1, 18);     // 4: all multiplications are done
+    add(workload, Instruction::CT_Z, 4);
+    add(workload, Instruction::CT_Z, 5);
+    add(workload, Instruction::CT_J, 5, 2, 15);     // 7: R4 = R2 * R0
+    add(workload, Instruction::CT_Z, 6);
+    add(workload, Instruction::CT_J, 6, 0, 13);     // 9: R4 += R0
+    add(workload, Instruction::CT_S, 4);
+    add(workload, Instruction::CT_S, 6);
+    add(workload, Instruction::CT_J, 0, 0, 9);
+    add(workload, Instruction::CT_S, 5);            // 13
+    add(workload, Instruction::CT_J, 0, 0, 7);
+    add(workload, Instruction::CT_T, 4, 2);         // 15
+    add(workload, Instruction::CT_S, 3);
+    add(workload, Instruction::CT_J, 0, 0, 4);
+    return workload;
+}
+
+// emits the loop of the level and the loops nested into it
+static void addLoop(Workload &workload, std::size_t level, std::size_t depth)
+{
+    // R0 - count of iterations, R1..R(depth) - counters, R(depth + 1) - count of the innermost iterations
+    RegNumber counter = level + 1;
+    add(workload, Instruction::CT_Z, counter);
+    std::size_t header = workload.instructions.size();
+    add(workload, Instruction::CT_J, counter, 0, 0);
+
+    if (level + 1 < depth)
+        addLoop(workload, level + 1, depth);
+    else
+        add(workload, Instruction::CT_S, depth + 1);
+
+    add(workload, Instruction::CT_S, counter);
+    add(workload, Instruction::CT_J, 0, 0, header + 1);
+    workload.instructions[header].instr = workload.instructions.size() + 1;
+}
+
+Workload loopNestWorkload(unsigned long long scale, std::size_t depth)
+{
+    // 4 steps per innermost iteration
+    Workload workload;
+    workload.name = "loop-nest";
+    RegValue iterations = std::max(2.0, std::floor(std::pow(scale / 4.0, 1.0 / depth)));
+    workload.registers[0] = iterations;
+    addLoop(workload, 0, depth);
+    return workload;
+}
+
+Workload straightLineWorkload(unsigned long long scale)
+{
+    Workload workload;
+    workload.name = "straight-line";
+    workload.registers[0] = 1;
+    workload.registers[1] = 2;
+    for (unsigned long long i=0; i<scale; ++i){
+        switch (i % 3) {
+        case 0: add(workload, Instruction::CT_S, i % 1000); break;
+        case 1: add(workload, Instruction::CT_T, i % 1000, (i + 7) % 1000); break;
+        case 2: add(workload, Instruction::CT_Z, (i + 500) % 1000); break;
+        }
+    }
+    return workload;
+}
+
+Workload sparseRegistersWorkload(unsigned long long scale)
+{
+    const RegNumber Sum = 1000000000, Count = 9000000000ULL, Counter = 5000000000ULL;
+    Workload workload;
+    workload.name = "sparse-registers";
+    workload.registers[Sum] = 1000;
+    workload.registers[Count] = scale / 4;
+    add(workload, Instruction::CT_J, Count, Counter, 5);
+    add(workload, Instruction::CT_S, Sum);
+    add(workload, Instruction::CT_S, Counter);
+    add(workload, Instruction::CT_J, Sum, Sum, 1);
+    return workload;
+}
+
+Workload longBodyWorkload(unsigned long long instructions, RegValue passes)
+{
+    // R1 - counter of the passes, the body uses R2..R1001
+    Workload workload;
+    workload.name = "long-body";
+    workload.registers[0] = passes;
+    unsigned long long body = std::max(instructions, 4ULL) - 3;
+    add(workload, Instruction::CT_J, 1, 0, body + 4);
+    for (unsigned long long i=0; i<body; ++i){
+        switch (i % 3) {
+        case 0: add(workload, Instruction::CT_S, 2 + i % 1000); break;
+        case 1: add(workload, Instruction::CT_T, 2 + i % 1000, 2 + (i + 7) % 1000); break;
+        case 2: add(workload, Instruction::CT_Z, 2 + (i + 500) % 1000); break;
+        }
+    }
+    add(workload, Instruction::CT_S, 1);
+    add(workload, Instruction::CT_J, 0, 0, 1);
+    return workload;
+}
+
+std::vector<Workload> allWorkloads(unsigned long long scale)
+{
+    std::vector<Workload> workloads;
+    workloads.push_back(additionWorkload(scale));
+    workloads.push_back(multiplicationWorkload(scale));
+    workloads.push_back(subtractionWorkload(scale));
+    workloads.push_back(exponentiationWorkload(scale));
+    workloads.push_back(loopNestWorkload(scale, 4));
+    // parsing is the heavy part of the long program
+    workloads.push_back(straightLineWorkload(scale / 10));
+    workloads.push_back(sparseRegistersWorkload(scale));
+    return workloads;
+}
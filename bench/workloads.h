@@ -0,0 +1,45 @@
+#ifndef WORKLOADS_H
+#define WORKLOADS_H
+
+#include <string>
+#include <vector>
+#include <map>
+
+#include "../instruction.h"
+
+
+//-- generated benchmark program
+// scale - approximate count of steps executed without optimisations
+// (count of lines for the straight-line code).
+struct Workload
+{
+    std::string name;
+    std::map<RegNumber, RegValue> registers;
+    std::vector<Instruction> instructions;
+
+    // writes the program in the source format.
+    bool write(const std::string &fileName) const;
+};
+
+// R0 += R1
+Workload additionWorkload(unsigned long long scale);
+// R0 = R0 * R1
+Workload multiplicationWorkload(unsigned long long scale);
+// R0 = R0 - R1
+Workload subtractionWorkload(unsigned long long scale);
+// R2 = R0 ^ R1 by repeated multiplication
+Workload exponentiationWorkload(unsigned long long scale);
+// counting loops nested to the given depth
+Workload loopNestWorkload(unsigned long long scale, std::size_t depth);
+// Z, S, T without jumps
+Workload straightLineWorkload(unsigned long long scale);
+// addition over registers with numbers above 10^9 (see increment-billion-register.rml)
+Workload sparseRegistersWorkload(unsigned long long scale);
+// loop of R0 passes over the straight-line body of the given count of instructions
+Workload longBodyWorkload(unsigned long long instructions, RegValue passes);
+
+// all workloads in the stable order
+std::vector<Workload> allWorkloads(unsigned long long scale);
+
+
+#endif // WORKLOADS_H
@@ -0,0 +1,109 @@
+#include "bigregister.h"
+#include <algorithm>
+
+
+void BigRegister::promote()
+{
+    // the only way to overflow is increment of 2^64-1: the value becomes 2^64.
+    mLimbs = new std::vector<unsigned int>(3, 0);
+    (*mLimbs)[2] = 1;
+    mValue = 0;
+}
+
+void BigRegister::incrementBig()
+{
+    for (std::size_t i=0; i<mLimbs->size(); ++i){
+        if (++(*mLimbs)[i] != 0)
+            return;
+    }
+    mLimbs->push_back(1);
+}
+
+void BigRegister::assignBig(const BigRegister &other)
+{
+    if (this == &other)
+        return;
+
+    if (! other.mLimbs){
+        setZero();
+        mValue = other.mValue;
+        return;
+    }
+
+    if (mLimbs)
+        *mLimbs = *other.mLimbs;
+    else
+        mLimbs = new std::vector<unsigned int>(*other.mLimbs);
+    mValue = 0;
+}
+
+bool BigRegister::equalsBig(const BigRegister &other) const
+{
+    if (! mLimbs || ! other.mLimbs)
+        return false;
+    return *mLimbs == *other.mLimbs;
+}
+
+bool BigRegister::setDecimal(const std::string &digits)
+{
+    std::vector<unsigned int> limbs;
+    for (std::size_t i=0; i<digits.length(); ++i){
+        if (digits[i] < '0' || digits[i] > '9')
+            return false;
+
+        // limbs = limbs * 10 + digit
+        unsigned long long carry = digits[i] - '0';
+        for (std::size_t j=0; j<limbs.size(); ++j){
+            unsigned long long value = (unsigned long long)limbs[j] * 10 + carry;
+            limbs[j] = (unsigned int)value;
+            carry = value >> 32;
+        }
+        if (carry)
+            limbs.push_back((unsigned int)carry);
+    }
+
+    setZero();
+    if (limbs.size() <= 2){
+        for (std::size_t i=0; i<limbs.size(); ++i)
+            mValue |= (RegValue)limbs[i] << (32*i);
+    } else
+        mLimbs = new std::vector<unsigned int>(limbs);
+    return true;
+}
+
+std::string BigRegister::toDecimal() const
+{
+    std::vector<unsigned int> limbs;
+    if (mLimbs)
+        limbs = *mLimbs;
+    else {
+        limbs.push_back((unsigned int)mValue);
+        limbs.push_back((unsigned int)(mValue >> 32));
+    }
+
+    // repeated division by 10^9, each remainder gives nine decimal digits
+    std::string result;
+    while (! limbs.empty()){
+        unsigned long long remainder = 0;
+        for (std::size_t i=limbs.size(); i>0; --i){
+            unsigned long long value = (remainder << 32) | limbs[i-1];
+            limbs[i-1] = (unsigned int)(value / 1000000000);
+            remainder = value % 1000000000;
+        }
+        while (! limbs.empty() && limbs.back() == 0)
+            limbs.pop_back();
+
+        for (int i=0; i<9; ++i){
+            result.push_back((char)('0' + remainder % 10));
+            remainder /= 10;
+        }
+    }
+
+    while (result.size() > 1 && result[result.size()-1] == '0')
+        result.erase(result.size()-1);
+    if (result.empty())
+        result = "0";
+
+    std::reverse(result.begin(), result.end());
+    return result;
+}
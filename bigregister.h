@@ -0,0 +1,100 @@
+#ifndef BIGREGISTER_H
+#define BIGREGISTER_H
+
+#include <vector>
+#include <string>
+
+#include "instruction.h"
+
+
+//-- register of unlimited size
+// Value is kept inline as RegValue while it fits 64 bits.
+// Only when increment overflows (or too big initial value is assigned)
+// the register is promoted to heap-allocated multi-limb integer.
+// Invariant: promoted register is always greater than any RegValue,
+// so small and promoted registers are never equal.
+class BigRegister
+{
+public:
+    BigRegister():
+        mValue(0), mLimbs(0){}
+
+    BigRegister(const BigRegister &other):
+        mValue(other.mValue), mLimbs(other.mLimbs ? new std::vector<unsigned int>(*other.mLimbs) : 0){}
+
+    ~BigRegister() {
+        delete mLimbs;
+    }
+
+    BigRegister& operator=(const BigRegister &other) {
+        if (! mLimbs && ! other.mLimbs)
+            mValue = other.mValue;
+        else
+            assignBig(other);
+        return *this;
+    }
+
+    bool operator==(const BigRegister &other) const {
+        // promoted registers keep zero in mValue,
+        // so different mValue always means different registers.
+        if (mValue != other.mValue)
+            return false;
+        if (! mLimbs && ! other.mLimbs)
+            return true;
+        return equalsBig(other);
+    }
+
+    void setZero() {
+        if (mLimbs){
+            delete mLimbs;
+            mLimbs = 0;
+        }
+        mValue = 0;
+    }
+
+    void increment() {
+        if (! mLimbs){
+#ifdef __GNUC__
+            if (! __builtin_add_overflow(mValue, 1, &mValue))
+                return;
+#else
+            if (++mValue != 0)
+                return;
+#endif
+            promote();
+            return;
+        }
+        incrementBig();
+    }
+
+    bool isSmall() const {
+        return mLimbs == 0;
+    }
+    // value of the small register.
+    RegValue value() const {
+        return mValue;
+    }
+    void setValue(RegValue value) {
+        setZero();
+        mValue = value;
+    }
+
+    // assigns decimal number of any length.
+    // returns false if string contains not only digits.
+    bool setDecimal(const std::string &digits);
+    std::string toDecimal() const;
+
+private:
+    void promote();
+    void incrementBig();
+    void assignBig(const BigRegister &other);
+    bool equalsBig(const BigRegister &other) const;
+
+private:
+    RegValue mValue;
+    // 32-bit limbs, least significant first.
+    std::vector<unsigned int> *mLimbs;
+};
+
+
+#endif // BIGREGISTER_H
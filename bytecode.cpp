@@ -0,0 +1,429 @@
+#include "bytecode.h"
+#include "program.h"
+#include "loops.h"
+#include <fstream>
+#include <cstring>
+#include <cstddef>
+#include <stdio.h>
+
+#ifdef LINUX
+#   include <sys/stat.h>
+#   include <unistd.h>
+#endif
+
+
+bool SourceStamp::read(const std::string &fileName)
+{
+#ifdef LINUX
+    struct stat status;
+    if (stat(fileName.c_str(), &status) != 0)
+        return false;
+
+    size = status.st_size;
+    modified = (long long)status.st_mtim.tv_sec * 1000000000LL + status.st_mtim.tv_nsec;
+    return true;
+#else
+    std::ifstream file(fileName.c_str(), std::ios::binary | std::ios::ate);
+    if (! file)
+        return false;
+
+    // modification time is not available, size only
+    size = file.tellg();
+    modified = 0;
+    return true;
+#endif
+}
+
+
+void RegisterRecord::write(const std::map<RegNumber, RegValue> &registers, char *records)
+{
+    std::map<RegNumber, RegValue>::const_iterator it = registers.begin();
+    for (std::size_t i=0; it != registers.end(); ++it, ++i){
+        RegisterRecord record;
+        record.number = (*it).first;
+        record.value = (*it).second;
+        std::memcpy(records + i * sizeof(RegisterRecord), &record, sizeof(record));
+    }
+}
+
+void RegisterRecord::read(const char *records, std::size_t count, std::map<RegNumber, RegValue> &registers)
+{
+    for (std::size_t i=0; i<count; ++i){
+        RegisterRecord record;
+        std::memcpy(&record, records + i * sizeof(RegisterRecord), sizeof(record));
+        registers[record.number] = record.value;
+    }
+}
+
+
+// ops are copied to and from the file as they are
+static_assert(sizeof(DecodedProgram::Op) == 16 && offsetof(DecodedProgram::Op, arg1) == 4,
+              "layout of the ops is the layout of the file");
+
+// writes the values as 64-bit words, returns the end of the words
+template<typename Value>
+static char* writeWords(const std::vector<Value> &values, char *words)
+{
+    for (std::size_t i=0; i<values.size(); ++i){
+        unsigned long long word = values[i];
+        std::memcpy(words + i * sizeof(word), &word, sizeof(word));
+    }
+    return words + values.size() * sizeof(unsigned long long);
+}
+
+template<typename Value>
+static const char* readWords(const char *words, std::size_t count, std::vector<Value> &values)
+{
+    values.resize(count);
+    for (std::size_t i=0; i<count; ++i){
+        unsigned long long word;
+        std::memcpy(&word, words + i * sizeof(word), sizeof(word));
+        values[i] = Value(word);
+    }
+    return words + count * sizeof(unsigned long long);
+}
+
+
+const unsigned int BytecodeFile::Version;
+const unsigned long long BytecodeFile::ChecksumBasis;
+
+std::string BytecodeFile::cacheName(const std::string &sourceName)
+{
+    std::string extension = ".rml";
+    if (sourceName.size() > extension.size()
+            && sourceName.compare(sourceName.size() - extension.size(), extension.size(), extension) == 0)
+        return sourceName + "c";
+    return sourceName + ".rmlc";
+}
+
+unsigned long long BytecodeFile::checksum(const char *data, std::size_t size, unsigned long long hash)
+{
+    std::size_t i = 0;
+    for (; i+8<=size; i+=8){
+        unsigned long long word;
+        std::memcpy(&word, data + i, 8);
+        hash = (hash ^ word) * 1099511628211ULL;
+    }
+    if (i < size){
+        unsigned long long word = 0;
+        std::memcpy(&word, data + i, size - i);
+        hash = (hash ^ word) * 1099511628211ULL;
+    }
+    return hash;
+}
+
+unsigned long long BytecodeFile::checksum(const std::vector< ::Instruction> &instructions)
+{
+    unsigned long long hash = ChecksumBasis;
+    for (std::size_t i=0; i<instructions.size(); ++i){
+        Instruction instruction = record(instructions[i]);
+        hash = checksum(reinterpret_cast<const char *>(&instruction), sizeof(instruction), hash);
+    }
+    return hash;
+}
+
+unsigned long long BytecodeFile::fileChecksum(const void *header, std::size_t headerSize, const char *body, std::size_t size)
+{
+    unsigned long long hash = checksum(reinterpret_cast<const char *>(header), headerSize);
+    return checksum(body, size, hash);
+}
+
+BytecodeFile::Instruction BytecodeFile::record(const ::Instruction &instruction)
+{
+    Instruction record;
+    record.type = instruction.type();
+    record.arg1 = instruction.arg1;
+    record.arg2 = instruction.arg2;
+    record.instr = instruction.instr;
+    return record;
+}
+
+bool BytecodeFile::write(const std::string &fileName, const SourceStamp &source,
+                         const std::map<RegNumber, RegValue> &registers, const std::vector< ::Instruction> &instructions,
+                         const Program *program)
+{
+    Header header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, "RMLC", 4);
+    header.version = Version;
+    header.sourceSize = source.size;
+    header.sourceModified = source.modified;
+    header.registersCount = registers.size();
+    header.instructionsCount = instructions.size();
+    header.optimisationLevel = -1;
+
+    std::size_t decodedSize = 0;
+    if (program){
+        const DecodedProgram &decoded = program->decoded();
+        header.optimisationLevel = program->optimisationLevel();
+        header.opsCount = decoded.ops().size();
+        header.haltsCount = decoded.halts().size();
+        header.registerNumbersCount = decoded.registerNumbers().size();
+        header.loopsCount = decoded.loopsCount();
+        for (std::size_t i=0; i<decoded.loopsCount(); ++i)
+            header.effectsCount += decoded.loop(i).effects.size();
+        header.unconditionalJumps = program->optimisation().peephole.unconditionalJumps;
+        header.superinstructions = program->optimisation().peephole.superinstructions;
+        header.absorbedOps = program->optimisation().peephole.absorbedOps;
+        decodedSize = header.opsCount * sizeof(DecodedProgram::Op)
+                + (header.haltsCount + header.registerNumbersCount) * sizeof(unsigned long long)
+                + header.loopsCount * sizeof(Loop) + header.effectsCount * sizeof(Effect);
+    }
+
+    std::size_t decodedOffset = registers.size() * sizeof(RegisterRecord) + instructions.size() * sizeof(Instruction);
+    std::vector<char> body(decodedOffset + decodedSize);
+    RegisterRecord::write(registers, body.data());
+
+    Instruction *instructionRecords = reinterpret_cast<Instruction *>(body.data() + registers.size() * sizeof(RegisterRecord));
+    for (std::size_t i=0; i<instructions.size(); ++i)
+        instructionRecords[i] = record(instructions[i]);
+
+    if (program){
+        const DecodedProgram &decoded = program->decoded();
+        char *records = body.data() + decodedOffset;
+        std::memcpy(records, decoded.ops().data(), header.opsCount * sizeof(DecodedProgram::Op));
+        // padding after the code is not initialised, it would change the checksum
+        for (std::size_t i=0; i<header.opsCount; ++i)
+            std::memset(records + i * sizeof(DecodedProgram::Op) + sizeof(DecodedProgram::OpCode), 0,
+                        offsetof(DecodedProgram::Op, arg1) - sizeof(DecodedProgram::OpCode));
+        records += header.opsCount * sizeof(DecodedProgram::Op);
+        records = writeWords(decoded.halts(), records);
+        records = writeWords(decoded.registerNumbers(), records);
+
+        Loop *loopRecords = reinterpret_cast<Loop *>(records);
+        Effect *effectRecords = reinterpret_cast<Effect *>(records + header.loopsCount * sizeof(Loop));
+        for (std::size_t i=0; i<decoded.loopsCount(); ++i){
+            const LoopSummary &loop = decoded.loop(i);
+            Loop &loopRecord = loopRecords[i];
+            loopRecord.left = loop.left;
+            loopRecord.right = loop.right;
+            loopRecord.leftStep = loop.leftStep;
+            loopRecord.rightStep = loop.rightStep;
+            loopRecord.exit = loop.exit;
+            loopRecord.iterationLength = loop.iterationLength;
+            loopRecord.effectsCount = loop.effects.size();
+            for (std::size_t e=0; e<loop.effects.size(); ++e, ++effectRecords){
+                const LoopSummary::Effect &effect = loop.effects[e];
+                effectRecords->kind = effect.kind;
+                effectRecords->reg = effect.reg;
+                effectRecords->source = effect.source;
+                effectRecords->value = effect.value;
+                effectRecords->sourceStep = effect.sourceStep;
+            }
+        }
+    }
+
+    header.checksum = fileChecksum(&header, offsetof(Header, checksum), body.data(), body.size());
+
+    return writeAtomically(fileName, &header, sizeof(header), body);
+}
+
+bool BytecodeFile::writeAtomically(const std::string &fileName, const void *header, std::size_t headerSize,
+                                   const std::vector<char> &body)
+{
+    std::string temporaryName = fileName + ".tmp";
+#ifdef LINUX
+    char pid[32];
+    sprintf(pid, ".%d", (int)getpid());
+    temporaryName += pid;
+#endif
+
+    std::ofstream file(temporaryName.c_str(), std::ios::binary | std::ios::trunc);
+    if (! file)
+        return false;
+
+    file.write(reinterpret_cast<const char *>(header), headerSize);
+    if (! body.empty())
+        file.write(&body[0], body.size());
+    file.close();
+
+    if (! file || rename(temporaryName.c_str(), fileName.c_str()) != 0){
+        remove(temporaryName.c_str());
+        return false;
+    }
+    return true;
+}
+
+bool BytecodeFile::open(const std::string &fileName)
+{
+    if (! mFile.open(fileName) || mFile.size() < sizeof(Header))
+        return false;
+
+    const Header &fileHeader = header();
+    if (std::memcmp(fileHeader.magic, "RMLC", 4) != 0 || fileHeader.version != Version)
+        return false;
+
+    // counts are checked by division, so huge values can't overflow the expected size
+    std::size_t bodySize = mFile.size() - sizeof(Header);
+    if (fileHeader.registersCount > bodySize / sizeof(RegisterRecord)
+            || fileHeader.instructionsCount > bodySize / sizeof(Instruction)
+            || fileHeader.opsCount > bodySize / sizeof(DecodedProgram::Op)
+            || fileHeader.haltsCount > bodySize / sizeof(unsigned long long)
+            || fileHeader.registerNumbersCount > bodySize / sizeof(unsigned long long)
+            || fileHeader.loopsCount > bodySize / sizeof(Loop)
+            || fileHeader.effectsCount > bodySize / sizeof(Effect))
+        return false;
+    if (decodedOffset() + fileHeader.opsCount * sizeof(DecodedProgram::Op)
+            + (fileHeader.haltsCount + fileHeader.registerNumbersCount) * sizeof(unsigned long long)
+            + fileHeader.loopsCount * sizeof(Loop) + fileHeader.effectsCount * sizeof(Effect) != mFile.size())
+        return false;
+
+    if (fileChecksum(&fileHeader, offsetof(Header, checksum), mFile.data() + sizeof(Header), bodySize) != fileHeader.checksum)
+        return false;
+
+    const Instruction *instructionRecords = reinterpret_cast<const Instruction *>(mFile.data() + sizeof(Header)
+                                                                                  + fileHeader.registersCount * sizeof(RegisterRecord));
+    for (std::size_t i=0; i<fileHeader.instructionsCount; ++i)
+        if (instructionRecords[i].type < ::Instruction::CT_Z || instructionRecords[i].type > ::Instruction::CT_J)
+            return false;
+
+    if (fileHeader.optimisationLevel < 0)
+        return fileHeader.optimisationLevel == -1 && fileHeader.opsCount == 0 && fileHeader.haltsCount == 0
+                && fileHeader.registerNumbersCount == 0 && fileHeader.loopsCount == 0 && fileHeader.effectsCount == 0;
+    return fileHeader.optimisationLevel <= Program::MaxOptimisationLevel && isDecodedValid();
+}
+
+std::size_t BytecodeFile::decodedOffset() const
+{
+    return sizeof(Header) + header().registersCount * sizeof(RegisterRecord) + header().instructionsCount * sizeof(Instruction);
+}
+
+bool BytecodeFile::isDecodedValid() const
+{
+    // the engine doesn't check anything, so every index it follows must be within it's table:
+    // ops of the instructions are followed by one halt op per halt (see DecodedProgram)
+    const Header &fileHeader = header();
+    std::size_t instructionsCount = fileHeader.instructionsCount, opsCount = fileHeader.opsCount;
+    std::size_t registersCount = fileHeader.registerNumbersCount;
+    if (fileHeader.haltsCount == 0 || opsCount != instructionsCount + fileHeader.haltsCount)
+        return false;
+
+    const char *records = mFile.data() + decodedOffset();
+    const DecodedProgram::Op *ops = reinterpret_cast<const DecodedProgram::Op *>(records);
+    const Loop *loops = reinterpret_cast<const Loop *>(records + opsCount * sizeof(DecodedProgram::Op)
+                                                       + (fileHeader.haltsCount + registersCount) * sizeof(unsigned long long));
+    const Effect *effects = reinterpret_cast<const Effect *>(loops + fileHeader.loopsCount);
+
+    for (std::size_t i=0; i<opsCount; ++i){
+        const DecodedProgram::Op &op = ops[i];
+        if (i >= instructionsCount){
+            if (op.code != DecodedProgram::OP_Halt || op.target != i - instructionsCount)
+                return false;
+            continue;
+        }
+
+        // superinstructions read the ops they absorbed
+        std::size_t absorbed = 0;
+        switch (op.code) {
+        case DecodedProgram::OP_Z: case DecodedProgram::OP_S: case DecodedProgram::OP_T:
+        case DecodedProgram::OP_J: case DecodedProgram::OP_Jmp: case DecodedProgram::OP_Loop:
+            break;
+        case DecodedProgram::OP_SS: case DecodedProgram::OP_SJ: case DecodedProgram::OP_SJmp: case DecodedProgram::OP_TZ:
+            absorbed = 1;
+            break;
+        case DecodedProgram::OP_SSJmp:
+            absorbed = 2;
+            break;
+        default:
+            // halts, breakpoints and unknown codes
+            return false;
+        }
+        if (op.arg1 >= registersCount || op.arg2 >= registersCount || i + absorbed >= instructionsCount)
+            return false;
+        if (op.code != DecodedProgram::OP_Loop && op.target >= opsCount)
+            return false;
+        if (op.code == DecodedProgram::OP_Loop && (op.target >= fileHeader.loopsCount
+                                                   || loops[op.target].iterationLength > instructionsCount - i))
+            return false;
+    }
+
+    unsigned long long effectsCount = 0;
+    for (std::size_t i=0; i<fileHeader.loopsCount; ++i){
+        const Loop &loop = loops[i];
+        if (loop.left >= registersCount || loop.right >= registersCount || loop.exit >= opsCount
+                || loop.effectsCount > fileHeader.effectsCount - effectsCount)
+            return false;
+        effectsCount += loop.effectsCount;
+    }
+    if (effectsCount != fileHeader.effectsCount)
+        return false;
+
+    for (std::size_t i=0; i<fileHeader.effectsCount; ++i){
+        const Effect &effect = effects[i];
+        if (effect.kind > LoopSummary::Effect::EK_Copy || effect.reg >= registersCount || effect.source >= registersCount)
+            return false;
+    }
+    return true;
+}
+
+bool BytecodeFile::isCompiledFrom(const SourceStamp &source) const
+{
+    SourceStamp stamp;
+    stamp.size = header().sourceSize;
+    stamp.modified = header().sourceModified;
+    return stamp == source;
+}
+
+void BytecodeFile::read(std::map<RegNumber, RegValue> &registers, std::vector< ::Instruction> &instructions) const
+{
+    const Header &fileHeader = header();
+    const char *registerRecords = mFile.data() + sizeof(Header);
+    const Instruction *instructionRecords = reinterpret_cast<const Instruction *>(
+                registerRecords + fileHeader.registersCount * sizeof(RegisterRecord));
+
+    RegisterRecord::read(registerRecords, fileHeader.registersCount, registers);
+
+    instructions.reserve(instructions.size() + fileHeader.instructionsCount);
+    for (std::size_t i=0; i<fileHeader.instructionsCount; ++i){
+        const Instruction &record = instructionRecords[i];
+        instructions.push_back(::Instruction(::Instruction::Type(record.type), record.arg1, record.arg2, record.instr));
+    }
+}
+
+std::shared_ptr<const Program> BytecodeFile::readProgram(const std::vector< ::Instruction> &instructions,
+                                                         const std::map<RegNumber, RegValue> &registers) const
+{
+    const Header &fileHeader = header();
+    const char *records = mFile.data() + decodedOffset();
+
+    std::vector<DecodedProgram::Op> ops(fileHeader.opsCount);
+    std::memcpy(ops.data(), records, ops.size() * sizeof(DecodedProgram::Op));
+    records += ops.size() * sizeof(DecodedProgram::Op);
+
+    std::vector<InstructionPos> halts;
+    std::vector<RegNumber> registerNumbers;
+    records = readWords(records, fileHeader.haltsCount, halts);
+    records = readWords(records, fileHeader.registerNumbersCount, registerNumbers);
+
+    const Loop *loopRecords = reinterpret_cast<const Loop *>(records);
+    const Effect *effectRecords = reinterpret_cast<const Effect *>(loopRecords + fileHeader.loopsCount);
+    std::vector<LoopSummary> loops(fileHeader.loopsCount);
+    for (std::size_t i=0; i<loops.size(); ++i){
+        const Loop &loopRecord = loopRecords[i];
+        LoopSummary &loop = loops[i];
+        loop.left = loopRecord.left;
+        loop.right = loopRecord.right;
+        loop.leftStep = loopRecord.leftStep;
+        loop.rightStep = loopRecord.rightStep;
+        loop.exit = loopRecord.exit;
+        loop.iterationLength = loopRecord.iterationLength;
+        for (std::size_t e=0; e<loopRecord.effectsCount; ++e, ++effectRecords){
+            LoopSummary::Effect effect;
+            effect.kind = LoopSummary::Effect::Kind(effectRecords->kind);
+            effect.reg = effectRecords->reg;
+            effect.source = effectRecords->source;
+            effect.value = effectRecords->value;
+            effect.sourceStep = effectRecords->sourceStep;
+            loop.effects.push_back(effect);
+        }
+    }
+
+    Program::Optimisation optimisation;
+    optimisation.peephole.unconditionalJumps = fileHeader.unconditionalJumps;
+    optimisation.peephole.superinstructions = fileHeader.superinstructions;
+    optimisation.peephole.absorbedOps = fileHeader.absorbedOps;
+    optimisation.loops = fileHeader.loopsCount;
+
+    DecodedProgram decoded(fileHeader.instructionsCount, ops, loops, halts, registerNumbers);
+    return std::make_shared<const Program>(instructions, registers, decoded, optimisationLevel(), optimisation);
+}
@@ -0,0 +1,172 @@
+#ifndef BYTECODE_H
+#define BYTECODE_H
+
+#include <string>
+#include <vector>
+#include <map>
+#include <memory>
+
+#include "instruction.h"
+#include "loader.h"
+
+class Program;
+
+
+//-- stamp of the text source
+// Compiled program is valid while size and modification time of the source are the same.
+struct SourceStamp
+{
+    SourceStamp():
+        size(0), modified(0){}
+
+    // returns false if file doesn't exist
+    bool read(const std::string &fileName);
+
+    bool operator==(const SourceStamp &other) const {
+        return size == other.size && modified == other.modified;
+    }
+
+    unsigned long long size;
+    // modification time in nanoseconds
+    long long modified;
+};
+
+
+//-- record of a register in the binary files (.rmlc, .rmls, .rmlr)
+struct RegisterRecord
+{
+    unsigned long long number;
+    unsigned long long value;
+
+    // writes records of all registers, there must be place for registers.size() of them.
+    static void write(const std::map<RegNumber, RegValue> &registers, char *records);
+    // records are copied, so they don't need to be aligned.
+    static void read(const char *records, std::size_t count, std::map<RegNumber, RegValue> &registers);
+};
+
+
+//-- compiled program file (.rmlc)
+// Layout (native byte order, all fields are 8-byte aligned, so the file is used in place after mmap):
+//      Header
+//      RegisterRecord[registersCount]  initial values of the registers
+//      Instruction[instructionsCount]
+//      DecodedProgram::Op[opsCount]    decoded program of the threaded engine (optional, see below)
+//      unsigned long long[haltsCount]  instruction numbers of the halt ops
+//      unsigned long long[registerNumbersCount]
+//      Loop[loopsCount]
+//      Effect[effectsCount]            effects of the loops in their order
+// The decoded program is optimised for optimisationLevel (-1 - the file has none) and is copied into
+// the engine as is, so the run doesn't decode the instructions again. Ops keep their in-memory layout
+// with zero padding.
+// Checksum covers the fields of the header before it and everything after the header.
+// Instructions of unknown types and decoded programs with indexes out of their tables are rejected on open,
+// so the file is never decoded or executed as garbage.
+class BytecodeFile
+{
+public:
+    static const unsigned int Version = 3;
+
+    struct Header
+    {
+        char               magic[4];     // "RMLC"
+        unsigned int       version;
+        unsigned long long sourceSize;
+        long long          sourceModified;
+        unsigned long long registersCount;
+        unsigned long long instructionsCount;
+        long long          optimisationLevel;
+        unsigned long long opsCount;
+        unsigned long long haltsCount;
+        unsigned long long registerNumbersCount;
+        unsigned long long loopsCount;
+        unsigned long long effectsCount;
+        // statistics of the peephole optimiser (see PeepholeOptimizer::Stats)
+        unsigned long long unconditionalJumps;
+        unsigned long long superinstructions;
+        unsigned long long absorbedOps;
+        unsigned long long checksum;
+    };
+
+    struct Instruction
+    {
+        unsigned long long type;
+        unsigned long long arg1;
+        unsigned long long arg2;
+        unsigned long long instr;
+    };
+
+    // summary of the loop (see LoopSummary), it's effects follow the effects of the previous loops
+    struct Loop
+    {
+        unsigned long long left;
+        unsigned long long right;
+        unsigned long long leftStep;
+        unsigned long long rightStep;
+        unsigned long long exit;
+        unsigned long long iterationLength;
+        unsigned long long effectsCount;
+    };
+
+    struct Effect
+    {
+        unsigned long long kind;
+        unsigned long long reg;
+        unsigned long long source;
+        unsigned long long value;
+        unsigned long long sourceStep;
+    };
+
+    // name of the cache file for the text source: "program.rml" -> "program.rmlc"
+    static std::string cacheName(const std::string &sourceName);
+
+    // writes compiled program atomically (through temporary file), returns false on failure.
+    // program - the same instructions decoded for the threaded engine, 0 - the file keeps the instructions only.
+    static bool write(const std::string &fileName, const SourceStamp &source,
+                      const std::map<RegNumber, RegValue> &registers, const std::vector< ::Instruction> &instructions,
+                      const Program *program = 0);
+
+    // maps the file and validates header and checksum.
+    bool open(const std::string &fileName);
+
+    const Header& header() const {
+        return *reinterpret_cast<const Header *>(mFile.data());
+    }
+    bool isCompiledFrom(const SourceStamp &source) const;
+
+    void read(std::map<RegNumber, RegValue> &registers, std::vector< ::Instruction> &instructions) const;
+
+    // level the decoded program is optimised for, -1 - the file has no decoded program.
+    int optimisationLevel() const {
+        return int(header().optimisationLevel);
+    }
+    // restores the decoded program, instructions and registers are the ones read from the file.
+    std::shared_ptr<const Program> readProgram(const std::vector< ::Instruction> &instructions,
+                                               const std::map<RegNumber, RegValue> &registers) const;
+
+    static const unsigned long long ChecksumBasis = 14695981039346656037ULL;
+
+    // FNV-1a over 64-bit words, a tail shorter than 8 bytes is hashed as a word padded by zeros.
+    // hash - result of the previous part to continue.
+    static unsigned long long checksum(const char *data, std::size_t size, unsigned long long hash = ChecksumBasis);
+    // checksum of the instruction records as they are written to the file
+    static unsigned long long checksum(const std::vector< ::Instruction> &instructions);
+    // checksum of the header fields before the checksum (headerSize bytes, multiple of 8) and of the body,
+    // the binary files keep the checksum as the last field of the header.
+    static unsigned long long fileChecksum(const void *header, std::size_t headerSize, const char *body, std::size_t size);
+    // writes header and body through temporary file, so other processes never see partially written file.
+    static bool writeAtomically(const std::string &fileName, const void *header, std::size_t headerSize,
+                                const std::vector<char> &body);
+
+private:
+    static Instruction record(const ::Instruction &instruction);
+    // offset of the decoded program in the file
+    std::size_t decodedOffset() const;
+    // indexes of the ops and of the loops are within their tables
+    bool isDecodedValid() const;
+
+private:
+    MappedFile mFile;
+};
+
+
+#endif // BYTECODE_H
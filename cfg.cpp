@@ -0,0 +1,231 @@
+#include "cfg.h"
+#include <map>
+#include <algorithm>
+
+
+static const std::size_t NoBlock = ~std::size_t(0);
+
+ControlFlowGraph::ControlFlowGraph(const std::vector<Instruction> &instructions):
+    mAnyRegister(0)
+{
+    std::size_t count = instructions.size();
+    if (count == 0)
+        return;
+    mAnyRegister = instructions[0].arg1;
+
+    // block starts at the entry, at every jump target and after every jump
+    std::vector<bool> isLeader(count, false);
+    isLeader[0] = true;
+    for (std::size_t i=0; i<count; ++i){
+        if (instructions[i].type() != Instruction::CT_J)
+            continue;
+        if (i+1 < count)
+            isLeader[i+1] = true;
+        if (instructions[i].instr >= 1 && instructions[i].instr <= count)
+            isLeader[instructions[i].instr - 1] = true;
+    }
+
+    std::vector<std::size_t> starts;
+    for (std::size_t i=0; i<count; ++i)
+        if (isLeader[i])
+            starts.push_back(i);
+
+    mBlocks.resize(starts.size());
+    for (std::size_t b=0; b<starts.size(); ++b){
+        Block &block = mBlocks[b];
+        std::size_t end = b+1 < starts.size() ? starts[b+1] : count;
+        block.first = starts[b];
+        block.next = end < count ? Target(Target::TK_Block, b+1) : Target(Target::TK_Halt, count+1);
+
+        const Instruction &last = instructions[end-1];
+        if (last.type() != Instruction::CT_J){
+            block.body.assign(instructions.begin() + starts[b], instructions.begin() + end);
+            for (std::size_t i=starts[b]; i<end; ++i)
+                block.numbers.push_back(i+1);
+            continue;
+        }
+
+        block.body.assign(instructions.begin() + starts[b], instructions.begin() + end - 1);
+        for (std::size_t i=starts[b]; i+1<end; ++i)
+            block.numbers.push_back(i+1);
+        block.exitNumber = end;
+        block.exit = last.arg1 == last.arg2 ? Block::BE_Jump : Block::BE_Branch;
+        block.left = last.arg1;
+        block.right = last.arg2;
+
+        if (last.instr >= 1 && last.instr <= count){
+            std::size_t target = std::upper_bound(starts.begin(), starts.end(), std::size_t(last.instr - 1))
+                    - starts.begin() - 1;
+            block.taken = Target(Target::TK_Block, target);
+        } else
+            block.taken = Target(Target::TK_Halt, last.instr);
+    }
+}
+
+std::size_t ControlFlowGraph::markReachable()
+{
+    for (std::size_t i=0; i<mBlocks.size(); ++i)
+        mBlocks[i].reachable = false;
+    if (mBlocks.empty())
+        return 0;
+
+    std::vector<std::size_t> stack(1, 0);
+    mBlocks[0].reachable = true;
+    while (! stack.empty()){
+        const Block &block = mBlocks[stack.back()];
+        stack.pop_back();
+
+        Target targets[2];
+        std::size_t targetsCount = 0;
+        if (block.exit != Block::BE_Jump)
+            targets[targetsCount++] = block.next;
+        if (block.exit != Block::BE_Fall)
+            targets[targetsCount++] = block.taken;
+
+        for (std::size_t i=0; i<targetsCount; ++i){
+            if (targets[i].kind == Target::TK_Block && ! mBlocks[targets[i].value].reachable){
+                mBlocks[targets[i].value].reachable = true;
+                stack.push_back(targets[i].value);
+            }
+        }
+    }
+
+    std::size_t unreachable = 0;
+    for (std::size_t i=0; i<mBlocks.size(); ++i)
+        if (! mBlocks[i].reachable)
+            unreachable += mBlocks[i].body.size() + (mBlocks[i].exit == Block::BE_Fall ? 0 : 1);
+    return unreachable;
+}
+
+bool ControlFlowGraph::needsJump(const ControlFlowGraph::Target &target, std::size_t nextBlock,
+                                 const ControlFlowGraph::Target &endHalt) const
+{
+    if (target.kind == Target::TK_Block)
+        return target.value != nextBlock;
+    // only the last block falls off the end
+    return ! (nextBlock == NoBlock && target == endHalt);
+}
+
+// number of the instruction the halt is emitted as
+static InstructionPos haltAddress(std::size_t number, std::size_t instructionsCount,
+                                  std::map<InstructionPos, std::size_t> &indexes, std::vector<InstructionPos> &haltNumbers)
+{
+    std::map<InstructionPos, std::size_t>::const_iterator it = indexes.find(number);
+    if (it != indexes.end())
+        return instructionsCount + 1 + (*it).second;
+
+    indexes[number] = haltNumbers.size();
+    haltNumbers.push_back(number);
+    return instructionsCount + haltNumbers.size();
+}
+
+ControlFlowGraph::Target ControlFlowGraph::fallHalt(const std::vector<std::size_t> &order) const
+{
+    const Block &lastBlock = mBlocks[order.back()];
+    Target target = lastBlock.exit == Block::BE_Jump ? lastBlock.taken : lastBlock.next;
+    if (target.kind == Target::TK_Halt)
+        return target;
+    return Target(Target::TK_Block, NoBlock);
+}
+
+std::size_t ControlFlowGraph::placeBlocks(const std::vector<std::size_t> &order, const ControlFlowGraph::Target &endHalt,
+                                          std::vector<std::size_t> *starts) const
+{
+    std::size_t count = 0;
+    for (std::size_t p=0; p<order.size(); ++p){
+        const Block &block = mBlocks[order[p]];
+        std::size_t nextBlock = p+1 < order.size() ? order[p+1] : NoBlock;
+
+        if (starts)
+            (*starts)[order[p]] = count;
+        count += block.body.size();
+        if (block.exit == Block::BE_Jump)
+            count += needsJump(block.taken, nextBlock, endHalt) ? 1 : 0;
+        else
+            count += (block.exit == Block::BE_Branch ? 1 : 0) + (needsJump(block.next, nextBlock, endHalt) ? 1 : 0);
+    }
+    return count;
+}
+
+std::size_t ControlFlowGraph::emittedCount(const std::vector<std::size_t> &order) const
+{
+    if (order.empty())
+        return 0;
+    return placeBlocks(order, fallHalt(order), 0);
+}
+
+void ControlFlowGraph::emit(const std::vector<std::size_t> &order, std::vector<Instruction> &instructions,
+                            std::vector<InstructionPos> &haltNumbers, std::vector<InstructionPos> &sourceNumbers) const
+{
+    instructions.clear();
+    haltNumbers.clear();
+    sourceNumbers.clear();
+    if (order.empty())
+        return;
+
+    Target endHalt = fallHalt(order);
+    std::vector<std::size_t> starts(mBlocks.size(), 0);
+    std::size_t count = placeBlocks(order, endHalt, &starts);
+
+    std::map<InstructionPos, std::size_t> haltIndexes;
+    if (endHalt.kind == Target::TK_Halt)
+        haltAddress(endHalt.value, count, haltIndexes, haltNumbers);
+
+    instructions.reserve(count);
+    for (std::size_t p=0; p<order.size(); ++p){
+        const Block &block = mBlocks[order[p]];
+        std::size_t nextBlock = p+1 < order.size() ? order[p+1] : NoBlock;
+        instructions.insert(instructions.end(), block.body.begin(), block.body.end());
+        sourceNumbers.insert(sourceNumbers.end(), block.numbers.begin(), block.numbers.end());
+
+        Target targets[2];
+        RegNumber registers[2][2];
+        std::size_t targetsCount = 0;
+
+        if (block.exit == Block::BE_Branch){
+            targets[targetsCount] = block.taken;
+            registers[targetsCount][0] = block.left;
+            registers[targetsCount][1] = block.right;
+            ++targetsCount;
+        }
+        const Target &continuation = block.exit == Block::BE_Jump ? block.taken : block.next;
+        if (needsJump(continuation, nextBlock, endHalt)){
+            targets[targetsCount] = continuation;
+            registers[targetsCount][0] = registers[targetsCount][1] =
+                    block.exit == Block::BE_Fall ? mAnyRegister : block.left;
+            ++targetsCount;
+        }
+
+        for (std::size_t i=0; i<targetsCount; ++i){
+            InstructionPos address = targets[i].kind == Target::TK_Block ? starts[targets[i].value] + 1
+                    : haltAddress(targets[i].value, count, haltIndexes, haltNumbers);
+            instructions.push_back(Instruction(Instruction::CT_J, registers[i][0], registers[i][1], address));
+            // the exit jump of the block or the jump added for the continuation
+            bool isExit = block.exit == Block::BE_Jump || (block.exit == Block::BE_Branch && i == 0);
+            sourceNumbers.push_back(isExit ? block.exitNumber : targetNumber(block.next));
+        }
+    }
+}
+
+InstructionPos ControlFlowGraph::targetNumber(const ControlFlowGraph::Target &target) const
+{
+    if (target.kind == Target::TK_Halt)
+        return target.value;
+    const Block &block = mBlocks[target.value];
+    return block.numbers.empty() ? block.exitNumber : block.numbers[0];
+}
+
+InstructionPos ControlFlowGraph::originalHalt(InstructionPos haltedAt, std::size_t instructionsCount,
+                                              const std::vector<InstructionPos> &haltNumbers)
+{
+    if (haltedAt > instructionsCount && haltedAt - instructionsCount - 1 < haltNumbers.size())
+        return haltNumbers[haltedAt - instructionsCount - 1];
+    return haltedAt;
+}
+
+InstructionPos ControlFlowGraph::originalInstruction(InstructionPos number, const std::vector<InstructionPos> &sourceNumbers)
+{
+    if (number >= 1 && number <= sourceNumbers.size())
+        return sourceNumbers[number-1];
+    return number;
+}
@@ -0,0 +1,120 @@
+#ifndef CFG_H
+#define CFG_H
+
+#include <vector>
+
+#include "instruction.h"
+
+
+//-- control-flow graph of the parsed program
+// Program is split into basic blocks: straight-line Z, S, T instructions ended by the exit.
+// Every J target is resolved while building: target inside of the program is the block starting there,
+// any other target (including 0 and "jump past end") is the halt that reports that number,
+// falling off the end is the halt reporting n+1.
+//
+// Blocks can be changed by passes (see PassPipeline) and emitted back as the program in any order.
+// Jumps that are needed because of the order are added on emission, halts keep their numbers
+// through the map returned by emit().
+class ControlFlowGraph
+{
+public:
+    struct Target
+    {
+        enum Kind {
+            TK_Block, TK_Halt
+        };
+
+        Target():
+            kind(TK_Halt), value(0){}
+        Target(Kind targetKind, std::size_t targetValue):
+            kind(targetKind), value(targetValue){}
+
+        bool operator==(const Target &other) const {
+            return kind == other.kind && value == other.value;
+        }
+        bool operator!=(const Target &other) const {
+            return ! (*this == other);
+        }
+
+        Kind kind;
+        // TK_Block: index of the block, TK_Halt: instruction number reported on termination.
+        std::size_t value;
+    };
+
+    struct Block
+    {
+        enum Exit {
+            BE_Fall,    // continues to `next`
+            BE_Jump,    // J(a, a, q): always goes to `taken`
+            BE_Branch   // J(a, b, q): goes to `taken` if R[a] = R[b], otherwise to `next`
+        };
+
+        Block():
+            exit(BE_Fall), left(0), right(0), first(0), exitNumber(0), reachable(false){}
+
+        std::vector<Instruction> body;
+        // source numbers of the body instructions (passes that remove instructions keep them in step)
+        std::vector<InstructionPos> numbers;
+        Exit exit;
+        // compared registers of the exit jump
+        RegNumber left;
+        RegNumber right;
+        Target taken;
+        Target next;
+        // index of the first instruction in the source program
+        std::size_t first;
+        // source number of the exit jump, 0 for BE_Fall
+        InstructionPos exitNumber;
+        bool reachable;
+    };
+
+    explicit ControlFlowGraph(const std::vector<Instruction> &instructions);
+
+    std::vector<Block>& blocks() {
+        return mBlocks;
+    }
+    const std::vector<Block>& blocks() const {
+        return mBlocks;
+    }
+
+    // marks blocks reachable from the entry (block 0).
+    // returns count of the instructions in unreachable blocks.
+    std::size_t markReachable();
+
+    // emits reachable blocks in the given order (the entry must be the first).
+    // haltNumbers[k] - original number reported by the halt that is emitted as the jump to n+1+k,
+    // where n - count of the emitted instructions.
+    // sourceNumbers[i] - number of the source instruction that is executed in place of the emitted
+    // instruction i (a jump added by the order - the first instruction it goes to).
+    void emit(const std::vector<std::size_t> &order, std::vector<Instruction> &instructions,
+              std::vector<InstructionPos> &haltNumbers, std::vector<InstructionPos> &sourceNumbers) const;
+    // count of the instructions that emit() produces for the order.
+    std::size_t emittedCount(const std::vector<std::size_t> &order) const;
+
+    // translates the instruction number reported by the emitted program to the original one.
+    static InstructionPos originalHalt(InstructionPos haltedAt, std::size_t instructionsCount,
+                                       const std::vector<InstructionPos> &haltNumbers);
+    // translates the number of the emitted instruction (of the suspended run) to the source one.
+    static InstructionPos originalInstruction(InstructionPos number, const std::vector<InstructionPos> &sourceNumbers);
+
+private:
+    // halt reached by falling off the end of the last block, it needs no jump.
+    // If the last block doesn't end by a halt, the result is not a halt.
+    Target fallHalt(const std::vector<std::size_t> &order) const;
+    // source number of the first instruction executed at the target
+    InstructionPos targetNumber(const Target &target) const;
+    // jump is not needed if the target immediately follows
+    bool needsJump(const Target &target, std::size_t nextBlock, const Target &endHalt) const;
+    // sets indexes of the first instructions of the blocks (if starts is not null),
+    // returns count of the instructions.
+    std::size_t placeBlocks(const std::vector<std::size_t> &order, const Target &endHalt,
+                            std::vector<std::size_t> *starts) const;
+
+private:
+    std::vector<Block> mBlocks;
+    // register used by the added unconditional jumps
+    RegNumber mAnyRegister;
+};
+
+
+#endif // CFG_H
@@ -0,0 +1,52 @@
+#include "checkpoint.h"
+#include "bytecode.h"
+#include <cstring>
+#include <cstddef>
+
+
+const unsigned int Checkpoint::Version;
+
+unsigned long long Checkpoint::hash(const std::vector<Instruction> &instructions)
+{
+    return BytecodeFile::checksum(instructions);
+}
+
+bool Checkpoint::write(const std::string &fileName) const
+{
+    std::vector<char> body(registers.size() * sizeof(RegisterRecord));
+    RegisterRecord::write(registers, body.data());
+
+    Header header;
+    std::memcpy(header.magic, "RMLS", 4);
+    header.version = Version;
+    header.programHash = programHash;
+    header.next = next;
+    header.steps = steps;
+    header.registersCount = registers.size();
+    header.checksum = BytecodeFile::fileChecksum(&header, offsetof(Header, checksum), body.data(), body.size());
+
+    return BytecodeFile::writeAtomically(fileName, &header, sizeof(header), body);
+}
+
+bool Checkpoint::read(const std::string &fileName)
+{
+    MappedFile file;
+    if (! file.open(fileName) || file.size() < sizeof(Header))
+        return false;
+
+    Header header;
+    std::memcpy(&header, file.data(), sizeof(header));
+    std::size_t bodySize = file.size() - sizeof(Header);
+    if (std::memcmp(header.magic, "RMLS", 4) != 0 || header.version != Version
+            || header.registersCount != bodySize / sizeof(RegisterRecord) || bodySize % sizeof(RegisterRecord) != 0
+            || BytecodeFile::fileChecksum(&header, offsetof(Header, checksum), file.data() + sizeof(Header), bodySize)
+               != header.checksum)
+        return false;
+
+    programHash = header.programHash;
+    next = header.next;
+    steps = header.steps;
+    registers.clear();
+    RegisterRecord::read(file.data() + sizeof(Header), header.registersCount, registers);
+    return true;
+}
@@ -0,0 +1,54 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include <string>
+#include <vector>
+#include <map>
+
+#include "instruction.h"
+
+
+//-- snapshot of the machine state (.rmls)
+// Layout (native byte order):
+//      Header
+//      RegisterRecord[registersCount]  values of all registers
+// Checksum covers the fields of the header before it and everything after the header.
+//
+// Program is not stored, only it's hash: the snapshot can be resumed only with the same program.
+class Checkpoint
+{
+public:
+    static const unsigned int Version = 2;
+
+    struct Header
+    {
+        char               magic[4];     // "RMLS"
+        unsigned int       version;
+        unsigned long long programHash;
+        // index of the instruction to continue from
+        unsigned long long next;
+        unsigned long long steps;
+        unsigned long long registersCount;
+        unsigned long long checksum;
+    };
+
+    Checkpoint():
+        programHash(0), next(0), steps(0){}
+
+    // checksum of the instruction records (see BytecodeFile::checksum())
+    static unsigned long long hash(const std::vector<Instruction> &instructions);
+
+    // writes the snapshot atomically, returns false on failure.
+    bool write(const std::string &fileName) const;
+    // returns false if file doesn't exist or is damaged.
+    bool read(const std::string &fileName);
+
+public:
+    unsigned long long programHash;
+    std::size_t next;
+    unsigned long long steps;
+    std::map<RegNumber, RegValue> registers;
+};
+
+
+#endif // CHECKPOINT_H
@@ -0,0 +1,461 @@
+#include "conformance.h"
+#include "jit.h"
+#include "passes.h"
+#include <sstream>
+#include <iomanip>
+#include <chrono>
+#include <algorithm>
+
+
+// instructions of a random program
+static const std::size_t MaxRandomInstructions = 12;
+// mismatches printed (shrunk) per engine, the rest are only counted
+static const unsigned long long MaxReports = 3;
+// runs of the engines while shrinking one program
+static const std::size_t MaxShrinkAttempts = 2000;
+
+
+ConformanceHarness::ConformanceHarness(unsigned long long seed, unsigned long long maxSteps):
+    mRandom(seed),
+    mMaxSteps(maxSteps),
+    mDiscarded(0)
+{
+    // the reference is the first
+    const Engine engines[] = {
+        {"reference", Interpreter::ET_Reference, 0, 0},
+        {"threaded-O0", Interpreter::ET_Threaded, 0, 0},
+        {"threaded-O1", Interpreter::ET_Threaded, 1, 0},
+        {"threaded-O2", Interpreter::ET_Threaded, 2, 0},
+        {"threaded-O3", Interpreter::ET_Threaded, 3, 0},
+        {"threaded-O4", Interpreter::ET_Threaded, 4, 0},
+        {"threaded-passes", Interpreter::ET_Threaded, 4, PassPipeline::PS_All},
+        {"jit", Interpreter::ET_Jit, 0, 0},
+        {"checked", Interpreter::ET_Checked, 0, 0},
+        {"simd", Interpreter::ET_Lockstep, 0, 0}
+    };
+
+    for (std::size_t i=0; i<sizeof(engines) / sizeof(engines[0]); ++i){
+        const Engine &engine = engines[i];
+        mEngines.push_back(engine);
+
+        std::unique_ptr<Interpreter> interpreter(new Interpreter());
+        interpreter->setEngine(engine.type);
+        interpreter->setOptimisationLevel(engine.optimisationLevel);
+        interpreter->setPasses(engine.passes);
+        mInterpreters.push_back(std::move(interpreter));
+
+        EngineStats stats;
+        stats.name = engine.name;
+        stats.isAvailable = engine.type != Interpreter::ET_Jit || JitProgram::isSupported();
+        mStats.push_back(stats);
+    }
+}
+
+unsigned long long ConformanceHarness::random(unsigned long long bound)
+{
+    return mRandom() % bound;
+}
+
+RegValue ConformanceHarness::randomValue()
+{
+    // mostly small, sometimes near 2^32 where the narrow registers end
+    unsigned long long kind = random(16);
+    if (kind < 10)
+        return random(4);
+    if (kind < 14)
+        return random(100);
+    if (kind == 14)
+        return 0xFFFFFFFFULL - random(8);
+    return 0x100000000ULL + random(8);
+}
+
+RegNumber ConformanceHarness::randomRegister(const std::vector<RegNumber> &registers)
+{
+    return registers[random(registers.size())];
+}
+
+Instruction ConformanceHarness::straightInstruction(const std::vector<RegNumber> &registers,
+                                                    const std::vector<RegNumber> &kept)
+{
+    std::vector<RegNumber> written;
+    for (std::size_t i=0; i<registers.size(); ++i){
+        if (std::find(kept.begin(), kept.end(), registers[i]) == kept.end())
+            written.push_back(registers[i]);
+    }
+    if (written.empty())
+        written.push_back(1000);
+
+    unsigned long long kind = random(8);
+    if (kind < 2)
+        return Instruction(Instruction::CT_Z, randomRegister(written));
+    if (kind < 6)
+        return Instruction(Instruction::CT_S, randomRegister(written));
+    return Instruction(Instruction::CT_T, randomRegister(registers), randomRegister(written));
+}
+
+// distinct registers, mostly with small numbers, sometimes far away (sparse register file)
+static std::vector<RegNumber> registerPool(std::mt19937_64 &random, std::size_t count)
+{
+    std::vector<RegNumber> registers;
+    while (registers.size() < count){
+        RegNumber number = random() % 8 == 0 ? 1000000000 + random() % 1000 : random() % 12;
+        if (std::find(registers.begin(), registers.end(), number) == registers.end())
+            registers.push_back(number);
+    }
+    return registers;
+}
+
+void ConformanceHarness::generateRandom(Case &program)
+{
+    program.kind = "random";
+    std::size_t count = 1 + random(MaxRandomInstructions);
+    std::vector<RegNumber> registers = registerPool(mRandom, 1 + random(5));
+    for (std::size_t i=0; i<registers.size(); ++i){
+        if (random(2))
+            program.registers[registers[i]] = randomValue();
+    }
+
+    for (std::size_t i=0; i<count; ++i){
+        if (random(20) < 13){
+            program.instructions.push_back(straightInstruction(registers, std::vector<RegNumber>()));
+            continue;
+        }
+        // targets 0 and past the end halt the program
+        RegValue target = random(16) == 0 ? 1000 + random(10) : random(count + 3);
+        program.instructions.push_back(Instruction(Instruction::CT_J, randomRegister(registers),
+                                                   randomRegister(registers), target));
+    }
+}
+
+void ConformanceHarness::generateLoop(Case &program, bool isNested)
+{
+    program.kind = isNested ? "nest" : "loop";
+    std::vector<RegNumber> registers = registerPool(mRandom, 4 + random(4));
+    RegNumber counter = registers[0], limit = registers[1];
+    std::vector<RegNumber> kept;
+    kept.push_back(counter);
+    kept.push_back(limit);
+    for (std::size_t i=2; i<registers.size(); ++i){
+        if (random(2))
+            program.registers[registers[i]] = randomValue();
+    }
+    program.registers[limit] = random(4) == 0 ? randomValue() : random(30);
+    if (random(4) == 0)
+        program.registers[counter] = random(program.registers[limit] + 1);
+
+    std::vector<Instruction> &instructions = program.instructions;
+    for (std::size_t i=random(3); i>0; --i)
+        instructions.push_back(straightInstruction(registers, std::vector<RegNumber>(1, counter)));
+
+    // J(counter, limit, exit); body; S(counter); J(x, x, header)
+    std::size_t header = instructions.size();
+    instructions.push_back(Instruction(Instruction::CT_J, counter, limit, 0));
+    for (std::size_t i=1+random(4); i>0; --i)
+        instructions.push_back(straightInstruction(registers, kept));
+
+    if (isNested && registers.size() > 5){
+        // inner counter starts from zero on every pass of the outer loop
+        RegNumber innerCounter = registers[2], innerLimit = registers[3];
+        kept.push_back(innerCounter);
+        kept.push_back(innerLimit);
+        program.registers[innerLimit] = random(10);
+        instructions.push_back(Instruction(Instruction::CT_Z, innerCounter));
+        std::size_t innerHeader = instructions.size();
+        instructions.push_back(Instruction(Instruction::CT_J, innerCounter, innerLimit, 0));
+        for (std::size_t i=1+random(3); i>0; --i)
+            instructions.push_back(straightInstruction(registers, kept));
+        instructions.push_back(Instruction(Instruction::CT_S, innerCounter));
+        RegNumber any = randomRegister(registers);
+        instructions.push_back(Instruction(Instruction::CT_J, any, any, innerHeader + 1));
+        instructions[innerHeader].instr = instructions.size() + 1;
+    }
+
+    instructions.push_back(Instruction(Instruction::CT_S, counter));
+    RegNumber any = randomRegister(registers);
+    instructions.push_back(Instruction(Instruction::CT_J, any, any, header + 1));
+    instructions[header].instr = instructions.size() + 1;
+
+    for (std::size_t i=random(3); i>0; --i)
+        instructions.push_back(straightInstruction(registers, std::vector<RegNumber>()));
+}
+
+void ConformanceHarness::generateArithmetic(Case &program)
+{
+    program.kind = "arithmetic";
+    std::vector<RegNumber> r = registerPool(mRandom, 5);
+    std::vector<Instruction> &instructions = program.instructions;
+    program.registers[r[0]] = random(200);
+    program.registers[r[1]] = random(200);
+
+    if (random(2)){
+        // r0 += r1, r2 counts
+        instructions.push_back(Instruction(Instruction::CT_J, r[1], r[2], 5));
+        instructions.push_back(Instruction(Instruction::CT_S, r[0]));
+        instructions.push_back(Instruction(Instruction::CT_S, r[2]));
+        instructions.push_back(Instruction(Instruction::CT_J, r[0], r[0], 1));
+    } else {
+        // r0 = r0 * r1: r4 accumulates, r3 counts r1, r2 counts r0
+        instructions.push_back(Instruction(Instruction::CT_J, r[3], r[1], 9));
+        instructions.push_back(Instruction(Instruction::CT_J, r[0], r[2], 6));
+        instructions.push_back(Instruction(Instruction::CT_S, r[2]));
+        instructions.push_back(Instruction(Instruction::CT_S, r[4]));
+        instructions.push_back(Instruction(Instruction::CT_J, r[0], r[0], 2));
+        instructions.push_back(Instruction(Instruction::CT_Z, r[2]));
+        instructions.push_back(Instruction(Instruction::CT_S, r[3]));
+        instructions.push_back(Instruction(Instruction::CT_J, r[0], r[0], 1));
+        instructions.push_back(Instruction(Instruction::CT_T, r[4], r[0]));
+    }
+}
+
+ConformanceHarness::Case ConformanceHarness::generate()
+{
+    for (;;){
+        Case program;
+        unsigned long long kind = random(8);
+        if (kind < 4)
+            generateRandom(program);
+        else if (kind < 6)
+            generateLoop(program, false);
+        else if (kind < 7)
+            generateLoop(program, true);
+        else
+            generateArithmetic(program);
+
+        if (halts(program))
+            return program;
+        ++mDiscarded;
+    }
+}
+
+bool ConformanceHarness::halts(Case &program) const
+{
+    // registers are renamed into a dense file, so the run is fast enough to filter every program
+    const std::vector<Instruction> &instructions = program.instructions;
+    std::map<RegNumber, std::size_t> indexes;
+    std::vector<RegValue> values;
+    std::vector<std::size_t> args1(instructions.size()), args2(instructions.size());
+    for (std::size_t i=0; i<instructions.size(); ++i){
+        RegNumber numbers[2] = {instructions[i].arg1, instructions[i].arg2};
+        std::size_t *args[2] = {&args1[i], &args2[i]};
+        for (int a=0; a<2; ++a){
+            std::map<RegNumber, std::size_t>::const_iterator it = indexes.find(numbers[a]);
+            if (it == indexes.end()){
+                it = indexes.insert(std::make_pair(numbers[a], values.size())).first;
+                std::map<RegNumber, RegValue>::const_iterator initial = program.registers.find(numbers[a]);
+                values.push_back(initial == program.registers.end() ? 0 : (*initial).second);
+            }
+            *args[a] = (*it).second;
+        }
+    }
+
+    std::size_t position = 0;
+    unsigned long long steps = 0;
+    while (position < instructions.size()){
+        if (steps == mMaxSteps)
+            return false;
+        ++steps;
+
+        const Instruction &instruction = instructions[position];
+        switch (instruction.type()) {
+        case Instruction::CT_Z:
+            values[args1[position]] = 0;
+            break;
+        case Instruction::CT_S:
+            ++values[args1[position]];
+            break;
+        case Instruction::CT_T:
+            values[args2[position]] = values[args1[position]];
+            break;
+        case Instruction::CT_J:
+            if (values[args1[position]] == values[args2[position]]){
+                // 0 and targets past the end halt
+                position = instruction.instr >= 1 && instruction.instr <= instructions.size()
+                        ? instruction.instr - 1 : instructions.size();
+                continue;
+            }
+            break;
+        }
+        ++position;
+    }
+    program.steps = steps;
+    return true;
+}
+
+ConformanceHarness::Outcome ConformanceHarness::execute(std::size_t engine, const Case &program)
+{
+    Outcome outcome;
+    std::map<RegNumber, RegValue> registers = program.registers;
+    ExecutionResult result;
+
+    std::chrono::steady_clock::time_point startTime = std::chrono::steady_clock::now();
+    outcome.isRun = mInterpreters[engine]->execute(program.instructions, registers, result);
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+    outcome.compileSeconds = result.compileSeconds;
+    outcome.seconds = std::max(seconds - result.compileSeconds, 0.0);
+
+    // absent registers are zero
+    outcome.haltedAt = result.haltedAt;
+    outcome.steps = result.steps;
+    for (std::map<RegNumber, RegValue>::const_iterator it = registers.begin(); it != registers.end(); ++it){
+        if ((*it).second != 0)
+            outcome.registers.insert(*it);
+    }
+    return outcome;
+}
+
+bool ConformanceHarness::agrees(std::size_t engine, const Outcome &expected, const Outcome &actual) const
+{
+    // the passes remove instructions, so their steps are fewer
+    bool isStepsCompared = mEngines[engine].passes == 0;
+    return expected.isRun == actual.isRun && expected.haltedAt == actual.haltedAt
+            && expected.registers == actual.registers && (! isStepsCompared || expected.steps == actual.steps);
+}
+
+bool ConformanceHarness::fails(std::size_t engine, Case &program)
+{
+    return halts(program) && ! agrees(engine, execute(0, program), execute(engine, program));
+}
+
+// removes the instruction, jumps past it are renumbered, jumps to it go to the next one
+static void removeInstruction(ConformanceHarness::Case &program, std::size_t index)
+{
+    std::vector<Instruction> &instructions = program.instructions;
+    instructions.erase(instructions.begin() + index);
+    for (std::size_t i=0; i<instructions.size(); ++i){
+        if (instructions[i].type() == Instruction::CT_J && instructions[i].instr > index + 1
+                && instructions[i].instr <= instructions.size() + 1)
+            --instructions[i].instr;
+    }
+}
+
+ConformanceHarness::Case ConformanceHarness::shrink(std::size_t engine, const Case &program)
+{
+    Case best = program;
+    std::size_t attempts = 0;
+    bool isChanged = true;
+    while (isChanged && attempts < MaxShrinkAttempts){
+        isChanged = false;
+
+        for (std::size_t i=0; i<best.instructions.size() && best.instructions.size() > 1 && attempts < MaxShrinkAttempts; ){
+            Case candidate = best;
+            removeInstruction(candidate, i);
+            ++attempts;
+            if (fails(engine, candidate)){
+                best = candidate;
+                isChanged = true;
+            } else
+                ++i;
+        }
+
+        std::map<RegNumber, RegValue> registers = best.registers;
+        for (std::map<RegNumber, RegValue>::const_iterator it = registers.begin();
+             it != registers.end() && attempts < MaxShrinkAttempts; ++it){
+            Case candidate = best;
+            candidate.registers.erase((*it).first);
+            ++attempts;
+            if (fails(engine, candidate)){
+                best = candidate;
+                isChanged = true;
+                continue;
+            }
+            while (best.registers[(*it).first] > 0 && attempts < MaxShrinkAttempts){
+                candidate = best;
+                candidate.registers[(*it).first] /= 2;
+                ++attempts;
+                if (! fails(engine, candidate))
+                    break;
+                best = candidate;
+                isChanged = true;
+            }
+        }
+    }
+    halts(best);
+    return best;
+}
+
+std::string ConformanceHarness::source(const Case &program)
+{
+    std::ostringstream text;
+    for (std::map<RegNumber, RegValue>::const_iterator it = program.registers.begin(); it != program.registers.end(); ++it)
+        text << "R" << (*it).first << " = " << (*it).second << "\n";
+    for (std::size_t i=0; i<program.instructions.size(); ++i)
+        text << program.instructions[i].text() << "\n";
+    return text.str();
+}
+
+void ConformanceHarness::printOutcome(const std::string &name, const Outcome &outcome, std::ostream &output)
+{
+    output << "  " << name << ": ";
+    if (! outcome.isRun){
+        output << "the program was not run." << std::endl;
+        return;
+    }
+    output << "terminated on instruction " << outcome.haltedAt << " after " << outcome.steps << " steps";
+    for (std::map<RegNumber, RegValue>::const_iterator it = outcome.registers.begin(); it != outcome.registers.end(); ++it)
+        output << ", [reg " << (*it).first << "]: " << (*it).second;
+    output << std::endl;
+}
+
+bool ConformanceHarness::run(std::size_t programs, std::ostream &output)
+{
+    std::map<std::string, unsigned long long> kinds;
+    unsigned long long failures = 0;
+
+    for (std::size_t p=0; p<programs; ++p){
+        Case program = generate();
+        ++kinds[program.kind];
+
+        Outcome expected = execute(0, program);
+        ++mStats[0].programs;
+        mStats[0].steps += expected.steps;
+        mStats[0].seconds += expected.seconds;
+        mStats[0].compileSeconds += expected.compileSeconds;
+
+        for (std::size_t e=1; e<mEngines.size(); ++e){
+            EngineStats &stats = mStats[e];
+            if (! stats.isAvailable)
+                continue;
+
+            Outcome actual = execute(e, program);
+            ++stats.programs;
+            stats.steps += actual.steps;
+            stats.seconds += actual.seconds;
+            stats.compileSeconds += actual.compileSeconds;
+            if (agrees(e, expected, actual))
+                continue;
+
+            ++failures;
+            if (stats.failures++ >= MaxReports)
+                continue;
+            Case shrunk = shrink(e, program);
+            output << std::endl << "MISMATCH: engine " << stats.name << ", " << program.kind << " program " << p + 1
+                   << " shrunk from " << program.instructions.size() << " to " << shrunk.instructions.size()
+                   << " instructions:" << std::endl << source(shrunk);
+            printOutcome(mEngines[0].name, execute(0, shrunk), output);
+            printOutcome(stats.name, execute(e, shrunk), output);
+        }
+    }
+
+    output << std::endl << "Conformance: " << programs << " programs";
+    for (std::map<std::string, unsigned long long>::const_iterator it = kinds.begin(); it != kinds.end(); ++it)
+        output << ", " << (*it).second << " " << (*it).first;
+    output << "; " << mDiscarded << " generated programs didn't halt in " << mMaxSteps << " steps and were replaced." << std::endl;
+
+    for (std::size_t e=0; e<mStats.size(); ++e){
+        const EngineStats &stats = mStats[e];
+        output << std::left << std::setw(16) << stats.name << std::right;
+        if (! stats.isAvailable){
+            output << " not available." << std::endl;
+            continue;
+        }
+        output << " " << stats.failures << " mismatches, " << stats.steps << " steps in " << stats.seconds << " s";
+        if (stats.seconds > 0)
+            output << " (" << std::fixed << std::setprecision(0) << stats.steps / stats.seconds << " steps/s)"
+                   << std::defaultfloat << std::setprecision(6);
+        if (stats.compileSeconds > 0)
+            output << ", prepared in " << stats.compileSeconds << " s";
+        output << "." << std::endl;
+    }
+    output << (failures == 0 ? "All engines agree with the reference." : "Engines disagree with the reference.") << std::endl;
+    return failures == 0;
+}
@@ -0,0 +1,130 @@
+#ifndef CONFORMANCE_H
+#define CONFORMANCE_H
+
+#include <string>
+#include <vector>
+#include <map>
+#include <random>
+#include <iostream>
+
+#include "instruction.h"
+#include "interpreter.h"
+
+
+//-- differential conformance harness
+// Generates programs, runs every one by the reference loop of the interpreter and by every other engine
+// (threaded on each optimisation level and with the passes, jit, checked, simd) and compares the halting
+// instruction, the final registers and the steps. Registers are compared as the reference sees them:
+// a register that is absent is zero, so the engines may keep any set of registers. Steps are not compared
+// for the passes, they remove instructions.
+//
+// Programs are random (any instructions, jumps into and out of the program) and structured (counting
+// loops, nested loops, arithmetic), initial values are small or near 2^32, where the machine changes
+// the width of the registers. Before the engines a program is run by the harness itself with the step
+// limit, the programs that don't halt within it are replaced, so every run is bounded.
+//
+// A failing program is shrunk while it still fails on the same engine: instructions are removed
+// (jumps are renumbered), initial values are dropped or halved. Throughput of every engine is
+// measured over the whole corpus by its own steps, the time of decoding and compilation is separate.
+//
+//      ConformanceHarness harness(seed, 100000);
+//      bool isConforming = harness.run(1000, std::cout);
+class ConformanceHarness
+{
+public:
+    struct Case
+    {
+        // "random", "loop", "nest" or "arithmetic"
+        std::string kind;
+        std::vector<Instruction> instructions;
+        std::map<RegNumber, RegValue> registers;
+        // steps of the bounded run of the harness
+        unsigned long long steps;
+    };
+
+    struct Outcome
+    {
+        Outcome():
+            isRun(false), haltedAt(0), steps(0), seconds(0), compileSeconds(0){}
+
+        // false if the engine failed to run the program
+        bool isRun;
+        InstructionPos haltedAt;
+        std::map<RegNumber, RegValue> registers;
+        // steps counted by the engine, time of the run and of the preparation (passes, decoding, compilation)
+        unsigned long long steps;
+        double seconds;
+        double compileSeconds;
+    };
+
+    struct EngineStats
+    {
+        EngineStats():
+            isAvailable(true), programs(0), failures(0), steps(0), seconds(0), compileSeconds(0){}
+
+        std::string name;
+        bool isAvailable;
+        unsigned long long programs;
+        unsigned long long failures;
+        // steps counted by the engine, time of the runs and of the preparation
+        unsigned long long steps;
+        double seconds;
+        double compileSeconds;
+    };
+
+    // maxSteps - limit of the steps of a generated program.
+    ConformanceHarness(unsigned long long seed, unsigned long long maxSteps);
+
+    // generates, runs and compares the count of programs, prints mismatches (shrunk)
+    // and the throughput of the engines. Returns true if all engines agree with the reference.
+    bool run(std::size_t programs, std::ostream &output);
+
+    const std::vector<EngineStats>& stats() const {
+        return mStats;
+    }
+
+    // program in the source format
+    static std::string source(const Case &program);
+
+private:
+    struct Engine
+    {
+        std::string name;
+        Interpreter::EngineType type;
+        int optimisationLevel;
+        unsigned passes;
+    };
+
+    // generated program that halts within the step limit
+    Case generate();
+    void generateRandom(Case &program);
+    void generateLoop(Case &program, bool isNested);
+    void generateArithmetic(Case &program);
+    // random Z, S or T that doesn't write the registers of the list
+    Instruction straightInstruction(const std::vector<RegNumber> &registers, const std::vector<RegNumber> &kept);
+    RegNumber randomRegister(const std::vector<RegNumber> &registers);
+    RegValue randomValue();
+    unsigned long long random(unsigned long long bound);
+
+    // runs the program by the harness, returns false if it doesn't halt within the step limit.
+    bool halts(Case &program) const;
+    Outcome execute(std::size_t engine, const Case &program);
+    // the program still halts and the engine disagrees with the reference
+    bool fails(std::size_t engine, Case &program);
+    Case shrink(std::size_t engine, const Case &program);
+    // outcome of the engine is the same as of the reference
+    bool agrees(std::size_t engine, const Outcome &expected, const Outcome &actual) const;
+    static void printOutcome(const std::string &name, const Outcome &outcome, std::ostream &output);
+
+private:
+    std::mt19937_64 mRandom;
+    unsigned long long mMaxSteps;
+    std::vector<Engine> mEngines;
+    // one per engine, configured once
+    std::vector< std::unique_ptr<Interpreter> > mInterpreters;
+    std::vector<EngineStats> mStats;
+    unsigned long long mDiscarded;
+};
+
+
+#endif // CONFORMANCE_H
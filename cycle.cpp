@@ -0,0 +1,54 @@
+#include "cycle.h"
+#include <algorithm>
+
+
+CycleDetector::CycleDetector(const Machine &machine):
+    mMachine(machine),
+    mSaved(machine.registerFile()),
+    mSavedNext(machine.next()),
+    mSamples(0),
+    mPower(1),
+    mSteps(0)
+{
+}
+
+bool CycleDetector::isSaved() const
+{
+    return mMachine.next() == mSavedNext
+            && std::equal(mSaved.begin(), mSaved.end(), mMachine.registerFile().begin());
+}
+
+bool CycleDetector::observe(unsigned long long steps)
+{
+    mSteps += steps;
+    ++mSamples;
+    if (isSaved())
+        return true;
+
+    if (mSamples == mPower){
+        // the buffer has the size of the register file, so it's not reallocated
+        std::copy(mMachine.registerFile().begin(), mMachine.registerFile().end(), mSaved.begin());
+        mSavedNext = mMachine.next();
+        mPower *= 2;
+        mSamples = 0;
+        mSteps = 0;
+    }
+    return false;
+}
+
+unsigned long long CycleDetector::period(Machine &machine, unsigned long long maxJumps) const
+{
+    // the state was saved on a taken jump, so it repeats on a taken jump too and single jumps don't miss it
+    unsigned long long steps = 0;
+    for (unsigned long long jumps = 0; jumps < maxJumps && steps < mSteps; ++jumps){
+        ExecutionResult result = machine.run(1);
+        steps += result.steps;
+        if (isSaved())
+            return steps;
+    }
+
+    // the state repeats after cycleSteps() anyway, the limit is checked on the same jump
+    if (steps < mSteps)
+        machine.run(mSteps - steps);
+    return mSteps;
+}
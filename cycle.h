@@ -0,0 +1,59 @@
+#ifndef CYCLE_H
+#define CYCLE_H
+
+#include <vector>
+
+#include "instruction.h"
+#include "program.h"
+
+
+//-- detector of the non-halting execution
+// The machine is deterministic, so once it comes to the same state (the next instruction and
+// the register file) twice, it repeats the path between them forever. States are sampled when the machine
+// is suspended (on taken jumps, see Machine::run()) and compared by Brent's algorithm: only one state
+// is saved, it's replaced by the current one when the count of samples since saving reaches
+// the next power of two. A cycle of the samples is found after at most 2 * (start + length) samples.
+//
+// A sample costs one comparison of the register file, the copy is made for powers of two only,
+// so with samples taken every few million steps the overhead is not measurable.
+// Programs that never repeat a state (a register grows without a bound) are not detected.
+//
+//      CycleDetector detector(machine);
+//      do {
+//          result = machine.run(SliceSteps);
+//      } while (result.suspended && ! detector.observe(result.steps));
+class CycleDetector
+{
+public:
+    // the machine is observed by reference.
+    explicit CycleDetector(const Machine &machine);
+
+    // called after the machine was suspended, steps - steps since the previous call.
+    // Returns true if the state was already observed.
+    bool observe(unsigned long long steps);
+    // steps between the repetitions of the state found by observe(), a multiple of the period of the cycle.
+    unsigned long long cycleSteps() const {
+        return mSteps;
+    }
+
+    // after observe() found the cycle runs the observed machine jump by jump until the state repeats.
+    // Returns the period of the cycle in steps, cycleSteps() if it has more than maxJumps jumps.
+    // The machine is left in the repeated state, it executes the returned count of steps.
+    unsigned long long period(Machine &machine, unsigned long long maxJumps) const;
+
+private:
+    bool isSaved() const;
+
+private:
+    const Machine &mMachine;
+    std::vector<RegValue> mSaved;
+    std::size_t mSavedNext;
+    // samples since saving and the samples to save the next state
+    unsigned long long mSamples;
+    unsigned long long mPower;
+    // steps since saving
+    unsigned long long mSteps;
+};
+
+
+#endif // CYCLE_H
@@ -0,0 +1,496 @@
+#include "debugger.h"
+#include <sstream>
+
+
+static const char *ConditionNames[] = {"changes", "==", "!=", "<", "<=", ">", ">="};
+
+// digits only, returns false on overflow
+static bool parseValue(const std::string &text, RegValue &value)
+{
+    if (text.empty() || text.find_first_not_of("0123456789") != std::string::npos)
+        return false;
+    value = 0;
+    for (std::size_t i=0; i<text.size(); ++i){
+        RegValue digit = text[i] - '0';
+        if (value > (~RegValue(0) - digit) / 10)
+            return false;
+        value = value * 10 + digit;
+    }
+    return true;
+}
+
+// "5", "R5" or "r5"
+static bool parseRegister(const std::string &text, RegNumber &number)
+{
+    RegValue value;
+    std::size_t start = ! text.empty() && (text[0] == 'R' || text[0] == 'r') ? 1 : 0;
+    if (! parseValue(text.substr(start), value) || value > RegValue(~RegNumber(0)))
+        return false;
+    number = value;
+    return true;
+}
+
+
+Debugger::Debugger(const std::vector<Instruction> &instructions, const std::map<RegNumber, RegValue> &registers):
+    mInstructions(instructions),
+    mProgram(instructions),
+    mPatched(mProgram),
+    mRegisters(mProgram.loadRegisters(registers)),
+    mPosition(0),
+    mSteps(0),
+    mIsHalted(false),
+    mHaltedAt(0),
+    mLastWatchpoint(0),
+    mLastValue(0)
+{
+    const std::vector<RegNumber> &numbers = mProgram.registerNumbers();
+    for (std::size_t i=0; i<numbers.size(); ++i)
+        mIndexes[numbers[i]] = i;
+    if (mRegisters.empty())
+        mRegisters.push_back(0);
+}
+
+bool Debugger::addBreakpoint(InstructionPos number)
+{
+    if (number < 1 || number > mInstructions.size())
+        return false;
+    mBreakpoints.insert(number);
+    patch();
+    return true;
+}
+
+bool Debugger::removeBreakpoint(InstructionPos number)
+{
+    if (mBreakpoints.erase(number) == 0)
+        return false;
+    patch();
+    return true;
+}
+
+bool Debugger::addWatchpoint(const Watchpoint &watchpoint)
+{
+    DecodedProgram::RegIndex index;
+    if (! registerIndex(watchpoint.number, index) || (watchpoint.isRegister && ! registerIndex(watchpoint.other, index)))
+        return false;
+    mWatchpoints.push_back(watchpoint);
+    patch();
+    return true;
+}
+
+bool Debugger::removeWatchpoint(std::size_t index)
+{
+    if (index >= mWatchpoints.size())
+        return false;
+    mWatchpoints.erase(mWatchpoints.begin() + index);
+    patch();
+    return true;
+}
+
+bool Debugger::registerIndex(RegNumber number, DecodedProgram::RegIndex &index) const
+{
+    std::map<RegNumber, DecodedProgram::RegIndex>::const_iterator it = mIndexes.find(number);
+    if (it == mIndexes.end())
+        return false;
+    index = (*it).second;
+    return true;
+}
+
+bool Debugger::isWatched(DecodedProgram::RegIndex index) const
+{
+    const std::vector<RegNumber> &numbers = mProgram.registerNumbers();
+    for (std::size_t i=0; i<mWatchpoints.size(); ++i){
+        if (mWatchpoints[i].number == numbers[index] || (mWatchpoints[i].isRegister && mWatchpoints[i].other == numbers[index]))
+            return true;
+    }
+    return false;
+}
+
+void Debugger::patch()
+{
+    std::vector<DecodedProgram::Op> &ops = mPatched.ops();
+    ops = mProgram.ops();
+    for (std::size_t i=0; i<mInstructions.size(); ++i){
+        const DecodedProgram::Op &op = ops[i];
+        bool isBreak = mBreakpoints.count(i + 1) > 0;
+        if (op.code == DecodedProgram::OP_Z || op.code == DecodedProgram::OP_S)
+            isBreak = isBreak || isWatched(op.arg1);
+        else if (op.code == DecodedProgram::OP_T)
+            isBreak = isBreak || isWatched(op.arg2);
+        if (isBreak)
+            ops[i].code = DecodedProgram::OP_Break;
+    }
+}
+
+bool Debugger::isTrue(const Watchpoint &watchpoint) const
+{
+    RegValue left = value(watchpoint.number);
+    RegValue right = watchpoint.isRegister ? value(watchpoint.other) : watchpoint.value;
+    switch (watchpoint.condition) {
+    case WC_Equal:
+        return left == right;
+    case WC_NotEqual:
+        return left != right;
+    case WC_Less:
+        return left < right;
+    case WC_LessEqual:
+        return left <= right;
+    case WC_Greater:
+        return left > right;
+    case WC_GreaterEqual:
+        return left >= right;
+    default:
+        return false;
+    }
+}
+
+bool Debugger::execute()
+{
+    const DecodedProgram::Op &op = mProgram.ops()[mPosition];
+    DecodedProgram::RegIndex written;
+    switch (op.code) {
+    case DecodedProgram::OP_Z:
+    case DecodedProgram::OP_S:
+        written = op.arg1;
+        break;
+    case DecodedProgram::OP_T:
+        written = op.arg2;
+        break;
+    case DecodedProgram::OP_J:
+        ++mSteps;
+        mPosition = mRegisters[op.arg1] == mRegisters[op.arg2] ? op.target : mPosition + 1;
+        return false;
+    default:
+        mIsHalted = true;
+        mHaltedAt = mProgram.haltNumber(op.target);
+        return false;
+    }
+
+    // conditions are checked before and after the write, so only the change of them stops
+    mConditions.resize(mWatchpoints.size());
+    for (std::size_t i=0; i<mWatchpoints.size(); ++i)
+        mConditions[i] = isTrue(mWatchpoints[i]);
+    RegValue old = mRegisters[written];
+
+    if (op.code == DecodedProgram::OP_Z)
+        mRegisters[written] = 0;
+    else if (op.code == DecodedProgram::OP_S)
+        ++mRegisters[written];
+    else
+        mRegisters[written] = mRegisters[op.arg1];
+    ++mSteps;
+    ++mPosition;
+
+    RegNumber number = mProgram.registerNumbers()[written];
+    for (std::size_t i=0; i<mWatchpoints.size(); ++i){
+        const Watchpoint &watchpoint = mWatchpoints[i];
+        if (watchpoint.number != number && ! (watchpoint.isRegister && watchpoint.other == number))
+            continue;
+        bool isStop = watchpoint.condition == WC_Changed ? (watchpoint.number == number && old != mRegisters[written])
+                                                         : (! mConditions[i] && isTrue(watchpoint));
+        if (isStop){
+            mLastWatchpoint = i;
+            mLastValue = old;
+            return true;
+        }
+    }
+    return false;
+}
+
+Debugger::StopReason Debugger::step(unsigned long long count)
+{
+    for (unsigned long long i=0; i<count && ! mIsHalted; ++i){
+        if (execute())
+            return SR_Watchpoint;
+    }
+    // the halt op is not a step, the program terminates right after the last instruction
+    if (! mIsHalted && mProgram.ops()[mPosition].code == DecodedProgram::OP_Halt)
+        execute();
+    return mIsHalted ? SR_Halt : SR_Step;
+}
+
+Debugger::StopReason Debugger::resume()
+{
+    bool isFirst = true;
+    while (! mIsHalted){
+        if (mPatched.ops()[mPosition].code == DecodedProgram::OP_Break){
+            if (! isFirst && mBreakpoints.count(mPosition + 1) > 0)
+                return SR_Breakpoint;
+            if (execute())
+                return SR_Watchpoint;
+        } else {
+            ExecutionResult result = ThreadedEngine().run(mPatched, &mRegisters[0], mPosition);
+            mSteps += result.steps;
+            if (result.suspended)
+                mPosition = result.haltedAt - 1;
+            else {
+                mIsHalted = true;
+                mHaltedAt = result.haltedAt;
+            }
+        }
+        isFirst = false;
+    }
+    return SR_Halt;
+}
+
+Debugger::StopReason Debugger::runTo(InstructionPos number)
+{
+    bool isTemporary = mBreakpoints.count(number) == 0;
+    if (isTemporary && ! addBreakpoint(number))
+        return resume();
+
+    StopReason reason = resume();
+    if (isTemporary)
+        removeBreakpoint(number);
+    return reason;
+}
+
+InstructionPos Debugger::instructionNumber() const
+{
+    return mIsHalted ? mHaltedAt : mPosition + 1;
+}
+
+RegValue Debugger::value(RegNumber number) const
+{
+    DecodedProgram::RegIndex index;
+    return registerIndex(number, index) ? mRegisters[index] : 0;
+}
+
+bool Debugger::setValue(RegNumber number, RegValue value)
+{
+    DecodedProgram::RegIndex index;
+    if (! registerIndex(number, index))
+        return false;
+    mRegisters[index] = value;
+    return true;
+}
+
+void Debugger::storeRegisters(std::map<RegNumber, RegValue> &registers) const
+{
+    mProgram.storeRegisters(mRegisters, registers);
+}
+
+ExecutionResult Debugger::result() const
+{
+    ExecutionResult result;
+    result.suspended = ! mIsHalted;
+    result.interrupted = ! mIsHalted;
+    result.haltedAt = instructionNumber();
+    result.steps = mSteps;
+    result.dispatches = mSteps;
+    return result;
+}
+
+void Debugger::run(std::istream &input, std::ostream &output)
+{
+    output << std::endl << "Debugger: " << mInstructions.size() << " instructions, "
+           << mProgram.registerNumbers().size() << " registers. Type \"help\" for the list of commands." << std::endl;
+    printLocation(output);
+
+    // an empty line repeats the previous command
+    std::string line, previous;
+    while (output << "(regm) " << std::flush, std::getline(input, line)){
+        if (line.find_first_not_of(" \t\r") == std::string::npos)
+            line = previous;
+        else
+            previous = line;
+        if (! command(line, output))
+            break;
+    }
+    output << std::endl;
+}
+
+bool Debugger::command(const std::string &line, std::ostream &output)
+{
+    std::istringstream stream(line);
+    std::string name;
+    std::vector<std::string> arguments;
+    stream >> name;
+    for (std::string argument; stream >> argument; )
+        arguments.push_back(argument);
+
+    if (name.empty())
+        return true;
+
+    if (name == "quit" || name == "q")
+        return false;
+
+    if (name == "help" || name == "h"){
+        printHelp(output);
+        return true;
+    }
+
+    if (name == "step" || name == "s"){
+        RegValue count = 1;
+        if (arguments.size() > 1 || (arguments.size() == 1 && ! parseValue(arguments[0], count))){
+            output << "Usage: step [count]" << std::endl;
+            return true;
+        }
+        printStop(step(count), output);
+        return true;
+    }
+
+    if (name == "continue" || name == "c"){
+        printStop(resume(), output);
+        return true;
+    }
+
+    if (name == "until" || name == "u" || name == "break" || name == "b" || name == "delete" || name == "d"){
+        RegValue number;
+        if (arguments.size() != 1 || ! parseValue(arguments[0], number)){
+            output << "Usage: " << name << " <instruction>" << std::endl;
+            return true;
+        }
+        if (name == "until" || name == "u"){
+            if (number < 1 || number > mInstructions.size())
+                output << "There is no instruction " << number << "." << std::endl;
+            else
+                printStop(runTo(number), output);
+        } else if (name == "break" || name == "b"){
+            if (addBreakpoint(number))
+                output << "Breakpoint at instruction " << number << ": " << mInstructions[number - 1].text() << "." << std::endl;
+            else
+                output << "There is no instruction " << number << "." << std::endl;
+        } else if (! removeBreakpoint(number))
+            output << "There is no breakpoint at instruction " << number << "." << std::endl;
+        return true;
+    }
+
+    if (name == "watch" || name == "w"){
+        Watchpoint watchpoint;
+        bool isValid = (arguments.size() == 1 || arguments.size() == 3) && parseRegister(arguments[0], watchpoint.number);
+        if (isValid && arguments.size() == 3){
+            isValid = false;
+            for (int condition = WC_Equal; condition <= WC_GreaterEqual; ++condition){
+                if (arguments[1] == ConditionNames[condition]){
+                    watchpoint.condition = Condition(condition);
+                    isValid = true;
+                }
+            }
+            const std::string &operand = arguments[2];
+            watchpoint.isRegister = ! operand.empty() && (operand[0] == 'R' || operand[0] == 'r');
+            isValid = isValid && (watchpoint.isRegister ? parseRegister(operand, watchpoint.other)
+                                                        : parseValue(operand, watchpoint.value));
+        }
+        if (! isValid){
+            output << "Usage: watch <register> [==|!=|<|<=|>|>= <value>|R<register>]" << std::endl;
+            return true;
+        }
+        if (addWatchpoint(watchpoint))
+            output << "Watchpoint " << mWatchpoints.size() << ": " << watchpointText(watchpoint) << std::endl;
+        else
+            output << "The register is not used by the program." << std::endl;
+        return true;
+    }
+
+    if (name == "unwatch"){
+        RegValue number;
+        if (arguments.size() != 1 || ! parseValue(arguments[0], number) || number < 1 || ! removeWatchpoint(number - 1))
+            output << "Usage: unwatch <watchpoint number>" << std::endl;
+        return true;
+    }
+
+    if (name == "print" || name == "p"){
+        std::map<RegNumber, RegValue> registers;
+        if (arguments.empty())
+            storeRegisters(registers);
+        for (std::size_t i=0; i<arguments.size(); ++i){
+            RegNumber number;
+            if (! parseRegister(arguments[i], number)){
+                output << "Usage: print [register]..." << std::endl;
+                return true;
+            }
+            registers[number] = value(number);
+        }
+        for (std::map<RegNumber, RegValue>::const_iterator it = registers.begin(); it != registers.end(); ++it)
+            output << "[reg " << (*it).first << "]: " << (*it).second << std::endl;
+        return true;
+    }
+
+    if (name == "set"){
+        RegNumber number;
+        RegValue newValue;
+        if (arguments.size() != 2 || ! parseRegister(arguments[0], number) || ! parseValue(arguments[1], newValue))
+            output << "Usage: set <register> <value>" << std::endl;
+        else if (! setValue(number, newValue))
+            output << "The register is not used by the program." << std::endl;
+        return true;
+    }
+
+    if (name == "info" || name == "i"){
+        printLocation(output);
+        for (std::set<InstructionPos>::const_iterator it = mBreakpoints.begin(); it != mBreakpoints.end(); ++it)
+            output << "Breakpoint at instruction " << *it << ": " << mInstructions[*it - 1].text() << std::endl;
+        for (std::size_t i=0; i<mWatchpoints.size(); ++i)
+            output << "Watchpoint " << i + 1 << ": " << watchpointText(mWatchpoints[i]) << std::endl;
+        return true;
+    }
+
+    if (name == "list" || name == "l"){
+        // a few instructions around the current one
+        std::size_t current = mIsHalted ? mInstructions.size() : mPosition;
+        std::size_t first = current >= 3 ? current - 3 : 0;
+        for (std::size_t i=first; i<mInstructions.size() && i<first+7; ++i)
+            output << (i == current ? "=> " : "   ") << (mBreakpoints.count(i + 1) > 0 ? "* " : "  ")
+                   << "[ins " << i + 1 << "]: " << mInstructions[i].text() << std::endl;
+        return true;
+    }
+
+    output << "Unknown command \"" << name << "\". Type \"help\" for the list of commands." << std::endl;
+    return true;
+}
+
+void Debugger::printStop(StopReason reason, std::ostream &output) const
+{
+    if (reason == SR_Breakpoint)
+        output << "Breakpoint at instruction " << instructionNumber() << "." << std::endl;
+    else if (reason == SR_Watchpoint){
+        const Watchpoint &watchpoint = mWatchpoints[mLastWatchpoint];
+        const DecodedProgram::Op &op = mProgram.ops()[mPosition - 1];
+        RegNumber written = mProgram.registerNumbers()[op.code == DecodedProgram::OP_T ? op.arg2 : op.arg1];
+        output << "Watchpoint " << mLastWatchpoint + 1 << ": [reg " << written << "]: "
+               << mLastValue << " -> " << value(written);
+        if (watchpoint.condition != WC_Changed)
+            output << " (" << watchpointText(watchpoint) << ")";
+        output << std::endl;
+    }
+    printLocation(output);
+}
+
+void Debugger::printLocation(std::ostream &output) const
+{
+    if (mIsHalted)
+        output << "Program terminated on instruction " << mHaltedAt << " after " << mSteps << " steps." << std::endl;
+    else
+        output << "[step " << mSteps << "] next [ins " << mPosition + 1 << "]: " << mInstructions[mPosition].text() << std::endl;
+}
+
+std::string Debugger::watchpointText(const Watchpoint &watchpoint)
+{
+    std::ostringstream text;
+    text << "[reg " << watchpoint.number << "] " << ConditionNames[watchpoint.condition];
+    if (watchpoint.condition != WC_Changed){
+        if (watchpoint.isRegister)
+            text << " [reg " << watchpoint.other << "]";
+        else
+            text << " " << watchpoint.value;
+    }
+    return text.str();
+}
+
+void Debugger::printHelp(std::ostream &output) const
+{
+    output << "step|s [count]          execute the count of instructions (1 by default)" << std::endl
+           << "continue|c              run until a breakpoint, a watchpoint or the halt" << std::endl
+           << "until|u <instruction>   run until the instruction" << std::endl
+           << "break|b <instruction>   set the breakpoint on the instruction" << std::endl
+           << "delete|d <instruction>  remove the breakpoint" << std::endl
+           << "watch|w <register> [==|!=|<|<=|>|>= <value>|R<register>]" << std::endl
+           << "                        stop when the register changes or the condition becomes true" << std::endl
+           << "unwatch <number>        remove the watchpoint" << std::endl
+           << "print|p [register]...   print the registers (all by default)" << std::endl
+           << "set <register> <value>  change the register" << std::endl
+           << "info|i                  current instruction, breakpoints and watchpoints" << std::endl
+           << "list|l                  instructions around the current one" << std::endl
+           << "quit|q                  stop debugging, the state is printed as results" << std::endl
+           << "An empty line repeats the previous command." << std::endl;
+}
@@ -0,0 +1,139 @@
+#ifndef DEBUGGER_H
+#define DEBUGGER_H
+
+#include <string>
+#include <vector>
+#include <set>
+#include <map>
+#include <iostream>
+
+#include "instruction.h"
+#include "engine.h"
+
+
+//-- interactive debugger
+// The program is decoded without optimisation, so every op is one instruction. The debugger keeps
+// a copy of the ops with breakpoints patched in: the op of every instruction with a breakpoint and
+// every op writing a watched register are replaced by OP_Break. The copy is run by the normal instance
+// of the threaded engine, it suspends on OP_Break, so between the stops the program runs at full speed
+// and the engine knows nothing about the debugger. The replaced op is executed by the debugger
+// (single step), then the watchpoints of the written register are checked.
+//
+// Watchpoints cost a return to the debugger on every write of the watched register,
+// breakpoints cost nothing until they are reached.
+class Debugger
+{
+public:
+    enum Condition {
+        WC_Changed = 0,     // any write that changes the value
+        WC_Equal, WC_NotEqual, WC_Less, WC_LessEqual, WC_Greater, WC_GreaterEqual
+    };
+
+    // stops when a write of the register changes the value or makes the condition true
+    // (it was false before the write).
+    struct Watchpoint
+    {
+        Watchpoint():
+            number(0), condition(WC_Changed), isRegister(false), other(0), value(0){}
+
+        RegNumber number;
+        Condition condition;
+        // the register is compared to the other register, otherwise to the value
+        bool isRegister;
+        RegNumber other;
+        RegValue value;
+    };
+
+    enum StopReason {
+        SR_Step = 0, SR_Breakpoint, SR_Watchpoint, SR_Halt
+    };
+
+    // throws DecodeException.
+    Debugger(const std::vector<Instruction> &instructions, const std::map<RegNumber, RegValue> &registers);
+
+    // returns false if there is no such instruction.
+    bool addBreakpoint(InstructionPos number);
+    bool removeBreakpoint(InstructionPos number);
+    const std::set<InstructionPos>& breakpoints() const {
+        return mBreakpoints;
+    }
+    // returns false if the registers are not used by the program.
+    bool addWatchpoint(const Watchpoint &watchpoint);
+    // index in watchpoints()
+    bool removeWatchpoint(std::size_t index);
+    const std::vector<Watchpoint>& watchpoints() const {
+        return mWatchpoints;
+    }
+
+    // executes the count of instructions, stops earlier on the halt and on the watchpoint.
+    StopReason step(unsigned long long count);
+    // runs until the breakpoint, the watchpoint or the halt. The breakpoint of the current instruction
+    // doesn't stop, so the execution can be continued from it.
+    StopReason resume();
+    // runs until the instruction (as resume() with the temporary breakpoint).
+    StopReason runTo(InstructionPos number);
+
+    bool isHalted() const {
+        return mIsHalted;
+    }
+    // number of the instruction to execute next, of the halt after the end of the run
+    InstructionPos instructionNumber() const;
+    unsigned long long steps() const {
+        return mSteps;
+    }
+    // the last stop on the watchpoint: index of the watchpoint and the value of the register before the write
+    std::size_t lastWatchpoint() const {
+        return mLastWatchpoint;
+    }
+    RegValue lastValue() const {
+        return mLastValue;
+    }
+    // registers not used by the program are zero and can't be set.
+    RegValue value(RegNumber number) const;
+    bool setValue(RegNumber number, RegValue value);
+    void storeRegisters(std::map<RegNumber, RegValue> &registers) const;
+    // suspended on the next instruction if the program is not halted.
+    ExecutionResult result() const;
+
+    // reads commands from the input until the end of it or "quit" (see "help").
+    void run(std::istream &input, std::ostream &output);
+
+private:
+    // rebuilds the patched copy of the ops
+    void patch();
+    bool isWatched(DecodedProgram::RegIndex index) const;
+    // executes the op of the current instruction, returns true if a watchpoint stops the execution.
+    bool execute();
+    bool isTrue(const Watchpoint &watchpoint) const;
+    bool registerIndex(RegNumber number, DecodedProgram::RegIndex &index) const;
+
+    // REPL
+    bool command(const std::string &line, std::ostream &output);
+    void printStop(StopReason reason, std::ostream &output) const;
+    void printLocation(std::ostream &output) const;
+    // "[reg 2] == 5"
+    static std::string watchpointText(const Watchpoint &watchpoint);
+    void printHelp(std::ostream &output) const;
+
+private:
+    std::vector<Instruction> mInstructions;
+    DecodedProgram mProgram;
+    // ops of the program with the breakpoints
+    DecodedProgram mPatched;
+    std::map<RegNumber, DecodedProgram::RegIndex> mIndexes;
+    std::set<InstructionPos> mBreakpoints;
+    std::vector<Watchpoint> mWatchpoints;
+    // conditions of the watchpoints before the write (see execute())
+    std::vector<char> mConditions;
+
+    std::vector<RegValue> mRegisters;
+    std::size_t mPosition;
+    unsigned long long mSteps;
+    bool mIsHalted;
+    InstructionPos mHaltedAt;
+    std::size_t mLastWatchpoint;
+    RegValue mLastValue;
+};
+
+
+#endif // DEBUGGER_H
@@ -0,0 +1,493 @@
+#include "engine.h"
+#include "trace.h"
+
+
+// a cache line holds 4 ops
+static_assert(sizeof(DecodedProgram::Op) == 16, "ops must be packed into 16 bytes");
+
+
+DecodedProgram::DecodedProgram(const std::vector<Instruction> &instructions):
+    mInstructionsCount(instructions.size())
+{
+    // every instruction adds at most one halt op and two registers, so their indexes fit 32 bits too
+    if (instructions.size() >= 0x7FFFFFFF)
+        throw DecodeException("Program is too large.", 0x7FFFFFFF);
+    mOps.reserve(instructions.size() + 1);
+
+    // fall through the last instruction is the same as jump to the next after it,
+    // so the first halt op will be placed right after the program.
+    std::vector<RegValue> halts;
+    std::map<RegValue, std::size_t> haltOps;
+    haltOps.insert(std::pair<RegValue, std::size_t>(instructions.size() + 1, instructions.size()));
+    halts.push_back(instructions.size() + 1);
+
+    for (std::size_t i=0; i<instructions.size(); ++i){
+        const Instruction &instruction = instructions[i];
+        Op op;
+        op.arg1 = registerIndex(instruction.arg1);
+        op.arg2 = 0;
+        op.target = 0;
+
+        switch (instruction.type()) {
+        case Instruction::CT_Z:
+            op.code = OP_Z;
+            break;
+
+        case Instruction::CT_S:
+            op.code = OP_S;
+            break;
+
+        case Instruction::CT_T:
+            op.code = OP_T;
+            op.arg2 = registerIndex(instruction.arg2);
+            break;
+
+        case Instruction::CT_J:
+            op.code = OP_J;
+            op.arg2 = registerIndex(instruction.arg2);
+
+            // instructions are numbered from 1,
+            // any jump outside of the program terminates it.
+            if (instruction.instr >= 1 && instruction.instr <= instructions.size())
+                op.target = instruction.instr - 1;
+            else {
+                std::map<RegValue, std::size_t>::const_iterator it = haltOps.find(instruction.instr);
+                if (it == haltOps.end()){
+                    op.target = instructions.size() + halts.size();
+                    haltOps.insert(std::pair<RegValue, std::size_t>(instruction.instr, op.target));
+                    halts.push_back(instruction.instr);
+                } else
+                    op.target = (*it).second;
+            }
+            break;
+
+        default:
+            throw DecodeException("Invalid instruction type.", i+1);
+        }
+
+        mOps.push_back(op);
+    }
+
+    for (std::size_t i=0; i<halts.size(); ++i){
+        Op op;
+        op.code = OP_Halt;
+        op.arg1 = 0;
+        op.arg2 = 0;
+        op.target = i;
+        mOps.push_back(op);
+    }
+    mHalts.assign(halts.begin(), halts.end());
+
+    // index map is needed only while decoding
+    mRegisterIndexes.clear();
+}
+
+DecodedProgram::DecodedProgram(std::size_t instructionsCount, const std::vector<Op> &ops, const std::vector<LoopSummary> &loops,
+                               const std::vector<InstructionPos> &halts, const std::vector<RegNumber> &registerNumbers):
+    mOps(ops),
+    mLoops(loops),
+    mHalts(halts),
+    mRegisterNumbers(registerNumbers),
+    mInstructionsCount(instructionsCount)
+{
+}
+
+DecodedProgram::RegIndex DecodedProgram::registerIndex(RegNumber number)
+{
+    std::map<RegNumber, RegIndex>::const_iterator it = mRegisterIndexes.find(number);
+    if (it != mRegisterIndexes.end())
+        return (*it).second;
+
+    RegIndex index = mRegisterNumbers.size();
+    mRegisterIndexes.insert(std::pair<RegNumber, RegIndex>(number, index));
+    mRegisterNumbers.push_back(number);
+    return index;
+}
+
+std::vector<RegValue> DecodedProgram::loadRegisters(const std::map<RegNumber, RegValue> &registers) const
+{
+    std::vector<RegValue> registerFile(mRegisterNumbers.size(), 0);
+    for (std::size_t i=0; i<mRegisterNumbers.size(); ++i){
+        std::map<RegNumber, RegValue>::const_iterator it = registers.find(mRegisterNumbers[i]);
+        if (it != registers.end())
+            registerFile[i] = (*it).second;
+    }
+    return registerFile;
+}
+
+void DecodedProgram::storeRegisters(const std::vector<RegValue> &registerFile, std::map<RegNumber, RegValue> &registers) const
+{
+    for (std::size_t i=0; i<mRegisterNumbers.size() && i<registerFile.size(); ++i)
+        registers[mRegisterNumbers[i]] = registerFile[i];
+}
+
+
+#if defined(__GNUC__)
+#   define ENGINE_COMPUTED_GOTO
+#endif
+
+#ifdef ENGINE_COMPUTED_GOTO
+#   define ENGINE_OP(label, code)   label:
+#   define ENGINE_DISPATCH()        counters.dispatched(); goto *labels[op->code]
+#else
+#   define ENGINE_OP(label, code)   case DecodedProgram::code:
+#   define ENGINE_DISPATCH()        counters.dispatched(); goto dispatch
+#endif
+
+// taken jump of the threaded engine. A jump to a halt op (index past the instructions) is not
+// suspended, the program has halted and there is no instruction to resume from.
+#define ENGINE_JUMP(index)  do { std::size_t target = (index); op = ops + target; \
+                                 if (Limited && steps >= limit && target < instructionsCount) goto suspend; } while (0)
+
+// the run loop is instantiated with NoCounters for the normal execution, so it pays nothing
+// for the profiling and doesn't count the dispatches, and with ProfileCounters and TraceCounters.
+struct NoCounters
+{
+    void dispatched(){}
+    void executed(std::size_t){}
+    void jumped(std::size_t, bool){}
+    template<typename Value>
+    void loop(std::size_t, Value, std::size_t){}
+    // dispatches are not counted (see ExecutionResult::dispatches)
+    unsigned long long dispatches(bool) const { return 0; }
+};
+
+// dispatches of the counting instantiations, the dispatch to the halt op doesn't execute any instruction
+struct DispatchCounter
+{
+    DispatchCounter(): dispatchCount(0){}
+
+    void dispatched(){
+        ++dispatchCount;
+    }
+    unsigned long long dispatches(bool isHalt) const {
+        return isHalt ? dispatchCount - 1 : dispatchCount;
+    }
+
+    unsigned long long dispatchCount;
+};
+
+struct ProfileCounters : DispatchCounter
+{
+    explicit ProfileCounters(ExecutionProfile &profile):
+        executedCounts(&profile.executed[0]), takenCounts(&profile.taken[0]){}
+
+    void executed(std::size_t index){
+        ++executedCounts[index];
+    }
+    void jumped(std::size_t index, bool taken){
+        ++executedCounts[index];
+        takenCounts[index] += taken;
+    }
+    // summarised loop: the header jump is not taken on every iteration and taken on the exit,
+    // the back jump at the end of the body is taken on every iteration
+    void loop(std::size_t header, RegValue trips, std::size_t length){
+        for (std::size_t i=header; i<header+length; ++i)
+            executedCounts[i] += trips;
+        ++executedCounts[header];
+        ++takenCounts[header];
+        takenCounts[header + length - 1] += trips;
+    }
+
+    unsigned long long *executedCounts;
+    unsigned long long *takenCounts;
+};
+
+// the keyframe is taken before the jump, registers are the register file of the run
+struct TraceCounters : DispatchCounter
+{
+    TraceCounters(TraceWriter &traceWriter, const RegValue *registerFile):
+        writer(traceWriter), registers(registerFile), steps(0), nextKeyframe(traceWriter.keyframeInterval()){}
+
+    void executed(std::size_t){
+        ++steps;
+    }
+    void jumped(std::size_t index, bool taken){
+        if (steps >= nextKeyframe){
+            writer.keyframe(steps, index, registers);
+            nextKeyframe = steps + writer.keyframeInterval();
+        }
+        ++steps;
+        writer.branch(taken);
+    }
+    template<typename Value>
+    void loop(std::size_t, Value, std::size_t){}
+
+    TraceWriter &writer;
+    const RegValue *registers;
+    // std::size_t doesn't alias RegValue, the counters stay in registers of the CPU
+    std::size_t steps;
+    std::size_t nextKeyframe;
+};
+
+// Limited: execution is stopped on the first taken jump after `limit` steps,
+// jumps are the only way to run long, so straight code is never checked.
+// Value: type of the registers.
+template<typename Value, typename Counters, bool Limited>
+static ExecutionResult runOps(const DecodedProgram &program, Value *registers, std::size_t start,
+                              Counters &counters, unsigned long long limit)
+{
+    const DecodedProgram::Op *ops = &program.ops()[0];
+    const DecodedProgram::Op *op = ops + start;
+    unsigned long long steps = 0;
+    const std::size_t instructionsCount = program.instructionsCount();
+    ExecutionResult result;
+
+#ifdef ENGINE_COMPUTED_GOTO
+    // must follow the order of DecodedProgram::OpCode
+    static void* const labels[DecodedProgram::OP_Count] = {
+        &&op_z, &&op_s, &&op_t, &&op_j, &&op_halt,
+        &&op_jmp, &&op_ss, &&op_sj, &&op_sjmp, &&op_tz, &&op_ssjmp,
+        &&op_loop, &&op_break
+    };
+    ENGINE_DISPATCH();
+#else
+dispatch:
+    switch (op->code) {
+#endif
+
+    ENGINE_OP(op_z, OP_Z)
+        counters.executed(op - ops);
+        registers[op->arg1] = 0;
+        ++steps;
+        ++op;
+        ENGINE_DISPATCH();
+
+    ENGINE_OP(op_s, OP_S)
+        counters.executed(op - ops);
+        ++registers[op->arg1];
+        ++steps;
+        ++op;
+        ENGINE_DISPATCH();
+
+    ENGINE_OP(op_t, OP_T)
+        counters.executed(op - ops);
+        registers[op->arg2] = registers[op->arg1];
+        ++steps;
+        ++op;
+        ENGINE_DISPATCH();
+
+    ENGINE_OP(op_j, OP_J)
+        ++steps;
+        counters.jumped(op - ops, registers[op->arg1] == registers[op->arg2]);
+        if (registers[op->arg1] == registers[op->arg2])
+            ENGINE_JUMP(op->target);
+        else
+            ++op;
+        ENGINE_DISPATCH();
+
+    ENGINE_OP(op_jmp, OP_Jmp)
+        ++steps;
+        counters.jumped(op - ops, true);
+        ENGINE_JUMP(op->target);
+        ENGINE_DISPATCH();
+
+    ENGINE_OP(op_ss, OP_SS)
+        counters.executed(op - ops);
+        counters.executed(op - ops + 1);
+        ++registers[op[0].arg1];
+        ++registers[op[1].arg1];
+        steps += 2;
+        op += 2;
+        ENGINE_DISPATCH();
+
+    ENGINE_OP(op_sj, OP_SJ)
+        ++registers[op[0].arg1];
+        steps += 2;
+        counters.executed(op - ops);
+        ++op;
+        counters.jumped(op - ops, registers[op->arg1] == registers[op->arg2]);
+        if (registers[op->arg1] == registers[op->arg2])
+            ENGINE_JUMP(op->target);
+        else
+            ++op;
+        ENGINE_DISPATCH();
+
+    ENGINE_OP(op_sjmp, OP_SJmp)
+        counters.executed(op - ops);
+        counters.jumped(op - ops + 1, true);
+        ++registers[op[0].arg1];
+        steps += 2;
+        ENGINE_JUMP(op[1].target);
+        ENGINE_DISPATCH();
+
+    ENGINE_OP(op_tz, OP_TZ)
+        counters.executed(op - ops);
+        counters.executed(op - ops + 1);
+        registers[op[0].arg2] = registers[op[0].arg1];
+        registers[op[1].arg1] = 0;
+        steps += 2;
+        op += 2;
+        ENGINE_DISPATCH();
+
+    ENGINE_OP(op_ssjmp, OP_SSJmp)
+        counters.executed(op - ops);
+        counters.executed(op - ops + 1);
+        counters.jumped(op - ops + 2, true);
+        ++registers[op[0].arg1];
+        ++registers[op[1].arg1];
+        steps += 3;
+        ENGINE_JUMP(op[2].target);
+        ENGINE_DISPATCH();
+
+    ENGINE_OP(op_loop, OP_Loop)
+    {
+        const LoopSummary &loop = program.loop(op->target);
+        Value trips;
+        if (loop.tripCount(registers, trips)){
+            loop.apply(registers, trips);
+            steps += trips * loop.iterationLength + 1;
+            counters.loop(op - ops, trips, loop.iterationLength);
+            ENGINE_JUMP(loop.exit);
+        } else {
+            ++steps;
+            counters.jumped(op - ops, registers[op->arg1] == registers[op->arg2]);
+            if (registers[op->arg1] == registers[op->arg2])
+                ENGINE_JUMP(loop.exit);
+            else
+                ++op;
+        }
+        ENGINE_DISPATCH();
+    }
+
+    ENGINE_OP(op_halt, OP_Halt)
+        result.haltedAt = program.haltNumber(op->target);
+        result.steps = steps;
+        result.dispatches = counters.dispatches(true);
+        return result;
+
+    // only the debugger patches breakpoints into the ops, the normal run pays nothing for them
+    ENGINE_OP(op_break, OP_Break)
+        result.suspended = true;
+        result.haltedAt = op - ops + 1;
+        result.steps = steps;
+        result.dispatches = counters.dispatches(true);
+        return result;
+
+suspend:
+    result.suspended = true;
+    result.haltedAt = op - ops + 1;
+    result.steps = steps;
+    result.dispatches = counters.dispatches(false);
+    return result;
+
+#ifndef ENGINE_COMPUTED_GOTO
+    default:
+        result.haltedAt = program.haltNumber(op->target);
+        result.steps = steps;
+        result.dispatches = counters.dispatches(true);
+        return result;
+    }
+#endif
+}
+
+template<typename Value>
+ExecutionResult ThreadedEngine::run(const DecodedProgram &program, Value *registers, std::size_t start) const
+{
+    NoCounters counters;
+    return runOps<Value, NoCounters, false>(program, registers, start, counters, 0);
+}
+
+template<typename Value>
+ExecutionResult ThreadedEngine::run(const DecodedProgram &program, Value *registers, std::size_t start,
+                                    unsigned long long stepLimit) const
+{
+    NoCounters counters;
+    return runOps<Value, NoCounters, true>(program, registers, start, counters, stepLimit);
+}
+
+template ExecutionResult ThreadedEngine::run(const DecodedProgram &, RegValue *, std::size_t) const;
+template ExecutionResult ThreadedEngine::run(const DecodedProgram &, RegValue *, std::size_t, unsigned long long) const;
+template ExecutionResult ThreadedEngine::run(const DecodedProgram &, uint32_t *, std::size_t) const;
+template ExecutionResult ThreadedEngine::run(const DecodedProgram &, uint32_t *, std::size_t, unsigned long long) const;
+#ifdef REGM_INT128
+template ExecutionResult ThreadedEngine::run(const DecodedProgram &, WideRegValue *, std::size_t) const;
+template ExecutionResult ThreadedEngine::run(const DecodedProgram &, WideRegValue *, std::size_t, unsigned long long) const;
+#endif
+
+ExecutionResult ThreadedEngine::profile(const DecodedProgram &program, RegValue *registers,
+                                        ExecutionProfile &counters) const
+{
+    counters.executed.assign(program.ops().size(), 0);
+    counters.taken.assign(program.ops().size(), 0);
+    ProfileCounters profileCounters(counters);
+    ExecutionResult result = runOps<RegValue, ProfileCounters, false>(program, registers, 0, profileCounters, 0);
+
+    // halt ops are not instructions
+    counters.executed.resize(program.instructionsCount());
+    counters.taken.resize(program.instructionsCount());
+    return result;
+}
+
+ExecutionResult ThreadedEngine::trace(const DecodedProgram &program, RegValue *registers, TraceWriter &writer) const
+{
+    writer.keyframe(0, 0, registers);
+    TraceCounters counters(writer, registers);
+    return runOps<RegValue, TraceCounters, false>(program, registers, 0, counters, 0);
+}
+
+ExecutionResult CheckedEngine::run(const DecodedProgram &program, BigRegister *registers) const
+{
+    const DecodedProgram::Op *ops = &program.ops()[0];
+    const DecodedProgram::Op *op = ops;
+    unsigned long long steps = 0;
+    NoCounters counters;
+    ExecutionResult result;
+
+#ifdef ENGINE_COMPUTED_GOTO
+    // must follow the order of DecodedProgram::OpCode, optimised ops are not supported
+    static void* const labels[DecodedProgram::OP_Count] = {
+        &&op_z, &&op_s, &&op_t, &&op_j, &&op_halt,
+        &&op_unsupported, &&op_unsupported, &&op_unsupported, &&op_unsupported, &&op_unsupported, &&op_unsupported,
+        &&op_unsupported, &&op_unsupported
+    };
+    ENGINE_DISPATCH();
+#else
+dispatch:
+    switch (op->code) {
+#endif
+
+    ENGINE_OP(op_z, OP_Z)
+        registers[op->arg1].setZero();
+        ++steps;
+        ++op;
+        ENGINE_DISPATCH();
+
+    ENGINE_OP(op_s, OP_S)
+        registers[op->arg1].increment();
+        ++steps;
+        ++op;
+        ENGINE_DISPATCH();
+
+    ENGINE_OP(op_t, OP_T)
+        registers[op->arg2] = registers[op->arg1];
+        ++steps;
+        ++op;
+        ENGINE_DISPATCH();
+
+    ENGINE_OP(op_j, OP_J)
+        ++steps;
+        if (registers[op->arg1] == registers[op->arg2])
+            op = ops + op->target;
+        else
+            ++op;
+        ENGINE_DISPATCH();
+
+    ENGINE_OP(op_halt, OP_Halt)
+        result.haltedAt = program.haltNumber(op->target);
+        result.steps = steps;
+        // optimised ops are not supported, every dispatch executes one instruction
+        result.dispatches = steps;
+        return result;
+
+#ifdef ENGINE_COMPUTED_GOTO
+op_unsupported:
+#else
+    default:
+#endif
+    throw DecodeException("Optimised ops are not supported by the checked engine.", op - ops + 1);
+
+#ifndef ENGINE_COMPUTED_GOTO
+    }
+#endif
+}
@@ -0,0 +1,221 @@
+#ifndef ENGINE_H
+#define ENGINE_H
+
+#include <vector>
+#include <map>
+#include <stdexcept>
+#include <cstdint>
+
+#include "instruction.h"
+#include "loops.h"
+#include "bigregister.h"
+
+class TraceWriter;
+
+
+//-- result of the program execution
+struct ExecutionResult
+{
+    ExecutionResult():
+        haltedAt(0), suspended(false), interrupted(false), steps(0), dispatches(0), compileSeconds(0), cycleSteps(0){}
+
+    // number of instruction (as it would be printed) on which the program terminated.
+    InstructionPos haltedAt;
+    // the execution was stopped by the step limit, haltedAt is the number of the instruction to continue from.
+    bool suspended;
+    // the suspended execution was stopped by the user (see Debugger).
+    bool interrupted;
+    // count of executed URM instructions.
+    unsigned long long steps;
+    // count of dispatches made by the engine (less than steps if superinstructions were used),
+    // 0 if the engine didn't count them: the normal run of the threaded engine doesn't.
+    unsigned long long dispatches;
+    // time spent to decode, optimise and compile the program before the execution.
+    double compileSeconds;
+    // the execution was stopped because the machine state repeated (see CycleDetector), the program never halts:
+    // steps between the repetitions of the state, execution is suspended and haltedAt is the instruction of the state.
+    unsigned long long cycleSteps;
+};
+
+
+//-- execution counters of the profiling run (see Profiler)
+struct ExecutionProfile
+{
+    // count of executions of every instruction
+    std::vector<unsigned long long> executed;
+    // for J: count of executions when the jump was taken, zero for other instructions
+    std::vector<unsigned long long> taken;
+};
+
+
+//-- pre-decoded program
+// Program representation used by the fast engine.
+// All jump targets are resolved to indexes in the ops stream while decoding,
+// so the engine never has to check them at run time. Every jump outside of the program
+// is redirected to the HALT op that remembers instruction number to be reported.
+//
+// URM has no indirect addressing, so all registers program can touch are known after parsing.
+// They are renamed into the dense register file: op arguments are indexes in this file,
+// original numbers are used only to load initial values and to store results.
+//
+// After renaming all operands are narrow, so an op is packed into 16 bytes (4 ops per cache line):
+// instruction numbers of halts and loop summaries are kept in side tables and the op keeps
+// the index only. Programs of 2^31 or more instructions are not decoded, so indexes fit 32 bits.
+class DecodedProgram
+{
+public:
+    enum OpCode : unsigned char {
+        OP_Z = 0, OP_S, OP_T, OP_J, OP_Halt,
+
+        // superinstructions (see PeepholeOptimizer).
+        // Fused op absorbs the ops following it: it reads their arguments
+        // from the following records and skips them after execution.
+        OP_Jmp,     // J(a, a, q)
+        OP_SS,      // S(a); S(b)
+        OP_SJ,      // S(a); J(b, c, q)
+        OP_SJmp,    // S(a); J(b, b, q)
+        OP_TZ,      // T(a, b); Z(c)
+        OP_SSJmp,   // S(a); S(b); J(c, c, q)
+
+        // header of the affine loop (see LoopSummariser).
+        // Behaves as OP_J if the loop can't be summarised at run time.
+        OP_Loop,
+
+        // breakpoint of the debugger (see Debugger): the op replaces an op of the debugged copy
+        // of the program, the engine suspends on it before the replaced op is executed.
+        OP_Break,
+
+        OP_Count
+    };
+
+    typedef uint32_t RegIndex;
+    typedef uint32_t OpIndex;
+
+    struct Op
+    {
+        OpCode   code;
+        RegIndex arg1;
+        RegIndex arg2;
+        // OP_J:    index of the op to jump to;
+        // OP_Halt: index of the instruction number to report on termination (see haltNumber());
+        // OP_Loop: index of the loop summary, the op to jump to is it's exit.
+        OpIndex  target;
+    };
+
+    explicit DecodedProgram(const std::vector<Instruction> &instructions);
+    // restores the program decoded before (see BytecodeFile), the tables are not validated.
+    DecodedProgram(std::size_t instructionsCount, const std::vector<Op> &ops, const std::vector<LoopSummary> &loops,
+                   const std::vector<InstructionPos> &halts, const std::vector<RegNumber> &registerNumbers);
+
+    const std::vector<Op>& ops() const {
+        return mOps;
+    }
+    std::vector<Op>& ops() {
+        return mOps;
+    }
+
+    // count of the source instructions (halt ops are not counted).
+    std::size_t instructionsCount() const {
+        return mInstructionsCount;
+    }
+
+    const LoopSummary& loop(std::size_t index) const {
+        return mLoops[index];
+    }
+    std::size_t addLoop(const LoopSummary &loop) {
+        mLoops.push_back(loop);
+        return mLoops.size() - 1;
+    }
+    std::size_t loopsCount() const {
+        return mLoops.size();
+    }
+
+    // instruction number reported by the halt op (see Op::target).
+    InstructionPos haltNumber(OpIndex index) const {
+        return mHalts[index];
+    }
+    const std::vector<InstructionPos>& halts() const {
+        return mHalts;
+    }
+
+    // original number of the register by it's index in the register file.
+    const std::vector<RegNumber>& registerNumbers() const {
+        return mRegisterNumbers;
+    }
+
+    // creates register file filled with values of the registers.
+    // registers absent in the map are set to zero.
+    std::vector<RegValue> loadRegisters(const std::map<RegNumber, RegValue> &registers) const;
+    // writes register file back to the map using original register numbers.
+    void storeRegisters(const std::vector<RegValue> &registerFile, std::map<RegNumber, RegValue> &registers) const;
+
+private:
+    RegIndex registerIndex(RegNumber number);
+
+private:
+    std::vector<Op> mOps;
+    std::vector<LoopSummary> mLoops;
+    std::vector<InstructionPos> mHalts;
+    std::vector<RegNumber> mRegisterNumbers;
+    std::map<RegNumber, RegIndex> mRegisterIndexes;
+    std::size_t mInstructionsCount;
+};
+
+class DecodeException: public std::runtime_error
+{
+public:
+    DecodeException(std::string message, std::size_t instructionNumber):
+        runtime_error(message), mNumber(instructionNumber){}
+
+    std::size_t instructionNumber() const {
+        return mNumber;
+    }
+
+private:
+    std::size_t mNumber;
+};
+
+
+//-- threaded engine
+// Executes decoded program without any exceptions on the hot path.
+// When compiled by GCC or Clang the computed goto dispatch is used, otherwise - plain switch.
+//
+// The engine is instantiated for registers of RegValue, uint32_t and WideRegValue (where the compiler
+// has 128-bit integers). Registers wrap around on overflow of their own type, so results of the narrow
+// engine are the same only while the values fit 32 bits (see Machine::run()).
+class ThreadedEngine
+{
+public:
+    // registers - register file of the program (see DecodedProgram::loadRegisters),
+    // start     - index of the op to start from (execution continued by another engine).
+    // OP_Break suspends the execution, haltedAt is the number of the instruction replaced by the breakpoint.
+    // Dispatches are not counted, profile() and trace() count them.
+    template<typename Value>
+    ExecutionResult run(const DecodedProgram &program, Value *registers, std::size_t start = 0) const;
+    // same as run() but suspends on the first taken jump after stepLimit steps (see ExecutionResult::suspended).
+    // Jump targets are never absorbed by superinstructions, so the execution can be continued from there
+    // with any optimisation level. This instance is separate, so run() doesn't check the limit.
+    template<typename Value>
+    ExecutionResult run(const DecodedProgram &program, Value *registers, std::size_t start,
+                        unsigned long long stepLimit) const;
+    // same as run() but counts executions of every instruction.
+    // Superinstructions and summarised loops are counted as the instructions they replace.
+    ExecutionResult profile(const DecodedProgram &program, RegValue *registers, ExecutionProfile &counters) const;
+    // same as run() but records the trace of the execution (see TraceWriter).
+    // Program must be decoded without optimisation passes: every step of the trace is one op.
+    ExecutionResult trace(const DecodedProgram &program, RegValue *registers, TraceWriter &writer) const;
+};
+
+
+//-- checked engine
+// Executes decoded program over registers of unlimited size (see BigRegister).
+// Registers use 64-bit fast path until they overflow, so results are exact for any values.
+// Optimised ops are not supported: program must be decoded without optimisation passes.
+class CheckedEngine
+{
+public:
+    ExecutionResult run(const DecodedProgram &program, BigRegister *registers) const;
+};
+
+
+#endif // ENGINE_H
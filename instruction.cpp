@@ -0,0 +1,53 @@
+#include "instruction.h"
+#include <iostream>
+#include <sstream>
+
+Instruction::Instruction(Instruction::Type type, RegNumber reg1, RegNumber reg2, InstructionPos instr):
+    arg1(0), arg2(0), instr(0), mType(type)
+{
+    switch (type){
+    case Instruction::CT_Z:
+    case Instruction::CT_S:
+        this->arg1  = reg1;
+        break;
+
+    case Instruction::CT_T:
+        this->arg1  = reg1;
+        this->arg2  = reg2;
+        break;
+
+    case Instruction::CT_J:
+        this->arg1  = reg1;
+        this->arg2  = reg2;
+        this->instr = instr;
+        break;
+
+#ifdef DEBUG
+    default:
+        std::cout << "ERROR: (Command::Command) - invalid command type;";
+#endif
+    }
+}
+
+void Instruction::setType(Instruction::Type type)
+{
+    mType = type;
+}
+
+Instruction::Type Instruction::type() const
+{
+    return mType;
+}
+
+std::string Instruction::text() const
+{
+    static const char *Names[] = {"Z", "S", "T", "J"};
+    std::ostringstream text;
+    text << Names[mType - 1] << "(" << arg1;
+    if (mType == CT_T || mType == CT_J)
+        text << ", " << arg2;
+    if (mType == CT_J)
+        text << ", " << instr;
+    text << ")";
+    return text.str();
+}
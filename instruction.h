@@ -0,0 +1,41 @@
+#ifndef INSTRUCTION_H
+#define INSTRUCTION_H
+
+#include <cstddef>
+#include <string>
+
+
+typedef unsigned long long int RegValue;
+typedef std::size_t InstructionPos;
+typedef std::size_t RegNumber;
+
+// registers of the threaded engine wider than RegValue (see ThreadedEngine)
+#if defined(__SIZEOF_INT128__)
+#   define REGM_INT128
+typedef unsigned __int128 WideRegValue;
+#endif
+
+class Instruction
+{
+public:
+    enum Type {
+        CT_Z = 1, CT_S, CT_T, CT_J
+    };
+
+    Instruction(Type type, RegNumber arg1=0, RegNumber arg2=0, InstructionPos instr=0);
+    void setType(Type type);
+    Type type() const;
+    // text of the instruction as in the listing: "J(1, 2, 5)"
+    std::string text() const;
+
+public:
+    RegNumber arg1;
+    RegNumber arg2;
+    RegValue  instr;
+
+private:
+    Type mType;
+};
+
+
+#endif // INSTRUCTION_H
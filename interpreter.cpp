@@ -1,116 +1,461 @@
 #include "interpreter.h"
+#include "peephole.h"
+#include "jit.h"
+#include "transpiler.h"
+#include "loader.h"
+#include "bytecode.h"
+#include "batch.h"
+#include "lockstep.h"
+#include "checkpoint.h"
+#include "cycle.h"
+#include "trace.h"
+#include "debugger.h"
+#include "resultcache.h"
+#include <chrono>
+#include <sstream>
+#include <algorithm>
+#include <cctype>
+
+const int Interpreter::MaxOptimisationLevel;
+
+Interpreter::Interpreter():
+    mEngine(ET_Threaded),
+    mOptimisationLevel(MaxOptimisationLevel),
+    mMappedLoading(true),
+    mLoaderThreads(0),
+    mBytecodeCache(true),
+    mLinker(0),
+    mBatchFormat(BatchRunner::BF_Csv),
+    mBatchThreads(0),
+    mPasses(0),
+    mProfiling(false),
+    mStepBudget(0),
+    mCheckpointInterval(60),
+    mCycleDetection(false),
+    mDebugging(false),
+    mResultCacheSize(0),
+    mOutput(&std::cout),
+    mOutputFormat(OutputWriter::OF_Text),
+    mOutputSections(OutputWriter::OS_All),
+    mIsInitialisation(true)
+{
+}
 
-Instruction::Instruction(Instruction::Type type, RegNumber reg1, RegNumber reg2, InstructionPos instr):
-    mType(type)
+void Interpreter::setOutput(std::ostream &output)
 {
-    switch (type){
-    case Instruction::CT_Z:
-    case Instruction::CT_S:
-        this->arg1  = reg1;
-        break;
+    mOutput = &output;
+}
 
-    case Instruction::CT_T:
-        this->arg1  = reg1;
-        this->arg2  = reg2;
-        break;
+void Interpreter::setOutputFormat(OutputWriter::Format format)
+{
+    mOutputFormat = format;
+}
 
-    case Instruction::CT_J:
-        this->arg1  = reg1;
-        this->arg2  = reg2;
-        this->instr = instr;
-        break;
+void Interpreter::setOutputSections(unsigned sections)
+{
+    mOutputSections = sections;
+}
 
-#ifdef DEBUG
-    default:
-        std::cout << "ERROR: (Command::Command) - invalid command type;";
-#endif
-    }
+void Interpreter::setOutputRegisters(const std::vector<RegNumber> &registers)
+{
+    mOutputRegisters = registers;
+}
+
+void Interpreter::setEngine(Interpreter::EngineType engine)
+{
+    mEngine = engine;
 }
 
-void Instruction::setType(Instruction::Type type)
+void Interpreter::setOptimisationLevel(int level)
 {
-    mType = type;
+    mOptimisationLevel = level;
 }
 
-Instruction::Type Instruction::type() const
+void Interpreter::setMappedLoading(bool enabled)
 {
-    return mType;
+    mMappedLoading = enabled;
 }
 
+void Interpreter::setLoaderThreads(unsigned threads)
+{
+    mLoaderThreads = threads;
+}
 
-Interpreter::Interpreter()
+void Interpreter::setTranspileOutput(std::string fileName)
 {
-    // Creating containers for instructions and registers.
-    // Because this containers may be as big as possible thay are created on heap.
+    mTranspileOutput = fileName;
+}
 
-    mInstructions = new std::vector<Instruction>();
-    mRegisters = new std::map<RegNumber, RegValue>();
+void Interpreter::setBytecodeCache(bool enabled)
+{
+    mBytecodeCache = enabled;
+}
+
+void Interpreter::setBytecodeOutput(std::string fileName)
+{
+    mBytecodeOutput = fileName;
+}
+
+void Interpreter::setLinkCache(std::string directory)
+{
+    mLinkCache = directory;
+}
+
+void Interpreter::setLinker(Linker *linker)
+{
+    mLinker = linker;
+}
+
+void Interpreter::setBatchInput(std::string fileName)
+{
+    mBatchInput = fileName;
+}
+
+void Interpreter::setBatchRegisters(const std::vector<RegNumber> &inputs, const std::vector<RegNumber> &outputs)
+{
+    mBatchInputRegisters = inputs;
+    mBatchOutputRegisters = outputs;
+}
+
+void Interpreter::setBatchFormat(BatchRunner::Format format)
+{
+    mBatchFormat = format;
+}
+
+void Interpreter::setBatchThreads(unsigned threads)
+{
+    mBatchThreads = threads;
+}
+
+void Interpreter::setPasses(unsigned passes)
+{
+    mPasses = passes;
+}
+
+void Interpreter::setStepBudget(unsigned long long steps)
+{
+    mStepBudget = steps;
+}
+
+void Interpreter::setCheckpoint(std::string fileName, double intervalSeconds)
+{
+    mCheckpointFile = fileName;
+    mCheckpointInterval = intervalSeconds;
+}
+
+void Interpreter::setResumeFile(std::string fileName)
+{
+    mResumeFile = fileName;
+}
+
+void Interpreter::setCycleDetection(bool enabled)
+{
+    mCycleDetection = enabled;
+}
+
+void Interpreter::setTraceFile(std::string fileName)
+{
+    mTraceFile = fileName;
+}
+
+void Interpreter::setDebugging(bool enabled)
+{
+    mDebugging = enabled;
+}
+
+void Interpreter::setResultCache(std::string directory, unsigned long long maxBytes)
+{
+    mResultCacheDirectory = directory;
+    mResultCacheSize = maxBytes;
+}
+
+void Interpreter::setProfiling(bool enabled)
+{
+    mProfiling = enabled;
+}
+
+void Interpreter::setProfileOutput(std::string fileName)
+{
+    mProfileOutput = fileName;
+    if (! fileName.empty())
+        mProfiling = true;
 }
 
 bool Interpreter::parseFile(std::string fileName)
 {
+    // structured output takes the standard output, messages go to the standard error
+    std::ostream *results = mOutput;
+    if (mOutputFormat != OutputWriter::OF_Text && mOutput == &std::cout)
+        mOutput = &std::cerr;
+    mWriter.reset(new OutputWriter(*results, mOutputFormat));
+    mWriter->setSections(mOutputSections);
+    mWriter->setRegisters(mOutputRegisters);
+
     if (fileName.empty()){
-        std::cout << "No input file specified. Process stopped." << std::endl;
+        *mOutput << "No input file specified. Process stopped." << std::endl;
         return false;
     }
 
-    std::ifstream inputFile(fileName.c_str());
-    if (! inputFile){
-        std::cout << "Can't open file \"" << fileName << "\". Process stopped." << std::endl;
+    if (mOutputFormat == OutputWriter::OF_Binary && mEngine == ET_Checked){
+        *mOutput << "ERROR: Binary output holds 64-bit values, it can't be used with the checked engine. "
+                 << "Process stopped." << std::endl;
         return false;
     }
 
-    // parse file and execute instructions
-    std::string line;
-    std::size_t lineNumber = 0;
-    bool result = true;
+    if (! loadFile(fileName))
+        return false;
 
-    while (std::getline(inputFile, line)){
-        try {
-            ++lineNumber;
-            parseLine(line);
+    // in batch mode the standard output contains results only
+    if (! mBatchInput.empty()){
+        if (mInstructions.empty()){
+            *mOutput << "No instructions occured. Process stoped." << std::endl;
+            return false;
+        }
+        applyPasses(std::cerr);
+        return runBatch();
+    }
 
-        } catch(EmptyCommandExpcept &){
-            // ignore empty line
-            continue;
+    // if some of registers was inititalised before instructions - print their values.
+    mWriter->writeRegisters(OutputWriter::OS_Initial, mRegisters, mBigRegisters);
 
-        } catch (InvalidCommandSyntaxExcept &e){
-            std::cout << "Parse error at " << "[" << lineNumber << "; " << e.index() << "]: "
-                      << e.what() << std::endl;
-            result = false;
-            continue;
+    // if instructions count > 0 - print all instructions
+    // else - stop the interpreter.
+    if (mInstructions.size() > 0){
+        mWriter->writeListing(mInstructions);
+    } else {
+        *mOutput << std::endl << "No instructions occured. Process stoped." << std::endl;
+        return false;
+    }
 
-        } catch(std::exception &){
-            std::cout << "Parse error at " << "[" << lineNumber << "; ?]: Unknown error." << std::endl;
-            result = false;
-            continue;
+    if (! mTranspileOutput.empty())
+        return transpile(fileName);
+
+    applyPasses(*mOutput);
+    return run();
+}
+
+bool Interpreter::loadFile(std::string fileName)
+{
+    mCompiled.reset();
+    if (isBytecodeName(fileName))
+        return loadBytecode(fileName);
+
+    // compiled program is used while the source is not changed
+    SourceStamp stamp;
+    bool isCacheable = mBytecodeCache && stamp.read(fileName);
+    std::string cacheName = BytecodeFile::cacheName(fileName);
+    if (isCacheable){
+        BytecodeFile cache;
+        if (cache.open(cacheName) && cache.isCompiledFrom(stamp)){
+            cache.read(mRegisters, mInstructions);
+            // the decoded program of another level is replaced by the one of this run
+            if (isDecodedOnLoad() && cache.optimisationLevel() == mOptimisationLevel)
+                mCompiled = cache.readProgram(mInstructions, mRegisters);
+            else if (decodeThreaded())
+                BytecodeFile::write(cacheName, stamp, mRegisters, mInstructions, mCompiled.get());
+            return writeBytecode(mBytecodeOutput, SourceStamp());
         }
     }
-    inputFile.close();
+
+    std::ifstream inputFile(fileName.c_str());
+    if (! inputFile){
+        *mOutput << "Can't open file \"" << fileName << "\". Process stopped." << std::endl;
+        return false;
+    }
+
+    // files that can't be mapped (pipes, devices) are read line by line
+    MappedFile file;
+    bool result = true;
+    if (mMappedLoading && file.open(fileName)){
+        inputFile.close();
+        result = loadMapped(file);
+    } else
+        result = loadStream(inputFile);
 
     if (! result){
-        std::cout << "Process stopped. File \"" << fileName.c_str()
+        *mOutput << "Process stopped. File \"" << fileName.c_str()
                   << "\" contains invalid instructions and can't be executed." << std::endl;
         return false;
     }
 
-    // if some of registers was inititalised before instructions - print their values.
-    if (mRegisters->size() > 0){
-        std::cout << "Register's initial values: " << std::endl;
-        printAllRegisters();
+    if (! mCalls.empty() && ! link(fileName))
+        return false;
+
+    // cache can't be written (read-only directory, etc.) - the program is just parsed next time.
+    // The stamp covers only the source, so programs that call modules are not cached.
+    if (isCacheable && mBigRegisters.empty() && mCalls.empty()){
+        decodeThreaded();
+        BytecodeFile::write(cacheName, stamp, mRegisters, mInstructions, mCompiled.get());
     }
+    return writeBytecode(mBytecodeOutput, stamp);
+}
 
-    // if instructions count > 0 - print all instructions
-    // else - stop the interpreter.
-    if (mInstructions->size() > 0){
-        std::cout << std::endl << "Instructions: " << std::endl;
-        printAllInstructions();
-    } else {
-        std::cout << std::endl << "No instructions occured. Process stoped." << std::endl;
+bool Interpreter::link(const std::string &fileName)
+{
+    // modules called by modules are linked by the same linker, errors go to the calling program
+    if (mLinker){
+        mLinker->link(fileName, mInstructions, mCalls);
+        return true;
+    }
+
+    try {
+        Linker linker(mLinkCache);
+        linker.link(fileName, mInstructions, mCalls);
+        const Linker::Stats &stats = linker.stats();
+        *mOutput << std::endl << "Linked " << stats.calls << " calls of " << stats.modules << " modules ("
+                 << stats.cached << " from the link cache), " << mInstructions.size() << " instructions." << std::endl;
+
+    } catch (LinkException &e) {
+        *mOutput << "ERROR: " << e.what() << " Process stopped." << std::endl;
+        return false;
+    }
+    return true;
+}
+
+bool Interpreter::isBytecodeName(const std::string &fileName)
+{
+    std::string extension = ".rmlc";
+    return fileName.size() > extension.size()
+            && fileName.compare(fileName.size() - extension.size(), extension.size(), extension) == 0;
+}
+
+bool Interpreter::loadBytecode(const std::string &fileName)
+{
+    BytecodeFile file;
+    if (! file.open(fileName)){
+        *mOutput << "Can't load compiled program \"" << fileName << "\": file is absent or damaged. Process stopped."
+                  << std::endl;
         return false;
     }
 
-    run();
+    file.read(mRegisters, mInstructions);
+    if (isDecodedOnLoad() && file.optimisationLevel() == mOptimisationLevel)
+        mCompiled = file.readProgram(mInstructions, mRegisters);
+    return writeBytecode(mBytecodeOutput, SourceStamp());
+}
+
+bool Interpreter::isDecodedOnLoad() const
+{
+    // the passes change the instructions after the load
+    return mEngine == ET_Threaded && mPasses == 0 && mBigRegisters.empty();
+}
+
+bool Interpreter::decodeThreaded()
+{
+    if (! isDecodedOnLoad())
+        return false;
+
+    try {
+        mCompiled = std::make_shared<const Program>(mInstructions, mRegisters, mOptimisationLevel);
+    } catch (DecodeException &) {
+        // the run reports the error
+        return false;
+    }
+    return true;
+}
+
+bool Interpreter::writeBytecode(const std::string &fileName, const SourceStamp &stamp)
+{
+    if (fileName.empty())
+        return true;
+
+    if (! mBigRegisters.empty()){
+        *mOutput << "Can't compile program: initial values of the registers don't fit 64 bits. Process stopped."
+                  << std::endl;
+        return false;
+    }
+    if (! mCompiled)
+        decodeThreaded();
+    if (! BytecodeFile::write(fileName, stamp, mRegisters, mInstructions, mCompiled.get())){
+        *mOutput << "Can't write compiled program to \"" << fileName << "\". Process stopped." << std::endl;
+        return false;
+    }
+    return true;
+}
+
+bool Interpreter::loadStream(std::istream &input)
+{
+    std::string line;
+    std::size_t lineNumber = 0;
+    bool result = true;
+
+    while (std::getline(input, line)){
+        ++lineNumber;
+        if (! parseLine(line, lineNumber))
+            result = false;
+    }
+    return result;
+}
+
+bool Interpreter::loadMapped(const MappedFile &file)
+{
+    std::vector<LoadedChunk> chunks;
+    ProgramLoader(mLoaderThreads).lex(file.data(), file.size(), chunks);
+
+    std::size_t instructionsCount = mInstructions.size();
+    for (std::size_t i=0; i<chunks.size(); ++i)
+        instructionsCount += chunks[i].instructions.size();
+
+    // merge chunks in order, lines that were not lexed are parsed as usual
+    std::size_t lineOffset = 0;
+    bool result = true;
+
+    for (std::size_t i=0; i<chunks.size(); ++i){
+        LoadedChunk &chunk = chunks[i];
+        std::size_t next = 0;
+
+        for (std::size_t j=0; j<chunk.events.size(); ++j){
+            const LoadedChunk::Event &event = chunk.events[j];
+            if (event.instructionIndex > next){
+                mInstructions.reserve(instructionsCount);
+                mInstructions.insert(mInstructions.end(), chunk.instructions.begin() + next,
+                                      chunk.instructions.begin() + event.instructionIndex);
+                next = event.instructionIndex;
+                mIsInitialisation = false;
+            }
+
+            if (event.kind == LoadedChunk::Event::EK_Init && mIsInitialisation){
+                mBigRegisters.erase(event.reg);
+                setRegisterValue(event.reg, event.value);
+            } else if (! parseLine(std::string(event.text, event.length), lineOffset + event.line + 1))
+                result = false;
+        }
+
+        if (chunk.instructions.size() > next){
+            // the common case: all instructions of the first chunk follow initialisation,
+            // they are taken without copying.
+            if (next == 0 && mInstructions.empty())
+                mInstructions.swap(chunk.instructions);
+            else {
+                mInstructions.reserve(instructionsCount);
+                mInstructions.insert(mInstructions.end(), chunk.instructions.begin() + next, chunk.instructions.end());
+            }
+            mIsInitialisation = false;
+        }
+        std::vector<Instruction>().swap(chunk.instructions);
+        lineOffset += chunk.lines;
+    }
+
+    return result;
+}
+
+bool Interpreter::parseLine(const std::string &line, std::size_t lineNumber)
+{
+    try {
+        parseLine(line);
+
+    } catch(EmptyCommandExpcept &){
+        // ignore empty line
+
+    } catch (InvalidCommandSyntaxExcept &e){
+        *mOutput << "Parse error at " << "[" << lineNumber << "; " << e.index() << "]: "
+                  << e.what() << std::endl;
+        return false;
+
+    } catch(std::exception &){
+        *mOutput << "Parse error at " << "[" << lineNumber << "; ?]: Unknown error." << std::endl;
+        return false;
+    }
     return true;
 }
 
@@ -145,6 +490,28 @@ void Interpreter::execInstruction(Instruction instruction)
     }
 }
 
+bool Interpreter::parseNumber(const std::string &digits, RegValue &value)
+{
+    value = 0;
+    for (std::size_t i=0; i<digits.length(); ++i){
+        RegValue digit = digits[i] - '0';
+        if (value > (~RegValue(0) - digit) / 10)
+            return false;
+        value = value * 10 + digit;
+    }
+    return true;
+}
+
+bool Interpreter::parseNumber(const std::string &digits, std::size_t &value)
+{
+    RegValue number;
+    if (! parseNumber(digits, number) || number > RegValue(~std::size_t(0)))
+        return false;
+
+    value = (std::size_t)number;
+    return true;
+}
+
 bool Interpreter::parseLine(std::string instruction)
 {
     if (instruction.empty())
@@ -158,10 +525,9 @@ bool Interpreter::parseLine(std::string instruction)
             break;
     }
 
-    static bool isInitialisation = true;
     // check for initial instruction
     if (instruction[pos] == 'r' || instruction[pos] == 'R'){
-        if (! isInitialisation)
+        if (! mIsInitialisation)
             throw InvalidCommandSyntaxExcept("Initialisation instructions not allowed here.", pos+1);
 
         ++pos;
@@ -170,24 +536,35 @@ bool Interpreter::parseLine(std::string instruction)
 
     // check for regular instruction
     else if (instruction[pos] == 'z' || instruction[pos] == 'Z'){
-        isInitialisation = false;
+        mIsInitialisation = false;
         ++pos;
         return parseInstruction(instruction.substr(pos), Instruction::CT_Z, pos+1);
 
     } else if (instruction[pos] == 's' || instruction[pos] == 'S'){
-        isInitialisation = false;
+        mIsInitialisation = false;
         ++pos;
         return parseInstruction(instruction.substr(pos), Instruction::CT_S, pos+1);
 
     } else if (instruction[pos] == 't' || instruction[pos] == 'T'){
-        isInitialisation = false;
+        mIsInitialisation = false;
         ++pos;
         return parseInstruction(instruction.substr(pos), Instruction::CT_T, pos+1);
 
     } else if (instruction[pos] == 'j' || instruction[pos] == 'J'){
-        isInitialisation = false;
+        mIsInitialisation = false;
         ++pos;
         return parseInstruction(instruction.substr(pos), Instruction::CT_J, pos+1);
+
+    } else if (instruction[pos] == 'c' || instruction[pos] == 'C'){
+        std::string keyword = instruction.substr(pos, 4);
+        for (std::size_t i=0; i<keyword.size(); ++i)
+            keyword[i] = toupper(keyword[i]);
+        if (keyword != "CALL")
+            throw InvalidCommandSyntaxExcept("Invalid symbol occurred. CALL expected.", pos+1);
+
+        mIsInitialisation = false;
+        pos += 4;
+        return parseCallInstruction(instruction.substr(pos), pos+1);
     }
 
     throw InvalidCommandSyntaxExcept("Invalid symbol occurred.", pos+1);
@@ -259,8 +636,9 @@ bool Interpreter::parseInstruction(std::string instruction, Instruction::Type co
                     if (arg1.empty())
                         throw InvalidCommandSyntaxExcept("First argument can't be empty.", pos+carretOffset);
 
-                    command.arg1 = atoll(arg1.c_str());
-                    mInstructions->push_back(command);
+                    if (! parseNumber(arg1, command.arg1))
+                        throw InvalidCommandSyntaxExcept("First argument is too big.", pos+carretOffset);
+                    mInstructions.push_back(command);
                     return true;
                 }
             }
@@ -272,9 +650,10 @@ bool Interpreter::parseInstruction(std::string instruction, Instruction::Type co
                 if (arg1.empty())
                     throw InvalidCommandSyntaxExcept("First argument can't be empty.", pos+carretOffset);
 
-                command.arg1 = atoll(arg1.c_str());
+                if (! parseNumber(arg1, command.arg1))
+                    throw InvalidCommandSyntaxExcept("First argument is too big.", pos+carretOffset);
                 if (command.type() == Instruction::CT_Z || command.type() == Instruction::CT_S){
-                    mInstructions->push_back(command);
+                    mInstructions.push_back(command);
                     return true;
                 }
 
@@ -328,8 +707,9 @@ bool Interpreter::parseInstruction(std::string instruction, Instruction::Type co
                     if (arg2.empty())
                         throw InvalidCommandSyntaxExcept("Second argument can't be empty.", pos+carretOffset);
 
-                    command.arg2 = atoll(arg2.c_str());
-                    mInstructions->push_back(command);
+                    if (! parseNumber(arg2, command.arg2))
+                        throw InvalidCommandSyntaxExcept("Second argument is too big.", pos+carretOffset);
+                    mInstructions.push_back(command);
                     return true;
                 }
             }
@@ -341,7 +721,8 @@ bool Interpreter::parseInstruction(std::string instruction, Instruction::Type co
                 if (arg2.empty())
                     throw InvalidCommandSyntaxExcept("Second argument can't be empty.", pos+carretOffset);
 
-                command.arg2 = atoll(arg2.c_str());
+                if (! parseNumber(arg2, command.arg2))
+                    throw InvalidCommandSyntaxExcept("Second argument is too big.", pos+carretOffset);
                 ++pos;
                 break;
             }
@@ -379,7 +760,8 @@ bool Interpreter::parseInstruction(std::string instruction, Instruction::Type co
             if (arg3.empty())
                 throw InvalidCommandSyntaxExcept("Third argument can't be empty.", pos+carretOffset);
 
-            command.instr = atoll(arg3.c_str());
+            if (! parseNumber(arg3, command.instr))
+                throw InvalidCommandSyntaxExcept("Third argument is too big.", pos+carretOffset);
 
             // ignoring space symbols between third argument and close parenthesis
             for (; pos<instruction.length(); ++pos){
@@ -389,7 +771,7 @@ bool Interpreter::parseInstruction(std::string instruction, Instruction::Type co
             if (instruction.length() == pos || instruction.at(pos) != ')')
                 throw InvalidCommandSyntaxExcept("Invalid symbol occurred. Close parenthesis expected.", pos+carretOffset);
 
-            mInstructions->push_back(command);
+            mInstructions.push_back(command);
             return true;
         }
     }
@@ -397,6 +779,75 @@ bool Interpreter::parseInstruction(std::string instruction, Instruction::Type co
     return false;
 }
 
+// skips spaces around the number, returns it's digits
+static std::string readDigits(const std::string &instruction, std::size_t &pos)
+{
+    for (; pos<instruction.length() && instruction.at(pos) == ' '; ++pos);
+    std::size_t begin = pos;
+    for (; pos<instruction.length() && instruction.at(pos) >= '0' && instruction.at(pos) <= '9'; ++pos);
+    std::string digits = instruction.substr(begin, pos - begin);
+    for (; pos<instruction.length() && instruction.at(pos) == ' '; ++pos);
+    return digits;
+}
+
+bool Interpreter::parseCallInstruction(std::string instruction, std::size_t carretOffset)
+{
+    std::size_t pos = 0;
+    for (; pos<instruction.length() && instruction.at(pos) == ' '; ++pos);
+    if (instruction.length() == pos)
+        throw InvalidCommandSyntaxExcept("Unexpected end of instruction occurred.", pos+carretOffset);
+    if (instruction.at(pos) != '(')
+        throw InvalidCommandSyntaxExcept("Invalid syntax. Open parenthesis is expected.", pos+carretOffset);
+    ++pos;
+
+    // file name is everything up to the comma, spaces around it are ignored
+    Linker::Call call;
+    std::size_t comma = instruction.find(',', pos);
+    if (comma == std::string::npos)
+        throw InvalidCommandSyntaxExcept("Invalid syntax. Comma after the module name is expected.", pos+carretOffset);
+    std::size_t first = instruction.find_first_not_of(' ', pos);
+    if (first >= comma)
+        throw InvalidCommandSyntaxExcept("Module name can't be empty.", pos+carretOffset);
+    call.fileName = instruction.substr(first, instruction.find_last_not_of(' ', comma - 1) - first + 1);
+    pos = comma + 1;
+
+    std::string base = readDigits(instruction, pos);
+    if (base.empty())
+        throw InvalidCommandSyntaxExcept("Base register can't be empty.", pos+carretOffset);
+    if (! parseNumber(base, call.base))
+        throw InvalidCommandSyntaxExcept("Base register is too big.", pos+carretOffset);
+
+    // registers of the module mapped to the registers of the program: ", 0:5"
+    while (pos<instruction.length() && instruction.at(pos) == ','){
+        ++pos;
+        std::pair<RegNumber, RegNumber> mapping;
+        std::string from = readDigits(instruction, pos);
+        if (from.empty() || ! parseNumber(from, mapping.first))
+            throw InvalidCommandSyntaxExcept("Invalid register of the module.", pos+carretOffset);
+        if (pos == instruction.length() || instruction.at(pos) != ':')
+            throw InvalidCommandSyntaxExcept("Invalid symbol occurred. Colon expected.", pos+carretOffset);
+        ++pos;
+        std::string to = readDigits(instruction, pos);
+        if (to.empty() || ! parseNumber(to, mapping.second))
+            throw InvalidCommandSyntaxExcept("Invalid register of the program.", pos+carretOffset);
+        call.registers.push_back(mapping);
+    }
+    if (pos == instruction.length() || instruction.at(pos) != ')')
+        throw InvalidCommandSyntaxExcept("Invalid symbol occurred. Close parenthesis expected.", pos+carretOffset);
+
+    std::sort(call.registers.begin(), call.registers.end());
+    for (std::size_t i=1; i<call.registers.size(); ++i){
+        if (call.registers[i].first == call.registers[i - 1].first)
+            throw InvalidCommandSyntaxExcept("Register of the module is mapped twice.", pos+carretOffset);
+    }
+
+    // the placeholder keeps numbers of the following instructions
+    call.index = mInstructions.size();
+    mCalls.push_back(call);
+    mInstructions.push_back(Instruction(Instruction::CT_J));
+    return true;
+}
+
 bool Interpreter::parseInitInstruction(std::string instruction, std::size_t carretOffset)
 {
     std::size_t pos = 0;
@@ -472,53 +923,200 @@ bool Interpreter::parseInitInstruction(std::string instruction, std::size_t carr
     if (regValue.empty())
         throw InvalidCommandSyntaxExcept("Register's value can't be empty.", pos+carretOffset);
 
-    // initialise the register
-    setRegisterValue(atoll(regNumber.c_str()), atoll(regValue.c_str()));
+    RegNumber number;
+    if (! parseNumber(regNumber, number))
+        throw InvalidCommandSyntaxExcept("Register's number is too big.", pos+carretOffset);
+
+    // initialise the register,
+    // values over 64 bits can be used only by the checked engine.
+    RegValue value;
+    if (! parseNumber(regValue, value)){
+        if (mEngine != ET_Checked)
+            throw InvalidCommandSyntaxExcept("Register's value doesn't fit 64 bits. Use checked engine for such values.", pos+carretOffset);
+
+        BigRegister bigValue;
+        bigValue.setDecimal(regValue);
+        mBigRegisters[number] = bigValue.toDecimal();
+        setRegisterValue(number, 0);
+        return true;
+    }
+
+    mBigRegisters.erase(number);
+    setRegisterValue(number, value);
     return true;
 }
 
-void Interpreter::printAllInstructions() const
+void Interpreter::applyPasses(std::ostream &report)
 {
-    std::vector<Instruction>::const_iterator it = mInstructions->begin();
-    std::size_t number=0;
-
-    for (; it != mInstructions->end(); ++it, ++number){
-        std::cout << "[ins " << number+1 << "]: ";
-        switch ((*it).type()) {
-        case Instruction::CT_Z:
-            std::cout << "Z(" << (*it).arg1 << ")" << std::endl;
-            break;
+    if (mPasses == 0)
+        return;
+    mCompiled.reset();
+
+    // registers of the removed instructions are still printed in the results
+    for (std::size_t i=0; i<mInstructions.size(); ++i){
+        const Instruction &instruction = mInstructions[i];
+        mRegisters.insert(std::make_pair(instruction.arg1, RegValue(0)));
+        if (instruction.type() == Instruction::CT_T || instruction.type() == Instruction::CT_J)
+            mRegisters.insert(std::make_pair(instruction.arg2, RegValue(0)));
+    }
 
-        case Instruction::CT_S:
-            std::cout << "S(" << (*it).arg1 << ")" << std::endl;
-            break;
+    PassPipeline::Stats stats = PassPipeline(mPasses).run(mInstructions, mHaltNumbers, mSourceNumbers);
+    report << std::endl << "Passes: " << stats.blocks << " blocks";
+    if (mPasses & PassPipeline::PS_Coalescing)
+        report << "; coalescing: " << stats.coalescedReads << " register reads";
+    if (mPasses & PassPipeline::PS_DeadStores)
+        report << "; dead stores: " << stats.deadStores << " removed";
+    if (mPasses & PassPipeline::PS_JumpThreading)
+        report << "; jump threading: " << stats.threadedJumps << " jumps";
+    if (mPasses & PassPipeline::PS_BlockLayout)
+        report << "; layout: " << stats.removedJumps << " jumps removed";
+    report << "; " << stats.unreachableInstructions << " unreachable instructions removed. "
+           << stats.instructionsBefore << " -> " << stats.instructionsAfter << " instructions." << std::endl;
+}
 
-        case Instruction::CT_T:
-            std::cout << "T(" << (*it).arg1 << ", " << (*it).arg2 << ")" << std::endl;
-            break;
+InstructionPos Interpreter::originalNumber(const ExecutionResult &result) const
+{
+    if (result.suspended)
+        return ControlFlowGraph::originalInstruction(result.haltedAt, mSourceNumbers);
+    return ControlFlowGraph::originalHalt(result.haltedAt, mInstructions.size(), mHaltNumbers);
+}
 
-        case Instruction::CT_J:
-            std::cout << "J(" << (*it).arg1 << ", " << (*it).arg2 << ", " << (*it).instr << ")" << std::endl;
-            break;
-        }
+bool Interpreter::run()
+{
+    ExecutionResult result;
+    ExecutionProfile profile;
+    HardwareCounters counters;
+    std::chrono::steady_clock::time_point startTime = std::chrono::steady_clock::now();
+
+    if ((mStepBudget > 0 || ! mCheckpointFile.empty() || ! mResumeFile.empty() || mCycleDetection)
+            && (mEngine != ET_Threaded || mProfiling)){
+        *mOutput << std::endl << "ERROR: Step budget, checkpoints, resume and cycle detection are supported "
+                  << "by the threaded engine without profiling only. Process stopped." << std::endl;
+        return false;
     }
+    if (! mTraceFile.empty() && (mEngine != ET_Threaded || mProfiling || mStepBudget > 0 || ! mCheckpointFile.empty()
+                                 || ! mResumeFile.empty() || mCycleDetection)){
+        *mOutput << std::endl << "ERROR: Tracing is supported by the threaded engine without profiling, step budget, "
+                  << "checkpoints and cycle detection only. Process stopped." << std::endl;
+        return false;
+    }
+    if (mDebugging && (mEngine != ET_Threaded || mProfiling || mStepBudget > 0 || ! mCheckpointFile.empty()
+                       || ! mResumeFile.empty() || mCycleDetection || ! mTraceFile.empty())){
+        *mOutput << std::endl << "ERROR: The debugger is supported by the threaded engine without profiling, step budget, "
+                  << "checkpoints, cycle detection and tracing only. Process stopped." << std::endl;
+        return false;
+    }
+
+    // interrupted runs and big values are not cached, the traced run is always executed
+    ResultCache cache(mResultCacheDirectory, mResultCacheSize);
+    bool isCacheable = ! mResultCacheDirectory.empty() && ! mProfiling && mEngine != ET_Checked
+            && mStepBudget == 0 && mCheckpointFile.empty() && mResumeFile.empty() && mBigRegisters.empty()
+            && mTraceFile.empty() && ! mDebugging;
+    ResultCache::Key cacheKey = isCacheable ? ResultCache::key(mEngine, mInstructions, mRegisters) : ResultCache::Key();
+    bool isCached = isCacheable && cache.find(cacheKey, result, mRegisters);
+
+    if (isCached){
+        // registers and the instruction of the halt are taken from the cache
+    } else if (mProfiling){
+        if (! runProfiled(result, profile, counters))
+            return false;
+    } else if (! mTraceFile.empty()){
+        if (! runTraced(result))
+            return false;
+    } else if (mDebugging){
+        if (! runDebugged(result))
+            return false;
+    } else if (! runEngine(result))
+        return false;
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count()
+            - result.compileSeconds;
+    mLastResult = result;
+
+    // the cache keeps the original number
+    if (! isCached)
+        result.haltedAt = originalNumber(result);
+    mWriter->writeHalt(result);
+    mWriter->writeRegisters(OutputWriter::OS_Results, mRegisters, mBigRegisters);
+
+    if (isCacheable)
+        printResultCache(cache, cacheKey, result, isCached);
+
+    mWriter->writeStats(result, seconds, isCached);
+
+    if (mProfiling)
+        printProfile(result, profile, counters, seconds);
+    return true;
 }
 
-void Interpreter::printAllRegisters() const
+bool Interpreter::runEngine(ExecutionResult &result)
 {
-    std::map<RegNumber, RegValue>::const_iterator it = mRegisters->begin();
-    for (; it != mRegisters->end(); ++it){
-        std::cout << "[reg " << (*it).first << "]: " << (*it).second << std::endl;
+    switch (mEngine) {
+    case ET_Reference:
+        return runReference(result);
+    case ET_Threaded:
+        return runThreaded(result);
+    case ET_Jit:
+        return runJit(result);
+    case ET_Checked:
+        return runChecked(result);
+    case ET_Lockstep:
+        return runLockstep(result);
     }
+    return false;
+}
+
+bool Interpreter::execute(const std::vector<Instruction> &instructions, std::map<RegNumber, RegValue> &registers,
+                          ExecutionResult &result)
+{
+    mInstructions = instructions;
+    mRegisters = registers;
+    mBigRegisters.clear();
+    mHaltNumbers.clear();
+    mSourceNumbers.clear();
+    mCompiled.reset();
+
+    // messages of the engines and of the passes are dropped
+    std::ostringstream messages;
+    std::ostream *output = mOutput;
+    mOutput = &messages;
+    std::chrono::steady_clock::time_point startTime = std::chrono::steady_clock::now();
+    applyPasses(messages);
+    double passesSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+    bool isRun = runEngine(result);
+    mOutput = output;
+
+    if (! isRun)
+        return false;
+    result.compileSeconds += passesSeconds;
+    result.haltedAt = originalNumber(result);
+    mLastResult = result;
+    registers = mRegisters;
+    return true;
 }
 
-void Interpreter::run()
+void Interpreter::printResultCache(ResultCache &cache, const ResultCache::Key &key, const ExecutionResult &result,
+                                   bool isCached) const
+{
+    // the cache has no place for the cycle
+    if (! isCached && result.cycleSteps == 0 && ! cache.store(key, result, mRegisters))
+        *mOutput << std::endl << "WARNING: Can't write result to the cache \"" << mResultCacheDirectory << "\"." << std::endl;
+
+    ResultCache::Statistics statistics = cache.statistics();
+    *mOutput << std::endl << "Result cache: " << (isCached ? "hit" : "miss") << "; " << statistics.hits << " hits, "
+              << statistics.misses << " misses, " << statistics.entries << " entries of "
+              << statistics.bytes << " bytes in total." << std::endl;
+}
+
+bool Interpreter::runReference(ExecutionResult &result)
 {
     std::size_t nextCommand = 0;
+    unsigned long long steps = 0;
 
-    while (nextCommand < mInstructions->size()){
+    while (nextCommand < mInstructions.size()){
         try {
-            Instruction instruction = mInstructions->at(nextCommand);
+            Instruction instruction = mInstructions.at(nextCommand);
+            ++steps;
 
             try {
                 execInstruction(instruction);
@@ -530,32 +1128,455 @@ void Interpreter::run()
             }
 
         } catch (std::bad_alloc &) {
-            std::cout << "ERROR: Not enough system memory. Process stopped.";
-            return;
+            *mOutput << "ERROR: Not enough system memory. Process stopped.";
+            return false;
         } catch(std::exception &) {
-            std::cout << "Unknown error occured. Process stopped.";
-            return;
+            *mOutput << "Unknown error occured. Process stopped.";
+            return false;
+        }
+    }
+
+    result.haltedAt = nextCommand+1;
+    result.steps = steps;
+    result.dispatches = steps;
+    return true;
+}
+
+bool Interpreter::runThreaded(ExecutionResult &result)
+{
+    try {
+        // the program decoded on load (see BytecodeFile) is not decoded again
+        std::chrono::steady_clock::time_point startTime = std::chrono::steady_clock::now();
+        std::shared_ptr<const Program> compiled = mCompiled;
+        if (! compiled || compiled->optimisationLevel() != mOptimisationLevel)
+            compiled = std::make_shared<const Program>(mInstructions, mRegisters, mOptimisationLevel);
+        const Program &program = *compiled;
+        double compileSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+        const PeepholeOptimizer::Stats &stats = program.optimisation().peephole;
+        if (mOptimisationLevel > 0){
+            *mOutput << std::endl << "Optimisation level " << mOptimisationLevel << ": "
+                      << stats.unconditionalJumps << " unconditional jumps, "
+                      << stats.superinstructions << " superinstructions replacing "
+                      << stats.superinstructions + stats.absorbedOps << " instructions";
+            if (mOptimisationLevel >= 4)
+                *mOutput << ", " << program.optimisation().loops << " affine loops summarised";
+            *mOutput << "." << std::endl;
+        }
+
+        // registers of the snapshot replace the initial values
+        Checkpoint checkpoint;
+        if (! mResumeFile.empty() && ! resume(checkpoint))
+            return false;
+
+        Machine machine(program, mRegisters);
+        machine.setNext(checkpoint.next);
+        if (mStepBudget == 0 && mCheckpointFile.empty() && ! mCycleDetection)
+            result = machine.run();
+        else
+            result = runCheckpointed(machine, checkpoint);
+        result.steps += checkpoint.steps;
+        result.compileSeconds = compileSeconds;
+        machine.storeRegisters(mRegisters);
+
+    } catch (DecodeException &e) {
+        *mOutput << "ERROR: Can't decode instruction " << e.instructionNumber() << ": "
+                  << e.what() << " Process stopped." << std::endl;
+        return false;
+    }
+    return true;
+}
+
+bool Interpreter::resume(Checkpoint &checkpoint)
+{
+    if (! checkpoint.read(mResumeFile)){
+        *mOutput << "ERROR: Can't read checkpoint \"" << mResumeFile << "\". Process stopped." << std::endl;
+        return false;
+    }
+    if (checkpoint.programHash != Checkpoint::hash(mInstructions)){
+        *mOutput << "ERROR: Checkpoint \"" << mResumeFile << "\" was made for another program. Process stopped." << std::endl;
+        return false;
+    }
+    if (checkpoint.next >= mInstructions.size()){
+        *mOutput << "ERROR: Checkpoint \"" << mResumeFile << "\" continues from instruction " << checkpoint.next + 1
+                  << " outside of the program of " << mInstructions.size() << " instructions. Process stopped." << std::endl;
+        return false;
+    }
+
+    mRegisters = checkpoint.registers;
+    *mOutput << std::endl << "Resumed from instruction "
+              << ControlFlowGraph::originalInstruction(checkpoint.next + 1, mSourceNumbers) << " after "
+              << checkpoint.steps << " steps." << std::endl;
+    return true;
+}
+
+ExecutionResult Interpreter::runCheckpointed(Machine &machine, const Checkpoint &resumed) const
+{
+    // the engine returns after a slice of steps to check the time of the next checkpoint and the state
+    const unsigned long long SliceSteps = 1ULL << 24;
+    // single jumps made to find the exact period of the cycle
+    const unsigned long long MaxPeriodJumps = 1ULL << 20;
+
+    Checkpoint checkpoint;
+    checkpoint.programHash = Checkpoint::hash(mInstructions);
+    std::chrono::steady_clock::time_point lastCheckpoint = std::chrono::steady_clock::now();
+
+    CycleDetector detector(machine);
+    ExecutionResult result;
+    // steps of the previous runs count against the budget too
+    unsigned long long steps = resumed.steps, dispatches = 0;
+
+    for (;;){
+        unsigned long long limit = mCheckpointFile.empty() && ! mCycleDetection ? ~0ULL : SliceSteps;
+        if (mStepBudget > 0)
+            limit = std::min(limit, mStepBudget > steps ? mStepBudget - steps : 0);
+        // the limit of 1 step stops on the first taken jump too, 0 would be no limit for the machine
+        limit = std::max(limit, 1ULL);
+
+        result = machine.run(limit);
+        steps += result.steps;
+        dispatches += result.dispatches;
+        if (! result.suspended)
+            break;
+
+        // the period is searched from the repeated state and ends in it, so its steps are not counted
+        if (mCycleDetection && detector.observe(result.steps)){
+            result.cycleSteps = detector.period(machine, MaxPeriodJumps);
+            break;
+        }
+
+        bool isExhausted = mStepBudget > 0 && steps >= mStepBudget;
+        if (! mCheckpointFile.empty() && (isExhausted || std::chrono::duration<double>(
+                std::chrono::steady_clock::now() - lastCheckpoint).count() >= mCheckpointInterval)){
+            checkpoint.next = machine.next();
+            checkpoint.steps = steps;
+            checkpoint.registers = mRegisters;
+            machine.storeRegisters(checkpoint.registers);
+            if (! checkpoint.write(mCheckpointFile))
+                *mOutput << "WARNING: Can't write checkpoint \"" << mCheckpointFile << "\"." << std::endl;
+            lastCheckpoint = std::chrono::steady_clock::now();
         }
+        if (isExhausted)
+            break;
+    }
+
+    // steps of the resumed checkpoint are added by the caller
+    result.steps = steps - resumed.steps;
+    result.dispatches = dispatches;
+    return result;
+}
+
+bool Interpreter::runJit(ExecutionResult &result)
+{
+    if (! JitProgram::isSupported()){
+        *mOutput << "ERROR: JIT is not supported on this platform. Process stopped." << std::endl;
+        return false;
+    }
+
+    try {
+        std::chrono::steady_clock::time_point startTime = std::chrono::steady_clock::now();
+
+        // JIT compiles the program as is, without optimisation passes.
+        DecodedProgram program(mInstructions);
+        JitProgram jit;
+        jit.compile(program);
+
+        double compileSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+        *mOutput << std::endl << "JIT: " << program.instructionsCount() << " instructions compiled into "
+                  << jit.codeSize() << " bytes." << std::endl;
+
+        std::vector<RegValue> registerFile = program.loadRegisters(mRegisters);
+        if (registerFile.empty())
+            registerFile.push_back(0);
+
+        result = jit.run(&registerFile[0]);
+        result.compileSeconds = compileSeconds;
+        program.storeRegisters(registerFile, mRegisters);
+
+    } catch (DecodeException &e) {
+        *mOutput << "ERROR: Can't decode instruction " << e.instructionNumber() << ": "
+                  << e.what() << " Process stopped." << std::endl;
+        return false;
+    } catch (JitException &e) {
+        *mOutput << "ERROR: JIT compilation failed: " << e.what() << " Process stopped." << std::endl;
+        return false;
     }
+    return true;
+}
 
-    std::cout << std::endl << "Program terminated on instruction " << nextCommand+1 << " with results: " << std::endl;
-    printAllRegisters();
+bool Interpreter::runChecked(ExecutionResult &result)
+{
+    try {
+        // checked engine runs the program as is, without optimisation passes.
+        std::chrono::steady_clock::time_point startTime = std::chrono::steady_clock::now();
+        DecodedProgram program(mInstructions);
+        double compileSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+
+        const std::vector<RegNumber> &numbers = program.registerNumbers();
+        std::vector<BigRegister> registerFile(numbers.empty() ? 1 : numbers.size());
+        for (std::size_t i=0; i<numbers.size(); ++i){
+            std::map<RegNumber, std::string>::const_iterator big = mBigRegisters.find(numbers[i]);
+            if (big != mBigRegisters.end())
+                registerFile[i].setDecimal((*big).second);
+            else if (mRegisters.find(numbers[i]) != mRegisters.end())
+                registerFile[i].setValue(mRegisters.at(numbers[i]));
+        }
+
+        result = CheckedEngine().run(program, &registerFile[0]);
+        result.compileSeconds = compileSeconds;
+
+        for (std::size_t i=0; i<numbers.size(); ++i){
+            if (registerFile[i].isSmall()){
+                mBigRegisters.erase(numbers[i]);
+                setRegisterValue(numbers[i], registerFile[i].value());
+            } else {
+                mBigRegisters[numbers[i]] = registerFile[i].toDecimal();
+                setRegisterValue(numbers[i], 0);
+            }
+        }
+
+    } catch (DecodeException &e) {
+        *mOutput << "ERROR: Can't decode instruction " << e.instructionNumber() << ": "
+                  << e.what() << " Process stopped." << std::endl;
+        return false;
+    }
+    return true;
+}
+
+bool Interpreter::runLockstep(ExecutionResult &result)
+{
+    try {
+        // single input occupies the first lane, lockstep engine runs the program as is.
+        std::chrono::steady_clock::time_point startTime = std::chrono::steady_clock::now();
+        DecodedProgram program(mInstructions);
+        double compileSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+
+        std::vector<RegValue> values = program.loadRegisters(mRegisters);
+        if (values.empty())
+            values.push_back(0);
+
+        std::vector<RegValue> registerFile(values.size() * LockstepEngine::Lanes, 0);
+        for (std::size_t i=0; i<values.size(); ++i)
+            registerFile[i * LockstepEngine::Lanes] = values[i];
+
+        LockstepEngine().run(program, &registerFile[0], 1, &result);
+        result.compileSeconds = compileSeconds;
+
+        for (std::size_t i=0; i<values.size(); ++i)
+            values[i] = registerFile[i * LockstepEngine::Lanes];
+        program.storeRegisters(values, mRegisters);
+
+    } catch (DecodeException &e) {
+        *mOutput << "ERROR: Can't decode instruction " << e.instructionNumber() << ": "
+                  << e.what() << " Process stopped." << std::endl;
+        return false;
+    }
+    return true;
+}
+
+bool Interpreter::runProfiled(ExecutionResult &result, ExecutionProfile &profile, HardwareCounters &counters)
+{
+    if (mEngine != ET_Threaded)
+        *mOutput << std::endl << "Profiling uses the threaded engine." << std::endl;
+
+    try {
+        DecodedProgram program(mInstructions);
+        Program::optimise(program, mOptimisationLevel);
+
+        std::vector<RegValue> registerFile = program.loadRegisters(mRegisters);
+        if (registerFile.empty())
+            registerFile.push_back(0);
+
+        counters.start();
+        result = ThreadedEngine().profile(program, &registerFile[0], profile);
+        counters.stop();
+        program.storeRegisters(registerFile, mRegisters);
+
+    } catch (DecodeException &e) {
+        *mOutput << "ERROR: Can't decode instruction " << e.instructionNumber() << ": "
+                  << e.what() << " Process stopped." << std::endl;
+        return false;
+    }
+    return true;
+}
+
+bool Interpreter::runTraced(ExecutionResult &result)
+{
+    try {
+        // every step of the trace is one instruction, so the program is not optimised
+        DecodedProgram program(mInstructions);
+        std::vector<RegValue> registerFile = program.loadRegisters(mRegisters);
+        if (registerFile.empty())
+            registerFile.push_back(0);
+
+        TraceWriter writer(mTraceFile, mInstructions, program.registerNumbers());
+        result = ThreadedEngine().trace(program, &registerFile[0], writer);
+        bool isWritten = writer.finish(result);
+        program.storeRegisters(registerFile, mRegisters);
+
+        const TraceWriter::Stats &stats = writer.stats();
+        *mOutput << std::endl << "Trace: " << stats.jumps << " jumps, " << stats.keyframes << " keyframes, "
+                  << stats.bytes << " bytes written to \"" << mTraceFile << "\" (" << stats.rawBytes << " before compression), "
+                  << "the engine waited for the writer " << stats.stalls << " times." << std::endl;
+        if (! isWritten)
+            *mOutput << "WARNING: Can't write trace \"" << mTraceFile << "\"." << std::endl;
+
+    } catch (DecodeException &e) {
+        *mOutput << "ERROR: Can't decode instruction " << e.instructionNumber() << ": "
+                  << e.what() << " Process stopped." << std::endl;
+        return false;
+    } catch (TraceException &e) {
+        *mOutput << "ERROR: " << e.what() << " Process stopped." << std::endl;
+        return false;
+    }
+    return true;
+}
+
+bool Interpreter::runDebugged(ExecutionResult &result)
+{
+    try {
+        Debugger debugger(mInstructions, mRegisters);
+        debugger.run(std::cin, *mOutput);
+        debugger.storeRegisters(mRegisters);
+        result = debugger.result();
+
+    } catch (DecodeException &e) {
+        *mOutput << "ERROR: Can't decode instruction " << e.instructionNumber() << ": "
+                  << e.what() << " Process stopped." << std::endl;
+        return false;
+    }
+    return true;
+}
+
+bool Interpreter::printProfile(const ExecutionResult &result, const ExecutionProfile &profile,
+                               const HardwareCounters &counters, double seconds) const
+{
+    Profiler profiler(mInstructions, profile, result, seconds);
+    profiler.setHardwareCounters(counters);
+    profiler.printText(*mOutput);
+
+    if (mProfileOutput.empty())
+        return true;
+
+    std::ofstream outputFile(mProfileOutput.c_str());
+    if (outputFile)
+        profiler.printJson(outputFile);
+    if (! outputFile){
+        *mOutput << "Can't write file \"" << mProfileOutput << "\"." << std::endl;
+        return false;
+    }
+    *mOutput << std::endl << "Profile is written to \"" << mProfileOutput << "\"." << std::endl;
+    return true;
+}
+
+bool Interpreter::runBatch()
+{
+    if (mEngine != ET_Threaded && mEngine != ET_Jit && mEngine != ET_Lockstep){
+        std::cout << "ERROR: Batch mode is supported by threaded, jit and simd engines only. Process stopped." << std::endl;
+        return false;
+    }
+    if (mEngine == ET_Jit && ! JitProgram::isSupported()){
+        std::cout << "ERROR: JIT is not supported on this platform. Process stopped." << std::endl;
+        return false;
+    }
+
+    std::ifstream inputFile;
+    std::istream *input = &std::cin;
+    if (mBatchInput != "-"){
+        inputFile.open(mBatchInput.c_str(), std::ios::binary);
+        if (! inputFile){
+            std::cout << "Can't open file \"" << mBatchInput << "\". Process stopped." << std::endl;
+            return false;
+        }
+        input = &inputFile;
+    }
+
+    try {
+        // results go to the standard output, so the summary is printed to the error stream
+        std::chrono::steady_clock::time_point startTime = std::chrono::steady_clock::now();
+
+        DecodedProgram program(mInstructions);
+        JitProgram jit;
+        if (mEngine == ET_Jit)
+            jit.compile(program);
+        else if (mEngine == ET_Threaded)
+            Program::optimise(program, mOptimisationLevel);
+
+        BatchRunner runner(program, mRegisters);
+        runner.setInputRegisters(mBatchInputRegisters);
+        if (! mBatchOutputRegisters.empty())
+            runner.setOutputRegisters(mBatchOutputRegisters);
+        runner.setFormat(mBatchFormat);
+        runner.setThreads(mBatchThreads);
+        if (mEngine == ET_Jit)
+            runner.setJit(&jit);
+        runner.setLockstep(mEngine == ET_Lockstep);
+
+        BatchRunner::Stats stats = runner.run(*input, std::cout);
+        std::cout.flush();
+
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+        std::cerr << "Batch: " << stats.vectors << " vectors, " << stats.steps << " steps in " << seconds << " s";
+        if (seconds > 0)
+            std::cerr << " (" << std::fixed << std::setprecision(0) << stats.vectors / seconds << " vectors/s)";
+        std::cerr << "." << std::endl;
+
+    } catch (BatchException &e) {
+        std::cout.flush();
+        std::cerr << "ERROR: Input " << (mBatchFormat == BatchRunner::BF_Csv ? "line " : "vector ") << e.line()
+                  << ": " << e.what() << " Process stopped." << std::endl;
+        return false;
+    } catch (DecodeException &e) {
+        std::cerr << "ERROR: Can't decode instruction " << e.instructionNumber() << ": "
+                  << e.what() << " Process stopped." << std::endl;
+        return false;
+    } catch (JitException &e) {
+        std::cerr << "ERROR: JIT compilation failed: " << e.what() << " Process stopped." << std::endl;
+        return false;
+    }
+    return true;
+}
+
+bool Interpreter::transpile(std::string sourceName)
+{
+    std::ofstream outputFile(mTranspileOutput.c_str());
+    if (! outputFile){
+        *mOutput << "Can't create file \"" << mTranspileOutput << "\". Process stopped." << std::endl;
+        return false;
+    }
+
+    try {
+        DecodedProgram program(mInstructions);
+        CppTranspiler().transpile(program, mRegisters, sourceName, outputFile);
+
+    } catch (DecodeException &e) {
+        *mOutput << "ERROR: Can't decode instruction " << e.instructionNumber() << ": "
+                  << e.what() << " Process stopped." << std::endl;
+        return false;
+    }
+
+    if (! outputFile){
+        *mOutput << "Can't write file \"" << mTranspileOutput << "\". Process stopped." << std::endl;
+        return false;
+    }
+
+    *mOutput << std::endl << "Program is transpiled to \"" << mTranspileOutput << "\"." << std::endl;
+    return true;
 }
 
 void Interpreter::setRegisterValue(RegNumber number, RegValue value)
 {
-    if (mRegisters->find(number) == mRegisters->end())
-        mRegisters->insert(std::pair<RegNumber, RegValue>(number, value));
+    if (mRegisters.find(number) == mRegisters.end())
+        mRegisters.insert(std::pair<RegNumber, RegValue>(number, value));
     else
-        mRegisters->at(number) = value;
+        mRegisters.at(number) = value;
 }
 
 RegValue Interpreter::registerValue(RegNumber number)
 {
-    if (mRegisters->find(number) == mRegisters->end()){
-        mRegisters->insert(std::pair<RegNumber, RegValue>(number, 0));
+    if (mRegisters.find(number) == mRegisters.end()){
+        mRegisters.insert(std::pair<RegNumber, RegValue>(number, 0));
         return 0;
     }
     else
-        return mRegisters->at(number);
+        return mRegisters.at(number);
 }
@@ -7,33 +7,24 @@
 #include <string>
 #include <vector>
 #include <map>
+#include <memory>
 #include <stdexcept>
 #include <stdlib.h>
 
+#include "instruction.h"
+#include "engine.h"
+#include "loader.h"
+#include "peephole.h"
+#include "batch.h"
+#include "passes.h"
+#include "profiler.h"
+#include "program.h"
+#include "output.h"
+#include "linker.h"
+#include "resultcache.h"
 
-typedef unsigned long long int RegValue;
-typedef std::size_t InstructionPos;
-typedef std::size_t RegNumber;
-
-class Instruction
-{
-public:
-    enum Type {
-        CT_Z = 1, CT_S, CT_T, CT_J
-    };
-
-    Instruction(Type type, RegNumber arg1=0, RegNumber arg2=0, InstructionPos instr=0);
-    void setType(Type type);
-    Type type() const;
-
-public:
-    RegNumber arg1;
-    RegNumber arg2;
-    RegValue  instr;
-
-private:
-    Type mType;
-};
+struct SourceStamp;
+class Checkpoint;
 
 
 //-- instructions exceptions
@@ -66,29 +57,209 @@ public:
 class Interpreter
 {
 public:
+    enum EngineType {
+        ET_Reference = 0, ET_Threaded, ET_Jit, ET_Checked, ET_Lockstep
+    };
+
+    // see Program::MaxOptimisationLevel
+    static const int MaxOptimisationLevel = Program::MaxOptimisationLevel;
+
+    // all state belongs to the instance, so several interpreters can run in parallel.
     Interpreter();
 
     bool parseFile(std::string fileName);
+    // parsed program (see loadFile())
+    const std::vector<Instruction>& instructions() const {
+        return mInstructions;
+    }
+    const std::map<RegNumber, RegValue>& registers() const {
+        return mRegisters;
+    }
+    // messages and results are printed to the stream (std::cout by default),
+    // batch mode always writes results to std::cout.
+    void setOutput(std::ostream &output);
+    // format of the listing, registers and statistics (text by default). In other formats they are
+    // written to the output and messages - to std::cerr (if the output is std::cout).
+    void setOutputFormat(OutputWriter::Format format);
+    // combination of OutputWriter::Section flags, all by default.
+    void setOutputSections(unsigned sections);
+    // only the registers are written in the initial values and the results, all if empty.
+    void setOutputRegisters(const std::vector<RegNumber> &registers);
+    // result of the last execution (steps are zero if the program wasn't run).
+    const ExecutionResult& lastResult() const {
+        return mLastResult;
+    }
+    // runs the instructions by the engine with the optimisation level and the passes without printing anything
+    // (see ConformanceHarness). registers - initial values, replaced by the results (big values of the checked
+    // engine are zero). Returns false if the engine can't run the program.
+    bool execute(const std::vector<Instruction> &instructions, std::map<RegNumber, RegValue> &registers,
+                 ExecutionResult &result);
+    // only parses (and links) the file, prints parse errors.
+    bool loadFile(std::string fileName);
+    // calls of the modules as they were parsed, the instructions are already linked (see Linker).
+    const std::vector<Linker::Call>& calls() const {
+        return mCalls;
+    }
+    // linked modules are kept in the directory (see Linker), empty name - no cache.
+    void setLinkCache(std::string directory);
+    // modules called by the program are linked by the linker (used for the modules called by modules),
+    // link errors are thrown as LinkException.
+    void setLinker(Linker *linker);
+    void setEngine(EngineType engine);
+    void setOptimisationLevel(int level);
+    // loading of the memory-mapped file (enabled by default), otherwise file is read line by line.
+    void setMappedLoading(bool enabled);
+    // count of threads that lex memory-mapped file, 0 - all available cores.
+    void setLoaderThreads(unsigned threads);
+    // instead of execution the program will be transpiled to C++ file.
+    void setTranspileOutput(std::string fileName);
+    // compiled program is cached next to the source ("program.rml" -> "program.rmlc", enabled by default)
+    // and used instead of parsing while the source is not changed.
+    void setBytecodeCache(bool enabled);
+    // additionally the compiled program is written to the file.
+    void setBytecodeOutput(std::string fileName);
+    // batch mode: the program is run for each input vector of the file ("-" - standard input),
+    // only values of the output registers are printed (see BatchRunner).
+    void setBatchInput(std::string fileName);
+    // empty inputs - R0, R1, ... by the count of values, empty outputs - R0.
+    void setBatchRegisters(const std::vector<RegNumber> &inputs, const std::vector<RegNumber> &outputs);
+    void setBatchFormat(BatchRunner::Format format);
+    // count of worker threads, 0 - all available cores.
+    void setBatchThreads(unsigned threads);
+    // passes over the control-flow graph (combination of PassPipeline::Pass flags, disabled by default),
+    // they are applied after the instructions are printed and change the count of steps.
+    void setPasses(unsigned passes);
+    // execution is stopped after the count of steps (0 - no limit), the limit is checked on taken jumps,
+    // so a few more steps can be executed.
+    void setStepBudget(unsigned long long steps);
+    // the machine state is periodically written to the file (see Checkpoint), empty name - no checkpoints.
+    void setCheckpoint(std::string fileName, double intervalSeconds);
+    // execution is continued from the checkpoint made for the same program.
+    void setResumeFile(std::string fileName);
+    // the execution is stopped when the machine state repeats, so the program never halts (see CycleDetector).
+    void setCycleDetection(bool enabled);
+    // the trace of the execution is written to the file (see TraceWriter), empty name - no trace.
+    void setTraceFile(std::string fileName);
+    // the program is run by the interactive debugger reading commands from std::cin (see Debugger).
+    void setDebugging(bool enabled);
+    // results of the runs are kept in the directory (see ResultCache), empty name - no cache.
+    // Repeated run of the same program with the same initial values is not executed.
+    void setResultCache(std::string directory, unsigned long long maxBytes);
+    // the program is run by the profiling instance of the threaded engine,
+    // the report is printed after the results (see Profiler).
+    void setProfiling(bool enabled);
+    // additionally the profile is written to the file as JSON (enables profiling).
+    void setProfileOutput(std::string fileName);
 
 private:
+    bool loadStream(std::istream &input);
+    bool loadMapped(const MappedFile &file);
+    static bool isBytecodeName(const std::string &fileName);
+    bool loadBytecode(const std::string &fileName);
+    // does nothing if file name is empty.
+    bool writeBytecode(const std::string &fileName, const SourceStamp &stamp);
+    // the threaded engine runs the instructions as they are loaded, so they are decoded once
+    // and the compiled program (.rmlc) keeps the decoded program of the optimisation level.
+    bool isDecodedOnLoad() const;
+    // returns false if the program is not decoded on load or can't be decoded.
+    bool decodeThreaded();
+    // parses the line and reports errors, returns false on error.
+    bool parseLine(const std::string &line, std::size_t lineNumber);
     bool parseLine(std::string command);
     bool parseInstruction(std::string instr, Instruction::Type commandType, std::size_t carretOffset);
     bool parseInitInstruction(std::string instr, std::size_t carretOffset);
+    bool parseCallInstruction(std::string instr, std::size_t carretOffset);
+    // replaces the calls by the code of the modules, prints errors.
+    bool link(const std::string &fileName);
+    // parses string of digits, returns false on overflow.
+    static bool parseNumber(const std::string &digits, RegValue &value);
+    static bool parseNumber(const std::string &digits, std::size_t &value);
 
-    void run();
+    // returns false if the program can't be run.
+    bool run();
+    // runs the program by the engine (without profiling, tracing and the debugger)
+    bool runEngine(ExecutionResult &result);
+    bool runReference(ExecutionResult &result);
+    bool runThreaded(ExecutionResult &result);
+    bool runJit(ExecutionResult &result);
+    bool runChecked(ExecutionResult &result);
+    bool runLockstep(ExecutionResult &result);
+    bool runBatch();
+    // replaces registers by the ones of the checkpoint, prints errors.
+    bool resume(Checkpoint &checkpoint);
+    // runs the threaded engine by slices, writes checkpoints, stops on the step budget and on the cycle.
+    ExecutionResult runCheckpointed(Machine &machine, const Checkpoint &resumed) const;
+    // stores the result on miss and prints the statistics of the cache.
+    void printResultCache(ResultCache &cache, const ResultCache::Key &key, const ExecutionResult &result, bool isCached) const;
+    bool runProfiled(ExecutionResult &result, ExecutionProfile &profile, HardwareCounters &counters);
+    bool runTraced(ExecutionResult &result);
+    bool runDebugged(ExecutionResult &result);
+    bool printProfile(const ExecutionResult &result, const ExecutionProfile &profile,
+                      const HardwareCounters &counters, double seconds) const;
+    // replaces the instructions by the output of the pass pipeline, report is printed to the stream.
+    void applyPasses(std::ostream &report);
+    // number of the halt or of the next instruction of the suspended run in the source program
+    InstructionPos originalNumber(const ExecutionResult &result) const;
+    // applies optimisation passes of the current level, loops - count of summarised loops.
+    bool transpile(std::string sourceName);
     void execInstruction(Instruction instruction);
     void execInstruction(std::size_t instructionNumber);
 
-    void printAllInstructions() const;
-    void printAllRegisters() const;
 
     inline void initRegister(RegNumber number, RegValue value);
     inline void setRegisterValue(RegNumber number, RegValue value);
     inline RegValue registerValue(RegNumber number);
 
 private:
-    std::vector<Instruction> *mInstructions;
-    std::map<RegNumber, RegValue> *mRegisters;
+    std::vector<Instruction> mInstructions;
+    std::map<RegNumber, RegValue> mRegisters;
+    // values of the registers that don't fit 64 bits (checked engine only),
+    // such registers are also present in mRegisters.
+    std::map<RegNumber, std::string> mBigRegisters;
+    EngineType mEngine;
+    int mOptimisationLevel;
+    std::string mTranspileOutput;
+    bool mMappedLoading;
+    unsigned mLoaderThreads;
+    bool mBytecodeCache;
+    std::string mBytecodeOutput;
+    // program decoded for the threaded engine on load, empty if the instructions changed since
+    std::shared_ptr<const Program> mCompiled;
+    // placeholders of the calls are in the instructions until they are linked
+    std::vector<Linker::Call> mCalls;
+    std::string mLinkCache;
+    Linker *mLinker;
+    std::string mBatchInput;
+    std::vector<RegNumber> mBatchInputRegisters;
+    std::vector<RegNumber> mBatchOutputRegisters;
+    BatchRunner::Format mBatchFormat;
+    unsigned mBatchThreads;
+    unsigned mPasses;
+    // original numbers of the halts of the optimised program (see ControlFlowGraph::emit())
+    std::vector<InstructionPos> mHaltNumbers;
+    // source numbers of the instructions of the optimised program (see ControlFlowGraph::emit())
+    std::vector<InstructionPos> mSourceNumbers;
+    bool mProfiling;
+    unsigned long long mStepBudget;
+    std::string mCheckpointFile;
+    double mCheckpointInterval;
+    std::string mResumeFile;
+    bool mCycleDetection;
+    std::string mTraceFile;
+    bool mDebugging;
+    std::string mResultCacheDirectory;
+    unsigned long long mResultCacheSize;
+    std::string mProfileOutput;
+    std::ostream *mOutput;
+    OutputWriter::Format mOutputFormat;
+    unsigned mOutputSections;
+    std::vector<RegNumber> mOutputRegisters;
+    // created by parseFile()
+    std::unique_ptr<OutputWriter> mWriter;
+    ExecutionResult mLastResult;
+
+    // initialisation instructions are allowed only before the first instruction
+    bool mIsInitialisation;
 };
 
 //-- interpreter exceptions
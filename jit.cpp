@@ -0,0 +1,199 @@
+#include "jit.h"
+#include <cstring>
+
+#if defined(LINUX) && defined(__x86_64__)
+#   define JIT_X86_64
+#   include <sys/mman.h>
+#endif
+
+
+#ifdef JIT_X86_64
+// generated function: RegValue function(RegValue *registers, unsigned long long *steps)
+// rdi - register file, rsi - pointer to the steps counter, rdx - steps, rax - scratch.
+typedef RegValue (*JitFunction)(RegValue *, unsigned long long *);
+
+class CodeBuffer
+{
+public:
+    void byte(unsigned char value) {
+        mCode.push_back(value);
+    }
+    void bytes(const char *values, std::size_t count) {
+        mCode.insert(mCode.end(), values, values + count);
+    }
+    void dword(unsigned int value) {
+        for (int i=0; i<4; ++i)
+            byte((value >> (i*8)) & 0xFF);
+    }
+    void qword(unsigned long long value) {
+        for (int i=0; i<8; ++i)
+            byte((value >> (i*8)) & 0xFF);
+    }
+    void patchDword(std::size_t offset, unsigned int value) {
+        for (int i=0; i<4; ++i)
+            mCode[offset + i] = (value >> (i*8)) & 0xFF;
+    }
+
+    // <opcode> qword [rdi + disp32] with rax (or /digit) as reg field
+    void registerOperand(const char *opcode, std::size_t opcodeSize, std::size_t reg) {
+        bytes(opcode, opcodeSize);
+        byte(0x87);
+        dword((unsigned int)(reg * sizeof(RegValue)));
+    }
+
+    std::size_t size() const {
+        return mCode.size();
+    }
+    const std::vector<unsigned char>& code() const {
+        return mCode;
+    }
+
+private:
+    std::vector<unsigned char> mCode;
+};
+#endif
+
+
+JitProgram::JitProgram():
+    mCode(0), mSize(0)
+{
+}
+
+JitProgram::~JitProgram()
+{
+    release();
+}
+
+bool JitProgram::isSupported()
+{
+#ifdef JIT_X86_64
+    return true;
+#else
+    return false;
+#endif
+}
+
+void JitProgram::release()
+{
+#ifdef JIT_X86_64
+    if (mCode)
+        munmap(mCode, mSize);
+#endif
+    mCode = 0;
+    mSize = 0;
+}
+
+void JitProgram::compile(const DecodedProgram &program)
+{
+#ifdef JIT_X86_64
+    const std::vector<DecodedProgram::Op> &ops = program.ops();
+
+    // registers are addressed by disp32
+    if (program.registerNumbers().size() >= 0x7FFFFFFF / sizeof(RegValue))
+        throw JitException("Too many registers.");
+
+    static const char MovRaxFromMem[] = {'\x48', '\x8B'};       // mov rax, [rdi+disp32]
+    static const char MovMemFromRax[] = {'\x48', '\x89'};       // mov [rdi+disp32], rax
+    static const char CmpRaxWithMem[] = {'\x48', '\x3B'};       // cmp rax, [rdi+disp32]
+    static const char IncMem[]        = {'\x48', '\xFF'};       // inc qword [rdi+disp32]
+    static const char MovMemImm[]     = {'\x48', '\xC7'};       // mov qword [rdi+disp32], imm32
+    static const char IncRdx[]        = {'\x48', '\xFF', '\xC2'};
+    static const char XorEdxEdx[]     = {'\x31', '\xD2'};
+    static const char MovStepsRdx[]   = {'\x48', '\x89', '\x16'}; // mov [rsi], rdx
+    static const char Je[]            = {'\x0F', '\x84'};
+
+    CodeBuffer code;
+    std::vector<std::size_t> opOffsets(ops.size());
+    // offsets of rel32 fields to be patched and indexes of the target ops
+    std::vector<std::pair<std::size_t, std::size_t> > jumps;
+
+    code.bytes(XorEdxEdx, sizeof(XorEdxEdx));
+
+    for (std::size_t i=0; i<ops.size(); ++i){
+        const DecodedProgram::Op &op = ops[i];
+        opOffsets[i] = code.size();
+
+        switch (op.code) {
+        case DecodedProgram::OP_Z:
+            code.registerOperand(MovMemImm, sizeof(MovMemImm), op.arg1);
+            code.dword(0);
+            code.bytes(IncRdx, sizeof(IncRdx));
+            break;
+
+        case DecodedProgram::OP_S:
+            code.registerOperand(IncMem, sizeof(IncMem), op.arg1);
+            code.bytes(IncRdx, sizeof(IncRdx));
+            break;
+
+        case DecodedProgram::OP_T:
+            code.registerOperand(MovRaxFromMem, sizeof(MovRaxFromMem), op.arg1);
+            code.registerOperand(MovMemFromRax, sizeof(MovMemFromRax), op.arg2);
+            code.bytes(IncRdx, sizeof(IncRdx));
+            break;
+
+        case DecodedProgram::OP_J:
+            code.bytes(IncRdx, sizeof(IncRdx));
+            if (op.arg1 == op.arg2){
+                code.byte(0xE9);                    // jmp rel32
+            } else {
+                code.registerOperand(MovRaxFromMem, sizeof(MovRaxFromMem), op.arg1);
+                code.registerOperand(CmpRaxWithMem, sizeof(CmpRaxWithMem), op.arg2);
+                code.bytes(Je, sizeof(Je));         // je rel32
+            }
+            jumps.push_back(std::pair<std::size_t, std::size_t>(code.size(), op.target));
+            code.dword(0);
+            break;
+
+        case DecodedProgram::OP_Halt:
+            code.bytes(MovStepsRdx, sizeof(MovStepsRdx));
+            code.byte(0x48);                        // mov rax, imm64
+            code.byte(0xB8);
+            code.qword(program.haltNumber(op.target));
+            code.byte(0xC3);                        // ret
+            break;
+
+        default:
+            throw JitException("Optimised ops can't be compiled.");
+        }
+    }
+
+    for (std::size_t i=0; i<jumps.size(); ++i){
+        std::size_t next = jumps[i].first + 4;
+        code.patchDword(jumps[i].first, (unsigned int)(opOffsets[jumps[i].second] - next));
+    }
+
+    release();
+    void *memory = mmap(0, code.size(), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (memory == MAP_FAILED)
+        throw JitException("Can't allocate memory for the code.");
+
+    std::memcpy(memory, &code.code()[0], code.size());
+    if (mprotect(memory, code.size(), PROT_READ | PROT_EXEC) != 0){
+        munmap(memory, code.size());
+        throw JitException("Can't make the code executable.");
+    }
+
+    mCode = memory;
+    mSize = code.size();
+#else
+    (void)program;
+    throw JitException("JIT is not supported on this platform.");
+#endif
+}
+
+ExecutionResult JitProgram::run(RegValue *registers) const
+{
+    ExecutionResult result;
+#ifdef JIT_X86_64
+    if (! mCode)
+        throw JitException("Program is not compiled.");
+
+    JitFunction function = reinterpret_cast<JitFunction>(mCode);
+    result.haltedAt = function(registers, &result.steps);
+    result.dispatches = result.steps;
+#else
+    (void)registers;
+    throw JitException("JIT is not supported on this platform.");
+#endif
+    return result;
+}
@@ -0,0 +1,52 @@
+#ifndef JIT_H
+#define JIT_H
+
+#include <vector>
+#include <stdexcept>
+
+#include "engine.h"
+
+
+//-- x86-64 JIT compiler
+// Translates decoded program into native code placed into mmap'd executable memory.
+// Registers stay in the dense register file (addressed by rdi), J becomes native
+// compare and branch, halt ops return the instruction number to report.
+// Optimised ops (superinstructions, loop summaries) are not supported,
+// so the program must be decoded without optimisation passes.
+class JitProgram
+{
+public:
+    JitProgram();
+    ~JitProgram();
+
+    // true if JIT is available on this platform.
+    static bool isSupported();
+
+    void compile(const DecodedProgram &program);
+    ExecutionResult run(RegValue *registers) const;
+
+    std::size_t codeSize() const {
+        return mSize;
+    }
+
+private:
+    // not copyable: owns executable memory
+    JitProgram(const JitProgram &);
+    JitProgram& operator=(const JitProgram &);
+
+    void release();
+
+private:
+    void *mCode;
+    std::size_t mSize;
+};
+
+class JitException: public std::runtime_error
+{
+public:
+    JitException(std::string message):
+        runtime_error(message){}
+};
+
+
+#endif // JIT_H
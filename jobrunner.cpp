@@ -0,0 +1,169 @@
+#include "jobrunner.h"
+#include <sstream>
+#include <thread>
+#include <algorithm>
+
+#ifdef LINUX
+#   include <sys/stat.h>
+#   include <dirent.h>
+#endif
+
+
+JobRunner::JobRunner(const std::vector<std::string> &files, std::function<void (Interpreter &)> configure):
+    mJobs(files.size()),
+    mConfigure(configure),
+    mThreads(0),
+    mStolen(0)
+{
+    for (std::size_t i=0; i<files.size(); ++i)
+        mJobs[i].fileName = files[i];
+}
+
+bool JobRunner::isDirectory(const std::string &path)
+{
+#ifdef LINUX
+    struct stat status;
+    return stat(path.c_str(), &status) == 0 && S_ISDIR(status.st_mode);
+#else
+    (void)path;
+    return false;
+#endif
+}
+
+std::vector<std::string> JobRunner::expand(const std::vector<std::string> &paths)
+{
+    std::vector<std::string> files;
+    for (std::size_t i=0; i<paths.size(); ++i){
+        if (! isDirectory(paths[i])){
+            files.push_back(paths[i]);
+            continue;
+        }
+
+#ifdef LINUX
+        std::vector<std::string> programs;
+        const std::string extension = ".rml";
+        if (DIR *handle = opendir(paths[i].c_str())){
+            while (struct dirent *item = readdir(handle)){
+                std::string name = item->d_name;
+                if (name.size() > extension.size()
+                        && name.compare(name.size() - extension.size(), extension.size(), extension) == 0)
+                    programs.push_back(paths[i] + "/" + name);
+            }
+            closedir(handle);
+        }
+        std::sort(programs.begin(), programs.end());
+        files.insert(files.end(), programs.begin(), programs.end());
+#endif
+    }
+    return files;
+}
+
+void JobRunner::setThreads(unsigned threads)
+{
+    mThreads = threads;
+}
+
+JobRunner::Stats JobRunner::run(std::ostream &output)
+{
+    unsigned threads = mThreads;
+    if (threads == 0)
+        threads = std::thread::hardware_concurrency();
+    if (threads == 0)
+        threads = 1;
+    threads = std::max(1u, std::min<unsigned>(threads, mJobs.size()));
+
+    mWorkers.clear();
+    for (unsigned i=0; i<threads; ++i)
+        mWorkers.push_back(std::unique_ptr<Worker>(new Worker()));
+    for (std::size_t i=0; i<mJobs.size(); ++i)
+        mWorkers[i % threads]->jobs.push_back(i);
+
+    std::vector<std::thread> workers;
+    for (unsigned i=0; i<threads; ++i)
+        workers.push_back(std::thread(&JobRunner::work, this, i));
+
+    // outputs are written in the order of the files
+    Stats stats;
+    for (std::size_t i=0; i<mJobs.size(); ++i){
+        std::unique_lock<std::mutex> lock(mMutex);
+        mDone.wait(lock, [this, i]{ return mJobs[i].isDone; });
+        lock.unlock();
+
+        Job &job = mJobs[i];
+        output << "==> " << job.fileName << " <==" << std::endl << job.output << std::endl;
+        ++stats.programs;
+        if (job.isFailed)
+            ++stats.failed;
+        stats.steps += job.steps;
+        // the output is not needed anymore
+        std::string().swap(job.output);
+    }
+
+    for (std::size_t i=0; i<workers.size(); ++i)
+        workers[i].join();
+    stats.stolen = mStolen;
+    return stats;
+}
+
+bool JobRunner::take(std::size_t worker, std::size_t &job, bool &isStolen)
+{
+    {
+        std::lock_guard<std::mutex> lock(mWorkers[worker]->mutex);
+        if (! mWorkers[worker]->jobs.empty()){
+            job = mWorkers[worker]->jobs.front();
+            mWorkers[worker]->jobs.pop_front();
+            isStolen = false;
+            return true;
+        }
+    }
+
+    // jobs are never added, so an empty deque stays empty
+    for (std::size_t i=1; i<mWorkers.size(); ++i){
+        Worker &victim = *mWorkers[(worker + i) % mWorkers.size()];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        if (! victim.jobs.empty()){
+            job = victim.jobs.back();
+            victim.jobs.pop_back();
+            isStolen = true;
+            return true;
+        }
+    }
+    return false;
+}
+
+void JobRunner::execute(Job &job) const
+{
+    std::ostringstream output;
+    try {
+        Interpreter interpreter;
+        mConfigure(interpreter);
+        // the pool already occupies the cores
+        interpreter.setLoaderThreads(1);
+        interpreter.setOutput(output);
+        job.isFailed = ! interpreter.parseFile(job.fileName);
+        job.steps = interpreter.lastResult().steps;
+
+    } catch (std::bad_alloc &) {
+        output << "ERROR: Not enough system memory. Process stopped." << std::endl;
+        job.isFailed = true;
+    } catch (std::exception &) {
+        output << "ERROR: unknown error occured. Process stopped." << std::endl;
+        job.isFailed = true;
+    }
+    job.output = output.str();
+}
+
+void JobRunner::work(std::size_t worker)
+{
+    std::size_t index;
+    bool isStolen;
+    while (take(worker, index, isStolen)){
+        execute(mJobs[index]);
+
+        std::lock_guard<std::mutex> lock(mMutex);
+        mJobs[index].isDone = true;
+        if (isStolen)
+            ++mStolen;
+        mDone.notify_all();
+    }
+}
@@ -0,0 +1,86 @@
+#ifndef JOBRUNNER_H
+#define JOBRUNNER_H
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <functional>
+#include <mutex>
+#include <condition_variable>
+
+#include "interpreter.h"
+
+
+//-- runner of many programs
+// Every program is run by its own Interpreter with the output captured into a string.
+// Run times differ by orders of magnitude, so programs are scheduled over a work-stealing pool:
+// jobs are dealt to the workers round-robin, a worker takes its jobs from the front of its deque
+// and when it's empty steals from the back of the others'. Outputs are written in the order
+// of the files as soon as all previous ones are done.
+class JobRunner
+{
+public:
+    struct Stats
+    {
+        Stats():
+            programs(0), failed(0), steps(0), stolen(0){}
+
+        unsigned long long programs;
+        unsigned long long failed;
+        unsigned long long steps;
+        // count of jobs executed by another worker than they were dealt to
+        unsigned long long stolen;
+    };
+
+    // configure - applies the settings to the interpreter of every job.
+    JobRunner(const std::vector<std::string> &files, std::function<void (Interpreter &)> configure);
+
+    // directories are replaced by the .rml files inside them, sorted by name.
+    static std::vector<std::string> expand(const std::vector<std::string> &paths);
+    static bool isDirectory(const std::string &path);
+
+    // threads = 0 - use all available cores.
+    void setThreads(unsigned threads);
+
+    Stats run(std::ostream &output);
+
+private:
+    struct Job
+    {
+        Job():
+            isDone(false), isFailed(false), steps(0){}
+
+        std::string fileName;
+        std::string output;
+        bool isDone;
+        bool isFailed;
+        unsigned long long steps;
+    };
+
+    struct Worker
+    {
+        std::deque<std::size_t> jobs;
+        std::mutex mutex;
+    };
+
+    // returns false if there are no jobs left.
+    bool take(std::size_t worker, std::size_t &job, bool &isStolen);
+    void execute(Job &job) const;
+    void work(std::size_t worker);
+
+private:
+    std::vector<Job> mJobs;
+    std::function<void (Interpreter &)> mConfigure;
+    unsigned mThreads;
+    std::vector< std::unique_ptr<Worker> > mWorkers;
+
+    // guarded by mMutex
+    unsigned long long mStolen;
+    std::mutex mMutex;
+    std::condition_variable mDone;
+};
+
+
+#endif // JOBRUNNER_H
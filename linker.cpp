@@ -0,0 +1,351 @@
+#include "linker.h"
+#include "interpreter.h"
+#include "bytecode.h"
+#include "loader.h"
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <cstring>
+#include <cstddef>
+#include <stdio.h>
+
+#ifdef LINUX
+#   include <sys/stat.h>
+#endif
+
+
+// path of the module called by the file
+static std::string resolve(const std::string &caller, const std::string &name)
+{
+    if (! name.empty() && name[0] == '/')
+        return name;
+    return caller.substr(0, caller.rfind('/') + 1) + name;
+}
+
+// names are padded to keep the records 8-byte aligned
+static std::size_t paddedSize(std::size_t size)
+{
+    return (size + 7) & ~std::size_t(7);
+}
+
+
+const unsigned int Linker::Version;
+
+Linker::Linker(const std::string &cacheDirectory):
+    mCacheDirectory(cacheDirectory)
+{
+#ifdef LINUX
+    if (! cacheDirectory.empty())
+        mkdir(cacheDirectory.c_str(), 0777);
+#endif
+}
+
+void Linker::link(const std::string &fileName, std::vector<Instruction> &instructions, const std::vector<Call> &calls)
+{
+    mStats.calls += calls.size();
+    std::vector<const Module *> modules;
+    for (std::size_t i=0; i<calls.size(); ++i)
+        modules.push_back(&module(resolve(fileName, calls[i].fileName)));
+
+    std::vector<Instruction> linked;
+    expand(instructions, calls, modules, linked);
+    instructions.swap(linked);
+}
+
+const Linker::Module& Linker::module(const std::string &fileName)
+{
+    std::map<std::string, Module>::const_iterator found = mModules.find(fileName);
+    if (found != mModules.end())
+        return (*found).second;
+
+    if (std::find(mStack.begin(), mStack.end(), fileName) != mStack.end()){
+        std::string chain;
+        for (std::size_t i=0; i<mStack.size(); ++i)
+            chain += "\"" + mStack[i] + "\" -> ";
+        throw LinkException("Module \"" + fileName + "\" calls itself: " + chain + "\"" + fileName + "\".");
+    }
+
+    unsigned long long hash;
+    std::string text;
+    if (! hashFile(fileName, hash, &text))
+        throw LinkException("Can't open module \"" + fileName + "\".");
+
+    // paths of the called modules depend on the directory
+    std::string directory = fileName.substr(0, fileName.rfind('/') + 1);
+    unsigned long long key = BytecodeFile::checksum(text.data(), text.size(),
+                                                    BytecodeFile::checksum(directory.c_str(), directory.size() + 1));
+
+    Module linked;
+    if (! mCacheDirectory.empty() && readEntry(key, linked))
+        ++mStats.cached;
+    else {
+        std::ostringstream errors;
+        Interpreter interpreter;
+        interpreter.setOutput(errors);
+        interpreter.setBytecodeCache(false);
+        interpreter.setLinker(this);
+
+        mStack.push_back(fileName);
+        bool isLoaded;
+        try {
+            isLoaded = interpreter.loadFile(fileName);
+        } catch (...) {
+            mStack.pop_back();
+            throw;
+        }
+        mStack.pop_back();
+
+        if (! isLoaded){
+            std::string message = errors.str();
+            while (! message.empty() && message[message.size() - 1] == '\n')
+                message.erase(message.size() - 1);
+            throw LinkException("Module \"" + fileName + "\" can't be loaded:\n" + message);
+        }
+
+        linked.instructions = interpreter.instructions();
+        linked.dependencies.push_back(std::make_pair(fileName, hash));
+        for (std::size_t i=0; i<interpreter.calls().size(); ++i){
+            const Module &callee = mModules[resolve(fileName, interpreter.calls()[i].fileName)];
+            for (std::size_t k=0; k<callee.dependencies.size(); ++k){
+                if (std::find(linked.dependencies.begin(), linked.dependencies.end(), callee.dependencies[k])
+                        == linked.dependencies.end())
+                    linked.dependencies.push_back(callee.dependencies[k]);
+            }
+        }
+
+        if (! mCacheDirectory.empty())
+            writeEntry(key, linked);
+    }
+
+    linked.registers = usedRegisters(linked.instructions);
+    linked.initialised = initialisedRegisters(linked.instructions);
+    ++mStats.modules;
+    Module &module = mModules[fileName];
+    std::swap(module, linked);
+    return module;
+}
+
+std::string Linker::entryName(unsigned long long key) const
+{
+    char name[32];
+    snprintf(name, sizeof(name), "%016llx.rmll", key);
+    return mCacheDirectory + "/" + name;
+}
+
+bool Linker::readEntry(unsigned long long key, Module &module) const
+{
+    MappedFile file;
+    if (! file.open(entryName(key)) || file.size() < sizeof(Header))
+        return false;
+
+    Header header;
+    std::memcpy(&header, file.data(), sizeof(header));
+    const char *body = file.data() + sizeof(Header), *end = file.data() + file.size();
+    if (std::memcmp(header.magic, "RMLL", 4) != 0 || header.version != Version || header.key != key
+            || (end - body) % 8 != 0 || BytecodeFile::fileChecksum(&header, offsetof(Header, checksum), body, end - body) != header.checksum)
+        return false;
+
+    // every module the entry was linked from must be the same
+    module.dependencies.clear();
+    for (unsigned long long i=0; i<header.dependenciesCount; ++i){
+        Dependency dependency;
+        if (std::size_t(end - body) < sizeof(dependency))
+            return false;
+        std::memcpy(&dependency, body, sizeof(dependency));
+        body += sizeof(dependency);
+        if (dependency.nameSize > std::size_t(end - body) || std::size_t(end - body) < paddedSize(dependency.nameSize))
+            return false;
+        std::string name(body, dependency.nameSize);
+        body += paddedSize(dependency.nameSize);
+
+        unsigned long long hash;
+        if (! hashFile(name, hash) || hash != dependency.hash)
+            return false;
+        module.dependencies.push_back(std::make_pair(name, hash));
+    }
+
+    if (std::size_t(end - body) != header.instructionsCount * sizeof(BytecodeFile::Instruction))
+        return false;
+    module.instructions.clear();
+    module.instructions.reserve(header.instructionsCount);
+    for (unsigned long long i=0; i<header.instructionsCount; ++i){
+        BytecodeFile::Instruction record;
+        std::memcpy(&record, body + i * sizeof(record), sizeof(record));
+        if (record.type < Instruction::CT_Z || record.type > Instruction::CT_J)
+            return false;
+        module.instructions.push_back(Instruction(Instruction::Type(record.type), record.arg1, record.arg2, record.instr));
+    }
+    return true;
+}
+
+void Linker::writeEntry(unsigned long long key, const Module &module) const
+{
+    std::size_t size = module.instructions.size() * sizeof(BytecodeFile::Instruction);
+    for (std::size_t i=0; i<module.dependencies.size(); ++i)
+        size += sizeof(Dependency) + paddedSize(module.dependencies[i].first.size());
+
+    std::vector<char> body(size, 0);
+    char *record = body.empty() ? 0 : &body[0];
+    for (std::size_t i=0; i<module.dependencies.size(); ++i){
+        Dependency dependency;
+        dependency.hash = module.dependencies[i].second;
+        dependency.nameSize = module.dependencies[i].first.size();
+        std::memcpy(record, &dependency, sizeof(dependency));
+        record += sizeof(dependency);
+        std::memcpy(record, module.dependencies[i].first.data(), dependency.nameSize);
+        record += paddedSize(dependency.nameSize);
+    }
+    for (std::size_t i=0; i<module.instructions.size(); ++i){
+        const Instruction &instruction = module.instructions[i];
+        BytecodeFile::Instruction fields = {
+            (unsigned long long)instruction.type(), instruction.arg1, instruction.arg2, instruction.instr
+        };
+        std::memcpy(record, &fields, sizeof(fields));
+        record += sizeof(fields);
+    }
+
+    Header header;
+    std::memcpy(header.magic, "RMLL", 4);
+    header.version = Version;
+    header.key = key;
+    header.dependenciesCount = module.dependencies.size();
+    header.instructionsCount = module.instructions.size();
+    header.checksum = BytecodeFile::fileChecksum(&header, offsetof(Header, checksum), body.data(), body.size());
+
+    // the module is just linked again next time if the entry can't be written
+    BytecodeFile::writeAtomically(entryName(key), &header, sizeof(header), body);
+}
+
+std::vector<RegNumber> Linker::usedRegisters(const std::vector<Instruction> &instructions)
+{
+    std::vector<RegNumber> registers;
+    for (std::size_t i=0; i<instructions.size(); ++i){
+        registers.push_back(instructions[i].arg1);
+        if (instructions[i].type() == Instruction::CT_T || instructions[i].type() == Instruction::CT_J)
+            registers.push_back(instructions[i].arg2);
+    }
+    std::sort(registers.begin(), registers.end());
+    registers.erase(std::unique(registers.begin(), registers.end()), registers.end());
+    return registers;
+}
+
+std::vector<RegNumber> Linker::initialisedRegisters(const std::vector<Instruction> &instructions)
+{
+    // the leading Z and T are executed on every call before anything else
+    std::vector<RegNumber> read, initialised;
+    for (std::size_t i=0; i<instructions.size(); ++i){
+        const Instruction &instruction = instructions[i];
+        RegNumber target = instruction.arg1;
+        if (instruction.type() == Instruction::CT_T){
+            if (std::find(initialised.begin(), initialised.end(), instruction.arg1) == initialised.end())
+                read.push_back(instruction.arg1);
+            target = instruction.arg2;
+        } else if (instruction.type() != Instruction::CT_Z)
+            break;
+
+        if (std::find(read.begin(), read.end(), target) == read.end())
+            initialised.push_back(target);
+    }
+    std::sort(initialised.begin(), initialised.end());
+    return initialised;
+}
+
+bool Linker::hashFile(const std::string &fileName, unsigned long long &hash, std::string *text)
+{
+    std::ifstream file(fileName.c_str(), std::ios::binary);
+    if (! file)
+        return false;
+
+    std::ostringstream content;
+    content << file.rdbuf();
+    std::string data = content.str();
+    hash = BytecodeFile::checksum(data.data(), data.size());
+    if (text)
+        text->swap(data);
+    return true;
+}
+
+void Linker::expand(const std::vector<Instruction> &program, const std::vector<Call> &calls,
+                    const std::vector<const Module *> &modules, std::vector<Instruction> &linked)
+{
+    // zeroed registers of every call: the ones that are not in the list and are not set by the module
+    std::vector< std::vector<RegNumber> > zeroed(calls.size());
+    for (std::size_t c=0; c<calls.size(); ++c){
+        const std::vector<RegNumber> &registers = modules[c]->registers;
+        for (std::size_t i=0; i<registers.size(); ++i){
+            if (std::binary_search(modules[c]->initialised.begin(), modules[c]->initialised.end(), registers[i]))
+                continue;
+            std::vector< std::pair<RegNumber, RegNumber> >::const_iterator mapped = std::lower_bound(
+                        calls[c].registers.begin(), calls[c].registers.end(), std::make_pair(registers[i], RegNumber(0)));
+            if (mapped == calls[c].registers.end() || (*mapped).first != registers[i])
+                zeroed[c].push_back(registers[i]);
+        }
+    }
+
+    // start[i] - index of the first linked instruction of the program instruction i
+    std::vector<std::size_t> start(program.size() + 1);
+    std::size_t size = 0;
+    for (std::size_t i=0, c=0; i<program.size(); ++i){
+        start[i] = size;
+        if (c < calls.size() && calls[c].index == i){
+            size += zeroed[c].size() + modules[c]->instructions.size();
+            ++c;
+        } else
+            ++size;
+    }
+    start[program.size()] = size;
+
+    linked.clear();
+    linked.reserve(size);
+    for (std::size_t i=0, c=0; i<program.size(); ++i){
+        if (c < calls.size() && calls[c].index == i){
+            const Call &call = calls[c];
+            const Module &module = *modules[c];
+            for (std::size_t k=0; k<zeroed[c].size(); ++k){
+                if (zeroed[c][k] > ~RegNumber(0) - call.base)
+                    throw LinkException("Registers of the module \"" + call.fileName + "\" don't fit after the base.");
+                linked.push_back(Instruction(Instruction::CT_Z, call.base + zeroed[c][k]));
+            }
+
+            // the module is numbered from 1, halts continue after the call
+            std::size_t body = linked.size();
+            for (std::size_t k=0; k<module.instructions.size(); ++k){
+                Instruction instruction = module.instructions[k];
+                RegNumber *args[2] = {&instruction.arg1, &instruction.arg2};
+                std::size_t argsCount = instruction.type() == Instruction::CT_T
+                        || instruction.type() == Instruction::CT_J ? 2 : 1;
+                for (std::size_t a=0; a<argsCount; ++a){
+                    std::vector< std::pair<RegNumber, RegNumber> >::const_iterator mapped = std::lower_bound(
+                                call.registers.begin(), call.registers.end(), std::make_pair(*args[a], RegNumber(0)));
+                    if (mapped != call.registers.end() && (*mapped).first == *args[a])
+                        *args[a] = (*mapped).second;
+                    else if (*args[a] > ~RegNumber(0) - call.base)
+                        throw LinkException("Registers of the module \"" + call.fileName + "\" don't fit after the base.");
+                    else
+                        *args[a] += call.base;
+                }
+                if (instruction.type() == Instruction::CT_J){
+                    if (instruction.instr >= 1 && instruction.instr <= module.instructions.size())
+                        instruction.instr += body;
+                    else
+                        instruction.instr = start[i + 1] + 1;
+                }
+                linked.push_back(instruction);
+            }
+            ++c;
+            continue;
+        }
+
+        // jumps past the end keep their distance from the end
+        Instruction instruction = program[i];
+        if (instruction.type() == Instruction::CT_J && instruction.instr != 0){
+            if (instruction.instr <= program.size())
+                instruction.instr = start[instruction.instr - 1] + 1;
+            else if (size >= program.size())
+                instruction.instr += std::min<RegValue>(size - program.size(), ~RegValue(0) - instruction.instr);
+            else
+                instruction.instr -= program.size() - size;
+        }
+        linked.push_back(instruction);
+    }
+}
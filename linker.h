@@ -0,0 +1,132 @@
+#ifndef LINKER_H
+#define LINKER_H
+
+#include <string>
+#include <vector>
+#include <map>
+#include <utility>
+#include <stdexcept>
+
+#include "instruction.h"
+
+
+//-- linker of the modules
+// A program calls another program (module) by the line
+//      CALL(<file>, <base>[, <module register>:<register>]...)
+// The line counts as one instruction of the program, the linker replaces it by the code of the module:
+//  * registers given in the list are mapped to the registers of the program (arguments and results),
+//    any other register r of the module becomes base + r and is zeroed before the module (unless the module
+//    starts by setting it), so the module runs as it would run alone with the arguments as initial values;
+//  * jumps inside the module are relocated, jumps outside of it (halts) continue after the call;
+//  * jumps of the program are relocated by the sizes of the calls, jumps past the end stay past the end.
+// Modules can call other modules, paths are relative to the calling file. Initialisation of the module
+// registers is ignored.
+//
+// Every module is linked once per program. With the cache directory linked modules are kept between runs
+// as "<key>.rmll", the key is the hash of the text and the directory of the module. The entry lists
+// the texts of all modules it was linked from with their hashes, it's used only while they are the same,
+// so a change of one module re-links only the modules that call it.
+// Entry layout (native byte order):
+//      Header
+//      Dependency[dependenciesCount]   each followed by the file name padded to 8 bytes
+//      BytecodeFile::Instruction[instructionsCount]
+// Checksum covers the fields of the header before it and everything after the header.
+class Linker
+{
+public:
+    static const unsigned int Version = 2;
+
+    // call of the module as it's parsed
+    struct Call
+    {
+        Call():
+            base(0), index(0){}
+
+        std::string fileName;
+        RegNumber base;
+        // pairs of the module register and the register of the program, sorted by module registers
+        std::vector< std::pair<RegNumber, RegNumber> > registers;
+        // index of the placeholder instruction in the program
+        std::size_t index;
+    };
+
+    struct Header
+    {
+        char               magic[4];     // "RMLL"
+        unsigned int       version;
+        unsigned long long key;
+        unsigned long long dependenciesCount;
+        unsigned long long instructionsCount;
+        unsigned long long checksum;
+    };
+
+    struct Dependency
+    {
+        unsigned long long hash;
+        unsigned long long nameSize;
+    };
+
+    struct Stats
+    {
+        Stats():
+            calls(0), modules(0), cached(0){}
+
+        unsigned long long calls;
+        // modules that were linked (parsed or taken from the cache directory)
+        unsigned long long modules;
+        unsigned long long cached;
+    };
+
+    // cacheDirectory - linked modules are kept in the directory, empty - only during the link.
+    explicit Linker(const std::string &cacheDirectory = std::string());
+
+    // replaces the placeholders of the calls by the code of the modules, fileName - the calling program.
+    // Throws LinkException.
+    void link(const std::string &fileName, std::vector<Instruction> &instructions, const std::vector<Call> &calls);
+
+    const Stats& stats() const {
+        return mStats;
+    }
+
+private:
+    struct Module
+    {
+        std::vector<Instruction> instructions;
+        // sorted
+        std::vector<RegNumber> registers;
+        // registers the module sets before reading, they are not zeroed before the call (sorted)
+        std::vector<RegNumber> initialised;
+        // the module and all modules it calls with the hashes of their texts
+        std::vector< std::pair<std::string, unsigned long long> > dependencies;
+    };
+
+    const Module& module(const std::string &fileName);
+    bool readEntry(unsigned long long key, Module &module) const;
+    void writeEntry(unsigned long long key, const Module &module) const;
+    std::string entryName(unsigned long long key) const;
+    static std::vector<RegNumber> usedRegisters(const std::vector<Instruction> &instructions);
+    static std::vector<RegNumber> initialisedRegisters(const std::vector<Instruction> &instructions);
+    // returns false if the file can't be read.
+    static bool hashFile(const std::string &fileName, unsigned long long &hash, std::string *text = 0);
+    static void expand(const std::vector<Instruction> &program, const std::vector<Call> &calls,
+                       const std::vector<const Module *> &modules, std::vector<Instruction> &linked);
+
+private:
+    std::string mCacheDirectory;
+    // linked modules by file names
+    std::map<std::string, Module> mModules;
+    // modules being linked, to find the recursion
+    std::vector<std::string> mStack;
+    Stats mStats;
+};
+
+
+class LinkException: public std::runtime_error
+{
+public:
+    explicit LinkException(std::string message):
+        runtime_error(message){}
+};
+
+
+#endif // LINKER_H
@@ -0,0 +1,209 @@
+#include "loader.h"
+#include <fstream>
+#include <thread>
+#include <iterator>
+#include <algorithm>
+#include <cstring>
+
+#ifdef LINUX
+#   include <sys/mman.h>
+#   include <sys/stat.h>
+#   include <fcntl.h>
+#   include <unistd.h>
+#endif
+
+
+MappedFile::MappedFile():
+    mData(0), mSize(0), mMapped(false)
+{
+}
+
+MappedFile::~MappedFile()
+{
+#ifdef LINUX
+    if (mMapped)
+        munmap(const_cast<char *>(mData), mSize);
+#endif
+}
+
+bool MappedFile::open(const std::string &fileName)
+{
+#ifdef LINUX
+    int descriptor = ::open(fileName.c_str(), O_RDONLY);
+    if (descriptor < 0)
+        return false;
+
+    struct stat status;
+    if (fstat(descriptor, &status) != 0 || ! S_ISREG(status.st_mode)){
+        close(descriptor);
+        return false;
+    }
+
+    mSize = status.st_size;
+    if (mSize == 0){
+        close(descriptor);
+        return true;
+    }
+
+    void *data = mmap(0, mSize, PROT_READ, MAP_PRIVATE, descriptor, 0);
+    close(descriptor);
+    if (data == MAP_FAILED){
+        mSize = 0;
+        return false;
+    }
+
+    madvise(data, mSize, MADV_SEQUENTIAL);
+    mData = static_cast<const char *>(data);
+    mMapped = true;
+    return true;
+#else
+    std::ifstream file(fileName.c_str(), std::ios::binary);
+    if (! file)
+        return false;
+
+    mBuffer.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    mSize = mBuffer.size();
+    mData = mSize ? &mBuffer[0] : 0;
+    return true;
+#endif
+}
+
+
+// texts smaller than this are lexed by the calling thread
+static const std::size_t MinChunkSize = 1 << 20;
+
+ProgramLoader::ProgramLoader(unsigned threads):
+    mThreads(threads)
+{
+    if (mThreads == 0)
+        mThreads = std::thread::hardware_concurrency();
+    if (mThreads == 0)
+        mThreads = 1;
+}
+
+void ProgramLoader::lex(const char *data, std::size_t size, std::vector<LoadedChunk> &chunks) const
+{
+    std::size_t count = std::min<std::size_t>(mThreads, size / MinChunkSize);
+    if (count <= 1){
+        chunks.assign(1, LoadedChunk());
+        lexChunk(data, data + size, &chunks[0]);
+        return;
+    }
+
+    // split at newline boundaries
+    std::vector<const char *> bounds(1, data);
+    for (std::size_t i=1; i<count; ++i){
+        const char *bound = data + size / count * i;
+        if (bound < bounds.back())
+            bound = bounds.back();
+        while (bound < data + size && *(bound - 1) != '\n')
+            ++bound;
+        bounds.push_back(bound);
+    }
+    bounds.push_back(data + size);
+
+    chunks.assign(count, LoadedChunk());
+    std::vector<std::thread> threads;
+    for (std::size_t i=1; i<count; ++i)
+        threads.push_back(std::thread(lexChunk, bounds[i], bounds[i+1], &chunks[i]));
+    lexChunk(bounds[0], bounds[1], &chunks[0]);
+
+    for (std::size_t i=0; i<threads.size(); ++i)
+        threads[i].join();
+}
+
+void ProgramLoader::lexChunk(const char *begin, const char *end, LoadedChunk *chunk)
+{
+    // count of lines is the upper bound of instructions count
+    std::size_t lines = 1;
+    for (const char *pos = begin; (pos = static_cast<const char *>(memchr(pos, '\n', end - pos))) != 0; ++pos)
+        ++lines;
+    chunk->instructions.reserve(lines);
+
+    const char *line = begin;
+    while (line < end){
+        const char *lineEnd = static_cast<const char *>(memchr(line, '\n', end - line));
+        if (! lineEnd)
+            lineEnd = end;
+
+        lexLine(line, lineEnd, *chunk);
+        ++chunk->lines;
+        line = lineEnd + 1;
+    }
+}
+
+
+static inline bool expect(const char *&pos, const char *end, char symbol)
+{
+    ProgramLoader::skipSpaces(pos, end);
+    if (pos == end || *pos != symbol)
+        return false;
+
+    ++pos;
+    return true;
+}
+
+// Accepts only lines that the regular parser accepts with the same result,
+// anything else is passed to it as EK_Line event.
+void ProgramLoader::lexLine(const char *begin, const char *end, LoadedChunk &chunk)
+{
+    // empty lines are ignored
+    if (begin == end)
+        return;
+
+    const char *pos = begin;
+    skipSpaces(pos, end);
+
+    LoadedChunk::Event event;
+    event.kind = LoadedChunk::Event::EK_Line;
+    event.instructionIndex = chunk.instructions.size();
+    event.line = chunk.lines;
+    event.text = begin;
+    event.length = end - begin;
+    event.reg = 0;
+    event.value = 0;
+
+    if (pos == end){
+        chunk.events.push_back(event);
+        return;
+    }
+
+    Instruction instruction(Instruction::CT_Z);
+    bool lexed = false;
+    char symbol = *pos++;
+
+    switch (symbol) {
+    case 'z': case 'Z':
+    case 's': case 'S':
+        instruction.setType(symbol == 'z' || symbol == 'Z' ? Instruction::CT_Z : Instruction::CT_S);
+        lexed = expect(pos, end, '(') && lexNumber(pos, end, instruction.arg1)
+                && expect(pos, end, ')');
+        break;
+
+    case 't': case 'T':
+        instruction.setType(Instruction::CT_T);
+        lexed = expect(pos, end, '(') && lexNumber(pos, end, instruction.arg1)
+                && expect(pos, end, ',') && lexNumber(pos, end, instruction.arg2)
+                && expect(pos, end, ')');
+        break;
+
+    case 'j': case 'J':
+        instruction.setType(Instruction::CT_J);
+        lexed = expect(pos, end, '(') && lexNumber(pos, end, instruction.arg1)
+                && expect(pos, end, ',') && lexNumber(pos, end, instruction.arg2)
+                && expect(pos, end, ',') && lexNumber(pos, end, instruction.instr)
+                && expect(pos, end, ')');
+        break;
+
+    case 'r': case 'R':
+        if (lexNumber(pos, end, event.reg) && expect(pos, end, '=') && lexNumber(pos, end, event.value))
+            event.kind = LoadedChunk::Event::EK_Init;
+        chunk.events.push_back(event);
+        return;
+    }
+
+    if (lexed)
+        chunk.instructions.push_back(instruction);
+    else
+        chunk.events.push_back(event);
+}
@@ -0,0 +1,126 @@
+#ifndef LOADER_H
+#define LOADER_H
+
+#include <vector>
+#include <string>
+
+#include "instruction.h"
+
+
+//-- memory-mapped file
+// Falls back to reading the whole file into memory where mmap is not available.
+class MappedFile
+{
+public:
+    MappedFile();
+    ~MappedFile();
+
+    // returns false if file can't be mapped (does not exist, is not regular file, etc.)
+    bool open(const std::string &fileName);
+
+    const char* data() const {
+        return mData;
+    }
+    std::size_t size() const {
+        return mSize;
+    }
+
+private:
+    MappedFile(const MappedFile &);
+    MappedFile& operator=(const MappedFile &);
+
+private:
+    const char *mData;
+    std::size_t mSize;
+    std::vector<char> mBuffer;
+    bool mMapped;
+};
+
+
+//-- lexed part of the file
+// Well-formed lines are lexed in place into instructions.
+// Everything else (initialisation, errors, unusual syntax) is kept as event with the text of the line,
+// so the interpreter can process it in order with the regular parser and report errors as usual.
+struct LoadedChunk
+{
+    struct Event
+    {
+        enum Kind {
+            EK_Init,    // well-formed initialisation "R<reg> = <value>"
+            EK_Line     // line to be parsed by the regular parser
+        };
+
+        Kind        kind;
+        // count of the chunk's instructions that precede the event
+        std::size_t instructionIndex;
+        // line number in the chunk, from 0
+        std::size_t line;
+        const char *text;
+        std::size_t length;
+
+        RegNumber   reg;
+        RegValue    value;
+    };
+
+    LoadedChunk():
+        lines(0){}
+
+    std::vector<Instruction> instructions;
+    std::vector<Event> events;
+    // count of lines in the chunk
+    std::size_t lines;
+};
+
+
+//-- program loader
+// Lexes the text of the program without per-line allocations.
+// Large texts are split at newline boundaries and lexed by several threads,
+// chunks are returned in order of the text.
+class ProgramLoader
+{
+public:
+    // threads = 0 - use all available cores.
+    explicit ProgramLoader(unsigned threads = 0);
+
+    void lex(const char *data, std::size_t size, std::vector<LoadedChunk> &chunks) const;
+
+    // lexer of the fields, also used by the batch reader.
+    // tabs - tabs are skipped as spaces (the lines of the program with tabs go to the regular parser).
+    static void skipSpaces(const char *&pos, const char *end, bool tabs = false) {
+        while (pos < end && (*pos == ' ' || (tabs && *pos == '\t')))
+            ++pos;
+    }
+    // reads not empty decimal number after the spaces, returns false on overflow
+    static bool lexNumber(const char *&pos, const char *end, RegValue &value, bool tabs = false) {
+        skipSpaces(pos, end, tabs);
+        if (pos == end || *pos < '0' || *pos > '9')
+            return false;
+
+        value = 0;
+        for (; pos < end && *pos >= '0' && *pos <= '9'; ++pos){
+            RegValue digit = *pos - '0';
+            if (value > (~RegValue(0) - digit) / 10)
+                return false;
+            value = value * 10 + digit;
+        }
+        return true;
+    }
+    static bool lexNumber(const char *&pos, const char *end, std::size_t &value, bool tabs = false) {
+        RegValue number;
+        if (! lexNumber(pos, end, number, tabs) || number > RegValue(~std::size_t(0)))
+            return false;
+
+        value = (std::size_t)number;
+        return true;
+    }
+
+private:
+    static void lexChunk(const char *begin, const char *end, LoadedChunk *chunk);
+    static void lexLine(const char *begin, const char *end, LoadedChunk &chunk);
+
+private:
+    unsigned mThreads;
+};
+
+
+#endif // LOADER_H
@@ -0,0 +1,300 @@
+#include "lockstep.h"
+#include <algorithm>
+
+#if defined(__GNUC__)
+#   define LOCKSTEP_VECTOR
+#endif
+
+// AVX2 version is selected at load time where the platform supports it
+#if defined(LOCKSTEP_VECTOR) && defined(__x86_64__) && defined(LINUX) && ! defined(__clang__)
+#   define LOCKSTEP_TARGETS __attribute__((target_clones("avx2", "default")))
+#else
+#   define LOCKSTEP_TARGETS
+#endif
+
+const std::size_t LockstepEngine::Lanes;
+static_assert(LockstepEngine::Lanes == 4, "lane masks are built for 4 lanes");
+
+// utilisation of the lanes in divergent execution is checked after this count of dispatches
+static const unsigned long long DivergenceWindow = 256;
+
+typedef DecodedProgram::Op Op;
+
+
+bool LockstepEngine::isVectorised()
+{
+#ifdef LOCKSTEP_VECTOR
+    return true;
+#else
+    return false;
+#endif
+}
+
+// executes the lane from the op `pc` up to the end by the threaded engine
+static void runScalar(const DecodedProgram &program, RegValue *registers, std::size_t lane,
+                      std::size_t pc, unsigned long long steps, ExecutionResult &result)
+{
+    const std::size_t lanes = LockstepEngine::Lanes;
+    std::vector<RegValue> registerFile(std::max<std::size_t>(program.registerNumbers().size(), 1));
+    for (std::size_t i=0; i<registerFile.size(); ++i)
+        registerFile[i] = registers[i * lanes + lane];
+
+    result = ThreadedEngine().run(program, &registerFile[0], pc);
+    result.steps += steps;
+    result.dispatches += steps;
+
+    for (std::size_t i=0; i<registerFile.size(); ++i)
+        registers[i * lanes + lane] = registerFile[i];
+}
+
+
+#ifdef LOCKSTEP_VECTOR
+
+typedef RegValue LaneVector __attribute__((vector_size(LockstepEngine::Lanes * sizeof(RegValue)),
+                                           aligned(sizeof(RegValue))));
+
+// bit i is set if lane i of the compare result is true
+template<typename Mask>
+static inline unsigned laneBits(const Mask &mask)
+{
+    unsigned bits = 0;
+    for (std::size_t i=0; i<LockstepEngine::Lanes; ++i)
+        if (mask[i])
+            bits |= 1u << i;
+    return bits;
+}
+
+// all ones in the lanes of set bits
+static inline void laneMask(unsigned bits, LaneVector &mask)
+{
+    const LaneVector laneBit = {1, 2, 4, 8};
+    mask = (LaneVector)((laneBit & bits) != 0);
+}
+
+// lanes standing on halt ops are finished at once, so they never hold the rest.
+// returns lanes that are still live.
+static inline unsigned retireHalted(const DecodedProgram &program, const std::size_t *pcs,
+                                    const unsigned long long *steps, unsigned live, ExecutionResult *results)
+{
+    const Op *ops = &program.ops()[0];
+    for (std::size_t i=0; i<LockstepEngine::Lanes; ++i)
+        if (live & (1u << i) && ops[pcs[i]].code == DecodedProgram::OP_Halt){
+            results[i].haltedAt = program.haltNumber(ops[pcs[i]].target);
+            results[i].steps = steps[i];
+            results[i].dispatches = steps[i];
+            live &= ~(1u << i);
+        }
+    return live;
+}
+
+LOCKSTEP_TARGETS
+static void runVector(const DecodedProgram &program, RegValue *registers, std::size_t lanes,
+                      ExecutionResult *results, LockstepEngine::Stats &stats)
+{
+    const std::size_t Lanes = LockstepEngine::Lanes;
+    const Op *ops = &program.ops()[0];
+    const Op *op = ops;
+    LaneVector *vectors = reinterpret_cast<LaneVector *>(registers);
+
+    // lanes that did not halt, halted lanes are never changed
+    unsigned live = (1u << lanes) - 1;
+    LaneVector liveMask = {};
+    laneMask(live, liveMask);
+
+    // converged execution: one counter for all lanes, steps are counted for all lanes at once
+    unsigned long long commonSteps = 0;
+    // divergent execution: own counter of every lane
+    std::size_t pcs[Lanes] = {};
+    unsigned long long steps[Lanes] = {};
+    unsigned long long windowDispatches = 0, windowLaneSteps = 0;
+    // kept locally, so the compiler doesn't reload it after register stores
+    unsigned long long divergentDispatches = 0;
+
+    // must follow the order of DecodedProgram::OpCode, optimised ops except OP_Jmp are not supported.
+    // The table is not static: functions keeping label addresses in static variables can't be cloned.
+    void* const labels[DecodedProgram::OP_Count] = {
+        &&op_z, &&op_s, &&op_t, &&op_j, &&op_halt,
+        &&op_jmp, &&op_unsupported, &&op_unsupported, &&op_unsupported, &&op_unsupported, &&op_unsupported,
+        &&op_unsupported, &&op_unsupported
+    };
+
+converged:
+    goto *labels[op->code];
+
+op_z:
+    vectors[op->arg1] &= ~liveMask;
+    ++commonSteps;
+    ++op;
+    goto *labels[op->code];
+
+op_s:
+    // live lanes of the mask are all ones, that is -1
+    vectors[op->arg1] -= liveMask;
+    ++commonSteps;
+    ++op;
+    goto *labels[op->code];
+
+op_t:
+    vectors[op->arg2] = (vectors[op->arg1] & liveMask) | (vectors[op->arg2] & ~liveMask);
+    ++commonSteps;
+    ++op;
+    goto *labels[op->code];
+
+op_j:
+{
+    unsigned equal = laneBits(vectors[op->arg1] == vectors[op->arg2]) & live;
+    ++commonSteps;
+    if (equal == live)
+        op = ops + op->target;
+    else if (equal == 0)
+        ++op;
+    else {
+        std::size_t pc = op - ops;
+        for (std::size_t i=0; i<Lanes; ++i){
+            steps[i] += commonSteps;
+            pcs[i] = equal & (1u << i) ? op->target : pc + 1;
+        }
+        stats.convergedDispatches += commonSteps;
+        commonSteps = 0;
+        goto divergent;
+    }
+    goto *labels[op->code];
+}
+
+op_jmp:
+    ++commonSteps;
+    op = ops + op->target;
+    goto *labels[op->code];
+
+op_halt:
+    for (std::size_t i=0; i<lanes; ++i)
+        if (live & (1u << i)){
+            results[i].haltedAt = program.haltNumber(op->target);
+            results[i].steps = steps[i] + commonSteps;
+            results[i].dispatches = results[i].steps;
+        }
+    stats.convergedDispatches += commonSteps;
+    stats.divergentDispatches += divergentDispatches;
+    return;
+
+op_unsupported:
+    throw DecodeException("Optimised ops are not supported by the lockstep engine.", op - ops + 1);
+
+divergent:
+    for (;;){
+        live = retireHalted(program, pcs, steps, live, results);
+        laneMask(live, liveMask);
+
+        // the last lane is faster without masks
+        if (__builtin_popcount(live) <= 1){
+            for (std::size_t i=0; i<lanes; ++i)
+                if (live & (1u << i)){
+                    runScalar(program, registers, i, pcs[i], steps[i], results[i]);
+                    ++stats.scalarLanes;
+                }
+            stats.divergentDispatches += divergentDispatches;
+            return;
+        }
+
+        // the op of the lanes that are behind, the rest of the lanes wait for them
+        std::size_t pc = ~std::size_t(0);
+        for (std::size_t i=0; i<Lanes; ++i)
+            if (live & (1u << i) && pcs[i] < pc)
+                pc = pcs[i];
+
+        unsigned active = 0;
+        for (std::size_t i=0; i<Lanes; ++i)
+            if (live & (1u << i) && pcs[i] == pc)
+                active |= 1u << i;
+
+        // lanes met again, steps are counted separately from now
+        if (active == live){
+            op = ops + pc;
+            goto converged;
+        }
+
+        const Op &current = ops[pc];
+        LaneVector mask = {};
+        laneMask(active, mask);
+        ++divergentDispatches;
+
+        switch (current.code) {
+        case DecodedProgram::OP_Z:
+            vectors[current.arg1] &= ~mask;
+            break;
+
+        case DecodedProgram::OP_S:
+            vectors[current.arg1] -= mask;
+            break;
+
+        case DecodedProgram::OP_T:
+            vectors[current.arg2] = (vectors[current.arg1] & mask) | (vectors[current.arg2] & ~mask);
+            break;
+
+        case DecodedProgram::OP_J:
+        {
+            unsigned equal = laneBits(vectors[current.arg1] == vectors[current.arg2]);
+            for (std::size_t i=0; i<Lanes; ++i)
+                if (active & (1u << i))
+                    pcs[i] = equal & (1u << i) ? current.target : pc + 1;
+            break;
+        }
+
+        case DecodedProgram::OP_Jmp:
+            for (std::size_t i=0; i<Lanes; ++i)
+                if (active & (1u << i))
+                    pcs[i] = current.target;
+            break;
+
+        default:
+            throw DecodeException("Optimised ops are not supported by the lockstep engine.", pc + 1);
+        }
+
+        // counters of the lanes are already set by jumps
+        bool isJump = current.code == DecodedProgram::OP_J || current.code == DecodedProgram::OP_Jmp;
+        for (std::size_t i=0; i<Lanes; ++i)
+            if (active & (1u << i)){
+                ++steps[i];
+                if (! isJump)
+                    ++pcs[i];
+            }
+
+        // lanes are too far from each other - finish them one by one
+        windowLaneSteps += __builtin_popcount(active);
+        if (++windowDispatches == DivergenceWindow){
+            if (windowLaneSteps * 4 < windowDispatches * 3 * __builtin_popcount(live)){
+                for (std::size_t i=0; i<lanes; ++i)
+                    if (live & (1u << i)){
+                        runScalar(program, registers, i, pcs[i], steps[i], results[i]);
+                        ++stats.scalarLanes;
+                    }
+                stats.divergentDispatches += divergentDispatches;
+                return;
+            }
+            windowDispatches = windowLaneSteps = 0;
+        }
+    }
+}
+
+#endif // LOCKSTEP_VECTOR
+
+
+void LockstepEngine::run(const DecodedProgram &program, RegValue *registers, std::size_t lanes,
+                         ExecutionResult *results, LockstepEngine::Stats *stats) const
+{
+    Stats counters;
+
+#ifdef LOCKSTEP_VECTOR
+    runVector(program, registers, lanes, results, counters);
+#else
+    for (std::size_t i=0; i<lanes; ++i)
+        runScalar(program, registers, i, 0, 0, results[i]);
+    counters.scalarLanes = lanes;
+#endif
+
+    if (stats){
+        stats->convergedDispatches += counters.convergedDispatches;
+        stats->divergentDispatches += counters.divergentDispatches;
+        stats->scalarLanes += counters.scalarLanes;
+    }
+}
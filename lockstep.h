@@ -0,0 +1,48 @@
+#ifndef LOCKSTEP_H
+#define LOCKSTEP_H
+
+#include "engine.h"
+
+
+//-- lockstep (SIMD) engine
+// Executes one decoded program over several inputs at once.
+// Registers are stored as structure of arrays: register file index i of the lane l
+// is registers[i * Lanes + l], so Z, S and T are single vector ops for all lanes
+// and J is one vector compare producing the mask of lanes that jump.
+//
+// While all lanes follow the same path they share one program counter.
+// When J splits them, every lane keeps its own counter and the op of the smallest counter
+// is executed under the mask of lanes standing on it, until the lanes meet again.
+// If too few lanes are active during the divergent execution, the rest of every lane
+// is finished by the scalar loop.
+//
+// Optimised ops (superinstructions, loop summaries) are not supported,
+// so the program must be decoded without optimisation passes (OP_Jmp is allowed).
+class LockstepEngine
+{
+public:
+    static const std::size_t Lanes = 4;
+
+    struct Stats
+    {
+        Stats():
+            convergedDispatches(0), divergentDispatches(0), scalarLanes(0){}
+
+        unsigned long long convergedDispatches;
+        unsigned long long divergentDispatches;
+        // count of lanes finished by the scalar loop
+        unsigned long long scalarLanes;
+    };
+
+    // true if the engine uses vector instructions, otherwise lanes are executed one by one.
+    static bool isVectorised();
+
+    // registers - register file of Lanes inputs in the layout described above,
+    // lanes      - count of used lanes (from 1 to Lanes), unused lanes are never changed,
+    // results    - result of each used lane.
+    void run(const DecodedProgram &program, RegValue *registers, std::size_t lanes,
+             ExecutionResult *results, Stats *stats = 0) const;
+};
+
+
+#endif // LOCKSTEP_H
@@ -0,0 +1,220 @@
+#include "loops.h"
+#include "engine.h"
+#include <map>
+#include <cstdint>
+
+
+// symbolic value of the register after one iteration:
+// constant (value) or R[source] + value, where R[source] is taken before the iteration.
+struct SymbolicValue
+{
+    bool        constant;
+    std::size_t source;
+    RegValue    value;
+};
+
+// step of the register that is only incremented by the loop body,
+// returns false for any other register.
+static bool inductionStep(const std::map<std::size_t, SymbolicValue> &values, std::size_t reg, RegValue &step)
+{
+    std::map<std::size_t, SymbolicValue>::const_iterator it = values.find(reg);
+    if (it == values.end()){
+        step = 0;
+        return true;
+    }
+    if ((*it).second.constant || (*it).second.source != reg)
+        return false;
+
+    step = (*it).second.value;
+    return true;
+}
+
+template<typename Value>
+bool LoopSummary::tripCount(const Value *registers, Value &trips) const
+{
+    // looking for the least i: left + i*leftStep == right + i*rightStep (mod 2^n),
+    // that is i*delta == difference (mod 2^n).
+    Value difference = registers[right] - registers[left];
+    Value delta = Value(leftStep) - Value(rightStep);
+
+    if (delta == 0){
+        if (difference != 0)
+            return false;
+
+        trips = 0;
+        return true;
+    }
+
+    // delta = 2^shift * odd, equation has solution only if difference is divisible by 2^shift.
+    int shift = 0;
+    while (! (delta & 1)){
+        delta >>= 1;
+        ++shift;
+    }
+    if (difference & ((Value(1) << shift) - 1))
+        return false;
+
+    // inverse of odd number modulo 2^n (Newton's iterations, each doubles correct bits,
+    // the odd number is the inverse of itself modulo 8)
+    Value inverse = delta;
+    for (std::size_t bits=3; bits<sizeof(Value)*8; bits*=2)
+        inverse *= 2 - delta * inverse;
+
+    trips = (difference >> shift) * inverse;
+    if (shift > 0)
+        trips &= ~Value(0) >> shift;
+    return true;
+}
+
+template<typename Value>
+void LoopSummary::apply(Value *registers, Value trips) const
+{
+    if (trips == 0)
+        return;
+
+    // copies read the values of their sources before the loop,
+    // so they must be applied before increments.
+    for (std::size_t i=0; i<effects.size(); ++i){
+        const Effect &effect = effects[i];
+        if (effect.kind == Effect::EK_Copy)
+            registers[effect.reg] = registers[effect.source] + (trips - 1) * Value(effect.sourceStep) + effect.value;
+    }
+
+    for (std::size_t i=0; i<effects.size(); ++i){
+        const Effect &effect = effects[i];
+        switch (effect.kind) {
+        case Effect::EK_Increment:
+            registers[effect.reg] += trips * Value(effect.value);
+            break;
+
+        case Effect::EK_Constant:
+            registers[effect.reg] = effect.value;
+            break;
+
+        case Effect::EK_Copy:
+            break;
+        }
+    }
+}
+
+
+template bool LoopSummary::tripCount(const RegValue *, RegValue &) const;
+template void LoopSummary::apply(RegValue *, RegValue) const;
+template bool LoopSummary::tripCount(const uint32_t *, uint32_t &) const;
+template void LoopSummary::apply(uint32_t *, uint32_t) const;
+#ifdef REGM_INT128
+template bool LoopSummary::tripCount(const WideRegValue *, WideRegValue &) const;
+template void LoopSummary::apply(WideRegValue *, WideRegValue) const;
+#endif
+
+
+std::size_t LoopSummariser::summarise(DecodedProgram &program) const
+{
+    std::vector<DecodedProgram::Op> &ops = program.ops();
+    std::size_t count = program.instructionsCount();
+    std::size_t summarised = 0;
+
+    // every backward unconditional jump closes the loop candidate
+    for (std::size_t i=0; i<count; ++i){
+        const DecodedProgram::Op &backJump = ops[i];
+        if (backJump.code != DecodedProgram::OP_J || backJump.arg1 != backJump.arg2 || backJump.target >= i)
+            continue;
+
+        std::size_t header = backJump.target;
+        if (ops[header].code != DecodedProgram::OP_J)
+            continue;
+
+        LoopSummary summary;
+        if (! analyse(program, header, i, summary))
+            continue;
+
+        ops[header].code = DecodedProgram::OP_Loop;
+        ops[header].target = program.addLoop(summary);
+        ++summarised;
+    }
+
+    return summarised;
+}
+
+bool LoopSummariser::analyse(const DecodedProgram &program, std::size_t header, std::size_t backJump, LoopSummary &summary) const
+{
+    const std::vector<DecodedProgram::Op> &ops = program.ops();
+    const DecodedProgram::Op &test = ops[header];
+
+    // unconditional header never enters the loop,
+    // exit inside of the loop is not a loop exit.
+    if (test.arg1 == test.arg2 || (test.target >= header && test.target <= backJump))
+        return false;
+
+    std::map<std::size_t, SymbolicValue> values;
+
+    for (std::size_t i=header+1; i<backJump; ++i){
+        const DecodedProgram::Op &op = ops[i];
+        SymbolicValue value;
+
+        switch (op.code) {
+        case DecodedProgram::OP_Z:
+            value.constant = true;
+            value.source = 0;
+            value.value = 0;
+            values[op.arg1] = value;
+            break;
+
+        case DecodedProgram::OP_S:
+            if (values.find(op.arg1) == values.end()){
+                value.constant = false;
+                value.source = op.arg1;
+                value.value = 0;
+                values[op.arg1] = value;
+            }
+            ++values[op.arg1].value;
+            break;
+
+        case DecodedProgram::OP_T:
+            if (values.find(op.arg1) == values.end()){
+                value.constant = false;
+                value.source = op.arg1;
+                value.value = 0;
+            } else
+                value = values[op.arg1];
+            values[op.arg2] = value;
+            break;
+
+        default:
+            // jumps inside of the body - not a simple loop
+            return false;
+        }
+    }
+
+    summary.left = test.arg1;
+    summary.right = test.arg2;
+    if (! inductionStep(values, summary.left, summary.leftStep) || ! inductionStep(values, summary.right, summary.rightStep))
+        return false;
+
+    std::map<std::size_t, SymbolicValue>::const_iterator it = values.begin();
+    for (; it != values.end(); ++it){
+        LoopSummary::Effect effect;
+        effect.reg = (*it).first;
+        effect.source = (*it).second.source;
+        effect.value = (*it).second.value;
+        effect.sourceStep = 0;
+
+        if ((*it).second.constant)
+            effect.kind = LoopSummary::Effect::EK_Constant;
+        else if ((*it).second.source == (*it).first){
+            if (effect.value == 0)
+                continue;
+            effect.kind = LoopSummary::Effect::EK_Increment;
+        } else {
+            if (! inductionStep(values, effect.source, effect.sourceStep))
+                return false;
+            effect.kind = LoopSummary::Effect::EK_Copy;
+        }
+
+        summary.effects.push_back(effect);
+    }
+
+    summary.exit = test.target;
+    summary.iterationLength = backJump - header + 1;
+    return true;
+}
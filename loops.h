@@ -0,0 +1,78 @@
+#ifndef LOOPS_H
+#define LOOPS_H
+
+#include <vector>
+#include <cstddef>
+
+#include "instruction.h"
+
+class DecodedProgram;
+
+
+//-- summary of the affine loop
+// Loop of the form
+//      h:   J(a, b, exit)          exit is outside of the loop
+//      ...  Z, S, T only
+//      e:   J(x, x, h)
+// where every register changed by the body is incremented by constant, set to constant
+// or copied from the register that is incremented by constant.
+// Such loop is executed in O(1): trip count is solved in closed form (modulo 2^n for registers
+// of n bits, exactly as the registers overflow) and the effect of all iterations is applied at once.
+class LoopSummary
+{
+public:
+    struct Effect
+    {
+        enum Kind {
+            EK_Increment,   // R[reg] += value on every iteration
+            EK_Constant,    // R[reg] = value after any iteration
+            EK_Copy         // R[reg] = R[source] + value, R[source] += sourceStep on every iteration
+        };
+
+        Kind        kind;
+        std::size_t reg;
+        std::size_t source;
+        RegValue    value;
+        RegValue    sourceStep;
+    };
+
+    // compared registers and their increments per iteration
+    std::size_t left;
+    std::size_t right;
+    RegValue    leftStep;
+    RegValue    rightStep;
+
+    // index of the op executed after the loop
+    InstructionPos exit;
+    // count of instructions executed per iteration (header, body and back jump)
+    std::size_t iterationLength;
+
+    std::vector<Effect> effects;
+
+public:
+    // calculates count of the iterations, Value - type of the registers (see ThreadedEngine).
+    // returns false if the loop never terminates.
+    template<typename Value>
+    bool tripCount(const Value *registers, Value &trips) const;
+    // applies effect of the given count of iterations.
+    template<typename Value>
+    void apply(Value *registers, Value trips) const;
+};
+
+
+//-- loop summariser
+// Finds affine loops in the decoded program and replaces their headers by OP_Loop.
+// Only innermost loops are summarised, outer loops are executed as usual,
+// so nested loops run in time proportional to the trip count of the outer one.
+class LoopSummariser
+{
+public:
+    // returns count of the summarised loops.
+    std::size_t summarise(DecodedProgram &program) const;
+
+private:
+    bool analyse(const DecodedProgram &program, std::size_t header, std::size_t backJump, LoopSummary &summary) const;
+};
+
+
+#endif // LOOPS_H
@@ -1,11 +1,416 @@
 #include "interpreter.h"
+#include "jobrunner.h"
+#include "trace.h"
+#include "conformance.h"
 #include <iostream>
+#include <chrono>
 
 
 struct Settings{
+    Settings():
+        engine(Interpreter::ET_Threaded),
+        optimisationLevel(Interpreter::MaxOptimisationLevel),
+        bytecodeCache(true),
+        batchFormat(BatchRunner::BF_Csv),
+        batchThreads(0),
+        passes(0),
+        profiling(false),
+        stepBudget(0),
+        checkpointInterval(60),
+        cycleDetection(false),
+        debugging(false),
+        replayFrom(0),
+        replaySteps(0),
+        conformancePrograms(0),
+        conformanceSeed(1),
+        conformanceSteps(100000),
+        resultCacheSize(64),
+        outputFormat(OutputWriter::OF_Text),
+        outputSections(OutputWriter::OS_All){}
+
     std::string filename;
+    // all program files, more than one (or a directory) - job runner mode
+    std::vector<std::string> filenames;
+    Interpreter::EngineType engine;
+    int optimisationLevel;
+    std::string transpileOutput;
+    bool bytecodeCache;
+    std::string bytecodeOutput;
+    std::string linkCache;
+    std::string batchInput;
+    std::vector<RegNumber> batchInputs;
+    std::vector<RegNumber> batchOutputs;
+    BatchRunner::Format batchFormat;
+    unsigned batchThreads;
+    unsigned passes;
+    bool profiling;
+    std::string profileOutput;
+    unsigned long long stepBudget;
+    std::string checkpointFile;
+    double checkpointInterval;
+    std::string resumeFile;
+    bool cycleDetection;
+    std::string traceFile;
+    bool debugging;
+    // the trace is replayed instead of running a program
+    std::string replayFile;
+    unsigned long long replayFrom;
+    unsigned long long replaySteps;
+    // the engines are checked against the reference by generated programs instead of running a program
+    unsigned long long conformancePrograms;
+    unsigned long long conformanceSeed;
+    unsigned long long conformanceSteps;
+    std::string resultCache;
+    // megabytes
+    unsigned long long resultCacheSize;
+    OutputWriter::Format outputFormat;
+    unsigned outputSections;
+    std::vector<RegNumber> outputRegisters;
 };
 
+// parses comma separated list of register numbers ("0,1,2").
+// returns false if list is invalid.
+bool parseRegisters(const std::string &value, std::vector<RegNumber> &registers)
+{
+    registers.clear();
+    std::size_t pos = 0;
+    while (pos <= value.size()){
+        std::size_t end = value.find(',', pos);
+        if (end == std::string::npos)
+            end = value.size();
+
+        std::string number = value.substr(pos, end - pos);
+        if (number.empty() || number.size() > 18 || number.find_first_not_of("0123456789") != std::string::npos)
+            return false;
+        registers.push_back(strtoull(number.c_str(), 0, 10));
+        pos = end + 1;
+    }
+    return ! registers.empty();
+}
+
+// parses comma separated list of passes ("dse,thread"), "all" or "none".
+// returns false if list is invalid.
+bool parsePasses(const std::string &value, unsigned &passes)
+{
+    passes = 0;
+    if (value == "none")
+        return true;
+    if (value == "all"){
+        passes = PassPipeline::PS_All;
+        return true;
+    }
+
+    std::size_t pos = 0;
+    while (pos <= value.size()){
+        std::size_t end = value.find(',', pos);
+        if (end == std::string::npos)
+            end = value.size();
+
+        std::string name = value.substr(pos, end - pos);
+        if (name == "coalesce")
+            passes |= PassPipeline::PS_Coalescing;
+        else if (name == "dse")
+            passes |= PassPipeline::PS_DeadStores;
+        else if (name == "thread")
+            passes |= PassPipeline::PS_JumpThreading;
+        else if (name == "layout")
+            passes |= PassPipeline::PS_BlockLayout;
+        else
+            return false;
+        pos = end + 1;
+    }
+    return true;
+}
+
+// parses "all" or comma separated list of output sections ("listing,results").
+// returns false if list is invalid.
+bool parseSections(const std::string &value, unsigned &sections)
+{
+    sections = 0;
+    if (value == "all"){
+        sections = OutputWriter::OS_All;
+        return true;
+    }
+
+    std::size_t pos = 0;
+    while (pos <= value.size()){
+        std::size_t end = value.find(',', pos);
+        if (end == std::string::npos)
+            end = value.size();
+
+        std::string name = value.substr(pos, end - pos);
+        if (name == "listing")
+            sections |= OutputWriter::OS_Listing;
+        else if (name == "initial")
+            sections |= OutputWriter::OS_Initial;
+        else if (name == "results")
+            sections |= OutputWriter::OS_Results;
+        else if (name == "stats")
+            sections |= OutputWriter::OS_Stats;
+        else
+            return false;
+        pos = end + 1;
+    }
+    return true;
+}
+
+// processes key (without prefix) and it's value.
+// returns false if key or value is invalid.
+bool processKey(std::string key, std::string value, Settings &arguments)
+{
+    if (key == "e" || key == "engine"){
+        if (value == "reference")
+            arguments.engine = Interpreter::ET_Reference;
+        else if (value == "threaded")
+            arguments.engine = Interpreter::ET_Threaded;
+        else if (value == "jit")
+            arguments.engine = Interpreter::ET_Jit;
+        else if (value == "checked")
+            arguments.engine = Interpreter::ET_Checked;
+        else if (value == "simd")
+            arguments.engine = Interpreter::ET_Lockstep;
+        else {
+            std::cout << "Unknown engine \"" << value << "\". Available engines: reference, threaded, jit, checked, simd." << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    if (key == "O"){
+        int level = atoi(value.c_str());
+        if (value.empty() || value.find_first_not_of("0123456789") != std::string::npos
+                || level > Interpreter::MaxOptimisationLevel){
+            std::cout << "Invalid optimisation level \"" << value << "\". Levels from 0 to "
+                      << Interpreter::MaxOptimisationLevel << " are available." << std::endl;
+            return false;
+        }
+        arguments.optimisationLevel = level;
+        return true;
+    }
+
+    if (key == "cpp"){
+        arguments.transpileOutput = value;
+        return true;
+    }
+
+    if (key == "cache"){
+        if (value == "on")
+            arguments.bytecodeCache = true;
+        else if (value == "off")
+            arguments.bytecodeCache = false;
+        else {
+            std::cout << "Invalid value of the key \"cache\": \"" << value << "\". Use on or off." << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    if (key == "rmlc"){
+        arguments.bytecodeOutput = value;
+        return true;
+    }
+
+    if (key == "link-cache"){
+        arguments.linkCache = value;
+        return true;
+    }
+
+    if (key == "batch"){
+        arguments.batchInput = value;
+        return true;
+    }
+
+    if (key == "in" || key == "out"){
+        if (! parseRegisters(value, key == "in" ? arguments.batchInputs : arguments.batchOutputs)){
+            std::cout << "Invalid list of registers \"" << value << "\". Use numbers separated by commas: 0,1,2." << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    if (key == "format"){
+        if (value == "csv")
+            arguments.batchFormat = BatchRunner::BF_Csv;
+        else if (value == "binary")
+            arguments.batchFormat = BatchRunner::BF_Binary;
+        else {
+            std::cout << "Unknown format \"" << value << "\". Available formats: csv, binary." << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    if (key == "threads"){
+        if (value.empty() || value.size() > 6 || value.find_first_not_of("0123456789") != std::string::npos){
+            std::cout << "Invalid count of threads \"" << value << "\"." << std::endl;
+            return false;
+        }
+        arguments.batchThreads = atoi(value.c_str());
+        return true;
+    }
+
+    if (key == "passes"){
+        if (! parsePasses(value, arguments.passes)){
+            std::cout << "Invalid list of passes \"" << value << "\". Use all, none or names separated by commas: "
+                      << "coalesce,dse,thread,layout." << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    if (key == "profile"){
+        if (value == "on")
+            arguments.profiling = true;
+        else if (value == "off")
+            arguments.profiling = false;
+        else {
+            std::cout << "Invalid value of the key \"profile\": \"" << value << "\". Use on or off." << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    if (key == "profile-json"){
+        arguments.profileOutput = value;
+        return true;
+    }
+
+    if (key == "budget"){
+        if (value.empty() || value.size() > 19 || value.find_first_not_of("0123456789") != std::string::npos){
+            std::cout << "Invalid step budget \"" << value << "\"." << std::endl;
+            return false;
+        }
+        arguments.stepBudget = strtoull(value.c_str(), 0, 10);
+        return true;
+    }
+
+    if (key == "checkpoint"){
+        arguments.checkpointFile = value;
+        return true;
+    }
+
+    if (key == "checkpoint-interval"){
+        if (value.empty() || value.size() > 9 || value.find_first_not_of("0123456789") != std::string::npos){
+            std::cout << "Invalid checkpoint interval \"" << value << "\". Use count of seconds." << std::endl;
+            return false;
+        }
+        arguments.checkpointInterval = atoi(value.c_str());
+        return true;
+    }
+
+    if (key == "resume"){
+        arguments.resumeFile = value;
+        return true;
+    }
+
+    if (key == "cycles"){
+        if (value == "on")
+            arguments.cycleDetection = true;
+        else if (value == "off")
+            arguments.cycleDetection = false;
+        else {
+            std::cout << "Invalid value of the key \"cycles\": \"" << value << "\". Use on or off." << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    if (key == "debug"){
+        if (value == "on")
+            arguments.debugging = true;
+        else if (value == "off")
+            arguments.debugging = false;
+        else {
+            std::cout << "Invalid value of the key \"debug\": \"" << value << "\". Use on or off." << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    if (key == "trace"){
+        arguments.traceFile = value;
+        return true;
+    }
+
+    if (key == "replay"){
+        arguments.replayFile = value;
+        return true;
+    }
+
+    if (key == "replay-from" || key == "replay-steps"){
+        if (value.empty() || value.size() > 19 || value.find_first_not_of("0123456789") != std::string::npos){
+            std::cout << "Invalid count of steps \"" << value << "\"." << std::endl;
+            return false;
+        }
+        (key == "replay-from" ? arguments.replayFrom : arguments.replaySteps) = strtoull(value.c_str(), 0, 10);
+        return true;
+    }
+
+    if (key == "conformance" || key == "conformance-seed" || key == "conformance-steps"){
+        if (value.empty() || value.size() > 19 || value.find_first_not_of("0123456789") != std::string::npos
+                || (key != "conformance-seed" && strtoull(value.c_str(), 0, 10) == 0)){
+            std::cout << "Invalid value of the key \"" << key << "\": \"" << value << "\"." << std::endl;
+            return false;
+        }
+        unsigned long long number = strtoull(value.c_str(), 0, 10);
+        if (key == "conformance")
+            arguments.conformancePrograms = number;
+        else if (key == "conformance-seed")
+            arguments.conformanceSeed = number;
+        else
+            arguments.conformanceSteps = number;
+        return true;
+    }
+
+    if (key == "result-cache"){
+        arguments.resultCache = value;
+        return true;
+    }
+
+    if (key == "result-cache-size"){
+        if (value.empty() || value.size() > 9 || value.find_first_not_of("0123456789") != std::string::npos){
+            std::cout << "Invalid size of the result cache \"" << value << "\". Use count of megabytes." << std::endl;
+            return false;
+        }
+        arguments.resultCacheSize = strtoull(value.c_str(), 0, 10);
+        return true;
+    }
+
+    if (key == "output"){
+        if (value == "text")
+            arguments.outputFormat = OutputWriter::OF_Text;
+        else if (value == "jsonl")
+            arguments.outputFormat = OutputWriter::OF_JsonLines;
+        else if (value == "binary")
+            arguments.outputFormat = OutputWriter::OF_Binary;
+        else {
+            std::cout << "Unknown output format \"" << value << "\". Available formats: text, jsonl, binary." << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    if (key == "sections"){
+        if (! parseSections(value, arguments.outputSections)){
+            std::cout << "Invalid list of sections \"" << value << "\". Use all or names separated by commas: "
+                      << "listing, initial, results, stats." << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    if (key == "registers"){
+        if (! parseRegisters(value, arguments.outputRegisters)){
+            std::cout << "Invalid list of registers \"" << value << "\"." << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    std::cout << "Unknown key \"" << key << "\". Process stopped." << std::endl;
+    return false;
+}
+
 bool processArguments(int argc, char* argv[], Settings &arguments)
 {
     if (argc <= 1){
@@ -15,23 +420,133 @@ bool processArguments(int argc, char* argv[], Settings &arguments)
 
     for (int i=1; i<argc; ++i){
 #ifdef WIN_32
-        // todo: keys parsing here
-        if (argv[i][0] == '/'){}
+        if (argv[i][0] == '/'){
 #endif
 
 #ifdef LINUX
-        // todo: keys parsing here
-        if (argv[i][0] == '-'){}
+        if (argv[i][0] == '-'){
 #endif
+            std::string key = argv[i] + 1;
+            if (i+1 >= argc){
+                std::cout << "Value of the key \"" << key << "\" is not specified. Process stopped." << std::endl;
+                return false;
+            }
+            if (! processKey(key, argv[++i], arguments))
+                return false;
+        }
 
-        else
+        else {
             if (arguments.filename == "")
                 arguments.filename = argv[i];
-            else
-                std::cout << "WARNING: Additional filename \"" << argv[i] << "\" will be ignored. \""
-                          << arguments.filename << "\" is used." << std::endl;
+            arguments.filenames.push_back(argv[i]);
+        }
+        }
+
+    return true;
+}
+
+
+void configure(Interpreter &interpreter, const Settings &settings)
+{
+    interpreter.setEngine(settings.engine);
+    interpreter.setOptimisationLevel(settings.optimisationLevel);
+    interpreter.setTranspileOutput(settings.transpileOutput);
+    interpreter.setBytecodeCache(settings.bytecodeCache);
+    interpreter.setBytecodeOutput(settings.bytecodeOutput);
+    interpreter.setLinkCache(settings.linkCache);
+    interpreter.setBatchInput(settings.batchInput);
+    interpreter.setBatchRegisters(settings.batchInputs, settings.batchOutputs);
+    interpreter.setBatchFormat(settings.batchFormat);
+    interpreter.setBatchThreads(settings.batchThreads);
+    interpreter.setPasses(settings.passes);
+    interpreter.setProfiling(settings.profiling);
+    interpreter.setProfileOutput(settings.profileOutput);
+    interpreter.setStepBudget(settings.stepBudget);
+    interpreter.setCheckpoint(settings.checkpointFile, settings.checkpointInterval);
+    interpreter.setResumeFile(settings.resumeFile);
+    interpreter.setCycleDetection(settings.cycleDetection);
+    interpreter.setTraceFile(settings.traceFile);
+    interpreter.setDebugging(settings.debugging);
+    interpreter.setResultCache(settings.resultCache, settings.resultCacheSize << 20);
+    interpreter.setOutputFormat(settings.outputFormat);
+    interpreter.setOutputSections(settings.outputSections);
+    interpreter.setOutputRegisters(settings.outputRegisters);
+}
+
+// runs every program of the job list, returns false if any of them failed
+bool runJobs(const Settings &settings)
+{
+    if (! settings.batchInput.empty() || ! settings.transpileOutput.empty()
+            || ! settings.checkpointFile.empty() || ! settings.resumeFile.empty() || ! settings.traceFile.empty()
+            || settings.debugging || settings.outputFormat != OutputWriter::OF_Text){
+        std::cout << "ERROR: Batch mode, transpilation, checkpoints, traces, the debugger and structured output are not supported "
+                  << "for several programs. Process stopped." << std::endl;
+        return false;
+    }
+
+    std::chrono::steady_clock::time_point startTime = std::chrono::steady_clock::now();
+    JobRunner runner(JobRunner::expand(settings.filenames), [&settings](Interpreter &interpreter){
+        configure(interpreter, settings);
+    });
+    runner.setThreads(settings.batchThreads);
+    JobRunner::Stats stats = runner.run(std::cout);
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+
+    std::cout << "Jobs: " << stats.programs << " programs, " << stats.failed << " failed, "
+              << stats.steps << " steps in " << seconds << " s";
+    if (seconds > 0)
+        std::cout << " (" << std::fixed << std::setprecision(0) << stats.programs / seconds << " programs/s, "
+                  << stats.steps / seconds << " steps/s)";
+    std::cout << ", " << stats.stolen << " jobs stolen." << std::endl;
+    return stats.failed == 0;
+}
+
+// prints the state of the traced run after replayFrom steps, then replaySteps steps one by one
+// and the state after them.
+bool replay(const Settings &settings)
+{
+    try {
+        TraceReader reader(settings.replayFile);
+        std::cout << "Trace \"" << settings.replayFile << "\": " << reader.instructions().size() << " instructions, "
+                  << reader.keyframesCount() << " keyframes, ";
+        if (reader.isComplete())
+            std::cout << reader.steps() << " steps." << std::endl;
+        else
+            std::cout << "the run was not finished." << std::endl;
+
+        std::chrono::steady_clock::time_point startTime = std::chrono::steady_clock::now();
+        reader.seek(settings.replayFrom);
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+        std::cout << "Replayed to step " << reader.step() << " in " << seconds << " s." << std::endl;
+
+        for (unsigned long long i=0; i<settings.replaySteps && ! reader.isHalted(); ++i){
+            InstructionPos number = reader.instructionNumber();
+            if (! reader.next())
+                break;
+
+            // the register written by the instruction
+            const Instruction &instruction = reader.instructions()[number - 1];
+            std::cout << "[step " << reader.step() << "]: [ins " << number << "] " << instruction.text();
+            if (instruction.type() != Instruction::CT_J){
+                RegNumber written = instruction.type() == Instruction::CT_T ? instruction.arg2 : instruction.arg1;
+                std::cout << " -> [reg " << written << "]: " << reader.value(written);
+            }
+            std::cout << std::endl;
         }
 
+        std::cout << std::endl << "State after " << reader.step() << " steps, "
+                  << (reader.isHalted() ? "terminated on instruction " : "next instruction ")
+                  << reader.instructionNumber() << ", registers: " << std::endl;
+        std::map<RegNumber, RegValue> registers;
+        reader.storeRegisters(registers);
+        OutputWriter writer(std::cout, OutputWriter::OF_Text);
+        writer.setRegisters(settings.outputRegisters);
+        writer.writeRegisters(OutputWriter::OS_Results, registers, std::map<RegNumber, std::string>());
+
+    } catch (TraceException &e) {
+        std::cout << "ERROR: " << e.what() << " Process stopped." << std::endl;
+        return false;
+    }
     return true;
 }
 
@@ -43,8 +558,17 @@ int main(int argc, char* argv[])
         return 1;
 
     try {
+        if (! settings.replayFile.empty())
+            return replay(settings) ? 0 : 1;
+        if (settings.conformancePrograms > 0)
+            return ConformanceHarness(settings.conformanceSeed, settings.conformanceSteps)
+                    .run(settings.conformancePrograms, std::cout) ? 0 : 1;
+        if (settings.filenames.size() > 1 || (! settings.filenames.empty() && JobRunner::isDirectory(settings.filename)))
+            return runJobs(settings) ? 0 : 1;
+
         Interpreter interpreter;
-        return interpreter.parseFile(settings.filename);
+        configure(interpreter, settings);
+        return interpreter.parseFile(settings.filename) ? 0 : 1;
 
     } catch (std::bad_alloc &) {
         std::cout << "ERROR: Not enough system memory. Process stopped.";
@@ -0,0 +1,308 @@
+#include "output.h"
+#include <sstream>
+#include <iomanip>
+#include <algorithm>
+#include <cstring>
+
+
+// the buffer is written to the stream when it grows over the size
+static const std::size_t BufferSize = 1 << 16;
+
+const unsigned int OutputWriter::Version;
+
+OutputWriter::OutputWriter(std::ostream &stream, OutputWriter::Format format):
+    mStream(stream),
+    mFormat(format),
+    mSections(OS_All),
+    mIsHeaderWritten(false)
+{
+    mBuffer.reserve(BufferSize + 256);
+}
+
+OutputWriter::~OutputWriter()
+{
+    flush();
+}
+
+void OutputWriter::setSections(unsigned sections)
+{
+    mSections = sections;
+}
+
+void OutputWriter::setRegisters(const std::vector<RegNumber> &registers)
+{
+    mRegisters = registers;
+    std::sort(mRegisters.begin(), mRegisters.end());
+}
+
+bool OutputWriter::isWritten(RegNumber number) const
+{
+    return mRegisters.empty() || std::binary_search(mRegisters.begin(), mRegisters.end(), number);
+}
+
+void OutputWriter::flush()
+{
+    if (mBuffer.empty())
+        return;
+    mStream.write(mBuffer.data(), mBuffer.size());
+    mBuffer.clear();
+}
+
+void OutputWriter::append(const char *text)
+{
+    mBuffer.append(text);
+}
+
+void OutputWriter::append(const std::string &text)
+{
+    mBuffer.append(text);
+}
+
+void OutputWriter::appendNumber(unsigned long long value)
+{
+    char digits[24];
+    char *end = digits + sizeof(digits), *begin = end;
+    do {
+        *--begin = char('0' + value % 10);
+        value /= 10;
+    } while (value != 0);
+    mBuffer.append(begin, end - begin);
+}
+
+void OutputWriter::appendWord(unsigned long long value)
+{
+    mBuffer.append(reinterpret_cast<const char *>(&value), sizeof(value));
+}
+
+void OutputWriter::appendHeader()
+{
+    if (mFormat != OF_Binary || mIsHeaderWritten)
+        return;
+
+    unsigned int version = Version;
+    mBuffer.append("RMLO", 4);
+    mBuffer.append(reinterpret_cast<const char *>(&version), sizeof(version));
+    mIsHeaderWritten = true;
+}
+
+void OutputWriter::writeListing(const std::vector<Instruction> &instructions)
+{
+    if (! hasSection(OS_Listing))
+        return;
+
+    appendHeader();
+    if (mFormat == OF_Text)
+        append("\nInstructions: \n");
+    else if (mFormat == OF_Binary){
+        appendWord(SK_Listing);
+        appendWord(instructions.size());
+    }
+
+    static const char *Names[] = {"Z", "S", "T", "J"};
+    for (std::size_t i=0; i<instructions.size(); ++i){
+        const Instruction &instruction = instructions[i];
+        Instruction::Type type = instruction.type();
+        bool hasArg2 = type == Instruction::CT_T || type == Instruction::CT_J;
+
+        switch (mFormat) {
+        case OF_Text:
+            append("[ins ");
+            appendNumber(i + 1);
+            append("]: ");
+            append(Names[type - 1]);
+            append("(");
+            appendNumber(instruction.arg1);
+            if (hasArg2){
+                append(", ");
+                appendNumber(instruction.arg2);
+            }
+            if (type == Instruction::CT_J){
+                append(", ");
+                appendNumber(instruction.instr);
+            }
+            append(")\n");
+            break;
+
+        case OF_JsonLines:
+            append("{\"section\":\"listing\",\"number\":");
+            appendNumber(i + 1);
+            append(",\"instruction\":\"");
+            append(Names[type - 1]);
+            append("\",\"args\":[");
+            appendNumber(instruction.arg1);
+            if (hasArg2){
+                append(",");
+                appendNumber(instruction.arg2);
+            }
+            if (type == Instruction::CT_J){
+                append(",");
+                appendNumber(instruction.instr);
+            }
+            append("]}\n");
+            break;
+
+        case OF_Binary:
+            appendWord(type);
+            appendWord(instruction.arg1);
+            appendWord(instruction.arg2);
+            appendWord(instruction.instr);
+            break;
+        }
+
+        if (mBuffer.size() >= BufferSize)
+            flush();
+    }
+    flush();
+}
+
+void OutputWriter::writeRegisters(OutputWriter::Section section, const std::map<RegNumber, RegValue> &registers,
+                                  const std::map<RegNumber, std::string> &bigValues)
+{
+    if (! hasSection(section))
+        return;
+
+    appendHeader();
+    const char *name = section == OS_Initial ? "initial" : "results";
+    if (mFormat == OF_Text && section == OS_Initial && ! registers.empty())
+        append("Register's initial values: \n");
+    else if (mFormat == OF_Binary){
+        unsigned long long count = 0;
+        std::map<RegNumber, RegValue>::const_iterator it = registers.begin();
+        for (; it != registers.end(); ++it)
+            count += isWritten((*it).first);
+        appendWord(section == OS_Initial ? SK_Initial : SK_Results);
+        appendWord(count);
+    }
+
+    std::map<RegNumber, RegValue>::const_iterator it = registers.begin();
+    for (; it != registers.end(); ++it){
+        if (! isWritten((*it).first))
+            continue;
+
+        std::map<RegNumber, std::string>::const_iterator big = bigValues.find((*it).first);
+        switch (mFormat) {
+        case OF_Text:
+            append("[reg ");
+            appendNumber((*it).first);
+            append("]: ");
+            break;
+
+        case OF_JsonLines:
+            append("{\"section\":\"");
+            append(name);
+            append("\",\"register\":");
+            appendNumber((*it).first);
+            append(",\"value\":");
+            break;
+
+        case OF_Binary:
+            // values over 64 bits are rejected before the run
+            appendWord((*it).first);
+            appendWord((*it).second);
+            break;
+        }
+
+        if (mFormat != OF_Binary){
+            if (big != bigValues.end())
+                append((*big).second);
+            else
+                appendNumber((*it).second);
+            append(mFormat == OF_Text ? "\n" : "}\n");
+        }
+
+        if (mBuffer.size() >= BufferSize)
+            flush();
+    }
+    flush();
+}
+
+void OutputWriter::writeHalt(const ExecutionResult &result)
+{
+    if (! hasSection(OS_Results))
+        return;
+
+    appendHeader();
+    switch (mFormat) {
+    case OF_Text:
+        if (result.cycleSteps > 0){
+            append("\nProgram does not halt: the state on instruction ");
+            appendNumber(result.haltedAt);
+            append(" repeats every ");
+            appendNumber(result.cycleSteps);
+            append(" steps, results: \n");
+        } else if (result.interrupted){
+            append("\nExecution is stopped by the debugger before instruction ");
+            appendNumber(result.haltedAt);
+            append(", results: \n");
+        } else if (result.suspended){
+            append("\nStep budget is exhausted before instruction ");
+            appendNumber(result.haltedAt);
+            append(", results: \n");
+        } else {
+            append("\nProgram terminated on instruction ");
+            appendNumber(result.haltedAt);
+            append(" with results: \n");
+        }
+        break;
+
+    case OF_JsonLines:
+        append("{\"section\":\"halt\",\"instruction\":");
+        appendNumber(result.haltedAt);
+        append(result.suspended ? ",\"suspended\":true" : ",\"suspended\":false");
+        if (result.cycleSteps > 0){
+            append(",\"cycleSteps\":");
+            appendNumber(result.cycleSteps);
+        }
+        append("}\n");
+        break;
+
+    case OF_Binary:
+        appendWord(SK_Halt);
+        appendWord(1);
+        appendWord(result.haltedAt);
+        appendWord(result.suspended);
+        appendWord(result.cycleSteps);
+        break;
+    }
+    flush();
+}
+
+void OutputWriter::writeStats(const ExecutionResult &result, double seconds, bool isCached)
+{
+    if (! hasSection(OS_Stats))
+        return;
+
+    appendHeader();
+    std::ostringstream text;
+    switch (mFormat) {
+    case OF_Text:
+        if (isCached){
+            text << "\nResult of " << result.steps << " steps is taken from the cache in " << seconds << " s.\n";
+            break;
+        }
+        text << "\nExecuted " << result.steps << " steps in " << seconds << " s";
+        if (seconds > 0)
+            text << " (" << std::fixed << std::setprecision(0) << result.steps / seconds << " steps/s)";
+        if (result.compileSeconds > 0)
+            text << ", compiled in " << std::defaultfloat << result.compileSeconds << " s";
+        text << ".\n";
+        if (result.dispatches > 0 && result.steps > result.dispatches)
+            text << "Optimisations removed " << result.steps - result.dispatches << " dispatches.\n";
+        break;
+
+    case OF_JsonLines:
+        text << "{\"section\":\"stats\",\"steps\":" << result.steps << ",\"dispatches\":" << result.dispatches
+             << ",\"seconds\":" << seconds << ",\"cached\":" << (isCached ? "true" : "false") << "}\n";
+        break;
+
+    case OF_Binary:
+        appendWord(SK_Stats);
+        appendWord(1);
+        appendWord(result.steps);
+        appendWord(result.dispatches);
+        appendWord((unsigned long long)(seconds * 1e9));
+        break;
+    }
+    append(text.str());
+    flush();
+}
@@ -0,0 +1,99 @@
+#ifndef OUTPUT_H
+#define OUTPUT_H
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <map>
+
+#include "instruction.h"
+#include "engine.h"
+
+
+//-- buffered writer of the listing, registers and statistics
+// Lines are collected in the buffer and written to the stream by large blocks, the stream is never flushed,
+// so a listing of millions of instructions doesn't cost a system call per line.
+// Every write*() call ends with flush() of the buffer, so the sections keep their order with other messages
+// written to the same stream.
+//
+// Formats:
+//      text   - human-readable text as it was always printed ("[reg 0]: 10").
+//      jsonl  - one JSON object per line:
+//                  {"section":"listing","number":1,"instruction":"J","args":[1,2,5]}
+//                  {"section":"initial","register":0,"value":10}
+//                  {"section":"halt","instruction":5,"suspended":false}
+//                  {"section":"halt","instruction":3,"suspended":true,"cycleSteps":4}   (the program never halts)
+//                  {"section":"results","register":0,"value":20}
+//                  {"section":"stats","steps":137,"dispatches":40,"seconds":0.0001}
+//      binary - native byte order, 64-bit fields. The stream starts with the header {"RMLO", version (32 bit)},
+//               every section is {kind, count} followed by count records:
+//                  SK_Listing:  {type, arg1, arg2, instr}
+//                  SK_Initial, SK_Results:  {number, value}
+//                  SK_Halt:     {instruction, suspended, cycleSteps}, count = 1
+//                  SK_Stats:    {steps, dispatches, nanoseconds}, count = 1
+class OutputWriter
+{
+public:
+    static const unsigned int Version = 2;
+
+    enum Format {
+        OF_Text = 0, OF_JsonLines, OF_Binary
+    };
+
+    // sections that are written, the halt belongs to the results
+    enum Section {
+        OS_Listing = 1,
+        OS_Initial = 2,
+        OS_Results = 4,
+        OS_Stats = 8,
+        OS_All = OS_Listing | OS_Initial | OS_Results | OS_Stats
+    };
+
+    // kinds of the binary sections
+    enum SectionKind {
+        SK_Listing = 1, SK_Initial, SK_Halt, SK_Results, SK_Stats
+    };
+
+    OutputWriter(std::ostream &stream, Format format);
+    ~OutputWriter();
+
+    // combination of Section flags, all by default.
+    void setSections(unsigned sections);
+    // only the registers are written, all if empty.
+    void setRegisters(const std::vector<RegNumber> &registers);
+    bool hasSection(Section section) const {
+        return (mSections & section) != 0;
+    }
+
+    void writeListing(const std::vector<Instruction> &instructions);
+    // section - OS_Initial or OS_Results,
+    // bigValues - decimal values of the registers that don't fit 64 bits (text and jsonl only).
+    void writeRegisters(Section section, const std::map<RegNumber, RegValue> &registers,
+                        const std::map<RegNumber, std::string> &bigValues);
+    void writeHalt(const ExecutionResult &result);
+    // isCached - the result is taken from the result cache.
+    void writeStats(const ExecutionResult &result, double seconds, bool isCached);
+
+    // writes the buffer to the stream.
+    void flush();
+
+private:
+    bool isWritten(RegNumber number) const;
+    void append(const char *text);
+    void append(const std::string &text);
+    void appendNumber(unsigned long long value);
+    void appendWord(unsigned long long value);
+    void appendHeader();
+
+private:
+    std::ostream &mStream;
+    Format mFormat;
+    unsigned mSections;
+    // sorted
+    std::vector<RegNumber> mRegisters;
+    std::string mBuffer;
+    bool mIsHeaderWritten;
+};
+
+
+#endif // OUTPUT_H
@@ -0,0 +1,215 @@
+#include "passes.h"
+#include <unordered_map>
+#include <unordered_set>
+#include <algorithm>
+
+typedef ControlFlowGraph::Block Block;
+typedef ControlFlowGraph::Target Target;
+
+
+PassPipeline::PassPipeline(unsigned passes):
+    mPasses(passes)
+{
+}
+
+PassPipeline::Stats PassPipeline::run(std::vector<Instruction> &instructions, std::vector<InstructionPos> &haltNumbers,
+                                      std::vector<InstructionPos> &sourceNumbers) const
+{
+    Stats stats;
+    stats.instructionsBefore = stats.instructionsAfter = instructions.size();
+    haltNumbers.clear();
+    sourceNumbers.clear();
+    if (instructions.empty())
+        return stats;
+
+    ControlFlowGraph graph(instructions);
+    std::vector<Block> &blocks = graph.blocks();
+    stats.blocks = blocks.size();
+
+    for (std::size_t i=0; i<blocks.size(); ++i){
+        if (mPasses & PS_Coalescing)
+            stats.coalescedReads += coalesce(blocks[i]);
+        if (mPasses & PS_DeadStores)
+            stats.deadStores += removeDeadStores(blocks[i]);
+    }
+    if (mPasses & PS_JumpThreading)
+        stats.threadedJumps = threadJumps(graph);
+
+    // threading can leave blocks without predecessors
+    stats.unreachableInstructions = graph.markReachable();
+
+    std::vector<std::size_t> order;
+    for (std::size_t i=0; i<blocks.size(); ++i)
+        if (blocks[i].reachable)
+            order.push_back(i);
+    if (mPasses & PS_BlockLayout){
+        std::size_t originalCount = graph.emittedCount(order);
+        order = layout(graph);
+        stats.removedJumps = originalCount - std::min(originalCount, graph.emittedCount(order));
+    }
+
+    graph.emit(order, instructions, haltNumbers, sourceNumbers);
+    stats.instructionsAfter = instructions.size();
+    return stats;
+}
+
+std::size_t PassPipeline::coalesce(ControlFlowGraph::Block &block) const
+{
+    // copies[b] = a: R[b] is known to be equal to R[a]
+    std::unordered_map<RegNumber, RegNumber> copies;
+    std::size_t replaced = 0;
+
+    for (std::size_t i=0; i<block.body.size(); ++i){
+        Instruction &instruction = block.body[i];
+        RegNumber changed = instruction.arg1;
+
+        if (instruction.type() == Instruction::CT_T){
+            std::unordered_map<RegNumber, RegNumber>::const_iterator source = copies.find(instruction.arg1);
+            if (source != copies.end()){
+                instruction.arg1 = (*source).second;
+                ++replaced;
+            }
+            changed = instruction.arg2;
+        }
+
+        // the changed register is not a copy anymore, as well as copies of it
+        copies.erase(changed);
+        for (std::unordered_map<RegNumber, RegNumber>::iterator it = copies.begin(); it != copies.end(); )
+            if ((*it).second == changed)
+                it = copies.erase(it);
+            else
+                ++it;
+
+        if (instruction.type() == Instruction::CT_T && instruction.arg1 != instruction.arg2)
+            copies[instruction.arg2] = instruction.arg1;
+    }
+
+    if (block.exit == Block::BE_Branch){
+        RegNumber *compared[2] = {&block.left, &block.right};
+        for (std::size_t i=0; i<2; ++i){
+            std::unordered_map<RegNumber, RegNumber>::const_iterator source = copies.find(*compared[i]);
+            if (source != copies.end()){
+                *compared[i] = (*source).second;
+                ++replaced;
+            }
+        }
+        // compares the copy with the original
+        if (block.left == block.right)
+            block.exit = Block::BE_Jump;
+    }
+    return replaced;
+}
+
+std::size_t PassPipeline::removeDeadStores(ControlFlowGraph::Block &block) const
+{
+    // registers that are overwritten later in the block before they are read,
+    // all registers are live at the end of the block
+    std::unordered_set<RegNumber> overwritten;
+    std::vector<bool> isDead(block.body.size(), false);
+    std::size_t removed = 0;
+
+    for (std::size_t i=block.body.size(); i-- > 0; ){
+        const Instruction &instruction = block.body[i];
+        switch (instruction.type()) {
+        case Instruction::CT_Z:
+            if (! overwritten.insert(instruction.arg1).second)
+                isDead[i] = true;
+            break;
+
+        case Instruction::CT_S:
+            overwritten.erase(instruction.arg1);
+            break;
+
+        case Instruction::CT_T:
+            if (instruction.arg1 == instruction.arg2 || overwritten.count(instruction.arg2))
+                isDead[i] = true;
+            else {
+                overwritten.insert(instruction.arg2);
+                overwritten.erase(instruction.arg1);
+            }
+            break;
+
+        default:
+            break;
+        }
+        if (isDead[i])
+            ++removed;
+    }
+
+    if (removed){
+        std::vector<Instruction> body;
+        std::vector<InstructionPos> numbers;
+        body.reserve(block.body.size() - removed);
+        numbers.reserve(block.body.size() - removed);
+        for (std::size_t i=0; i<block.body.size(); ++i)
+            if (! isDead[i]){
+                body.push_back(block.body[i]);
+                numbers.push_back(block.numbers[i]);
+            }
+        block.body.swap(body);
+        block.numbers.swap(numbers);
+    }
+    return removed;
+}
+
+std::size_t PassPipeline::threadJumps(ControlFlowGraph &graph) const
+{
+    std::vector<Block> &blocks = graph.blocks();
+    std::size_t threaded = 0;
+
+    for (std::size_t i=0; i<blocks.size(); ++i){
+        Block &block = blocks[i];
+        Target *targets[2] = {&block.taken, &block.next};
+
+        for (std::size_t t=0; t<2; ++t){
+            // taken is used by jumps only, next - by all but unconditional jumps
+            if ((t == 0 && block.exit == Block::BE_Fall) || (t == 1 && block.exit == Block::BE_Jump))
+                continue;
+            Target &target = *targets[t];
+            // blocks without instructions only pass the control further,
+            // the count of hops is limited because of empty infinite loops
+            for (std::size_t hops=0; hops<blocks.size() && target.kind == Target::TK_Block; ++hops){
+                const Block &passed = blocks[target.value];
+                if (! passed.body.empty() || passed.exit == Block::BE_Branch)
+                    break;
+                Target further = passed.exit == Block::BE_Jump ? passed.taken : passed.next;
+                if (further == target)
+                    break;
+                target = further;
+                if (hops == 0)
+                    ++threaded;
+            }
+        }
+
+        // J(a, b, q) that goes to the same place either way
+        if (block.exit == Block::BE_Branch && block.taken == block.next){
+            block.exit = Block::BE_Fall;
+            ++threaded;
+        }
+    }
+    return threaded;
+}
+
+std::vector<std::size_t> PassPipeline::layout(const ControlFlowGraph &graph) const
+{
+    const std::vector<Block> &blocks = graph.blocks();
+    std::vector<bool> isPlaced(blocks.size(), false);
+    std::vector<std::size_t> order;
+
+    // chains start from the entry and then from the first block that is not placed yet,
+    // every chain follows the successor reached without a jump
+    for (std::size_t first=0; first<blocks.size(); ++first){
+        std::size_t current = first;
+        while (blocks[current].reachable && ! isPlaced[current]){
+            isPlaced[current] = true;
+            order.push_back(current);
+
+            const Block &block = blocks[current];
+            const Target &successor = block.exit == Block::BE_Jump ? block.taken : block.next;
+            if (successor.kind != Target::TK_Block)
+                break;
+            current = successor.value;
+        }
+    }
+    return order;
+}
@@ -0,0 +1,72 @@
+#ifndef PASSES_H
+#define PASSES_H
+
+#include "cfg.h"
+
+
+//-- optimisation passes over the control-flow graph
+// Passes are run in this order, each of them can be disabled:
+//  coalescing     - copy propagation inside of the block: after T(a, b) reads of b by T and J
+//                   are replaced by reads of a until a or b is changed, so copies become dead
+//                   more often and jumps compare the original registers
+//                   (J that compares the copy with the original becomes unconditional);
+//  dead stores    - Z and T whose result is overwritten later in the same block
+//                   without being read are removed, as well as T(a, a);
+//  jump threading - jumps to blocks that contain only an unconditional jump go straight
+//                   to the final target, J(a, b, q) to the next instruction is removed;
+//  block layout   - blocks are placed in chains following the fall-through edges,
+//                   so fewer unconditional jumps are emitted.
+// Unreachable blocks are always removed.
+//
+// All registers are treated as live at the end of every block, because all of them
+// are printed on termination, so the final registers are the same as of the source program.
+// Count of the steps and instruction numbers are changed, halt numbers are mapped back
+// by ControlFlowGraph::originalHalt(), numbers of the suspended runs - by originalInstruction().
+class PassPipeline
+{
+public:
+    enum Pass {
+        PS_Coalescing = 1,
+        PS_DeadStores = 2,
+        PS_JumpThreading = 4,
+        PS_BlockLayout = 8,
+        PS_All = PS_Coalescing | PS_DeadStores | PS_JumpThreading | PS_BlockLayout
+    };
+
+    struct Stats
+    {
+        Stats():
+            blocks(0), unreachableInstructions(0), coalescedReads(0), deadStores(0),
+            threadedJumps(0), removedJumps(0), instructionsBefore(0), instructionsAfter(0){}
+
+        std::size_t blocks;
+        std::size_t unreachableInstructions;
+        std::size_t coalescedReads;
+        std::size_t deadStores;
+        std::size_t threadedJumps;
+        // unconditional jumps that are not needed after the layout
+        std::size_t removedJumps;
+        std::size_t instructionsBefore;
+        std::size_t instructionsAfter;
+    };
+
+    // passes - combination of Pass flags
+    explicit PassPipeline(unsigned passes);
+
+    // replaces the instructions by optimised ones.
+    // haltNumbers, sourceNumbers - see ControlFlowGraph::emit().
+    Stats run(std::vector<Instruction> &instructions, std::vector<InstructionPos> &haltNumbers,
+              std::vector<InstructionPos> &sourceNumbers) const;
+
+private:
+    std::size_t coalesce(ControlFlowGraph::Block &block) const;
+    std::size_t removeDeadStores(ControlFlowGraph::Block &block) const;
+    std::size_t threadJumps(ControlFlowGraph &graph) const;
+    std::vector<std::size_t> layout(const ControlFlowGraph &graph) const;
+
+private:
+    unsigned mPasses;
+};
+
+
+#endif // PASSES_H
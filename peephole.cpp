@@ -0,0 +1,79 @@
+#include "peephole.h"
+
+
+const int PeepholeOptimizer::MaxLevel;
+
+PeepholeOptimizer::PeepholeOptimizer(int level):
+    mLevel(level)
+{
+}
+
+PeepholeOptimizer::Stats PeepholeOptimizer::optimise(DecodedProgram &program) const
+{
+    Stats stats;
+    if (mLevel <= 0)
+        return stats;
+
+    std::vector<DecodedProgram::Op> &ops = program.ops();
+    std::size_t count = program.instructionsCount();
+
+    // level 1: J(a, a, q) always jumps.
+    for (std::size_t i=0; i<count; ++i){
+        if (ops[i].code == DecodedProgram::OP_J && ops[i].arg1 == ops[i].arg2){
+            ops[i].code = DecodedProgram::OP_Jmp;
+            ++stats.unconditionalJumps;
+        }
+    }
+
+    if (mLevel < 2)
+        return stats;
+
+    // ops that are targets of jumps can't be absorbed by superinstructions.
+    std::vector<bool> isTarget(count, false);
+    for (std::size_t i=0; i<count; ++i){
+        // the loop header keeps the index of the summary, it jumps to the exit of the loop
+        std::size_t target = ops[i].code == DecodedProgram::OP_Loop ? program.loop(ops[i].target).exit : ops[i].target;
+        if ((ops[i].code == DecodedProgram::OP_J || ops[i].code == DecodedProgram::OP_Jmp
+             || ops[i].code == DecodedProgram::OP_Loop) && target < count)
+            isTarget[target] = true;
+    }
+
+    for (std::size_t i=0; i<count; ++i){
+        DecodedProgram::OpCode first = ops[i].code;
+        DecodedProgram::OpCode second = (i+1 < count && ! isTarget[i+1]) ?
+                    ops[i+1].code : DecodedProgram::OP_Halt;
+        DecodedProgram::OpCode third = (i+2 < count && ! isTarget[i+1] && ! isTarget[i+2]) ?
+                    ops[i+2].code : DecodedProgram::OP_Halt;
+
+        std::size_t absorbed = 0;
+        if (mLevel >= 3 && first == DecodedProgram::OP_S && second == DecodedProgram::OP_S
+                && third == DecodedProgram::OP_Jmp){
+            ops[i].code = DecodedProgram::OP_SSJmp;
+            absorbed = 2;
+
+        } else if (first == DecodedProgram::OP_S && second == DecodedProgram::OP_S){
+            ops[i].code = DecodedProgram::OP_SS;
+            absorbed = 1;
+
+        } else if (first == DecodedProgram::OP_S && second == DecodedProgram::OP_J){
+            ops[i].code = DecodedProgram::OP_SJ;
+            absorbed = 1;
+
+        } else if (first == DecodedProgram::OP_S && second == DecodedProgram::OP_Jmp){
+            ops[i].code = DecodedProgram::OP_SJmp;
+            absorbed = 1;
+
+        } else if (first == DecodedProgram::OP_T && second == DecodedProgram::OP_Z){
+            ops[i].code = DecodedProgram::OP_TZ;
+            absorbed = 1;
+        }
+
+        if (absorbed > 0){
+            ++stats.superinstructions;
+            stats.absorbedOps += absorbed;
+            i += absorbed;
+        }
+    }
+
+    return stats;
+}
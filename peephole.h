@@ -0,0 +1,41 @@
+#ifndef PEEPHOLE_H
+#define PEEPHOLE_H
+
+#include "engine.h"
+
+
+//-- peephole optimiser
+// Replaces recurring sequences of decoded ops by superinstructions.
+// Levels:
+//  0 - no optimisation;
+//  1 - J(a, a, q) is replaced by unconditional jump;
+//  2 - pairs "S; S", "S; J", "T; Z" are fused;
+//  3 - triples "S; S; unconditional J" are fused.
+//
+// Ops absorbed by superinstruction stay in the stream, so indexes of the ops are not changed.
+// Sequence is never fused if some jump leads inside of it.
+class PeepholeOptimizer
+{
+public:
+    static const int MaxLevel = 3;
+
+    struct Stats
+    {
+        Stats():
+            unconditionalJumps(0), superinstructions(0), absorbedOps(0){}
+
+        std::size_t unconditionalJumps;
+        std::size_t superinstructions;
+        std::size_t absorbedOps;
+    };
+
+    explicit PeepholeOptimizer(int level);
+
+    Stats optimise(DecodedProgram &program) const;
+
+private:
+    int mLevel;
+};
+
+
+#endif // PEEPHOLE_H
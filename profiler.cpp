@@ -0,0 +1,307 @@
+#include "profiler.h"
+#include "cfg.h"
+#include <algorithm>
+#include <iomanip>
+#include <cstring>
+
+#ifdef LINUX
+#   include <linux/perf_event.h>
+#   include <sys/ioctl.h>
+#   include <sys/syscall.h>
+#   include <unistd.h>
+#endif
+
+
+#ifdef LINUX
+// returns descriptor of the disabled counter of the current thread or -1
+static int openCounter(unsigned long long config)
+{
+    perf_event_attr attributes;
+    memset(&attributes, 0, sizeof(attributes));
+    attributes.type = PERF_TYPE_HARDWARE;
+    attributes.size = sizeof(attributes);
+    attributes.config = config;
+    attributes.disabled = 1;
+    attributes.exclude_kernel = 1;
+    attributes.exclude_hv = 1;
+    return syscall(__NR_perf_event_open, &attributes, 0, -1, -1, 0);
+}
+
+static unsigned long long readCounter(int fd)
+{
+    unsigned long long value = 0;
+    if (read(fd, &value, sizeof(value)) != sizeof(value))
+        return 0;
+    return value;
+}
+#endif
+
+HardwareCounters::HardwareCounters():
+    mInstructionsFd(-1),
+    mBranchMissesFd(-1),
+    mIsAvailable(false),
+    mInstructions(0),
+    mBranchMisses(0)
+{
+}
+
+HardwareCounters::~HardwareCounters()
+{
+#ifdef LINUX
+    if (mInstructionsFd >= 0)
+        close(mInstructionsFd);
+    if (mBranchMissesFd >= 0)
+        close(mBranchMissesFd);
+#endif
+}
+
+bool HardwareCounters::start()
+{
+#ifdef LINUX
+    mInstructionsFd = openCounter(PERF_COUNT_HW_INSTRUCTIONS);
+    mBranchMissesFd = openCounter(PERF_COUNT_HW_BRANCH_MISSES);
+    mIsAvailable = mInstructionsFd >= 0 && mBranchMissesFd >= 0;
+    if (! mIsAvailable)
+        return false;
+
+    ioctl(mInstructionsFd, PERF_EVENT_IOC_RESET, 0);
+    ioctl(mBranchMissesFd, PERF_EVENT_IOC_RESET, 0);
+    ioctl(mInstructionsFd, PERF_EVENT_IOC_ENABLE, 0);
+    ioctl(mBranchMissesFd, PERF_EVENT_IOC_ENABLE, 0);
+#endif
+    return mIsAvailable;
+}
+
+void HardwareCounters::stop()
+{
+#ifdef LINUX
+    if (! mIsAvailable)
+        return;
+
+    ioctl(mInstructionsFd, PERF_EVENT_IOC_DISABLE, 0);
+    ioctl(mBranchMissesFd, PERF_EVENT_IOC_DISABLE, 0);
+    mInstructions = readCounter(mInstructionsFd);
+    mBranchMisses = readCounter(mBranchMissesFd);
+#endif
+}
+
+
+static bool hotterBlock(const Profiler::Block &left, const Profiler::Block &right)
+{
+    return left.steps > right.steps || (left.steps == right.steps && left.first < right.first);
+}
+
+static bool hotterLoop(const Profiler::Loop &left, const Profiler::Loop &right)
+{
+    return left.steps > right.steps || (left.steps == right.steps && left.header < right.header);
+}
+
+// count of executions and index of the instruction
+typedef std::pair<unsigned long long, std::size_t> InstructionCount;
+
+static bool hotterInstruction(const InstructionCount &left, const InstructionCount &right)
+{
+    return left.first > right.first || (left.first == right.first && left.second < right.second);
+}
+
+Profiler::Profiler(const std::vector<Instruction> &instructions, const ExecutionProfile &profile,
+                   const ExecutionResult &result, double seconds):
+    mInstructions(instructions),
+    mProfile(profile),
+    mResult(result),
+    mSeconds(seconds),
+    mTopCount(10),
+    mHasHardwareCounters(false),
+    mHardwareInstructions(0),
+    mBranchMisses(0)
+{
+    ControlFlowGraph graph(instructions);
+    const std::vector<ControlFlowGraph::Block> &blocks = graph.blocks();
+    for (std::size_t i=0; i<blocks.size(); ++i){
+        Block block;
+        block.first = blocks[i].first;
+        block.length = blocks[i].body.size() + (blocks[i].exit == ControlFlowGraph::Block::BE_Fall ? 0 : 1);
+        // control enters the block only at the first instruction
+        block.entries = profile.executed[block.first];
+        block.steps = 0;
+        for (std::size_t k=block.first; k<block.first + block.length; ++k)
+            block.steps += profile.executed[k];
+        if (block.steps)
+            mBlocks.push_back(block);
+    }
+    std::sort(mBlocks.begin(), mBlocks.end(), hotterBlock);
+
+    // prefix sums give the steps of any range of instructions
+    std::vector<unsigned long long> stepsBefore(instructions.size() + 1, 0);
+    for (std::size_t i=0; i<instructions.size(); ++i)
+        stepsBefore[i+1] = stepsBefore[i] + profile.executed[i];
+
+    for (std::size_t i=0; i<instructions.size(); ++i){
+        const Instruction &instruction = instructions[i];
+        if (instruction.type() != Instruction::CT_J || instruction.instr < 1 || instruction.instr > i+1
+                || profile.taken[i] == 0)
+            continue;
+
+        Loop loop;
+        loop.header = instruction.instr - 1;
+        loop.backJump = i;
+        loop.iterations = profile.taken[i];
+        loop.steps = stepsBefore[i+1] - stepsBefore[loop.header];
+        mLoops.push_back(loop);
+    }
+    std::sort(mLoops.begin(), mLoops.end(), hotterLoop);
+}
+
+void Profiler::setHardwareCounters(const HardwareCounters &counters)
+{
+    mHasHardwareCounters = counters.isAvailable();
+    mHardwareInstructions = counters.instructions();
+    mBranchMisses = counters.branchMisses();
+}
+
+void Profiler::setTopCount(std::size_t count)
+{
+    mTopCount = count;
+}
+
+void Profiler::printInstruction(std::ostream &output, std::size_t index) const
+{
+    const Instruction &instruction = mInstructions[index];
+    switch (instruction.type()) {
+    case Instruction::CT_Z:
+        output << "Z(" << instruction.arg1 << ")";
+        break;
+
+    case Instruction::CT_S:
+        output << "S(" << instruction.arg1 << ")";
+        break;
+
+    case Instruction::CT_T:
+        output << "T(" << instruction.arg1 << ", " << instruction.arg2 << ")";
+        break;
+
+    case Instruction::CT_J:
+        output << "J(" << instruction.arg1 << ", " << instruction.arg2 << ", " << instruction.instr << ")";
+        break;
+    }
+}
+
+double Profiler::ratio(unsigned long long part, unsigned long long total) const
+{
+    return total ? 100.0 * part / total : 0;
+}
+
+void Profiler::printText(std::ostream &output) const
+{
+    std::ios::fmtflags flags = output.flags();
+    std::streamsize precision = output.precision();
+
+    output << std::defaultfloat << std::setprecision(6);
+    output << std::endl << "Profile: " << mResult.steps << " steps in " << mSeconds << " s";
+    output << std::fixed << std::setprecision(0);
+    if (mSeconds > 0)
+        output << " (" << mResult.steps / mSeconds << " steps/s)";
+    output << "." << std::endl << std::setprecision(1);
+
+    if (mHasHardwareCounters)
+        output << "Hardware counters: " << mHardwareInstructions << " instructions retired ("
+               << (mResult.steps ? double(mHardwareInstructions) / mResult.steps : 0) << " per step), "
+               << mBranchMisses << " branch misses." << std::endl;
+    else
+        output << "Hardware counters are not available." << std::endl;
+
+    std::vector<InstructionCount> instructions, jumps;
+    for (std::size_t i=0; i<mInstructions.size(); ++i){
+        if (mProfile.executed[i] == 0)
+            continue;
+        instructions.push_back(std::make_pair(mProfile.executed[i], i));
+        if (mInstructions[i].type() == Instruction::CT_J)
+            jumps.push_back(std::make_pair(mProfile.executed[i], i));
+    }
+    // the hottest first, equal counts - in the program order
+    std::size_t top = std::min(mTopCount, instructions.size());
+    std::partial_sort(instructions.begin(), instructions.begin() + top, instructions.end(), hotterInstruction);
+    instructions.resize(top);
+
+    output << std::endl << "Hottest instructions:" << std::endl;
+    for (std::size_t i=0; i<instructions.size(); ++i){
+        output << "[ins " << instructions[i].second + 1 << "]: ";
+        printInstruction(output, instructions[i].second);
+        output << " - " << instructions[i].first << " (" << ratio(instructions[i].first, mResult.steps) << "%)" << std::endl;
+    }
+
+    top = std::min(mTopCount, jumps.size());
+    std::partial_sort(jumps.begin(), jumps.begin() + top, jumps.end(), hotterInstruction);
+    jumps.resize(top);
+
+    output << std::endl << "Jumps:" << std::endl;
+    for (std::size_t i=0; i<jumps.size(); ++i){
+        std::size_t index = jumps[i].second;
+        output << "[ins " << index + 1 << "]: ";
+        printInstruction(output, index);
+        output << " - executed " << mProfile.executed[index] << ", taken " << mProfile.taken[index]
+               << " (" << ratio(mProfile.taken[index], mProfile.executed[index]) << "%)" << std::endl;
+    }
+
+    output << std::endl << "Hot blocks:" << std::endl;
+    for (std::size_t i=0; i<mBlocks.size() && i<mTopCount; ++i)
+        output << "[ins " << mBlocks[i].first + 1 << "-" << mBlocks[i].first + mBlocks[i].length << "]: "
+               << mBlocks[i].entries << " entries, " << mBlocks[i].steps << " steps ("
+               << ratio(mBlocks[i].steps, mResult.steps) << "%)" << std::endl;
+
+    output << std::endl << "Hot loops:" << std::endl;
+    if (mLoops.empty())
+        output << "none" << std::endl;
+    for (std::size_t i=0; i<mLoops.size() && i<mTopCount; ++i)
+        output << "[ins " << mLoops[i].header + 1 << "-" << mLoops[i].backJump + 1 << "]: "
+               << mLoops[i].iterations << " iterations, " << mLoops[i].steps << " steps ("
+               << ratio(mLoops[i].steps, mResult.steps) << "%)" << std::endl;
+
+    output.flags(flags);
+    output.precision(precision);
+}
+
+void Profiler::printJson(std::ostream &output) const
+{
+    std::ios::fmtflags flags = output.flags();
+    output << "{" << std::endl
+           << "  \"steps\": " << mResult.steps << "," << std::endl
+           << "  \"seconds\": " << mSeconds << "," << std::endl
+           << "  \"stepsPerSecond\": " << std::fixed << std::setprecision(0)
+           << (mSeconds > 0 ? mResult.steps / mSeconds : 0) << "," << std::endl;
+    output.flags(flags);
+    output << "  \"haltedAt\": " << mResult.haltedAt << "," << std::endl;
+
+    output << "  \"hardware\": ";
+    if (mHasHardwareCounters)
+        output << "{\"instructions\": " << mHardwareInstructions << ", \"branchMisses\": " << mBranchMisses << "}";
+    else
+        output << "null";
+    output << "," << std::endl;
+
+    // instruction texts contain only letters, digits, commas and parentheses
+    output << "  \"instructions\": [";
+    for (std::size_t i=0; i<mInstructions.size(); ++i){
+        output << (i ? "," : "") << std::endl << "    {\"number\": " << i + 1 << ", \"instruction\": \"";
+        printInstruction(output, i);
+        output << "\", \"executed\": " << mProfile.executed[i];
+        if (mInstructions[i].type() == Instruction::CT_J)
+            output << ", \"taken\": " << mProfile.taken[i];
+        output << "}";
+    }
+    output << std::endl << "  ]," << std::endl;
+
+    output << "  \"blocks\": [";
+    for (std::size_t i=0; i<mBlocks.size(); ++i)
+        output << (i ? "," : "") << std::endl << "    {\"first\": " << mBlocks[i].first + 1
+               << ", \"last\": " << mBlocks[i].first + mBlocks[i].length
+               << ", \"entries\": " << mBlocks[i].entries << ", \"steps\": " << mBlocks[i].steps << "}";
+    output << std::endl << "  ]," << std::endl;
+
+    output << "  \"loops\": [";
+    for (std::size_t i=0; i<mLoops.size(); ++i)
+        output << (i ? "," : "") << std::endl << "    {\"header\": " << mLoops[i].header + 1
+               << ", \"backJump\": " << mLoops[i].backJump + 1
+               << ", \"iterations\": " << mLoops[i].iterations << ", \"steps\": " << mLoops[i].steps << "}";
+    output << std::endl << "  ]" << std::endl << "}" << std::endl;
+}
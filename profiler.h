@@ -0,0 +1,112 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <iostream>
+#include <vector>
+
+#include "instruction.h"
+#include "engine.h"
+
+
+//-- hardware counters of the current thread (Linux perf_event_open)
+// Counters are not available on other platforms, in virtual machines without PMU
+// or if perf events are forbidden by the system (kernel.perf_event_paranoid).
+class HardwareCounters
+{
+public:
+    HardwareCounters();
+    ~HardwareCounters();
+
+    // returns false if counters are not available.
+    bool start();
+    void stop();
+
+    bool isAvailable() const {
+        return mIsAvailable;
+    }
+    unsigned long long instructions() const {
+        return mInstructions;
+    }
+    unsigned long long branchMisses() const {
+        return mBranchMisses;
+    }
+
+private:
+    HardwareCounters(const HardwareCounters &);
+    HardwareCounters& operator=(const HardwareCounters &);
+
+private:
+    int mInstructionsFd;
+    int mBranchMissesFd;
+    bool mIsAvailable;
+    unsigned long long mInstructions;
+    unsigned long long mBranchMisses;
+};
+
+
+//-- profile report
+// Built from the counters of the profiling run (see ThreadedEngine::profile()).
+// Hot blocks are the basic blocks of the control-flow graph ordered by the executed steps,
+// hot loops are ranges between the jump target and the backward jump to it,
+// their steps include the steps of nested loops.
+class Profiler
+{
+public:
+    struct Block
+    {
+        // index of the first instruction
+        std::size_t first;
+        std::size_t length;
+        unsigned long long entries;
+        unsigned long long steps;
+    };
+
+    struct Loop
+    {
+        // index of the first instruction (jump target)
+        std::size_t header;
+        // index of the backward jump
+        std::size_t backJump;
+        unsigned long long iterations;
+        unsigned long long steps;
+    };
+
+    Profiler(const std::vector<Instruction> &instructions, const ExecutionProfile &profile,
+             const ExecutionResult &result, double seconds);
+
+    void setHardwareCounters(const HardwareCounters &counters);
+    // count of the entries in every section of the text report.
+    void setTopCount(std::size_t count);
+
+    const std::vector<Block>& hotBlocks() const {
+        return mBlocks;
+    }
+    const std::vector<Loop>& hotLoops() const {
+        return mLoops;
+    }
+
+    // hottest instructions, jumps, blocks and loops.
+    void printText(std::ostream &output) const;
+    // counters of all instructions, all blocks and loops.
+    void printJson(std::ostream &output) const;
+
+private:
+    void printInstruction(std::ostream &output, std::size_t index) const;
+    double ratio(unsigned long long part, unsigned long long total) const;
+
+private:
+    const std::vector<Instruction> &mInstructions;
+    const ExecutionProfile &mProfile;
+    ExecutionResult mResult;
+    double mSeconds;
+    std::size_t mTopCount;
+    std::vector<Block> mBlocks;
+    std::vector<Loop> mLoops;
+
+    bool mHasHardwareCounters;
+    unsigned long long mHardwareInstructions;
+    unsigned long long mBranchMisses;
+};
+
+
+#endif // PROFILER_H
@@ -0,0 +1,231 @@
+#include "program.h"
+#include "interpreter.h"
+#include "loops.h"
+#include <sstream>
+#include <algorithm>
+
+
+const int Program::MaxOptimisationLevel;
+
+Program::Program(const std::vector<Instruction> &instructions, const std::map<RegNumber, RegValue> &registers,
+                 int optimisationLevel):
+    mInstructions(instructions),
+    mRegisters(registers),
+    mDecoded(instructions),
+    mOptimisationLevel(optimisationLevel),
+    mIsNarrowable(false)
+{
+    mOptimisation = optimise(mDecoded, optimisationLevel);
+    loadRegisters();
+}
+
+Program::Program(const std::vector<Instruction> &instructions, const std::map<RegNumber, RegValue> &registers,
+                 const DecodedProgram &decoded, int optimisationLevel, const Optimisation &optimisation):
+    mInstructions(instructions),
+    mRegisters(registers),
+    mDecoded(decoded),
+    mOptimisationLevel(optimisationLevel),
+    mOptimisation(optimisation),
+    mIsNarrowable(false)
+{
+    loadRegisters();
+}
+
+void Program::loadRegisters()
+{
+    mIsNarrowable = mDecoded.loopsCount() == 0;
+    mRegisterFile = mDecoded.loadRegisters(mRegisters);
+
+    const std::vector<RegNumber> &numbers = mDecoded.registerNumbers();
+    for (std::size_t i=0; i<numbers.size(); ++i)
+        mRegisterIndexes.push_back(std::make_pair(numbers[i], i));
+    std::sort(mRegisterIndexes.begin(), mRegisterIndexes.end());
+
+    // the program without registers still needs valid pointer
+    if (mRegisterFile.empty())
+        mRegisterFile.push_back(0);
+}
+
+std::shared_ptr<const Program> Program::load(const std::string &fileName, int optimisationLevel)
+{
+    // the parser of the interpreter reports errors to the output
+    std::ostringstream errors;
+    Interpreter interpreter;
+    interpreter.setOutput(errors);
+    interpreter.setBytecodeCache(false);
+    if (! interpreter.loadFile(fileName)){
+        std::string message = errors.str();
+        while (! message.empty() && message[message.size() - 1] == '\n')
+            message.erase(message.size() - 1);
+        throw ProgramException(message);
+    }
+
+    return std::make_shared<const Program>(interpreter.instructions(), interpreter.registers(), optimisationLevel);
+}
+
+bool Program::findRegister(RegNumber number, DecodedProgram::RegIndex &index) const
+{
+    std::vector< std::pair<RegNumber, DecodedProgram::RegIndex> >::const_iterator it = std::lower_bound(
+                mRegisterIndexes.begin(), mRegisterIndexes.end(), std::make_pair(number, DecodedProgram::RegIndex(0)));
+    if (it == mRegisterIndexes.end() || (*it).first != number)
+        return false;
+    index = (*it).second;
+    return true;
+}
+
+Program::Optimisation Program::optimise(DecodedProgram &program, int optimisationLevel)
+{
+    // loops are summarised before peephole, because it changes the ops of loop bodies.
+    Optimisation optimisation;
+    if (optimisationLevel >= 4)
+        optimisation.loops = LoopSummariser().summarise(program);
+
+    optimisation.peephole = PeepholeOptimizer(std::min(optimisationLevel, PeepholeOptimizer::MaxLevel)).optimise(program);
+    return optimisation;
+}
+
+
+Machine::Machine(const Program &program):
+    mProgram(program),
+    mRegisterFile(program.registerFile()),
+    mNarrowFile(mRegisterFile.size()),
+    mNext(0),
+    mIsHalted(false),
+    mHaltedAt(0)
+{
+}
+
+Machine::Machine(const Program &program, const std::map<RegNumber, RegValue> &registers):
+    mProgram(program),
+    mRegisterFile(program.registerFile()),
+    mNarrowFile(mRegisterFile.size()),
+    mNext(0),
+    mIsHalted(false),
+    mHaltedAt(0)
+{
+    reset(registers);
+}
+
+void Machine::reset()
+{
+    std::copy(mProgram.registerFile().begin(), mProgram.registerFile().end(), mRegisterFile.begin());
+    mNext = 0;
+    mIsHalted = false;
+}
+
+void Machine::reset(const std::map<RegNumber, RegValue> &registers)
+{
+    reset();
+    std::map<RegNumber, RegValue>::const_iterator it = registers.begin();
+    for (; it != registers.end(); ++it)
+        setValue((*it).first, (*it).second);
+}
+
+bool Machine::setValue(RegNumber number, RegValue value)
+{
+    DecodedProgram::RegIndex index;
+    if (! mProgram.findRegister(number, index))
+        return false;
+    mRegisterFile[index] = value;
+    return true;
+}
+
+RegValue Machine::value(RegNumber number) const
+{
+    DecodedProgram::RegIndex index;
+    if (mProgram.findRegister(number, index))
+        return mRegisterFile[index];
+
+    std::map<RegNumber, RegValue>::const_iterator it = mProgram.registers().find(number);
+    return it != mProgram.registers().end() ? (*it).second : 0;
+}
+
+void Machine::storeRegisters(std::map<RegNumber, RegValue> &registers) const
+{
+    mProgram.decoded().storeRegisters(mRegisterFile, registers);
+}
+
+ExecutionResult Machine::run(unsigned long long stepLimit)
+{
+    // the narrow engine runs in slices while the values allow it,
+    // shorter slices are not worth the conversion of the register file
+    const unsigned long long MinNarrowSteps = 1ULL << 20;
+
+    // the halted machine stays halted until reset
+    ExecutionResult result;
+    if (mIsHalted){
+        result.haltedAt = mHaltedAt;
+        return result;
+    }
+
+    for (;;){
+        if (stepLimit != 0 && result.steps >= stepLimit)
+            return result;
+
+        unsigned long long steps = narrowSteps();
+        bool isLast = false;
+        if (stepLimit != 0){
+            unsigned long long remaining = stepLimit - result.steps;
+            unsigned long long count = mProgram.decoded().instructionsCount();
+            isLast = remaining <= steps;
+            // a slice overruns its limit by less than the count of instructions,
+            // so the slice before the last one must stop before the step limit
+            if (isLast)
+                steps = remaining;
+            else if (remaining - steps < count)
+                steps = remaining > count ? remaining - count : 0;
+        }
+        if (! isLast && steps < MinNarrowSteps)
+            break;
+
+        ExecutionResult part = runNarrow(steps);
+        part.steps += result.steps;
+        part.dispatches += result.dispatches;
+        result = part;
+        if (! result.suspended || isLast)
+            return result;
+    }
+
+    ExecutionResult part;
+    if (stepLimit == 0)
+        part = ThreadedEngine().run(mProgram.decoded(), &mRegisterFile[0], mNext);
+    else
+        part = ThreadedEngine().run(mProgram.decoded(), &mRegisterFile[0], mNext, stepLimit - result.steps);
+    update(part);
+
+    part.steps += result.steps;
+    part.dispatches += result.dispatches;
+    return part;
+}
+
+unsigned long long Machine::narrowSteps() const
+{
+    if (! mProgram.isNarrowable())
+        return 0;
+
+    // a step increments a register by one at most, and the engine stops on the first taken jump
+    // after the limit, that is less than the count of instructions later (straight code),
+    // so the values stay under the maximum + limit + instructions count.
+    RegValue bound = 0xFFFFFFFFULL - mProgram.decoded().instructionsCount();
+    RegValue maximum = *std::max_element(mRegisterFile.begin(), mRegisterFile.end());
+    return maximum < bound ? bound - maximum : 0;
+}
+
+ExecutionResult Machine::runNarrow(unsigned long long stepLimit)
+{
+    std::copy(mRegisterFile.begin(), mRegisterFile.end(), mNarrowFile.begin());
+    ExecutionResult result = ThreadedEngine().run(mProgram.decoded(), &mNarrowFile[0], mNext, stepLimit);
+    std::copy(mNarrowFile.begin(), mNarrowFile.end(), mRegisterFile.begin());
+    update(result);
+    return result;
+}
+
+void Machine::update(const ExecutionResult &result)
+{
+    if (result.suspended)
+        mNext = result.haltedAt - 1;
+    else {
+        mIsHalted = true;
+        mHaltedAt = result.haltedAt;
+    }
+}
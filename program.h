@@ -0,0 +1,167 @@
+#ifndef PROGRAM_H
+#define PROGRAM_H
+
+#include <string>
+#include <vector>
+#include <map>
+#include <memory>
+#include <stdexcept>
+#include <cstdint>
+
+#include "instruction.h"
+#include "engine.h"
+#include "peephole.h"
+
+
+//-- compiled program (library API)
+// Decoded and optimised once, immutable afterwards, so one Program can be shared
+// by any number of threads and machines.
+//
+//      std::shared_ptr<const Program> program = Program::load("x*y.rml");
+//      Machine machine(*program);
+//      ExecutionResult result = machine.run();
+//      RegValue product = machine.value(0);
+class Program
+{
+public:
+    // levels 1-3 - peephole optimisations (see PeepholeOptimizer),
+    // level 4 - additionally affine loops are summarised (see LoopSummariser).
+    static const int MaxOptimisationLevel = 4;
+
+    struct Optimisation
+    {
+        Optimisation():
+            loops(0){}
+
+        PeepholeOptimizer::Stats peephole;
+        std::size_t loops;
+    };
+
+    // registers - initial values. Throws DecodeException.
+    Program(const std::vector<Instruction> &instructions, const std::map<RegNumber, RegValue> &registers,
+            int optimisationLevel = MaxOptimisationLevel);
+    // program decoded and optimised for the level before (see BytecodeFile), it's not decoded again.
+    Program(const std::vector<Instruction> &instructions, const std::map<RegNumber, RegValue> &registers,
+            const DecodedProgram &decoded, int optimisationLevel, const Optimisation &optimisation);
+
+    // parses the text source or loads the compiled program (.rmlc) without printing anything.
+    // Throws ProgramException with the parse error.
+    static std::shared_ptr<const Program> load(const std::string &fileName, int optimisationLevel = MaxOptimisationLevel);
+
+    // applies the optimisations of the level to the decoded program.
+    static Optimisation optimise(DecodedProgram &program, int optimisationLevel);
+
+    const std::vector<Instruction>& instructions() const {
+        return mInstructions;
+    }
+    // initial values of the registers
+    const std::map<RegNumber, RegValue>& registers() const {
+        return mRegisters;
+    }
+    const DecodedProgram& decoded() const {
+        return mDecoded;
+    }
+    // initial register file (see DecodedProgram::loadRegisters)
+    const std::vector<RegValue>& registerFile() const {
+        return mRegisterFile;
+    }
+    // index of the register in the register file, returns false if the program doesn't use the register.
+    bool findRegister(RegNumber number, DecodedProgram::RegIndex &index) const;
+    int optimisationLevel() const {
+        return mOptimisationLevel;
+    }
+    const Optimisation& optimisation() const {
+        return mOptimisation;
+    }
+    // the program can run on 32-bit registers while the values allow it (see Machine::run()),
+    // summarised loops make any count of steps at once, so programs with them can't.
+    bool isNarrowable() const {
+        return mIsNarrowable;
+    }
+
+private:
+    // builds the initial register file and the index of the registers of the decoded program
+    void loadRegisters();
+
+private:
+    std::vector<Instruction> mInstructions;
+    std::map<RegNumber, RegValue> mRegisters;
+    DecodedProgram mDecoded;
+    std::vector<RegValue> mRegisterFile;
+    // pairs of the register number and it's index, sorted by numbers
+    std::vector< std::pair<RegNumber, DecodedProgram::RegIndex> > mRegisterIndexes;
+    int mOptimisationLevel;
+    Optimisation mOptimisation;
+    bool mIsNarrowable;
+};
+
+
+//-- register file of the program
+// The register file is allocated by the constructor only, so the machine can be reset
+// and run any number of times without allocations. Registers that the program doesn't use
+// can't change and keep the initial values of the program.
+//
+// The engine is run on 32-bit registers when the values and the step limit guarantee that
+// they don't overflow, the ops then touch half of the cache lines of the register file.
+// The register file keeps RegValue, it's converted before and after the narrow run.
+class Machine
+{
+public:
+    explicit Machine(const Program &program);
+    // registers - initial values that replace the ones of the program.
+    Machine(const Program &program, const std::map<RegNumber, RegValue> &registers);
+
+    // restores the initial values of the program and starts from the first instruction.
+    void reset();
+    void reset(const std::map<RegNumber, RegValue> &registers);
+
+    // returns false if the program doesn't use the register.
+    bool setValue(RegNumber number, RegValue value);
+    RegValue value(RegNumber number) const;
+    // values of the registers used by the program (see Program::registerFile()).
+    const std::vector<RegValue>& registerFile() const {
+        return mRegisterFile;
+    }
+    // writes values of the registers used by the program to the map.
+    void storeRegisters(std::map<RegNumber, RegValue> &registers) const;
+
+    // runs until the halt or until the first taken jump after stepLimit steps (0 - no limit).
+    // Suspended execution is continued by the next call, steps of the result are the steps of the call.
+    // Halted machine returns the same halt without steps until reset.
+    ExecutionResult run(unsigned long long stepLimit = 0);
+
+    // index of the instruction to execute next
+    std::size_t next() const {
+        return mNext;
+    }
+    void setNext(std::size_t next) {
+        mNext = next;
+        mIsHalted = false;
+    }
+
+private:
+    // steps the narrow engine can make from the current values, 0 - the values don't allow it.
+    unsigned long long narrowSteps() const;
+    ExecutionResult runNarrow(unsigned long long stepLimit);
+    // continues from the suspension or remembers the halt
+    void update(const ExecutionResult &result);
+
+private:
+    const Program &mProgram;
+    std::vector<RegValue> mRegisterFile;
+    std::vector<uint32_t> mNarrowFile;
+    std::size_t mNext;
+    bool mIsHalted;
+    InstructionPos mHaltedAt;
+};
+
+
+class ProgramException: public std::runtime_error
+{
+public:
+    explicit ProgramException(std::string message):
+        runtime_error(message){}
+};
+
+
+#endif // PROGRAM_H
@@ -0,0 +1,257 @@
+#include "resultcache.h"
+#include "bytecode.h"
+#include "loader.h"
+#include <fstream>
+#include <algorithm>
+#include <cstring>
+#include <cstddef>
+#include <stdio.h>
+
+#ifdef LINUX
+#   include <sys/stat.h>
+#   include <sys/file.h>
+#   include <dirent.h>
+#   include <fcntl.h>
+#   include <unistd.h>
+#   include <utime.h>
+#endif
+
+
+// exclusive lock of the cache directory for the lifetime of the object
+class DirectoryLock
+{
+public:
+    explicit DirectoryLock(const std::string &directory):
+        mDescriptor(-1)
+    {
+#ifdef LINUX
+        mDescriptor = ::open((directory + "/lock").c_str(), O_RDWR | O_CREAT, 0666);
+        if (mDescriptor >= 0)
+            flock(mDescriptor, LOCK_EX);
+#else
+        (void)directory;
+#endif
+    }
+
+    ~DirectoryLock()
+    {
+#ifdef LINUX
+        if (mDescriptor >= 0)
+            close(mDescriptor);
+#endif
+    }
+
+private:
+    int mDescriptor;
+};
+
+struct CachedEntry
+{
+    std::string fileName;
+    unsigned long long size;
+    long long used;
+
+    bool operator<(const CachedEntry &other) const {
+        return used < other.used;
+    }
+};
+
+// entries of the directory with their sizes and times of the last use
+static std::vector<CachedEntry> listEntries(const std::string &directory)
+{
+    std::vector<CachedEntry> entries;
+#ifdef LINUX
+    DIR *handle = opendir(directory.c_str());
+    if (handle == 0)
+        return entries;
+
+    const std::string extension = ".rmlr";
+    while (struct dirent *item = readdir(handle)){
+        std::string name = item->d_name;
+        if (name.size() <= extension.size()
+                || name.compare(name.size() - extension.size(), extension.size(), extension) != 0)
+            continue;
+
+        CachedEntry entry;
+        entry.fileName = directory + "/" + name;
+        struct stat status;
+        // the entry could be removed by another process meanwhile
+        if (stat(entry.fileName.c_str(), &status) != 0)
+            continue;
+        entry.size = status.st_size;
+        entry.used = (long long)status.st_mtim.tv_sec * 1000000000LL + status.st_mtim.tv_nsec;
+        entries.push_back(entry);
+    }
+    closedir(handle);
+#else
+    (void)directory;
+#endif
+    return entries;
+}
+
+static void readCounters(const std::string &fileName, unsigned long long &hits, unsigned long long &misses)
+{
+    hits = misses = 0;
+    std::ifstream file(fileName.c_str());
+    std::string name;
+    unsigned long long value;
+    while (file >> name >> value){
+        if (name == "hits")
+            hits = value;
+        else if (name == "misses")
+            misses = value;
+    }
+}
+
+
+const unsigned int ResultCache::Version;
+
+ResultCache::ResultCache(const std::string &directory, unsigned long long maxBytes):
+    mDirectory(directory),
+    mMaxBytes(maxBytes)
+{
+#ifdef LINUX
+    mkdir(directory.c_str(), 0777);
+#endif
+}
+
+ResultCache::Key ResultCache::key(unsigned int engine, const std::vector<Instruction> &instructions,
+                                  const std::map<RegNumber, RegValue> &registers)
+{
+    Key key;
+    key.material.reserve(3 + instructions.size() * 4 + registers.size() * 2);
+    key.material.push_back(engine);
+    key.material.push_back(instructions.size());
+    for (std::size_t i=0; i<instructions.size(); ++i){
+        key.material.push_back(instructions[i].type());
+        key.material.push_back(instructions[i].arg1);
+        key.material.push_back(instructions[i].arg2);
+        key.material.push_back(instructions[i].instr);
+    }
+    key.material.push_back(registers.size());
+    std::map<RegNumber, RegValue>::const_iterator it = registers.begin();
+    for (; it != registers.end(); ++it){
+        key.material.push_back((*it).first);
+        key.material.push_back((*it).second);
+    }
+
+    // checksum of the material names the entry
+    key.hash = BytecodeFile::checksum(reinterpret_cast<const char *>(key.material.data()),
+                                      key.material.size() * sizeof(unsigned long long));
+    return key;
+}
+
+std::string ResultCache::entryName(unsigned long long key) const
+{
+    char name[32];
+    sprintf(name, "%016llx.rmlr", key);
+    return mDirectory + "/" + name;
+}
+
+bool ResultCache::find(const Key &key, ExecutionResult &result, std::map<RegNumber, RegValue> &registers)
+{
+    std::string fileName = entryName(key.hash);
+    MappedFile file;
+    bool isHit = file.open(fileName) && file.size() >= sizeof(Header);
+
+    Header header;
+    std::size_t materialBytes = key.material.size() * sizeof(unsigned long long);
+    if (isHit){
+        std::memcpy(&header, file.data(), sizeof(header));
+        std::size_t bodySize = file.size() - sizeof(Header);
+        // the material of the entry must be the material of the run, not just the hash
+        isHit = std::memcmp(header.magic, "RMLR", 4) == 0 && header.version == Version && header.key == key.hash
+                && header.materialSize == key.material.size() && bodySize >= materialBytes
+                && header.registersCount == (bodySize - materialBytes) / sizeof(RegisterRecord)
+                && (bodySize - materialBytes) % sizeof(RegisterRecord) == 0
+                && BytecodeFile::fileChecksum(&header, offsetof(Header, checksum), file.data() + sizeof(Header), bodySize)
+                   == header.checksum
+                && std::memcmp(file.data() + file.size() - materialBytes, key.material.data(), materialBytes) == 0;
+    }
+    count(isHit);
+    if (! isHit)
+        return false;
+
+    registers.clear();
+    RegisterRecord::read(file.data() + sizeof(Header), header.registersCount, registers);
+    result.haltedAt = header.haltedAt;
+    result.steps = header.steps;
+    result.dispatches = header.steps;
+
+#ifdef LINUX
+    // modification time is the time of the last use for eviction
+    utime(fileName.c_str(), 0);
+#endif
+    return true;
+}
+
+bool ResultCache::store(const Key &key, const ExecutionResult &result,
+                        const std::map<RegNumber, RegValue> &registers)
+{
+    std::size_t registersBytes = registers.size() * sizeof(RegisterRecord);
+    std::vector<char> body(registersBytes + key.material.size() * sizeof(unsigned long long));
+    RegisterRecord::write(registers, body.data());
+    if (! key.material.empty())
+        std::memcpy(&body[registersBytes], &key.material[0], key.material.size() * sizeof(unsigned long long));
+
+    Header header;
+    std::memcpy(header.magic, "RMLR", 4);
+    header.version = Version;
+    header.key = key.hash;
+    header.haltedAt = result.haltedAt;
+    header.steps = result.steps;
+    header.registersCount = registers.size();
+    header.materialSize = key.material.size();
+    header.checksum = BytecodeFile::fileChecksum(&header, offsetof(Header, checksum), body.data(), body.size());
+
+    if (! BytecodeFile::writeAtomically(entryName(key.hash), &header, sizeof(header), body))
+        return false;
+    evict();
+    return true;
+}
+
+void ResultCache::count(bool isHit)
+{
+    DirectoryLock lock(mDirectory);
+    std::string fileName = mDirectory + "/stats";
+    unsigned long long hits, misses;
+    readCounters(fileName, hits, misses);
+    if (isHit)
+        ++hits;
+    else
+        ++misses;
+
+    std::ofstream file(fileName.c_str(), std::ios::trunc);
+    file << "hits " << hits << "\n" << "misses " << misses << "\n";
+}
+
+void ResultCache::evict()
+{
+    DirectoryLock lock(mDirectory);
+    std::vector<CachedEntry> entries = listEntries(mDirectory);
+    unsigned long long bytes = 0;
+    for (std::size_t i=0; i<entries.size(); ++i)
+        bytes += entries[i].size;
+    if (bytes <= mMaxBytes)
+        return;
+
+    // the least recently used first
+    std::sort(entries.begin(), entries.end());
+    for (std::size_t i=0; i<entries.size() && bytes > mMaxBytes; ++i){
+        if (remove(entries[i].fileName.c_str()) == 0)
+            bytes -= entries[i].size;
+    }
+}
+
+ResultCache::Statistics ResultCache::statistics() const
+{
+    DirectoryLock lock(mDirectory);
+    Statistics statistics;
+    readCounters(mDirectory + "/stats", statistics.hits, statistics.misses);
+
+    std::vector<CachedEntry> entries = listEntries(mDirectory);
+    statistics.entries = entries.size();
+    for (std::size_t i=0; i<entries.size(); ++i)
+        statistics.bytes += entries[i].size;
+    return statistics;
+}
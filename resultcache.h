@@ -0,0 +1,85 @@
+#ifndef RESULTCACHE_H
+#define RESULTCACHE_H
+
+#include <string>
+#include <vector>
+#include <map>
+
+#include "instruction.h"
+#include "engine.h"
+
+
+//-- persistent cache of execution results
+// Directory of entries "<key>.rmlr", the key is the hash of the program as parsed (comments, whitespace
+// and case are already dropped by the parser), initial values of the registers and the engine.
+// The hash only names the entry: the entry keeps the whole key material and a hit is accepted only
+// if it's equal to the material of the run, so a collision of the hashes is a miss.
+// Entry: Header, RegisterRecord[registersCount] (final values of the registers) and
+// uint64[materialSize] (key material, see Key), checksummed as the other binary files (see bytecode.h).
+//
+// Entries are written atomically and validated on read, so several processes can share the directory.
+// Statistics and eviction are serialised by the lock file (Linux only).
+class ResultCache
+{
+public:
+    static const unsigned int Version = 3;
+
+    struct Header
+    {
+        char               magic[4];     // "RMLR"
+        unsigned int       version;
+        unsigned long long key;
+        unsigned long long haltedAt;
+        unsigned long long steps;
+        unsigned long long registersCount;
+        unsigned long long materialSize;
+        unsigned long long checksum;
+    };
+
+    struct Statistics
+    {
+        Statistics():
+            hits(0), misses(0), entries(0), bytes(0){}
+
+        // counted over all processes that used the directory
+        unsigned long long hits;
+        unsigned long long misses;
+        unsigned long long entries;
+        unsigned long long bytes;
+    };
+
+    // maxBytes - total size of entries, the least recently used ones are removed above it.
+    ResultCache(const std::string &directory, unsigned long long maxBytes);
+
+    struct Key
+    {
+        Key():
+            hash(0){}
+
+        unsigned long long hash;
+        // engine, count and fields of the instructions, count, numbers and values of the registers
+        std::vector<unsigned long long> material;
+    };
+
+    static Key key(unsigned int engine, const std::vector<Instruction> &instructions,
+                   const std::map<RegNumber, RegValue> &registers);
+
+    // on hit replaces the registers and fills haltedAt and steps of the result.
+    bool find(const Key &key, ExecutionResult &result, std::map<RegNumber, RegValue> &registers);
+    // returns false if the entry can't be written.
+    bool store(const Key &key, const ExecutionResult &result, const std::map<RegNumber, RegValue> &registers);
+
+    Statistics statistics() const;
+
+private:
+    std::string entryName(unsigned long long key) const;
+    void count(bool isHit);
+    void evict();
+
+private:
+    std::string mDirectory;
+    unsigned long long mMaxBytes;
+};
+
+
+#endif // RESULTCACHE_H
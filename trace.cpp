@@ -0,0 +1,529 @@
+#include "trace.h"
+#include "bytecode.h"
+#include <algorithm>
+#include <sstream>
+#include <chrono>
+#include <cstring>
+#include <cstdint>
+
+
+const unsigned int TraceWriter::Version;
+const unsigned long long TraceWriter::DefaultKeyframeInterval;
+const std::size_t TraceWriter::RingSlots;
+const std::size_t TraceWriter::SlotWords;
+
+
+static void putVarint(std::vector<unsigned char> &output, std::size_t value)
+{
+    while (value >= 0x80){
+        output.push_back((unsigned char)(value | 0x80));
+        value >>= 7;
+    }
+    output.push_back((unsigned char)value);
+}
+
+// returns false if the number runs over the end of the data.
+static bool getVarint(const unsigned char *&data, const unsigned char *end, std::size_t &value)
+{
+    value = 0;
+    for (int shift=0; shift<64; shift+=7){
+        if (data == end)
+            return false;
+        unsigned char byte = *data++;
+        value |= std::size_t(byte & 0x7F) << shift;
+        if (! (byte & 0x80))
+            return true;
+    }
+    return false;
+}
+
+// LZ77 block: the sequence of
+//      literals count, literals, match length (0 - end of the block), match offset
+// Matches are found by the hash of 4 bytes, table - the hash table kept between the calls.
+static void compressBlock(const unsigned char *data, std::size_t size, std::vector<unsigned char> &output,
+                          std::vector<std::size_t> &table)
+{
+    const int HashBits = 14;
+    const std::size_t MinMatch = 4, MaxOffset = 1 << 20, None = ~std::size_t(0);
+
+    output.clear();
+    table.assign(std::size_t(1) << HashBits, None);
+    std::size_t start = 0, i = 0;
+    while (i + MinMatch <= size){
+        uint32_t word;
+        std::memcpy(&word, data + i, sizeof(word));
+        std::size_t &entry = table[(word * 2654435761u) >> (32 - HashBits)];
+        std::size_t candidate = entry;
+        entry = i;
+        if (candidate == None || i - candidate > MaxOffset || std::memcmp(data + candidate, data + i, MinMatch) != 0){
+            ++i;
+            continue;
+        }
+
+        std::size_t length = MinMatch;
+        while (i + length < size && data[candidate + length] == data[i + length])
+            ++length;
+
+        putVarint(output, i - start);
+        output.insert(output.end(), data + start, data + i);
+        putVarint(output, length);
+        putVarint(output, i - candidate);
+        i += length;
+        start = i;
+    }
+
+    putVarint(output, size - start);
+    output.insert(output.end(), data + start, data + size);
+    putVarint(output, 0);
+}
+
+// returns false if the block is damaged or doesn't unpack to rawSize bytes.
+static bool decompressBlock(const unsigned char *data, std::size_t size, std::vector<unsigned char> &output,
+                            std::size_t rawSize)
+{
+    const unsigned char *end = data + size;
+    output.clear();
+    output.reserve(rawSize);
+    for (;;){
+        std::size_t literals, length, offset;
+        if (! getVarint(data, end, literals) || literals > std::size_t(end - data) || literals > rawSize - output.size())
+            return false;
+        output.insert(output.end(), data, data + literals);
+        data += literals;
+
+        if (! getVarint(data, end, length))
+            return false;
+        if (length == 0)
+            return output.size() == rawSize;
+        if (! getVarint(data, end, offset) || offset == 0 || offset > output.size() || length > rawSize - output.size())
+            return false;
+
+        // the match can overlap the bytes it produces
+        std::size_t from = output.size() - offset;
+        for (std::size_t k=0; k<length; ++k)
+            output.push_back(output[from + k]);
+    }
+}
+
+
+TraceWriter::TraceWriter(const std::string &fileName, const std::vector<Instruction> &instructions,
+                         const std::vector<RegNumber> &registerNumbers, unsigned long long keyframeInterval):
+    mFile(fileName.c_str(), std::ios::binary | std::ios::trunc),
+    mRegistersCount(registerNumbers.size()),
+    mKeyframeInterval(std::max(keyframeInterval, 1ULL)),
+    mWord(0),
+    mJumps(0),
+    mOpen(0),
+    mSlots(RingSlots),
+    mHead(0),
+    mTail(0),
+    mIsFinished(false),
+    mIsFailed(false)
+{
+    if (! mFile)
+        throw TraceException("Can't create the trace \"" + fileName + "\".");
+
+    Header header;
+    std::memcpy(header.magic, "RMLT", 4);
+    header.version = Version;
+    header.instructionsCount = instructions.size();
+    header.registersCount = registerNumbers.size();
+    header.keyframeInterval = mKeyframeInterval;
+    mFile.write(reinterpret_cast<const char *>(&header), sizeof(header));
+
+    for (std::size_t i=0; i<instructions.size(); ++i){
+        BytecodeFile::Instruction record;
+        record.type = instructions[i].type();
+        record.arg1 = instructions[i].arg1;
+        record.arg2 = instructions[i].arg2;
+        record.instr = instructions[i].instr;
+        mFile.write(reinterpret_cast<const char *>(&record), sizeof(record));
+    }
+    for (std::size_t i=0; i<registerNumbers.size(); ++i){
+        unsigned long long number = registerNumbers[i];
+        mFile.write(reinterpret_cast<const char *>(&number), sizeof(number));
+    }
+    if (! mFile)
+        throw TraceException("Can't write the trace \"" + fileName + "\".");
+
+    // the slots are never reallocated, so the engine doesn't allocate memory while tracing
+    for (std::size_t i=0; i<mSlots.size(); ++i)
+        mSlots[i].words.resize(std::max(SlotWords, mRegistersCount));
+
+    mThread = std::thread(&TraceWriter::write, this);
+}
+
+TraceWriter::~TraceWriter()
+{
+    stop();
+}
+
+void TraceWriter::keyframe(unsigned long long steps, std::size_t next, const RegValue *registers)
+{
+    // the jumps of the partial word are written by the next chunk of the branches
+    if (mOpen)
+        publish();
+
+    Slot &slot = openSlot(CK_Keyframe);
+    slot.steps = steps;
+    slot.jumps = mJumps;
+    slot.position = next;
+    std::copy(registers, registers + mRegistersCount, slot.words.begin());
+    slot.size = mRegistersCount;
+    publish();
+    ++mStats.keyframes;
+}
+
+bool TraceWriter::finish(const ExecutionResult &result)
+{
+    if (mJumps & 63)
+        pushWord(mJumps & 63);
+    if (mOpen)
+        publish();
+
+    Slot &slot = openSlot(CK_End);
+    slot.steps = result.steps;
+    slot.jumps = mJumps;
+    slot.position = result.haltedAt;
+    publish();
+
+    stop();
+    mStats.jumps = mJumps;
+    return ! mIsFailed;
+}
+
+void TraceWriter::pushWord(unsigned bits)
+{
+    if (! mOpen){
+        Slot &slot = openSlot(CK_Branches);
+        // words start on the jumps divisible by 64
+        slot.jumps = (mJumps - 1) & ~63ULL;
+    }
+
+    mOpen->words[mOpen->size++] = mWord;
+    mOpen->count += bits;
+    mWord = 0;
+    if (mOpen->size == SlotWords)
+        publish();
+}
+
+TraceWriter::Slot& TraceWriter::openSlot(ChunkKind kind)
+{
+    unsigned long long head = mHead.load(std::memory_order_relaxed);
+    if (head - mTail.load(std::memory_order_acquire) >= RingSlots){
+        ++mStats.stalls;
+        while (head - mTail.load(std::memory_order_acquire) >= RingSlots)
+            std::this_thread::yield();
+    }
+
+    Slot &slot = mSlots[head % RingSlots];
+    slot.kind = kind;
+    slot.steps = 0;
+    slot.jumps = 0;
+    slot.count = 0;
+    slot.position = 0;
+    slot.size = 0;
+    mOpen = &slot;
+    return slot;
+}
+
+void TraceWriter::publish()
+{
+    mOpen = 0;
+    mHead.store(mHead.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+}
+
+void TraceWriter::stop()
+{
+    if (! mThread.joinable())
+        return;
+    mIsFinished.store(true, std::memory_order_release);
+    mThread.join();
+    mFile.close();
+}
+
+void TraceWriter::write()
+{
+    // the engine makes a slot in tens of microseconds at most, so the thread sleeps only while it's idle
+    const std::chrono::microseconds IdleSleep(100);
+
+    std::vector<unsigned char> compressed;
+    std::vector<std::size_t> table;
+    for (;;){
+        unsigned long long tail = mTail.load(std::memory_order_relaxed);
+        if (tail == mHead.load(std::memory_order_acquire)){
+            // the flag is set after the last slot is published
+            if (mIsFinished.load(std::memory_order_acquire) && tail == mHead.load(std::memory_order_acquire))
+                break;
+            std::this_thread::sleep_for(IdleSleep);
+            continue;
+        }
+
+        writeSlot(mSlots[tail % RingSlots], compressed, table);
+        mTail.store(tail + 1, std::memory_order_release);
+    }
+}
+
+void TraceWriter::writeSlot(const Slot &slot, std::vector<unsigned char> &compressed, std::vector<std::size_t> &table)
+{
+    Chunk chunk;
+    chunk.kind = slot.kind;
+    chunk.reserved = 0;
+    chunk.steps = slot.steps;
+    chunk.jumps = slot.jumps;
+    chunk.count = slot.count;
+    chunk.position = slot.position;
+    chunk.rawSize = slot.size * sizeof(unsigned long long);
+
+    compressed.clear();
+    if (slot.kind != CK_End)
+        compressBlock(reinterpret_cast<const unsigned char *>(&slot.words[0]), chunk.rawSize, compressed, table);
+    chunk.size = compressed.size();
+    compressed.resize((compressed.size() + 7) & ~std::size_t(7), 0);
+    chunk.checksum = BytecodeFile::checksum(compressed.empty() ? 0 : reinterpret_cast<const char *>(&compressed[0]),
+                                            compressed.size());
+
+    mFile.write(reinterpret_cast<const char *>(&chunk), sizeof(chunk));
+    if (! compressed.empty())
+        mFile.write(reinterpret_cast<const char *>(&compressed[0]), compressed.size());
+    // a killed process leaves the trace readable up to the last chunk
+    mFile.flush();
+    if (! mFile)
+        mIsFailed = true;
+
+    mStats.rawBytes += chunk.rawSize;
+    mStats.bytes += sizeof(chunk) + compressed.size();
+}
+
+
+TraceReader::TraceReader(const std::string &fileName):
+    mProgram(std::vector<Instruction>()),
+    mIsComplete(false),
+    mSteps(0),
+    mPosition(0),
+    mStep(0),
+    mJumps(0),
+    mBranchesIndex(~std::size_t(0))
+{
+    if (! mFile.open(fileName))
+        throw TraceException("Can't read the trace \"" + fileName + "\".");
+
+    TraceWriter::Header header;
+    std::size_t size = mFile.size();
+    if (size < sizeof(header))
+        throw TraceException("The trace \"" + fileName + "\" is damaged.");
+    std::memcpy(&header, mFile.data(), sizeof(header));
+    std::size_t offset = sizeof(header);
+    if (std::memcmp(header.magic, "RMLT", 4) != 0 || header.version != TraceWriter::Version
+            || header.instructionsCount > (size - offset) / sizeof(BytecodeFile::Instruction))
+        throw TraceException("The trace \"" + fileName + "\" is damaged.");
+
+    for (unsigned long long i=0; i<header.instructionsCount; ++i){
+        BytecodeFile::Instruction record;
+        std::memcpy(&record, mFile.data() + offset, sizeof(record));
+        offset += sizeof(record);
+        if (record.type < Instruction::CT_Z || record.type > Instruction::CT_J)
+            throw TraceException("The trace \"" + fileName + "\" is damaged.");
+        mInstructions.push_back(Instruction(Instruction::Type(record.type), record.arg1, record.arg2, record.instr));
+    }
+
+    try {
+        mProgram = DecodedProgram(mInstructions);
+    } catch (DecodeException &e) {
+        throw TraceException(std::string("The program of the trace can't be decoded: ") + e.what());
+    }
+
+    // the register file is renamed the same way as by the writer
+    const std::vector<RegNumber> &numbers = mProgram.registerNumbers();
+    if (header.registersCount != numbers.size()
+            || header.registersCount > (size - offset) / sizeof(unsigned long long))
+        throw TraceException("The trace \"" + fileName + "\" is damaged.");
+    for (std::size_t i=0; i<numbers.size(); ++i){
+        unsigned long long number;
+        std::memcpy(&number, mFile.data() + offset, sizeof(number));
+        offset += sizeof(number);
+        if (number != numbers[i])
+            throw TraceException("The trace \"" + fileName + "\" is damaged.");
+    }
+
+    readChunks(fileName, offset);
+    if (mKeyframes.empty())
+        throw TraceException("The trace \"" + fileName + "\" has no keyframes.");
+
+    mRegisters.assign(std::max<std::size_t>(numbers.size(), 1), 0);
+    load(mKeyframes[0]);
+}
+
+void TraceReader::readChunks(const std::string &fileName, std::size_t offset)
+{
+    std::size_t size = mFile.size();
+    std::size_t registersSize = mProgram.registerNumbers().size() * sizeof(RegValue);
+    unsigned long long jumps = 0;
+
+    // the incomplete chunk ends the trace of the killed process, complete chunks must be consistent
+    while (size - offset >= sizeof(TraceWriter::Chunk)){
+        TraceWriter::Chunk chunk;
+        std::memcpy(&chunk, mFile.data() + offset, sizeof(chunk));
+        offset += sizeof(chunk);
+        if (chunk.size > size - offset || ((chunk.size + 7) & ~7ULL) > size - offset)
+            break;
+        std::size_t padded = (chunk.size + 7) & ~std::size_t(7);
+        if (BytecodeFile::checksum(mFile.data() + offset, padded) != chunk.checksum)
+            throw TraceException("The trace \"" + fileName + "\" is damaged.");
+
+        Entry entry;
+        entry.steps = chunk.steps;
+        entry.jumps = chunk.jumps;
+        entry.count = chunk.count;
+        entry.position = chunk.position;
+        entry.offset = offset;
+        entry.size = chunk.size;
+        entry.rawSize = chunk.rawSize;
+        offset += padded;
+
+        if (chunk.kind == TraceWriter::CK_Branches){
+            if (chunk.jumps != jumps || chunk.rawSize != (chunk.count + 63) / 64 * sizeof(unsigned long long))
+                throw TraceException("The trace \"" + fileName + "\" is damaged.");
+            jumps += chunk.count;
+            mBranches.push_back(entry);
+        } else if (chunk.kind == TraceWriter::CK_Keyframe){
+            if (chunk.rawSize != registersSize || chunk.position >= mProgram.ops().size()
+                    || (! mKeyframes.empty() && chunk.steps < mKeyframes.back().steps))
+                throw TraceException("The trace \"" + fileName + "\" is damaged.");
+            mKeyframes.push_back(entry);
+        } else if (chunk.kind == TraceWriter::CK_End){
+            mIsComplete = true;
+            mSteps = chunk.steps;
+            break;
+        } else
+            throw TraceException("The trace \"" + fileName + "\" is damaged.");
+    }
+}
+
+void TraceReader::unpack(const Entry &entry, std::vector<unsigned char> &raw) const
+{
+    if (! decompressBlock(reinterpret_cast<const unsigned char *>(mFile.data() + entry.offset), entry.size,
+                          raw, entry.rawSize))
+        throw TraceException("The trace is damaged.");
+}
+
+bool TraceReader::branch(unsigned long long jump, bool &taken)
+{
+    if (mBranchesIndex >= mBranches.size() || jump < mBranches[mBranchesIndex].jumps
+            || jump - mBranches[mBranchesIndex].jumps >= mBranches[mBranchesIndex].count){
+        // the last chunk that starts before the jump
+        std::size_t low = 0, high = mBranches.size();
+        while (low < high){
+            std::size_t middle = (low + high) / 2;
+            if (mBranches[middle].jumps <= jump)
+                low = middle + 1;
+            else
+                high = middle;
+        }
+        if (low == 0 || jump - mBranches[low - 1].jumps >= mBranches[low - 1].count)
+            return false;
+
+        mBranchesIndex = low - 1;
+        std::vector<unsigned char> raw;
+        unpack(mBranches[mBranchesIndex], raw);
+        mBits.resize(raw.size() / sizeof(unsigned long long));
+        if (! raw.empty())
+            std::memcpy(&mBits[0], &raw[0], raw.size());
+    }
+
+    unsigned long long bit = jump - mBranches[mBranchesIndex].jumps;
+    taken = (mBits[bit / 64] >> (bit % 64)) & 1;
+    return true;
+}
+
+void TraceReader::seek(unsigned long long step)
+{
+    // the last keyframe at or before the step
+    std::size_t index = 0;
+    while (index + 1 < mKeyframes.size() && mKeyframes[index + 1].steps <= step)
+        ++index;
+    const Entry &keyframe = mKeyframes[index];
+
+    // the replay is continued if it's already past the keyframe
+    if (mStep < keyframe.steps || mStep > step)
+        load(keyframe);
+
+    while (mStep < step && next())
+        ;
+}
+
+void TraceReader::load(const Entry &keyframe)
+{
+    std::vector<unsigned char> raw;
+    unpack(keyframe, raw);
+    if (! raw.empty())
+        std::memcpy(&mRegisters[0], &raw[0], raw.size());
+    mPosition = keyframe.position;
+    mStep = keyframe.steps;
+    mJumps = keyframe.jumps;
+}
+
+bool TraceReader::next()
+{
+    const DecodedProgram::Op &op = mProgram.ops()[mPosition];
+    switch (op.code) {
+    case DecodedProgram::OP_Z:
+        mRegisters[op.arg1] = 0;
+        ++mPosition;
+        break;
+
+    case DecodedProgram::OP_S:
+        ++mRegisters[op.arg1];
+        ++mPosition;
+        break;
+
+    case DecodedProgram::OP_T:
+        mRegisters[op.arg2] = mRegisters[op.arg1];
+        ++mPosition;
+        break;
+
+    case DecodedProgram::OP_J:
+    {
+        bool taken;
+        if (! branch(mJumps, taken))
+            return false;
+        if (taken != (mRegisters[op.arg1] == mRegisters[op.arg2])){
+            std::ostringstream message;
+            message << "The trace doesn't match the program on step " << mStep + 1 << ".";
+            throw TraceException(message.str());
+        }
+        ++mJumps;
+        mPosition = taken ? op.target : mPosition + 1;
+        break;
+    }
+
+    default:
+        return false;
+    }
+
+    ++mStep;
+    return true;
+}
+
+InstructionPos TraceReader::instructionNumber() const
+{
+    const DecodedProgram::Op &op = mProgram.ops()[mPosition];
+    return op.code == DecodedProgram::OP_Halt ? mProgram.haltNumber(op.target) : mPosition + 1;
+}
+
+bool TraceReader::isHalted() const
+{
+    return mProgram.ops()[mPosition].code == DecodedProgram::OP_Halt;
+}
+
+RegValue TraceReader::value(RegNumber number) const
+{
+    const std::vector<RegNumber> &numbers = mProgram.registerNumbers();
+    std::vector<RegNumber>::const_iterator it = std::find(numbers.begin(), numbers.end(), number);
+    return it != numbers.end() ? mRegisters[it - numbers.begin()] : 0;
+}
+
+void TraceReader::storeRegisters(std::map<RegNumber, RegValue> &registers) const
+{
+    mProgram.storeRegisters(mRegisters, registers);
+}
@@ -0,0 +1,251 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <string>
+#include <vector>
+#include <map>
+#include <atomic>
+#include <thread>
+#include <fstream>
+#include <stdexcept>
+
+#include "instruction.h"
+#include "engine.h"
+#include "loader.h"
+
+
+//-- trace of the execution (.rmlt)
+// The machine is deterministic, so the trace keeps only what can't be computed cheaply:
+//  * the program and the register file at keyframes (every keyframeInterval steps, on a jump);
+//  * one bit per executed jump: it was taken or not.
+// Executed instructions between two jumps follow from the program, register writes follow from
+// the instruction and the registers before it, so they take no place in the file; the reader
+// replays them from the nearest keyframe and checks every jump against the recorded bit.
+//
+// Layout (native byte order):
+//      Header
+//      BytecodeFile::Instruction[instructionsCount]
+//      unsigned long long registerNumbers[registersCount]     original numbers of the register file
+//      Chunk followed by the compressed payload padded to 8 bytes, ...
+// Payloads are compressed by blocks (LZ77), the checksum covers the padded payload.
+// The end chunk is written by finish(), a trace without it (the process was killed)
+// is read up to the last complete chunk.
+class TraceWriter
+{
+public:
+    static const unsigned int Version = 1;
+    static const unsigned long long DefaultKeyframeInterval = 1ULL << 24;
+
+    enum ChunkKind {
+        CK_Branches = 1,    // jumps - index of the first jump, count - count of jumps; payload - bits by 64-bit words
+        CK_Keyframe,        // steps and jumps before the keyframe, position - index of the next instruction;
+                            // payload - the register file
+        CK_End              // steps and jumps of the run, position - number of the instruction of the halt
+    };
+
+    struct Header
+    {
+        char               magic[4];     // "RMLT"
+        unsigned int       version;
+        unsigned long long instructionsCount;
+        unsigned long long registersCount;
+        unsigned long long keyframeInterval;
+    };
+
+    struct Chunk
+    {
+        unsigned int       kind;
+        unsigned int       reserved;
+        unsigned long long steps;
+        unsigned long long jumps;
+        unsigned long long count;
+        unsigned long long position;
+        unsigned long long rawSize;
+        unsigned long long size;
+        unsigned long long checksum;
+    };
+
+    struct Stats
+    {
+        Stats():
+            jumps(0), keyframes(0), rawBytes(0), bytes(0), stalls(0){}
+
+        unsigned long long jumps;
+        unsigned long long keyframes;
+        // payloads before and after the compression
+        unsigned long long rawBytes;
+        unsigned long long bytes;
+        // times the engine waited for a free slot of the ring
+        unsigned long long stalls;
+    };
+
+    // creates the file, writes the program and starts the writer thread.
+    // registerNumbers - original numbers of the register file (see DecodedProgram::registerNumbers()).
+    // Throws TraceException if the file can't be created.
+    TraceWriter(const std::string &fileName, const std::vector<Instruction> &instructions,
+                const std::vector<RegNumber> &registerNumbers,
+                unsigned long long keyframeInterval = DefaultKeyframeInterval);
+    ~TraceWriter();
+
+    unsigned long long keyframeInterval() const {
+        return mKeyframeInterval;
+    }
+
+    // called by the engine (see ThreadedEngine::trace()), from one thread only.
+    void branch(bool taken) {
+        mWord |= (std::size_t)taken << (mJumps & 63);
+        if ((++mJumps & 63) == 0)
+            pushWord(64);
+    }
+    // next - index of the instruction to execute next.
+    void keyframe(unsigned long long steps, std::size_t next, const RegValue *registers);
+
+    // writes the end of the trace and waits for the writer thread.
+    // Returns false if the trace was not written completely.
+    bool finish(const ExecutionResult &result);
+
+    // valid after finish()
+    const Stats& stats() const {
+        return mStats;
+    }
+
+private:
+    // part of the trace passed to the writer thread
+    struct Slot
+    {
+        ChunkKind kind;
+        unsigned long long steps;
+        unsigned long long jumps;
+        unsigned long long count;
+        unsigned long long position;
+        std::vector<unsigned long long> words;
+        std::size_t size;
+    };
+
+    void pushWord(unsigned bits);
+    // waits for the free slot of the ring
+    Slot& openSlot(ChunkKind kind);
+    void publish();
+    void stop();
+    // body of the writer thread
+    void write();
+    void writeSlot(const Slot &slot, std::vector<unsigned char> &compressed, std::vector<std::size_t> &table);
+
+private:
+    static const std::size_t RingSlots = 16;
+    static const std::size_t SlotWords = 8192;
+
+    std::ofstream mFile;
+    std::size_t mRegistersCount;
+    unsigned long long mKeyframeInterval;
+
+    // engine side; std::size_t doesn't alias RegValue, so register writes of the engine
+    // don't force the reload of these
+    std::size_t mWord;
+    std::size_t mJumps;
+    Slot *mOpen;
+
+    // single producer, single consumer ring: slots [tail, head) are published and not written yet
+    std::vector<Slot> mSlots;
+    std::atomic<unsigned long long> mHead;
+    std::atomic<unsigned long long> mTail;
+    std::atomic<bool> mIsFinished;
+    bool mIsFailed;
+    std::thread mThread;
+    Stats mStats;
+};
+
+
+//-- reader of the trace
+// Replays the trace from the nearest keyframe, so seek() to any step costs at most keyframeInterval steps.
+//
+//      TraceReader reader("program.rmlt");
+//      reader.seek(1000000);
+//      while (reader.next())
+//          std::cout << reader.step() << ": " << reader.instructionNumber() << std::endl;
+class TraceReader
+{
+public:
+    // reads the program and the index of the chunks. Throws TraceException if the file is damaged.
+    explicit TraceReader(const std::string &fileName);
+
+    const std::vector<Instruction>& instructions() const {
+        return mInstructions;
+    }
+    // the end chunk is present
+    bool isComplete() const {
+        return mIsComplete;
+    }
+    // steps of the run (of the complete trace)
+    unsigned long long steps() const {
+        return mSteps;
+    }
+    std::size_t keyframesCount() const {
+        return mKeyframes.size();
+    }
+
+    // moves to the state after the given count of steps or to the end of the trace.
+    // Throws TraceException if the trace doesn't match the program.
+    void seek(unsigned long long step);
+    // replays one step, returns false at the end of the trace (the halt or the last recorded jump).
+    // Throws TraceException if the trace doesn't match the program.
+    bool next();
+
+    // steps replayed
+    unsigned long long step() const {
+        return mStep;
+    }
+    // number of the instruction to execute next, of the halt at the end of the run
+    InstructionPos instructionNumber() const;
+    bool isHalted() const;
+    RegValue value(RegNumber number) const;
+    void storeRegisters(std::map<RegNumber, RegValue> &registers) const;
+
+private:
+    struct Entry
+    {
+        unsigned long long steps;
+        unsigned long long jumps;
+        unsigned long long count;
+        unsigned long long position;
+        std::size_t offset;
+        std::size_t size;
+        std::size_t rawSize;
+    };
+
+    void readChunks(const std::string &fileName, std::size_t offset);
+    void unpack(const Entry &entry, std::vector<unsigned char> &raw) const;
+    // starts the replay from the keyframe
+    void load(const Entry &keyframe);
+    bool branch(unsigned long long jump, bool &taken);
+
+private:
+    MappedFile mFile;
+    std::vector<Instruction> mInstructions;
+    DecodedProgram mProgram;
+    std::vector<RegNumber> mRegisterNumbers;
+    std::vector<Entry> mKeyframes;
+    std::vector<Entry> mBranches;
+    bool mIsComplete;
+    unsigned long long mSteps;
+
+    // replay state
+    std::vector<RegValue> mRegisters;
+    std::size_t mPosition;
+    unsigned long long mStep;
+    unsigned long long mJumps;
+    // unpacked chunk of the branches
+    std::size_t mBranchesIndex;
+    std::vector<unsigned long long> mBits;
+};
+
+
+class TraceException: public std::runtime_error
+{
+public:
+    explicit TraceException(std::string message):
+        runtime_error(message){}
+};
+
+
+#endif // TRACE_H
@@ -0,0 +1,120 @@
+#include "transpiler.h"
+#include <vector>
+#include <sstream>
+
+
+void CppTranspiler::transpile(const DecodedProgram &program, const std::map<RegNumber, RegValue> &initialRegisters,
+                              const std::string &sourceName, std::ostream &output) const
+{
+    const std::vector<DecodedProgram::Op> &ops = program.ops();
+    const std::vector<RegNumber> &numbers = program.registerNumbers();
+
+    // only targets of the jumps need labels
+    std::vector<bool> isTarget(ops.size(), false);
+    for (std::size_t i=0; i<ops.size(); ++i){
+        if (ops[i].code == DecodedProgram::OP_J)
+            isTarget[ops[i].target] = true;
+        else if (ops[i].code != DecodedProgram::OP_Z && ops[i].code != DecodedProgram::OP_S
+                 && ops[i].code != DecodedProgram::OP_T && ops[i].code != DecodedProgram::OP_Halt)
+            throw DecodeException("Optimised ops can't be transpiled.", i+1);
+    }
+
+    output << "// Generated by regm from \"" << sourceName << "\"." << "\n"
+           << "//" << "\n"
+           << "// Register file of run():" << "\n";
+    for (std::size_t i=0; i<numbers.size(); ++i)
+        output << "//   regs[" << i << "] - R" << numbers[i] << "\n";
+
+    output << "\n"
+           << "typedef unsigned long long int RegValue;" << "\n"
+           << "\n"
+           << "extern \"C\" unsigned long long run(RegValue *regs)" << "\n"
+           << "{" << "\n";
+    for (std::size_t i=0; i<numbers.size(); ++i)
+        output << "    RegValue r" << i << " = regs[" << i << "];" << "\n";
+    output << "    unsigned long long halted;" << "\n"
+           << "\n";
+
+    for (std::size_t i=0; i<ops.size(); ++i){
+        const DecodedProgram::Op &op = ops[i];
+        if (isTarget[i])
+            output << "l" << i << ":" << "\n";
+
+        switch (op.code) {
+        case DecodedProgram::OP_Z:
+            output << "    r" << op.arg1 << " = 0;" << "\n";
+            break;
+
+        case DecodedProgram::OP_S:
+            output << "    ++r" << op.arg1 << ";" << "\n";
+            break;
+
+        case DecodedProgram::OP_T:
+            output << "    r" << op.arg2 << " = r" << op.arg1 << ";" << "\n";
+            break;
+
+        case DecodedProgram::OP_J:
+            if (op.arg1 == op.arg2)
+                output << "    goto l" << op.target << ";" << "\n";
+            else
+                output << "    if (r" << op.arg1 << " == r" << op.arg2 << ") goto l" << op.target << ";" << "\n";
+            break;
+
+        case DecodedProgram::OP_Halt:
+            output << "    halted = " << program.haltNumber(op.target) << "ULL;" << "\n"
+                   << "    goto done;" << "\n";
+            break;
+
+        default:
+            break;
+        }
+    }
+
+    output << "\n"
+           << "done:" << "\n";
+    for (std::size_t i=0; i<numbers.size(); ++i)
+        output << "    regs[" << i << "] = r" << i << ";" << "\n";
+    output << "    return halted;" << "\n"
+           << "}" << "\n";
+
+    // main() prints registers in order of their numbers, as the interpreter does:
+    // registers of the program and initialised registers not used by the program.
+    std::map<RegNumber, std::string> results;
+    std::map<RegNumber, RegValue>::const_iterator it = initialRegisters.begin();
+    for (; it != initialRegisters.end(); ++it){
+        std::ostringstream value;
+        value << (*it).second << "ULL";
+        results[(*it).first] = value.str();
+    }
+    for (std::size_t i=0; i<numbers.size(); ++i){
+        std::ostringstream value;
+        value << "regs[" << i << "]";
+        results[numbers[i]] = value.str();
+    }
+
+    output << "\n"
+           << "#ifndef REGM_NO_MAIN" << "\n"
+           << "#include <iostream>" << "\n"
+           << "\n"
+           << "int main()" << "\n"
+           << "{" << "\n"
+           << "    static RegValue regs[" << (numbers.empty() ? 1 : numbers.size()) << "] = {";
+    for (std::size_t i=0; i<numbers.size(); ++i){
+        std::map<RegNumber, RegValue>::const_iterator initial = initialRegisters.find(numbers[i]);
+        output << (i > 0 ? ", " : "") << (initial == initialRegisters.end() ? 0 : (*initial).second) << "ULL";
+    }
+    if (numbers.empty())
+        output << "0";
+    output << "};" << "\n"
+           << "    unsigned long long halted = run(regs);" << "\n"
+           << "\n"
+           << "    std::cout << std::endl << \"Program terminated on instruction \" << halted << \" with results: \" << std::endl;" << "\n";
+
+    std::map<RegNumber, std::string>::const_iterator result = results.begin();
+    for (; result != results.end(); ++result)
+        output << "    std::cout << \"[reg " << (*result).first << "]: \" << " << (*result).second << " << std::endl;" << "\n";
+
+    output << "    return 0;" << "\n"
+           << "}" << "\n"
+           << "#endif // REGM_NO_MAIN" << "\n";
+}
@@ -0,0 +1,33 @@
+#ifndef TRANSPILER_H
+#define TRANSPILER_H
+
+#include <ostream>
+#include <string>
+#include <map>
+
+#include "engine.h"
+
+
+//-- RML to C++ transpiler
+// Emits standalone C++ translation unit for the decoded program:
+// registers become locals, J becomes goto to the label of the target instruction.
+//
+// Generated code has stable entry point
+//      extern "C" unsigned long long run(RegValue *regs);
+// which executes the program over the dense register file (order of the registers
+// is listed in the header comment of the generated file) and returns
+// the instruction number on which the program terminated.
+// Unless REGM_NO_MAIN is defined, main() is also emitted: it runs the program with
+// the initial values of the registers and prints results exactly as the interpreter does.
+// Build it as executable:     c++ -O3 program.cpp -o program
+// or as shared object:        c++ -O3 -DREGM_NO_MAIN -shared -fPIC program.cpp -o program.so
+class CppTranspiler
+{
+public:
+    // program must be decoded without optimisation passes.
+    void transpile(const DecodedProgram &program, const std::map<RegNumber, RegValue> &initialRegisters,
+                   const std::string &sourceName, std::ostream &output) const;
+};
+
+
+#endif // TRANSPILER_H